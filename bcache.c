@@ -0,0 +1,624 @@
+#include "types.h"
+#include "lib.h"
+#include "mm.h"
+#include "screen.h"
+#include "bcache.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+static struct buf *bcache_hash[BCACHE_HASH_SIZE];
+static struct buf *lru_head;    /* Más recientemente usado */
+static struct buf *lru_tail;    /* Primer candidato a expulsión */
+
+static struct bcache_stats bcache_stats = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, BCACHE_DEFAULT_BUDGET };
+
+/* Reloj de la escritura diferida (tics) y aviso periódico al flusher */
+static volatile u32 bcache_ticks = 0;
+static volatile int bcache_flush_wanted = 0;
+
+static u32 bcache_hashfn(u32 block)
+{
+    return (block ^ (block >> 6)) & (BCACHE_HASH_SIZE - 1);
+}
+
+static void lru_unlink(struct buf *b)
+{
+    if (b->lru_prev)
+        b->lru_prev->lru_next = b->lru_next;
+    else
+        lru_head = b->lru_next;
+    if (b->lru_next)
+        b->lru_next->lru_prev = b->lru_prev;
+    else
+        lru_tail = b->lru_prev;
+    b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_push_head(struct buf *b)
+{
+    b->lru_prev = NULL;
+    b->lru_next = lru_head;
+    if (lru_head)
+        lru_head->lru_prev = b;
+    else
+        lru_tail = b;
+    lru_head = b;
+}
+
+static struct buf *bcache_lookup(struct blk_dev *dev, u32 block, u32 size)
+{
+    struct buf *b;
+
+    for (b = bcache_hash[bcache_hashfn(block)]; b; b = b->hash_next) {
+        if (b->dev == dev && b->block == block && b->size == size)
+            return b;
+    }
+    return NULL;
+}
+
+/*
+ * Saca un buffer de la caché y libera su memoria
+ */
+static void bcache_free(struct buf *b)
+{
+    struct buf **p = &bcache_hash[bcache_hashfn(b->block)];
+
+    while (*p != b)
+        p = &(*p)->hash_next;
+    *p = b->hash_next;
+    lru_unlink(b);
+
+    bcache_stats.nr_buffers--;
+    bcache_stats.bytes -= b->size;
+    kfree(b->data);
+    kfree(b);
+}
+
+/*
+ * Expulsa buffers sin usuarios, E/S en curso ni datos pendientes de
+ * escribir, del menos reciente al más reciente, hasta que 'needed'
+ * bytes más quepan en el presupuesto
+ */
+static void bcache_shrink(u32 needed)
+{
+    struct buf *b = lru_tail;
+    struct buf *prev;
+
+    while (b && bcache_stats.bytes + needed > bcache_stats.budget) {
+        prev = b->lru_prev;
+        if (b->refcount == 0 && !(b->flags & (B_BUSY | B_DIRTY))) {
+            bcache_free(b);
+            bcache_stats.evictions++;
+        }
+        b = prev;
+    }
+}
+
+/*
+ * Reserva un buffer para un bloque y lo inserta en la caché (sin datos)
+ */
+static struct buf *bcache_alloc(struct blk_dev *dev, u32 block, u32 size)
+{
+    struct buf *b;
+
+    b = (struct buf *)kmalloc(sizeof(struct buf));
+    if (b == NULL)
+        return NULL;
+    b->data = (char *)kmalloc(size);
+    if (b->data == NULL) {
+        kfree(b);
+        return NULL;
+    }
+
+    b->dev = dev;
+    b->block = block;
+    b->size = size;
+    b->refcount = 0;
+    b->flags = 0;
+    b->hash_next = bcache_hash[bcache_hashfn(block)];
+    bcache_hash[bcache_hashfn(block)] = b;
+    lru_push_head(b);
+
+    bcache_stats.nr_buffers++;
+    bcache_stats.bytes += size;
+    return b;
+}
+
+/*
+ * Lee el bloque de un buffer de forma síncrona
+ */
+static int bcache_fill(struct buf *b)
+{
+    u32 sectors = b->size / BLK_SECTOR_SIZE;
+
+    if (blk_read(b->dev, b->block * sectors, sectors, b->data) != 0)
+        return -1;
+    b->flags |= B_VALID;
+    return 0;
+}
+
+/*
+ * Fin de una lectura anticipada (puede llamarse desde una IRQ)
+ */
+static void bcache_end_io(struct blk_request *req)
+{
+    struct buf *b = (struct buf *)req->private;
+
+    if (req->error == 0)
+        b->flags |= B_VALID;
+    b->flags &= ~B_BUSY;
+}
+
+/*
+ * Devuelve el buffer de un bloque con una referencia tomada, leyéndolo
+ * del disco si no está en caché o esperando a su lectura anticipada.
+ * Devuelve NULL si falla. El llamador debe soltarlo con brelse().
+ */
+struct buf *bread(struct blk_dev *dev, u32 block, u32 size)
+{
+    struct buf *b;
+
+    b = bcache_lookup(dev, block, size);
+    if (b != NULL) {
+        bcache_stats.hits++;
+        b->refcount++;
+        lru_unlink(b);
+        lru_push_head(b);
+
+        if (b->flags & B_BUSY)
+            blk_wait(&b->req);
+
+        /* Una lectura anticipada fallida se reintenta aquí */
+        if (!(b->flags & B_VALID) && bcache_fill(b) != 0) {
+            brelse(b);
+            return NULL;
+        }
+        return b;
+    }
+
+    bcache_stats.misses++;
+    bcache_shrink(size);
+
+    /* Si todos los buffers están en uso el presupuesto se supera
+       temporalmente; se recupera al soltarlos */
+    b = bcache_alloc(dev, block, size);
+    if (b == NULL)
+        return NULL;
+    b->refcount = 1;
+
+    if (bcache_fill(b) != 0) {
+        b->refcount = 0;
+        bcache_free(b);
+        return NULL;
+    }
+
+    return b;
+}
+
+/*
+ * Como bread(), pero sin leer el disco si el bloque no está en caché:
+ * para bloques que el llamador va a sobrescribir por completo. El
+ * contenido de un buffer nuevo no está definido.
+ */
+struct buf *bget(struct blk_dev *dev, u32 block, u32 size)
+{
+    struct buf *b;
+
+    b = bcache_lookup(dev, block, size);
+    if (b != NULL) {
+        b->refcount++;
+        lru_unlink(b);
+        lru_push_head(b);
+
+        /* No pisar una lectura anticipada en curso */
+        if (b->flags & B_BUSY)
+            blk_wait(&b->req);
+        b->flags |= B_VALID;
+        return b;
+    }
+
+    bcache_shrink(size);
+    b = bcache_alloc(dev, block, size);
+    if (b == NULL)
+        return NULL;
+    b->refcount = 1;
+    b->flags = B_VALID;
+    return b;
+}
+
+static void bcache_clean(struct buf *b)
+{
+    if (b->flags & B_DIRTY) {
+        b->flags &= ~B_DIRTY;
+        bcache_stats.dirty--;
+        bcache_stats.dirty_bytes -= b->size;
+    }
+}
+
+static void bcache_write_error(struct buf *b)
+{
+    print("bcache : ERROR - Cannot write block ");
+    print_dec(b->block);
+    print("\n");
+}
+
+/*
+ * Escribe el contenido de un buffer en el disco (escritura síncrona).
+ * El llamador debe tener una referencia.
+ */
+int bwrite(struct buf *b)
+{
+    u32 sectors = b->size / BLK_SECTOR_SIZE;
+
+    if (blk_write(b->dev, b->block * sectors, sectors, b->data) != 0) {
+        bcache_write_error(b);
+        return -1;
+    }
+    bcache_clean(b);
+    return 0;
+}
+
+/*
+ * Marca un buffer como modificado: se escribirá más tarde con
+ * bcache_flush(). En dispositivos en memoria escribir es una copia y se
+ * hace al momento.
+ */
+void bdirty(struct buf *b)
+{
+    if (blk_map(b->dev, 0, 1) != NULL) {
+        bwrite(b);
+        return;
+    }
+
+    if (!(b->flags & B_DIRTY)) {
+        b->flags |= B_DIRTY;
+        b->dirty_since = bcache_ticks;
+        bcache_stats.dirty++;
+        bcache_stats.dirty_bytes += b->size;
+    }
+}
+
+/* Escritura en curso de una racha de buffers contiguos */
+struct bcache_wb {
+    struct blk_request req;
+    struct buf **bufs;
+    u32 count;
+    char *bounce;               /* Copia contigua si la racha tiene varios bloques */
+};
+
+/* Ordena por número de bloque (Shell sort: sin recursión ni memoria) */
+static void bcache_sort(struct buf **v, u32 n)
+{
+    u32 gap, i, j;
+    struct buf *t;
+
+    for (gap = n / 2; gap > 0; gap /= 2) {
+        for (i = gap; i < n; i++) {
+            t = v[i];
+            for (j = i; j >= gap && v[j - gap]->block > t->block; j -= gap)
+                v[j] = v[j - gap];
+            v[j] = t;
+        }
+    }
+}
+
+/*
+ * Envía la escritura de 'count' buffers contiguos con una sola petición.
+ * Devuelve -1 si no se pudo enviar (los buffers siguen sucios).
+ */
+static int bcache_wb_submit(struct bcache_wb *wb, struct buf **bufs, u32 count)
+{
+    u32 size = bufs[0]->size;
+    u32 i;
+
+    wb->bufs = bufs;
+    wb->count = count;
+    wb->bounce = NULL;
+
+    if (count > 1) {
+        wb->bounce = (char *)kmalloc(count * size);
+        if (wb->bounce == NULL)
+            return -1;
+        for (i = 0; i < count; i++)
+            memcpy(wb->bounce + i * size, bufs[i]->data, size);
+    }
+
+    wb->req.dev = bufs[0]->dev;
+    wb->req.cmd = BLK_WRITE;
+    wb->req.lba = bufs[0]->block * (size / BLK_SECTOR_SIZE);
+    wb->req.count = count * (size / BLK_SECTOR_SIZE);
+    wb->req.buffer = wb->bounce ? wb->bounce : bufs[0]->data;
+    wb->req.end_io = NULL;
+    wb->req.private = NULL;
+
+    bcache_stats.write_requests++;
+    return blk_submit(&wb->req);
+}
+
+/* Espera una tanda de escrituras y limpia los buffers escritos */
+static int bcache_wb_wait(struct bcache_wb *wb, u32 n)
+{
+    u32 i, k;
+    int error = 0;
+
+    for (i = 0; i < n; i++) {
+        if (blk_wait(&wb[i].req) != 0) {
+            bcache_write_error(wb[i].bufs[0]);
+            error = -1;
+        } else {
+            for (k = 0; k < wb[i].count; k++)
+                bcache_clean(wb[i].bufs[k]);
+            bcache_stats.writebacks += wb[i].count;
+        }
+        if (wb[i].bounce)
+            kfree(wb[i].bounce);
+    }
+    return error;
+}
+
+/*
+ * Escribe los buffers sucios de un dispositivo (o de todos si 'dev' es
+ * NULL) que lleven al menos 'min_age' tics sin escribir, salvo los que
+ * retiene el journal. Se ordenan por bloque y cada racha de bloques
+ * contiguos va en una sola petición (de hasta max_sectors), con
+ * BLK_MAX_INFLIGHT peticiones en vuelo.
+ */
+int bcache_flush(struct blk_dev *dev, u32 min_age)
+{
+    struct bcache_wb wb[BLK_MAX_INFLIGHT];
+    struct buf **list;
+    struct buf *b;
+    u32 n = 0, nwb = 0, i, j, max;
+    int error = 0;
+
+    if (bcache_stats.dirty == 0)
+        return 0;
+
+    list = (struct buf **)kmalloc(bcache_stats.dirty * sizeof(struct buf *));
+    if (list == NULL) {
+        /* Sin memoria para ordenar: de uno en uno */
+        for (b = lru_head; b; b = b->lru_next) {
+            if ((b->flags & (B_DIRTY | B_PINNED)) == B_DIRTY &&
+                (dev == NULL || b->dev == dev) && bwrite(b) != 0)
+                error = -1;
+        }
+        return error;
+    }
+
+    for (b = lru_head; b; b = b->lru_next) {
+        if ((b->flags & (B_DIRTY | B_PINNED)) == B_DIRTY && (dev == NULL || b->dev == dev) &&
+            bcache_ticks - b->dirty_since >= min_age)
+            list[n++] = b;
+    }
+    bcache_sort(list, n);
+
+    for (i = 0; i < n; i = j) {
+        max = list[i]->dev->max_sectors / (list[i]->size / BLK_SECTOR_SIZE);
+        for (j = i + 1; j < n && j - i < max; j++) {
+            if (list[j]->dev != list[i]->dev || list[j]->size != list[i]->size ||
+                list[j]->block != list[j - 1]->block + 1)
+                break;
+        }
+
+        if (bcache_wb_submit(&wb[nwb], list + i, j - i) != 0) {
+            if (wb[nwb].bounce)
+                kfree(wb[nwb].bounce);
+            error = -1;
+            continue;
+        }
+        if (++nwb == BLK_MAX_INFLIGHT) {
+            if (bcache_wb_wait(wb, nwb) != 0)
+                error = -1;
+            nwb = 0;
+        }
+    }
+    if (bcache_wb_wait(wb, nwb) != 0)
+        error = -1;
+
+    kfree(list);
+    return error;
+}
+
+/*
+ * Escribe los buffers sucios de un rango de bloques, antes de leerlo
+ * directamente del disco sin pasar por la caché
+ */
+int bcache_flush_range(struct blk_dev *dev, u32 block, u32 count, u32 size)
+{
+    struct buf *b;
+    u32 i;
+    int error = 0;
+
+    if (bcache_stats.dirty == 0)
+        return 0;
+
+    for (i = 0; i < count; i++) {
+        b = bcache_lookup(dev, block + i, size);
+        if (b != NULL && (b->flags & (B_DIRTY | B_PINNED)) == B_DIRTY && bwrite(b) != 0)
+            error = -1;
+    }
+    return error;
+}
+
+/*
+ * Tic del reloj (desde la IRQ 0): avanza la edad de los buffers sucios
+ * y despierta al flusher cada BCACHE_WRITEBACK_INTERVAL tics
+ */
+void bcache_tick(void)
+{
+    bcache_ticks++;
+    if (bcache_ticks % BCACHE_WRITEBACK_INTERVAL == 0)
+        bcache_flush_wanted = 1;
+}
+
+u32 bcache_now(void)
+{
+    return bcache_ticks;
+}
+
+/*
+ * Indica al flusher si debe escribir: ha pasado su periodo, o los datos
+ * sucios ('extra_dirty': los que el sistema de archivos aún no ha
+ * pasado a la caché) superan BCACHE_DIRTY_BACKGROUND_RATIO
+ */
+int bcache_writeback_due(u32 extra_dirty)
+{
+    if (bcache_flush_wanted || bcache_over_background(extra_dirty)) {
+        bcache_flush_wanted = 0;
+        return 1;
+    }
+    return 0;
+}
+
+int bcache_over_background(u32 extra_dirty)
+{
+    return bcache_stats.dirty_bytes + extra_dirty >
+           bcache_stats.budget / 100 * BCACHE_DIRTY_BACKGROUND_RATIO;
+}
+
+/*
+ * Indica si quien escribe debe vaciar la caché antes de seguir
+ */
+int bcache_over_dirty_limit(u32 extra_dirty)
+{
+    return bcache_stats.dirty_bytes + extra_dirty >
+           bcache_stats.budget / 100 * BCACHE_DIRTY_RATIO;
+}
+
+/*
+ * Empieza a leer un bloque en la caché sin esperar (lectura anticipada).
+ * No toma referencias ni supera el presupuesto: devuelve -1 si no hay
+ * sitio. El llamador debe hacer blk_unplug() tras encolar un lote.
+ */
+int bcache_prefetch(struct blk_dev *dev, u32 block, u32 size)
+{
+    struct buf *b;
+
+    if (bcache_lookup(dev, block, size) != NULL)
+        return 0;
+
+    bcache_shrink(size);
+    if (bcache_stats.bytes + size > bcache_stats.budget)
+        return -1;
+
+    b = bcache_alloc(dev, block, size);
+    if (b == NULL)
+        return -1;
+
+    b->flags = B_BUSY;
+    b->req.dev = dev;
+    b->req.cmd = BLK_READ;
+    b->req.lba = block * (size / BLK_SECTOR_SIZE);
+    b->req.count = size / BLK_SECTOR_SIZE;
+    b->req.buffer = b->data;
+    b->req.end_io = bcache_end_io;
+    b->req.private = b;
+
+    bcache_stats.prefetches++;
+    if (blk_submit(&b->req) != 0) {
+        b->flags &= ~B_BUSY;
+        bcache_free(b);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Suelta la referencia tomada con bread()
+ */
+void brelse(struct buf *b)
+{
+    if (b == NULL)
+        return;
+
+    if (b->refcount == 0) {
+        print("bcache : ERROR - brelse on unreferenced buffer\n");
+        return;
+    }
+
+    b->refcount--;
+    if (b->refcount == 0 && bcache_stats.bytes > bcache_stats.budget)
+        bcache_shrink(0);
+}
+
+/*
+ * Cambia la memoria máxima dedicada a la caché
+ */
+void bcache_set_budget(u32 bytes)
+{
+    bcache_stats.budget = bytes;
+    bcache_shrink(0);
+}
+
+/*
+ * Escribe y descarta los buffers sin usuarios de un dispositivo (p.ej.
+ * al desmontarlo)
+ */
+void bcache_invalidate(struct blk_dev *dev)
+{
+    struct buf *b = lru_head;
+    struct buf *next;
+
+    bcache_flush(dev, 0);
+
+    while (b) {
+        next = b->lru_next;
+        if (b->dev == dev && b->refcount == 0 && !(b->flags & (B_BUSY | B_DIRTY)))
+            bcache_free(b);
+        b = next;
+    }
+}
+
+/*
+ * Descarta los buffers sin usuarios de un dispositivo sin escribir los
+ * sucios, como si el sistema se hubiera caído (pruebas de recuperación)
+ */
+void bcache_discard(struct blk_dev *dev)
+{
+    struct buf *b = lru_head;
+    struct buf *next;
+
+    while (b) {
+        next = b->lru_next;
+        if (b->dev == dev && b->refcount == 0 && !(b->flags & B_BUSY)) {
+            bcache_clean(b);
+            bcache_free(b);
+        }
+        b = next;
+    }
+}
+
+void bcache_get_stats(struct bcache_stats *stats)
+{
+    memcpy(stats, &bcache_stats, sizeof(struct bcache_stats));
+}
+
+/*
+ * Muestra los contadores de la caché por consola
+ */
+void bcache_stats_dump(void)
+{
+    print("bcache : ");
+    print_dec(bcache_stats.hits);
+    print(" hits, ");
+    print_dec(bcache_stats.misses);
+    print(" misses, ");
+    print_dec(bcache_stats.evictions);
+    print(" evictions, ");
+    print_dec(bcache_stats.prefetches);
+    print(" prefetches, ");
+    print_dec(bcache_stats.dirty);
+    print(" dirty, ");
+    print_dec(bcache_stats.writebacks);
+    print(" written in ");
+    print_dec(bcache_stats.write_requests);
+    print(" requests, ");
+    print_dec(bcache_stats.nr_buffers);
+    print(" buffers (");
+    print_dec(bcache_stats.bytes / 1024);
+    print("/");
+    print_dec(bcache_stats.budget / 1024);
+    print(" KB)\n");
+}
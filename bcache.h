@@ -0,0 +1,72 @@
+#ifndef BCACHE_H_
+#define BCACHE_H_
+
+#include "types.h"
+#include "blk.h"
+
+/* Caché de bloques: buffers indexados por (dispositivo, bloque) */
+#define BCACHE_HASH_SIZE        64
+#define BCACHE_DEFAULT_BUDGET   (256 * 1024)    /* Bytes de datos en caché */
+
+/* Estados de un buffer */
+#define B_VALID     0x01        /* Contiene los datos del disco */
+#define B_BUSY      0x02        /* Lectura asíncrona en curso */
+#define B_DIRTY     0x04        /* Modificado, pendiente de escribir */
+#define B_PINNED    0x08        /* Retenido por el journal hasta el commit */
+
+/* Escritura diferida. bcache_tick() se llama en cada tic del reloj */
+#define BCACHE_HZ                       100
+#define BCACHE_WRITEBACK_INTERVAL       (5 * BCACHE_HZ)     /* Periodo del flusher */
+#define BCACHE_DIRTY_EXPIRE             (30 * BCACHE_HZ)    /* Edad máxima de un bloque sucio */
+#define BCACHE_DIRTY_BACKGROUND_RATIO   25  /* % del presupuesto: el flusher lo escribe todo */
+#define BCACHE_DIRTY_RATIO              50  /* %: quien escribe espera a vaciar la caché */
+
+struct buf {
+    struct blk_dev *dev;
+    u32 block;                  /* Número de bloque (en unidades de 'size') */
+    u32 size;                   /* Tamaño del bloque en bytes */
+    char *data;
+    u32 refcount;               /* Usuarios activos; 0 = candidato a expulsión */
+    u32 flags;
+    u32 dirty_since;            /* Tic en que se ensució */
+    struct buf *hash_next;
+    struct buf *lru_prev;       /* Lista LRU: cabeza = más reciente */
+    struct buf *lru_next;
+    struct blk_request req;     /* Petición de lectura anticipada */
+};
+
+struct bcache_stats {
+    u32 hits;
+    u32 misses;
+    u32 evictions;
+    u32 prefetches;             /* Lecturas anticipadas enviadas */
+    u32 dirty;                  /* Buffers pendientes de escribir */
+    u32 dirty_bytes;
+    u32 writebacks;             /* Bloques escritos por bcache_flush() */
+    u32 write_requests;         /* Peticiones usadas para escribirlos */
+    u32 nr_buffers;
+    u32 bytes;                  /* Memoria de datos ocupada */
+    u32 budget;
+};
+
+/* Funciones */
+struct buf *bread(struct blk_dev *dev, u32 block, u32 size);
+struct buf *bget(struct blk_dev *dev, u32 block, u32 size);
+int bwrite(struct buf *b);
+void bdirty(struct buf *b);
+int bcache_flush(struct blk_dev *dev, u32 min_age);
+int bcache_flush_range(struct blk_dev *dev, u32 block, u32 count, u32 size);
+void bcache_tick(void);
+u32 bcache_now(void);
+int bcache_writeback_due(u32 extra_dirty);
+int bcache_over_background(u32 extra_dirty);
+int bcache_over_dirty_limit(u32 extra_dirty);
+void brelse(struct buf *b);
+int bcache_prefetch(struct blk_dev *dev, u32 block, u32 size);
+void bcache_set_budget(u32 bytes);
+void bcache_invalidate(struct blk_dev *dev);
+void bcache_discard(struct blk_dev *dev);
+void bcache_get_stats(struct bcache_stats *stats);
+void bcache_stats_dump(void);
+
+#endif
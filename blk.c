@@ -0,0 +1,403 @@
+#include "types.h"
+#include "io.h"
+#include "lib.h"
+#include "mm.h"
+#include "screen.h"
+#include "blk.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/* Dispositivos registrados por los drivers */
+static struct blk_dev *blk_devices[BLK_MAX_DEVICES];
+static int blk_count = 0;
+
+/*
+ * Registra un dispositivo de bloques
+ */
+int blk_register(struct blk_dev *dev)
+{
+    if (blk_count >= BLK_MAX_DEVICES) {
+        print("blk    : ERROR - Too many block devices\n");
+        return -1;
+    }
+
+    blk_devices[blk_count++] = dev;
+
+    print("blk    : ");
+    print(dev->name);
+    print(": ");
+    print_dec(dev->nr_sectors / 2);
+    print(" KB");
+    if (dev->readonly)
+        print(" (read-only)");
+    print("\n");
+    return 0;
+}
+
+/*
+ * Busca un dispositivo por nombre
+ */
+struct blk_dev *blk_get(const char *name)
+{
+    int i;
+
+    for (i = 0; i < blk_count; i++) {
+        if (strcmp(blk_devices[i]->name, name) == 0)
+            return blk_devices[i];
+    }
+    return NULL;
+}
+
+/*
+ * Índice de la cubeta del histograma: parte entera de log2(v)
+ */
+static int blk_log2(u64 v)
+{
+    int n = 0;
+
+    while (v > 1 && n < BLK_HIST_BUCKETS - 1) {
+        v >>= 1;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Contabiliza una petición aceptada: marca de tiempo y cola
+ */
+static void blk_account_start(struct blk_request *req)
+{
+    struct blk_stats *st = &req->dev->stats;
+    u64 now = rdtsc();
+    u32 flags;
+
+    irq_save(flags);
+    req->submit_time = now;
+    if (st->in_flight++ == 0)
+        st->busy_since = now;
+    if (st->in_flight > st->max_in_flight)
+        st->max_in_flight = st->in_flight;
+    irq_restore(flags);
+}
+
+/*
+ * Contabiliza el fin de una petición: latencia, histograma y tiempo ocupado
+ */
+static void blk_account_done(struct blk_request *req, int error)
+{
+    struct blk_stats *st = &req->dev->stats;
+    int rw = (req->cmd == BLK_WRITE);
+    u64 now = rdtsc();
+    u64 latency = now - req->submit_time;
+    u32 flags;
+
+    irq_save(flags);
+    st->requests[rw]++;
+    st->sectors[rw] += req->count;
+    if (error)
+        st->errors++;
+    st->latency_cycles[rw] += latency;
+    st->latency_hist[rw][blk_log2(latency)]++;
+    if (--st->in_flight == 0)
+        st->busy_cycles += now - st->busy_since;
+    irq_restore(flags);
+}
+
+/*
+ * Envía una petición al driver sin esperar a que termine.
+ * Devuelve -1 si la petición se rechaza (queda completada con error).
+ */
+int blk_submit(struct blk_request *req)
+{
+    struct blk_dev *dev = req->dev;
+
+    req->done = 0;
+    req->error = 0;
+    req->next = NULL;
+    req->submit_time = 0;
+
+    if (req->count == 0 || req->lba + req->count > dev->nr_sectors ||
+        req->lba + req->count < req->lba) {
+        print("blk    : ERROR - Request beyond end of ");
+        print(dev->name);
+        print("\n");
+        blk_end_request(req, -1);
+        return -1;
+    }
+
+    if (req->cmd == BLK_WRITE && dev->readonly) {
+        blk_end_request(req, -1);
+        return -1;
+    }
+
+    blk_account_start(req);
+    if (dev->ops->submit(dev, req) != 0) {
+        blk_end_request(req, -1);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Llamada por los drivers al completar una petición. 'end_io' puede
+ * liberar la petición, así que no se toca después de llamarla.
+ */
+void blk_end_request(struct blk_request *req, int error)
+{
+    if (req->submit_time)
+        blk_account_done(req, error);
+
+    req->error = error;
+    req->done = 1;
+    if (req->end_io)
+        req->end_io(req);
+}
+
+/*
+ * Pide al driver que notifique al dispositivo las peticiones encoladas
+ */
+void blk_unplug(struct blk_dev *dev)
+{
+    if (dev->ops->unplug)
+        dev->ops->unplug(dev);
+}
+
+/*
+ * Devuelve un puntero a los sectores si el dispositivo está en memoria
+ * (ramdisk) para leerlos sin copia, o NULL si hay que usar blk_read()
+ */
+void *blk_map(struct blk_dev *dev, u32 lba, u32 count)
+{
+    if (dev == NULL || dev->ops->map == NULL)
+        return NULL;
+    if (lba + count > dev->nr_sectors || lba + count < lba)
+        return NULL;
+    return dev->ops->map(dev, lba, count);
+}
+
+/*
+ * Espera a que una petición termine. Se sondea el driver para no
+ * depender de que las interrupciones estén habilitadas.
+ */
+int blk_wait(struct blk_request *req)
+{
+    struct blk_dev *dev = req->dev;
+
+    blk_unplug(dev);
+    while (!req->done) {
+        if (dev->ops->poll)
+            dev->ops->poll(dev);
+    }
+    return req->error;
+}
+
+/*
+ * Lectura/escritura síncrona: trocea el rango según max_sectors y
+ * mantiene hasta BLK_MAX_INFLIGHT peticiones en vuelo a la vez.
+ */
+static int blk_rw(struct blk_dev *dev, int cmd, u32 lba, u32 count, void *buffer)
+{
+    struct blk_request reqs[BLK_MAX_INFLIGHT];
+    char *buf = (char *)buffer;
+    u32 chunk;
+    int i, n, error = 0;
+
+    if (dev == NULL)
+        return -1;
+
+    while (count > 0 && !error) {
+        n = 0;
+        while (count > 0 && n < BLK_MAX_INFLIGHT) {
+            chunk = count;
+            if (chunk > dev->max_sectors)
+                chunk = dev->max_sectors;
+
+            reqs[n].dev = dev;
+            reqs[n].cmd = cmd;
+            reqs[n].lba = lba;
+            reqs[n].count = chunk;
+            reqs[n].buffer = buf;
+            reqs[n].end_io = NULL;
+            reqs[n].private = NULL;
+            blk_submit(&reqs[n]);
+            n++;
+
+            lba += chunk;
+            count -= chunk;
+            buf += chunk * BLK_SECTOR_SIZE;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (blk_wait(&reqs[i]) != 0)
+                error = -1;
+        }
+    }
+
+    return error;
+}
+
+/*
+ * Lee 'count' sectores a partir de 'lba'
+ */
+int blk_read(struct blk_dev *dev, u32 lba, u32 count, void *buffer)
+{
+    return blk_rw(dev, BLK_READ, lba, count, buffer);
+}
+
+/*
+ * Escribe 'count' sectores a partir de 'lba'
+ */
+int blk_write(struct blk_dev *dev, u32 lba, u32 count, void *buffer)
+{
+    return blk_rw(dev, BLK_WRITE, lba, count, buffer);
+}
+
+/*
+ * Mide el rendimiento de lectura secuencial de un dispositivo con el
+ * TSC. Se usa para comparar IDE y virtio-blk sobre la misma imagen
+ * (ver "make run-virtio"). Un "Mcyc" son 2^20 ciclos.
+ */
+#define BLK_BENCH_CHUNK 512     /* sectores por blk_read (256 KB) */
+
+void blk_bench(struct blk_dev *dev, u32 sectors)
+{
+    char *buffer;
+    u64 start, cycles;
+    u32 lba, chunk, mcycles;
+
+    if (dev == NULL)
+        return;
+
+    if (sectors > dev->nr_sectors)
+        sectors = dev->nr_sectors;
+
+    buffer = (char *)kmalloc(BLK_BENCH_CHUNK * BLK_SECTOR_SIZE);
+    if (buffer == NULL) {
+        print("blk    : ERROR - Cannot allocate benchmark buffer\n");
+        return;
+    }
+
+    start = rdtsc();
+    for (lba = 0; lba < sectors; lba += chunk) {
+        chunk = sectors - lba;
+        if (chunk > BLK_BENCH_CHUNK)
+            chunk = BLK_BENCH_CHUNK;
+        if (blk_read(dev, lba, chunk, buffer) != 0) {
+            print("blk    : ERROR - Benchmark read failed\n");
+            kfree(buffer);
+            return;
+        }
+    }
+    cycles = rdtsc() - start;
+    kfree(buffer);
+
+    mcycles = (u32)(cycles >> 20);
+    if (mcycles == 0)
+        mcycles = 1;
+
+    print("blk    : ");
+    print(dev->name);
+    print(": read ");
+    print_dec(sectors / 2);
+    print(" KB in ");
+    print_dec(mcycles);
+    print(" Mcyc (");
+    print_dec((sectors / 2) / mcycles);
+    print(" KB/Mcyc)\n");
+}
+
+/*
+ * Copia las estadísticas de un dispositivo (interfaz para el resto del
+ * kernel). Devuelve -1 si no existe.
+ */
+int blk_get_stats(const char *name, struct blk_stats *stats)
+{
+    struct blk_dev *dev = blk_get(name);
+    u32 flags;
+
+    if (dev == NULL)
+        return -1;
+
+    irq_save(flags);
+    memcpy(stats, &dev->stats, sizeof(struct blk_stats));
+    irq_restore(flags);
+    return 0;
+}
+
+/*
+ * Muestra un histograma de latencias (solo las cubetas con datos)
+ */
+static void blk_hist_dump(char *label, u32 *hist)
+{
+    int i;
+
+    for (i = 0; i < BLK_HIST_BUCKETS; i++) {
+        if (hist[i] == 0)
+            continue;
+        print("blk    :   ");
+        print(label);
+        print(" 2^");
+        print_dec(i);
+        print(" cyc: ");
+        print_dec(hist[i]);
+        print("\n");
+    }
+}
+
+/*
+ * Vuelca por consola las estadísticas de un dispositivo. Las latencias
+ * medias se dan en Kcyc (2^10 ciclos) y el tiempo ocupado en Mcyc.
+ */
+void blk_stats_dump(struct blk_dev *dev)
+{
+    struct blk_stats st;
+    u32 flags;
+    int rw;
+
+    irq_save(flags);
+    memcpy(&st, &dev->stats, sizeof(struct blk_stats));
+    irq_restore(flags);
+
+    print("blk    : ");
+    print(dev->name);
+    print(": in flight ");
+    print_dec(st.in_flight);
+    print(" (max ");
+    print_dec(st.max_in_flight);
+    print("), busy ");
+    print_dec((u32)(st.busy_cycles >> 20));
+    print(" Mcyc, errors ");
+    print_dec(st.errors);
+    print("\n");
+
+    for (rw = 0; rw < 2; rw++) {
+        if (st.requests[rw] == 0)
+            continue;
+        print("blk    :   ");
+        print(rw == BLK_WRITE ? "write" : "read ");
+        print(": ");
+        print_dec(st.requests[rw]);
+        print(" reqs, ");
+        print_dec(st.sectors[rw]);
+        print(" sectors, ");
+        print_dec(st.merges[rw]);
+        print(" merges, avg ");
+        print_dec((u32)(st.latency_cycles[rw] >> 10) / st.requests[rw]);
+        print(" Kcyc\n");
+        blk_hist_dump(rw == BLK_WRITE ? "write" : "read ", st.latency_hist[rw]);
+    }
+}
+
+/*
+ * Vuelca las estadísticas de todos los dispositivos registrados
+ */
+void blk_stats_dump_all(void)
+{
+    int i;
+
+    for (i = 0; i < blk_count; i++)
+        blk_stats_dump(blk_devices[i]);
+}
@@ -0,0 +1,86 @@
+#ifndef BLK_H_
+#define BLK_H_
+
+#include "types.h"
+
+/* Capa de bloques: interfaz común para IDE, virtio-blk y demás discos */
+#define BLK_SECTOR_SIZE     512
+#define BLK_MAX_DEVICES     8
+#define BLK_NAME_LEN        8
+
+/* Número de peticiones en vuelo que blk_read()/blk_write() encolan */
+#define BLK_MAX_INFLIGHT    8
+
+/* Tipos de petición */
+#define BLK_READ            0
+#define BLK_WRITE           1
+
+/* Cubetas del histograma de latencias: cubeta n = [2^n, 2^(n+1)) ciclos */
+#define BLK_HIST_BUCKETS    40
+
+struct blk_dev;
+
+/* Estadísticas por dispositivo (índice 0 = BLK_READ, 1 = BLK_WRITE) */
+struct blk_stats {
+    u32 requests[2];            /* Peticiones completadas */
+    u32 sectors[2];             /* Sectores transferidos */
+    u32 merges[2];              /* Peticiones que el driver fusionó con otra */
+    u32 errors;
+    u32 in_flight;              /* Profundidad de cola actual */
+    u32 max_in_flight;
+    u64 busy_cycles;            /* Ciclos con al menos una petición en vuelo */
+    u64 busy_since;
+    u64 latency_cycles[2];      /* Suma de latencias envío-fin */
+    u32 latency_hist[2][BLK_HIST_BUCKETS];
+};
+
+/* Petición de E/S sobre un rango de sectores */
+struct blk_request {
+    struct blk_dev *dev;
+    int cmd;                    /* BLK_READ o BLK_WRITE */
+    u32 lba;                    /* Primer sector */
+    u32 count;                  /* Número de sectores */
+    void *buffer;               /* Memoria física contigua (identity mapping) */
+    volatile int done;          /* 1 cuando el driver la ha completado */
+    int error;                  /* 0 o -1 */
+    void (*end_io)(struct blk_request *req);  /* Opcional, al completar */
+    void *private;              /* Libre para quien envía la petición */
+    struct blk_request *next;   /* Enlace en la cola del driver */
+    u64 submit_time;            /* TSC al aceptar la petición (0: no aceptada) */
+};
+
+/* Operaciones que implementa cada driver */
+struct blk_ops {
+    int (*submit)(struct blk_dev *dev, struct blk_request *req);
+    void (*unplug)(struct blk_dev *dev);    /* Notificar peticiones encoladas */
+    void (*poll)(struct blk_dev *dev);      /* Recoger peticiones completadas */
+    void *(*map)(struct blk_dev *dev, u32 lba, u32 count);  /* Opcional: acceso directo */
+};
+
+/* Dispositivo de bloques */
+struct blk_dev {
+    char name[BLK_NAME_LEN];    /* "hda", "vda"... */
+    u32 nr_sectors;             /* Capacidad en sectores */
+    u32 max_sectors;            /* Máximo de sectores por petición */
+    int readonly;
+    struct blk_ops *ops;
+    void *private;              /* Estado del driver */
+    struct blk_stats stats;
+};
+
+/* Funciones */
+int blk_register(struct blk_dev *dev);
+struct blk_dev *blk_get(const char *name);
+int blk_submit(struct blk_request *req);
+void blk_end_request(struct blk_request *req, int error);
+void blk_unplug(struct blk_dev *dev);
+void *blk_map(struct blk_dev *dev, u32 lba, u32 count);
+int blk_wait(struct blk_request *req);
+int blk_read(struct blk_dev *dev, u32 lba, u32 count, void *buffer);
+int blk_write(struct blk_dev *dev, u32 lba, u32 count, void *buffer);
+void blk_bench(struct blk_dev *dev, u32 sectors);
+int blk_get_stats(const char *name, struct blk_stats *stats);
+void blk_stats_dump(struct blk_dev *dev);
+void blk_stats_dump_all(void);
+
+#endif
@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# Crea la imagen Ext2 de ext2_bench sin privilegios de root: el
+# contenido se prepara en un directorio temporal y se copia con
+# mke2fs -d (que conserva los huecos de los archivos dispersos); después
+# e2fsck -D indexa los directorios grandes con htree.
+#
+#   /deep/l00/l01/.../l31/leaf      32 niveles de directorios
+#   /tree/dXX/dYY/fZZ               16 x 16 directorios con 16 archivos
+#   /huge/f00000 ... f19999         un directorio de 20000 entradas
+#   /large/data                     64 MB de datos
+#   /sparse/data                    1 GB aparente, 16 tramos de 1 MB
+#
+# Uso: ./create_bench_image.sh [imagen] [tamaño de bloque]
+
+IMAGE_NAME="${1:-bench_disk.img}"
+BLOCK_SIZE="${2:-1024}"
+ROOT_DIR=$(mktemp -d)
+
+echo "Creando $IMAGE_NAME (bloques de $BLOCK_SIZE bytes)..."
+
+# Árbol profundo
+DEEP="$ROOT_DIR/deep"
+for i in $(seq -f "%02g" 0 31); do
+    DEEP="$DEEP/l$i"
+done
+mkdir -p "$DEEP"
+echo "leaf" > "$DEEP/leaf"
+
+# Árbol ancho: 4096 archivos pequeños
+for a in $(seq -f "%02g" 0 15); do
+    for b in $(seq -f "%02g" 0 15); do
+        mkdir -p "$ROOT_DIR/tree/d$a/d$b"
+        for c in $(seq -f "%02g" 0 15); do
+            echo "d$a/d$b/f$c" > "$ROOT_DIR/tree/d$a/d$b/f$c"
+        done
+    done
+done
+
+# Directorio enorme
+mkdir -p "$ROOT_DIR/huge"
+(cd "$ROOT_DIR/huge" && seq -f "f%05g" 0 19999 | xargs touch)
+
+# Archivo grande y archivo disperso
+mkdir -p "$ROOT_DIR/large" "$ROOT_DIR/sparse"
+head -c $((64 * 1024 * 1024)) /dev/urandom > "$ROOT_DIR/large/data"
+truncate -s 1G "$ROOT_DIR/sparse/data"
+for i in $(seq 0 15); do
+    dd if=/dev/urandom of="$ROOT_DIR/sparse/data" bs=1M count=1 \
+       seek=$((i * 64)) conv=notrunc status=none
+done
+
+echo "¡Hola desde Pepin OS!" > "$ROOT_DIR/hello.txt"
+
+rm -f "$IMAGE_NAME"
+mke2fs -q -t ext2 -b "$BLOCK_SIZE" -N 32768 -d "$ROOT_DIR" "$IMAGE_NAME" 192M
+rm -rf "$ROOT_DIR"
+
+# Índices htree de todos los directorios
+e2fsck -fyD "$IMAGE_NAME" > /dev/null 2>&1
+
+echo "Para medir: make bench"
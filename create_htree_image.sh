@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Crea una imagen Ext2 con un directorio /spool de muchas entradas
+# (f00000, f00001...) indexado con htree, para medir las búsquedas con
+# ext2_htree_bench(). No necesita privilegios de root: el contenido se
+# copia con mke2fs -d y e2fsck -D construye los índices.
+#
+# Uso: ./create_htree_image.sh [imagen] [entradas]
+
+IMAGE_NAME="${1:-htree_disk.img}"
+ENTRIES="${2:-50000}"
+ROOT_DIR=$(mktemp -d)
+
+echo "Creando $IMAGE_NAME con $ENTRIES entradas en /spool..."
+
+mkdir -p "$ROOT_DIR/spool"
+(cd "$ROOT_DIR/spool" && seq -f "f%05g" 0 $((ENTRIES - 1)) | xargs touch)
+echo "¡Hola desde Pepin OS!" > "$ROOT_DIR/hello.txt"
+
+# Bloques de 1 KB e inodos de 128 bytes (lo que soporta el kernel)
+rm -f "$IMAGE_NAME"
+mke2fs -q -t ext2 -b 1024 -I 128 -N $((ENTRIES + 1024)) -d "$ROOT_DIR" "$IMAGE_NAME" 64M
+rm -rf "$ROOT_DIR"
+
+# Reconstruir (u optimizar) los índices de todos los directorios
+e2fsck -fyD "$IMAGE_NAME" > /dev/null 2>&1
+
+debugfs -R "htree_dump /spool" "$IMAGE_NAME" 2>/dev/null | head -8
+echo "Para probar con QEMU: make run-htree"
@@ -0,0 +1,37 @@
+#!/bin/bash
+
+# Reparte una imagen Ext2 en varios discos para el RAID-0 del kernel
+# (raid0_create). Los chunks se asignan en orden: chunk c va al disco
+# c % N, fila c / N. No necesita privilegios de root.
+#
+# Uso: ./create_raid0_images.sh [imagen] [discos] [chunk_kb]
+
+IMAGE_NAME="${1:-ext2_disk.img}"
+MEMBERS="${2:-2}"
+CHUNK_KB="${3:-64}"
+
+if [ ! -f "$IMAGE_NAME" ]; then
+    echo "No existe $IMAGE_NAME (crearla con create_ext2_image.sh)"
+    exit 1
+fi
+
+SIZE=$(stat -c %s "$IMAGE_NAME")
+CHUNK=$((CHUNK_KB * 1024))
+CHUNKS=$(((SIZE + CHUNK - 1) / CHUNK))
+ROWS=$(((CHUNKS + MEMBERS - 1) / MEMBERS))
+
+echo "Repartiendo $IMAGE_NAME en $MEMBERS discos (chunk de ${CHUNK_KB} KB)..."
+
+for ((m = 0; m < MEMBERS; m++)); do
+    rm -f raid0_$m.img
+    truncate -s $((ROWS * CHUNK)) raid0_$m.img
+done
+
+for ((c = 0; c < CHUNKS; c++)); do
+    dd if="$IMAGE_NAME" of=raid0_$((c % MEMBERS)).img bs=$CHUNK \
+       skip=$c seek=$((c / MEMBERS)) count=1 conv=notrunc status=none
+done
+
+echo "Discos creados: $(ls raid0_*.img | tr '\n' ' ')"
+echo "Para probar con QEMU (un disco por canal IDE):"
+echo "qemu-system-i386 -kernel kernel -hda raid0_0.img -hdc raid0_1.img"
@@ -2,6 +2,12 @@
 #include "screen.h"
 #include "mm.h"
 #include "lib.h"
+#include "bcache.h"
+#include "ext2_htree.h"
+#include "ext2_journal.h"
+#include "pagecache.h"
+#include "ext2_prewarm.h"
+#include "fs.h"
 
 #ifndef NULL
 #define NULL ((void*)0)
@@ -10,34 +16,191 @@
 /* Variable global del sistema de archivos */
 struct ext2_fs ext2_fs;
 
+/* Dispositivos donde se busca la raíz, por orden de preferencia */
+static char *ext2_root_devices[] = { "rd0", "md0", "vda", "hda", NULL };
+
+static int ext2_icache_busy(void);
+static void ext2_icache_clear(void);
+static void ext2_dcache_clear(void);
+
 /*
- * Inicializa el sistema de archivos Ext2
+ * Inicializa el sistema de archivos Ext2 en el primer dispositivo
+ * disponible
  */
 int ext2_init(void)
 {
-    print("ext2   : initializing Ext2 filesystem...\n");
+    struct blk_dev *dev;
+    int i;
     
-    /* Leer el superbloque */
-    if (ext2_read_superblock() != 0) {
-        print("ext2   : ERROR - Failed to read superblock\n");
+    for (i = 0; ext2_root_devices[i] != NULL; i++) {
+        dev = blk_get(ext2_root_devices[i]);
+        if (dev != NULL && ext2_mount(dev) == 0) {
+            pcache_init();
+            fs_mount("/", &ext2_fs_ops);
+            return 0;
+        }
+    }
+    
+    print("ext2   : ERROR - No device with an Ext2 filesystem\n");
+    return -1;
+}
+
+/*
+ * Valida el superbloque leído y calcula los tamaños de bloque e inodo.
+ * En la revisión 0 los inodos miden 128 bytes; en la revisión 1 el
+ * tamaño está en s_inode_size y las características en s_feature_*.
+ */
+static int ext2_check_superblock(void)
+{
+    struct ext2_superblock *sb = &ext2_fs.superblock;
+    u32 incompat;
+    
+    if (sb->s_log_block_size > EXT2_MAX_LOG_BLOCK_SIZE) {
+        print("ext2   : ERROR - Unsupported block size: ");
+        print_dec(1024 << sb->s_log_block_size);
+        print("\n");
+        return -1;
+    }
+    ext2_fs.block_size = 1024 << sb->s_log_block_size;
+    ext2_fs.first_data_block = sb->s_first_data_block;
+    
+    if (sb->s_blocks_per_group == 0 || sb->s_inodes_per_group == 0 ||
+        sb->s_blocks_per_group > 8 * ext2_fs.block_size) {
+        print("ext2   : ERROR - Invalid group geometry\n");
+        return -1;
+    }
+    
+    if (sb->s_rev_level < EXT2_DYNAMIC_REV) {
+        ext2_fs.inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+        return 0;
+    }
+    
+    /* Potencia de 2 entre 128 bytes y el tamaño de bloque */
+    ext2_fs.inode_size = sb->s_inode_size;
+    if (ext2_fs.inode_size < EXT2_GOOD_OLD_INODE_SIZE || ext2_fs.inode_size > ext2_fs.block_size ||
+        (ext2_fs.inode_size & (ext2_fs.inode_size - 1)) != 0) {
+        print("ext2   : ERROR - Invalid inode size: ");
+        print_dec(ext2_fs.inode_size);
+        print("\n");
+        return -1;
+    }
+    
+    incompat = sb->s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPP;
+    if (incompat != 0) {
+        print("ext2   : ERROR - Unsupported incompat features: 0x");
+        print_hex(incompat);
+        print("\n");
+        return -1;
+    }
+    
+    return 0;
+}
+
+/*
+ * Comprueba, sin tocar el montaje actual, que el dispositivo tiene la
+ * signatura de Ext2
+ */
+static int ext2_probe(struct blk_dev *dev)
+{
+    struct ext2_superblock *sb;
+    int result = 0;
+    
+    sb = (struct ext2_superblock *)kmalloc(1024);
+    if (sb == NULL) {
+        print("ext2   : ERROR - Cannot allocate buffer for superblock\n");
         return -1;
     }
     
-    /* Verificar la signatura mágica */
-    if (ext2_fs.superblock.s_magic != EXT2_SIGNATURE) {
+    if (blk_read(dev, 2, 2, (char *)sb) != 0) {
+        print("ext2   : ERROR - Failed to read superblock\n");
+        result = -1;
+    } else if (sb->s_magic != EXT2_SIGNATURE) {
         print("ext2   : ERROR - Invalid Ext2 signature: 0x");
-        print_hex(ext2_fs.superblock.s_magic);
+        print_hex(sb->s_magic);
         print("\n");
+        result = -1;
+    }
+    
+    kfree(sb);
+    return result;
+}
+
+/*
+ * Deshace un montaje que falla a medias: las cachés ya no guardan nada
+ * del sistema anterior, así que queda desmontado en lugar de con la
+ * raíz a NULL bajo "/"
+ */
+static int ext2_mount_abort(void)
+{
+    struct fs_mount *mount;
+    
+    ext2_journal.active = 0;
+    ext2_journal.inode = NULL;
+    ext2_dcache_clear();
+    ext2_icache_clear();
+    bcache_invalidate(ext2_fs.dev);
+    ext2_fs.root = NULL;
+    ext2_fs.dev = NULL;
+    ext2_fs.readonly = 1;
+    
+    mount = fs_resolve("/", NULL);
+    if (mount != NULL && mount->ops == &ext2_fs_ops) {
+        fs_umount("/");
+    }
+    return -1;
+}
+
+/*
+ * Monta el sistema de archivos Ext2 de un dispositivo de bloques. Si
+ * falla después de descartar el montaje anterior, Ext2 queda desmontado
+ */
+int ext2_mount(struct blk_dev *dev)
+{
+    print("ext2   : initializing Ext2 filesystem on ");
+    print(dev->name);
+    print("...\n");
+    
+    /* Escribir lo pendiente del sistema montado antes */
+    if (ext2_fs.dev != NULL && ext2_fs.gd_dirty != NULL) {
+        ext2_sync();
+    }
+    
+    /* Archivos abiertos, proyecciones o datos sin escribir siguen
+       apuntando a los inodos del montaje anterior */
+    if (ext2_icache_busy()) {
+        print("ext2   : ERROR - Filesystem busy, cannot remount\n");
+        return -1;
+    }
+    
+    /* Un dispositivo sin Ext2 no toca el montaje actual */
+    if (ext2_probe(dev) != 0) {
         return -1;
     }
     
-    /* Calcular el tamaño del bloque */
-    ext2_fs.block_size = 1024 << ext2_fs.superblock.s_log_block_size;
-    ext2_fs.inode_size = EXT2_INODE_SIZE;
-    ext2_fs.first_data_block = ext2_fs.superblock.s_first_data_block;
+    ext2_fs.dev = dev;
+    
+    /* Descartar bloques, inodos y nombres de un montaje anterior. A
+       partir de aquí un error deja el sistema desmontado */
+    ext2_dcache_clear();
+    ext2_icache_clear();
+    ext2_fs.root = NULL;
+    bcache_invalidate(dev);
+    
+    /* Leer el superbloque */
+    if (ext2_read_superblock() != 0) {
+        print("ext2   : ERROR - Failed to read superblock\n");
+        return ext2_mount_abort();
+    }
+    
+    /* Tamaños de bloque e inodo y características del formato */
+    if (ext2_check_superblock() != 0) {
+        return ext2_mount_abort();
+    }
     
     print("ext2   : block size: ");
     print_dec(ext2_fs.block_size);
+    print(" bytes, inode size: ");
+    print_dec(ext2_fs.inode_size);
     print(" bytes\n");
     
     print("ext2   : total blocks: ");
@@ -51,8 +214,50 @@ int ext2_init(void)
     /* Leer los descriptores de grupo */
     if (ext2_read_group_desc() != 0) {
         print("ext2   : ERROR - Failed to read group descriptors\n");
-        return -1;
+        return ext2_mount_abort();
+    }
+
+    /* Estado de escritura: descriptores y superbloque se reescriben tras
+       cada asignación */
+    ext2_fs.readonly = dev->readonly;
+    if (ext2_fs.superblock.s_rev_level >= EXT2_DYNAMIC_REV &&
+        (ext2_fs.superblock.s_feature_ro_compat & ~EXT2_FEATURE_RO_COMPAT_SUPP) != 0) {
+        print("ext2   : unsupported ro_compat features 0x");
+        print_hex(ext2_fs.superblock.s_feature_ro_compat & ~EXT2_FEATURE_RO_COMPAT_SUPP);
+        print(", mounting read-only\n");
+        ext2_fs.readonly = 1;
     }
+    if (ext2_fs.gd_dirty != NULL) {
+        kfree(ext2_fs.gd_dirty);
+    }
+    ext2_fs.gd_dirty = (u8 *)kmalloc(ext2_fs.groups_count);
+    if (ext2_fs.gd_dirty == NULL) {
+        print("ext2   : ERROR - Cannot allocate group descriptor state\n");
+        return ext2_mount_abort();
+    }
+    memset(ext2_fs.gd_dirty, 0, ext2_fs.groups_count);
+    ext2_fs.sb_dirty = 0;
+    ext2_fs.da_blocks = 0;
+
+    /* ext3: recuperar el journal antes de usar ningún otro metadato */
+    if (ext2_journal_load() < 0) {
+        print("ext2   : ERROR - Failed to load the journal\n");
+        return ext2_mount_abort();
+    }
+
+    /* El inodo raíz se usa en cada búsqueda: queda fijo en la caché */
+    ext2_fs.root = ext2_iget(EXT2_ROOT_INODE);
+    if (ext2_fs.root == NULL) {
+        print("ext2   : ERROR - Cannot read root inode\n");
+        return ext2_mount_abort();
+    }
+    
+    /* Los índices htree solo son válidos si el sistema declara dir_index */
+    ext2_fs.use_htree = ext2_fs.superblock.s_rev_level >= EXT2_DYNAMIC_REV &&
+                        (ext2_fs.superblock.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX);
+    
+    /* Las lecturas de la precarga quedan para el bucle ocioso */
+    ext2_prewarm_schedule();
     
     print("ext2   : filesystem initialized successfully\n");
     return 0;
@@ -70,7 +275,7 @@ int ext2_read_superblock(void)
     }
     
     /* Leer el sector que contiene el superbloque (sector 2, offset 1024) */
-    if (ide_read_sectors(IDE_MASTER, 2, 2, buffer) != 0) {
+    if (blk_read(ext2_fs.dev, 2, 2, buffer) != 0) {
         print("ext2   : ERROR - Cannot read superblock from disk\n");
         kfree(buffer);
         return -1;
@@ -84,19 +289,24 @@ int ext2_read_superblock(void)
 }
 
 /*
- * Lee los descriptores de grupo
+ * Lee los descriptores de grupo. Ocupan los bloques que siguen al del
+ * superbloque; con muchos grupos son varios, y se piden todos juntos a
+ * la caché antes de copiarlos.
  */
 int ext2_read_group_desc(void)
 {
+    struct ext2_superblock *sb = &ext2_fs.superblock;
     u32 groups_count;
     u32 desc_per_block;
     u32 blocks_needed;
     u32 first_desc_block;
-    char *buffer;
+    u32 i, count;
+    struct buf *bh;
+    char *data;
     
-    /* Calcular el número de grupos */
-    groups_count = (ext2_fs.superblock.s_blocks_count + ext2_fs.superblock.s_blocks_per_group - 1) / 
-                   ext2_fs.superblock.s_blocks_per_group;
+    /* Calcular el número de grupos: el grupo 0 empieza en s_first_data_block */
+    groups_count = (sb->s_blocks_count - sb->s_first_data_block + sb->s_blocks_per_group - 1) /
+                   sb->s_blocks_per_group;
     
     ext2_fs.groups_count = groups_count;
     
@@ -108,85 +318,115 @@ int ext2_read_group_desc(void)
     desc_per_block = ext2_fs.block_size / sizeof(struct ext2_group_desc);
     blocks_needed = (groups_count + desc_per_block - 1) / desc_per_block;
     
-    /* El primer bloque de descriptores está después del superbloque */
-    if (ext2_fs.block_size == 1024) {
-        first_desc_block = 2;  /* Superbloque está en el bloque 1 */
-    } else {
-        first_desc_block = 1;  /* Superbloque está en el bloque 0 */
-    }
+    /* El primer bloque de descriptores está después del superbloque
+       (bloque 1 con bloques de 1 KB, bloque 0 con bloques mayores) */
+    first_desc_block = ext2_fs.first_data_block + 1;
     
     /* Asignar memoria para los descriptores */
+    if (ext2_fs.group_desc != NULL) {
+        kfree(ext2_fs.group_desc);
+    }
     ext2_fs.group_desc = (struct ext2_group_desc *)kmalloc(groups_count * sizeof(struct ext2_group_desc));
     if (ext2_fs.group_desc == NULL) {
         print("ext2   : ERROR - Cannot allocate memory for group descriptors\n");
         return -1;
     }
     
-    /* Leer los descriptores de grupo */
-    buffer = (char *)kmalloc(ext2_fs.block_size);
-    if (buffer == NULL) {
-        print("ext2   : ERROR - Cannot allocate buffer for group descriptors\n");
-        kfree(ext2_fs.group_desc);
-        return -1;
+    /* Pedir todos los bloques en una tanda (salvo en memoria) */
+    if (blocks_needed > 1 && blk_map(ext2_fs.dev, 0, 1) == NULL) {
+        for (i = 0; i < blocks_needed; i++) {
+            if (bcache_prefetch(ext2_fs.dev, first_desc_block + i, ext2_fs.block_size) != 0) {
+                break;
+            }
+        }
+        blk_unplug(ext2_fs.dev);
     }
     
-    if (ext2_read_block(first_desc_block, buffer) != 0) {
-        print("ext2   : ERROR - Cannot read group descriptors from disk\n");
-        kfree(buffer);
-        kfree(ext2_fs.group_desc);
-        return -1;
+    /* Copiar los descriptores de cada bloque */
+    for (i = 0; i < blocks_needed; i++) {
+        data = ext2_get_block(first_desc_block + i, &bh);
+        if (data == NULL) {
+            print("ext2   : ERROR - Cannot read group descriptors from disk\n");
+            kfree(ext2_fs.group_desc);
+            ext2_fs.group_desc = NULL;
+            return -1;
+        }
+        
+        count = groups_count - i * desc_per_block;
+        if (count > desc_per_block) {
+            count = desc_per_block;
+        }
+        memcpy(&ext2_fs.group_desc[i * desc_per_block], data, count * sizeof(struct ext2_group_desc));
+        ext2_put_block(bh);
     }
     
-    /* Copiar los descriptores */
-    memcpy(ext2_fs.group_desc, buffer, groups_count * sizeof(struct ext2_group_desc));
-    
-    kfree(buffer);
     print("ext2   : group descriptors loaded successfully\n");
     return 0;
 }
 
 /*
- * Lee un bloque del disco
+ * Lee un bloque (a través de la caché de bloques)
  */
 int ext2_read_block(u32 block_num, void *buffer)
 {
-    u32 sector_start;
-    u32 sectors_per_block;
+    struct buf *bh;
     
-    /* Calcular el sector inicial y cuántos sectores por bloque */
-    sectors_per_block = ext2_fs.block_size / 512;
-    sector_start = block_num * sectors_per_block;
-    
-    /* Leer el bloque */
-    if (ide_read_sectors(IDE_MASTER, sector_start, sectors_per_block, buffer) != 0) {
+    bh = bread(ext2_fs.dev, block_num, ext2_fs.block_size);
+    if (bh == NULL) {
         print("ext2   : ERROR - Cannot read block ");
         print_dec(block_num);
         print(" from disk\n");
         return -1;
     }
     
+    memcpy(buffer, bh->data, ext2_fs.block_size);
+    brelse(bh);
     return 0;
 }
 
 /*
- * Lee un inodo del disco
+ * Devuelve un puntero al contenido de un bloque. En dispositivos en
+ * memoria (ramdisk) apunta directamente a sus datos; si no, al buffer
+ * de la caché de bloques, que queda referenciado en *bh. El llamador
+ * suelta la referencia con ext2_put_block().
  */
-int ext2_read_inode(u32 inode_num, struct ext2_inode *inode)
+char *ext2_get_block(u32 block_num, struct buf **bh)
+{
+    u32 sectors_per_block = ext2_fs.block_size / 512;
+    char *data;
+    
+    *bh = NULL;
+    data = (char *)blk_map(ext2_fs.dev, block_num * sectors_per_block, sectors_per_block);
+    if (data != NULL) {
+        return data;
+    }
+    
+    *bh = bread(ext2_fs.dev, block_num, ext2_fs.block_size);
+    if (*bh == NULL) {
+        print("ext2   : ERROR - Cannot read block ");
+        print_dec(block_num);
+        print(" from disk\n");
+        return NULL;
+    }
+    
+    return (*bh)->data;
+}
+
+void ext2_put_block(struct buf *bh)
+{
+    if (bh != NULL) {
+        brelse(bh);
+    }
+}
+
+/*
+ * Calcula el bloque de la tabla de inodos y el desplazamiento de un inodo
+ */
+static void ext2_inode_location(u32 inode_num, u32 *block, u32 *offset)
 {
     u32 group_num;
     u32 inode_index;
-    u32 inode_block;
-    u32 inode_offset;
     struct ext2_group_desc *group;
-    char *buffer;
-    
-    /* Verificar que el número de inodo sea válido */
-    if (inode_num == 0 || inode_num > ext2_fs.superblock.s_inodes_count) {
-        print("ext2   : ERROR - Invalid inode number ");
-        print_dec(inode_num);
-        print("\n");
-        return -1;
-    }
     
     /* Calcular el grupo y el índice del inodo */
     group_num = (inode_num - 1) / ext2_fs.superblock.s_inodes_per_group;
@@ -196,197 +436,1656 @@ int ext2_read_inode(u32 inode_num, struct ext2_inode *inode)
     group = &ext2_fs.group_desc[group_num];
     
     /* Calcular la posición del inodo */
-    inode_block = group->bg_inode_table + (inode_index * ext2_fs.inode_size) / ext2_fs.block_size;
-    inode_offset = (inode_index * ext2_fs.inode_size) % ext2_fs.block_size;
+    *block = group->bg_inode_table + (inode_index * ext2_fs.inode_size) / ext2_fs.block_size;
+    *offset = (inode_index * ext2_fs.inode_size) % ext2_fs.block_size;
+}
+
+/*
+ * Lee un inodo de la tabla de inodos del disco
+ */
+static int ext2_load_inode(u32 inode_num, struct ext2_inode *inode)
+{
+    u32 inode_block;
+    u32 inode_offset;
+    struct buf *bh;
+    char *data;
     
-    /* Leer el bloque que contiene el inodo */
-    buffer = (char *)kmalloc(ext2_fs.block_size);
-    if (buffer == NULL) {
-        print("ext2   : ERROR - Cannot allocate buffer for inode\n");
-        return -1;
-    }
+    ext2_inode_location(inode_num, &inode_block, &inode_offset);
     
-    if (ext2_read_block(inode_block, buffer) != 0) {
+    /* Leer el bloque que contiene el inodo */
+    data = ext2_get_block(inode_block, &bh);
+    if (data == NULL) {
         print("ext2   : ERROR - Cannot read inode block\n");
-        kfree(buffer);
         return -1;
     }
     
     /* Copiar el inodo */
-    memcpy(inode, buffer + inode_offset, sizeof(struct ext2_inode));
+    memcpy(inode, data + inode_offset, sizeof(struct ext2_inode));
     
-    kfree(buffer);
+    ext2_put_block(bh);
     return 0;
 }
 
 /*
- * Lee el contenido de un archivo
+ * Escribe un inodo en memoria en la tabla de inodos y lo marca limpio
  */
-int ext2_read_file(struct ext2_inode *inode, void *buffer, u32 size)
+int ext2_write_inode(struct ext2_inode_info *ei)
 {
-    u32 bytes_read = 0;
-    u32 block_num = 0;
-    u32 bytes_to_read;
-    char *file_buffer;
-    char *dest = (char *)buffer;
+    u32 inode_block;
+    u32 inode_offset;
+    struct buf *bh;
     
-    /* Verificar que sea un archivo regular */
-    if (!EXT2_S_ISREG(inode->i_mode)) {
-        print("ext2   : ERROR - Not a regular file\n");
+    ext2_inode_location(ei->ino, &inode_block, &inode_offset);
+    
+    bh = bread(ext2_fs.dev, inode_block, ext2_fs.block_size);
+    if (bh == NULL) {
+        print("ext2   : ERROR - Cannot read inode block\n");
         return -1;
     }
     
-    /* Limitar el tamaño a leer */
-    if (size > inode->i_size) {
-        size = inode->i_size;
-    }
+    memcpy(bh->data + inode_offset, &ei->raw, sizeof(struct ext2_inode));
     
-    /* Asignar buffer temporal */
-    file_buffer = (char *)kmalloc(ext2_fs.block_size);
-    if (file_buffer == NULL) {
-        print("ext2   : ERROR - Cannot allocate file buffer\n");
-        return -1;
+    /* Un inodo nuevo no hereda los campos extendidos (i_extra_isize y
+       siguientes) del anterior dueño del hueco */
+    if ((ei->flags & EXT2_I_NEW) && ext2_fs.inode_size > sizeof(struct ext2_inode)) {
+        memset(bh->data + inode_offset + sizeof(struct ext2_inode), 0,
+               ext2_fs.inode_size - sizeof(struct ext2_inode));
     }
+    ei->flags &= ~EXT2_I_NEW;
+    ext2_journal_dirty(bh);
     
-    /* Leer bloques directos */
-    while (bytes_read < size && block_num < 12) {
-        if (inode->i_block[block_num] == 0) {
-            break;
-        }
-        
-        if (ext2_read_block(inode->i_block[block_num], file_buffer) != 0) {
-            print("ext2   : ERROR - Cannot read file block\n");
-            kfree(file_buffer);
-            return -1;
-        }
-        
-        bytes_to_read = ext2_fs.block_size;
-        if (bytes_read + bytes_to_read > size) {
-            bytes_to_read = size - bytes_read;
-        }
-        
-        memcpy(dest + bytes_read, file_buffer, bytes_to_read);
-        bytes_read += bytes_to_read;
-        block_num++;
+    brelse(bh);
+    ei->flags &= ~EXT2_I_DIRTY;
+    return 0;
+}
+
+/* Caché de inodos en memoria: tabla hash por número de inodo y lista
+   LRU de los inodos sin referencias */
+static struct ext2_inode_info *icache_hash[EXT2_ICACHE_HASH_SIZE];
+static struct ext2_inode_info *icache_lru_head;    /* Más reciente */
+static struct ext2_inode_info *icache_lru_tail;
+static u32 icache_count = 0;
+
+static void icache_lru_unlink(struct ext2_inode_info *ei)
+{
+    if (ei->lru_prev) {
+        ei->lru_prev->lru_next = ei->lru_next;
+    } else if (icache_lru_head == ei) {
+        icache_lru_head = ei->lru_next;
+    }
+    if (ei->lru_next) {
+        ei->lru_next->lru_prev = ei->lru_prev;
+    } else if (icache_lru_tail == ei) {
+        icache_lru_tail = ei->lru_prev;
     }
+    ei->lru_prev = ei->lru_next = NULL;
+}
+
+/*
+ * Saca un inodo de la caché y libera su memoria
+ */
+static void icache_free(struct ext2_inode_info *ei)
+{
+    struct ext2_inode_info **p = &icache_hash[ei->ino % EXT2_ICACHE_HASH_SIZE];
     
-    kfree(file_buffer);
-    return bytes_read;
+    while (*p != ei) {
+        p = &(*p)->hash_next;
+    }
+    *p = ei->hash_next;
+    icache_lru_unlink(ei);
+    icache_count--;
+    ext2_rsv_release(ei);
+    pcache_release_inode(ei);
+    kfree(ei);
 }
 
 /*
- * Busca un archivo en el directorio raíz
+ * Libera inodos sin referencias, del menos reciente al más reciente,
+ * hasta volver a estar por debajo del límite. Los inodos sucios se
+ * conservan hasta que se escriban.
  */
-int ext2_find_file(const char *name, struct ext2_inode *inode)
+static void icache_shrink(u32 limit)
 {
-    struct ext2_inode root_inode;
-    char *buffer;
-    struct ext2_dir_entry *entry;
-    u32 offset = 0;
-    u32 name_len = strlen(name);
+    struct ext2_inode_info *ei = icache_lru_tail;
+    struct ext2_inode_info *prev;
     
-    /* Leer el inodo raíz */
-    if (ext2_read_inode(EXT2_ROOT_INODE, &root_inode) != 0) {
-        print("ext2   : ERROR - Cannot read root inode\n");
-        return -1;
+    while (ei != NULL && icache_count > limit) {
+        prev = ei->lru_prev;
+        if (!(ei->flags & EXT2_I_DIRTY)) {
+            icache_free(ei);
+        }
+        ei = prev;
     }
+}
+
+/*
+ * Devuelve el inodo en memoria con una referencia tomada, leyéndolo del
+ * disco si no está en caché. Se suelta con ext2_iput().
+ */
+struct ext2_inode_info *ext2_iget(u32 inode_num)
+{
+    struct ext2_inode_info *ei;
+    u32 bucket = inode_num % EXT2_ICACHE_HASH_SIZE;
     
-    /* Verificar que sea un directorio */
-    if (!EXT2_S_ISDIR(root_inode.i_mode)) {
-        print("ext2   : ERROR - Root is not a directory\n");
-        return -1;
+    /* Verificar que el número de inodo sea válido */
+    if (inode_num == 0 || inode_num > ext2_fs.superblock.s_inodes_count) {
+        print("ext2   : ERROR - Invalid inode number ");
+        print_dec(inode_num);
+        print("\n");
+        return NULL;
     }
     
-    /* Asignar buffer para el directorio */
-    buffer = (char *)kmalloc(ext2_fs.block_size);
-    if (buffer == NULL) {
-        print("ext2   : ERROR - Cannot allocate directory buffer\n");
-        return -1;
+    for (ei = icache_hash[bucket]; ei != NULL; ei = ei->hash_next) {
+        if (ei->ino == inode_num) {
+            if (ei->refcount++ == 0) {
+                icache_lru_unlink(ei);
+            }
+            return ei;
+        }
     }
     
-    /* Leer el primer bloque del directorio */
-    if (ext2_read_block(root_inode.i_block[0], buffer) != 0) {
-        print("ext2   : ERROR - Cannot read directory block\n");
-        kfree(buffer);
-        return -1;
+    icache_shrink(EXT2_ICACHE_MAX - 1);
+    
+    ei = (struct ext2_inode_info *)kmalloc(sizeof(struct ext2_inode_info));
+    if (ei == NULL) {
+        print("ext2   : ERROR - Cannot allocate in-core inode\n");
+        return NULL;
     }
     
-    /* Buscar el archivo */
-    while (offset < root_inode.i_size) {
-        entry = (struct ext2_dir_entry *)(buffer + offset);
-        
-        /* Verificar que la entrada sea válida */
-        if (entry->rec_len == 0) {
-            break;
-        }
-        
-        /* Comparar nombres */
-        if (entry->name_len == name_len && entry->inode != 0) {
-            if (memcmp(entry->name, name, name_len) == 0) {
-                /* Archivo encontrado, leer su inodo */
-                if (ext2_read_inode(entry->inode, inode) != 0) {
-                    print("ext2   : ERROR - Cannot read file inode\n");
-                    kfree(buffer);
-                    return -1;
-                }
-                kfree(buffer);
-                return 0;
-            }
-        }
-        
-        offset += entry->rec_len;
+    if (ext2_load_inode(inode_num, &ei->raw) != 0) {
+        kfree(ei);
+        return NULL;
     }
     
-    kfree(buffer);
-    return -1;  /* Archivo no encontrado */
+    ei->ino = inode_num;
+    ei->refcount = 1;
+    ei->flags = 0;
+    ei->rsv_start = ei->rsv_end = 0;
+    ei->rsv_next = NULL;
+    ei->da_head = ei->da_tail = NULL;
+    ei->da_count = 0;
+    ei->da_next = NULL;
+    ei->pc_root = NULL;
+    ei->pc_height = 0;
+    ei->pc_pages = 0;
+    ei->lru_prev = ei->lru_next = NULL;
+    ei->hash_next = icache_hash[bucket];
+    icache_hash[bucket] = ei;
+    icache_count++;
+    return ei;
 }
 
 /*
- * Lista el contenido de un directorio
+ * Suelta una referencia. Sin referencias, el inodo pasa a la cabeza de
+ * la LRU y puede liberarse si la caché supera su límite.
  */
-int ext2_list_dir(struct ext2_inode *dir_inode, void (*callback)(struct ext2_dir_entry *))
+void ext2_iput(struct ext2_inode_info *ei)
 {
-    char *buffer;
-    struct ext2_dir_entry *entry;
-    u32 offset = 0;
+    if (ei == NULL) {
+        return;
+    }
     
-    /* Verificar que sea un directorio */
-    if (!EXT2_S_ISDIR(dir_inode->i_mode)) {
-        print("ext2   : ERROR - Not a directory\n");
-        return -1;
+    if (ei->refcount == 0) {
+        print("ext2   : ERROR - iput on unreferenced inode\n");
+        return;
     }
     
-    /* Asignar buffer para el directorio */
-    buffer = (char *)kmalloc(ext2_fs.block_size);
-    if (buffer == NULL) {
-        print("ext2   : ERROR - Cannot allocate directory buffer\n");
-        return -1;
+    if (--ei->refcount > 0) {
+        return;
     }
     
-    /* Leer el primer bloque del directorio */
-    if (ext2_read_block(dir_inode->i_block[0], buffer) != 0) {
-        print("ext2   : ERROR - Cannot read directory block\n");
-        kfree(buffer);
-        return -1;
+    /* Sin usuarios el archivo no crece: se devuelve su ventana de
+       reserva (los bloques diferidos la usan hasta asignarse) */
+    if (ei->da_count == 0) {
+        ext2_rsv_release(ei);
     }
     
-    /* Recorrer las entradas */
-    while (offset < dir_inode->i_size) {
-        entry = (struct ext2_dir_entry *)(buffer + offset);
-        
-        /* Verificar que la entrada sea válida */
-        if (entry->rec_len == 0) {
-            break;
-        }
-        
-        /* Llamar al callback si la entrada es válida */
-        if (entry->inode != 0) {
-            callback(entry);
-        }
-        
-        offset += entry->rec_len;
+    /* Último usuario de un inodo ya sin nombre: liberar sus bloques y el
+       propio inodo */
+    if (ei->flags & EXT2_I_UNLINKED) {
+        ext2_delete_inode(ei);
+        icache_free(ei);
+        return;
     }
     
-    kfree(buffer);
+    ei->lru_prev = NULL;
+    ei->lru_next = icache_lru_head;
+    if (icache_lru_head) {
+        icache_lru_head->lru_prev = ei;
+    } else {
+        icache_lru_tail = ei;
+    }
+    icache_lru_head = ei;
+    
+    icache_shrink(EXT2_ICACHE_MAX);
+}
+
+/*
+ * Marca un inodo como modificado: no se libera hasta escribirlo
+ */
+void ext2_mark_inode_dirty(struct ext2_inode_info *ei)
+{
+    ei->flags |= EXT2_I_DIRTY;
+}
+
+/*
+ * Indica si algún inodo está en uso fuera del propio montaje (que
+ * retiene la raíz y el journal): referencias de archivos abiertos o de
+ * proyecciones, páginas mapeadas o escrituras diferidas pendientes
+ */
+static int ext2_icache_busy(void)
+{
+    struct ext2_inode_info *ei;
+    struct pcache_stats stats;
+    u32 held;
+    int i;
+    
+    pcache_get_stats(&stats);
+    if (stats.mapped > 0) {
+        return 1;
+    }
+    
+    for (i = 0; i < EXT2_ICACHE_HASH_SIZE; i++) {
+        for (ei = icache_hash[i]; ei != NULL; ei = ei->hash_next) {
+            held = 0;
+            if (ei == ext2_fs.root) {
+                held++;
+            }
+            if (ei == ext2_journal.inode) {
+                held++;
+            }
+            if (ei->refcount > held || ei->da_count > 0) {
+                return 1;
+            }
+        }
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Vacía la caché de inodos (al cambiar de sistema de archivos). Nadie
+ * debe estar usándolos: ver ext2_icache_busy()
+ */
+static void ext2_icache_clear(void)
+{
+    struct ext2_inode_info *ei;
+    struct ext2_inode_info *next;
+    int i;
+    
+    for (i = 0; i < EXT2_ICACHE_HASH_SIZE; i++) {
+        for (ei = icache_hash[i]; ei != NULL; ei = next) {
+            next = ei->hash_next;
+            ext2_rsv_release(ei);
+            pcache_release_inode(ei);
+            kfree(ei);
+        }
+        icache_hash[i] = NULL;
+    }
+    icache_lru_head = icache_lru_tail = NULL;
+    icache_count = 0;
+}
+
+/*
+ * Lee un inodo (a través de la caché de inodos)
+ */
+int ext2_read_inode(u32 inode_num, struct ext2_inode *inode)
+{
+    struct ext2_inode_info *ei = ext2_iget(inode_num);
+    
+    if (ei == NULL) {
+        return -1;
+    }
+    
+    /* La copia debe mapear los bloques aún sin asignar en el disco */
+    if (ei->da_count > 0) {
+        ext2_da_flush_inode(ei);
+    }
+    
+    memcpy(inode, &ei->raw, sizeof(struct ext2_inode));
+    ext2_iput(ei);
+    return 0;
+}
+
+/*
+ * Devuelve la entrada 'index' de un bloque de punteros (bloque
+ * indirecto), leído a través de la caché de bloques. Un bloque 0
+ * (hueco) da una entrada 0.
+ */
+static int ext2_indirect_entry(u32 block, u32 index, u32 *entry)
+{
+    struct buf *bh;
+    char *data;
+    
+    if (block == 0) {
+        *entry = 0;
+        return 0;
+    }
+    
+    data = ext2_get_block(block, &bh);
+    if (data == NULL) {
+        print("ext2   : ERROR - Cannot read indirect block\n");
+        return -1;
+    }
+    
+    *entry = ((u32 *)data)[index];
+    ext2_put_block(bh);
+    return 0;
+}
+
+/*
+ * Traduce un bloque lógico del archivo a su bloque físico recorriendo
+ * los punteros directos, indirectos, doble y triple indirectos.
+ * *pblock queda a 0 si el bloque no está asignado (hueco); entonces
+ * *span es el número de bloques desde 'lblock' que cubre el puntero a 0
+ * donde se detuvo el recorrido (todo el subárbol si es un bloque de
+ * punteros), que son hueco sin necesidad de mirarlos uno a uno.
+ */
+static int ext2_bmap_span(struct ext2_inode *inode, u32 lblock, u32 *pblock, u32 *span)
+{
+    u32 per_block = ext2_fs.block_size / 4;     /* Punteros por bloque */
+    u32 shift = 8 + ext2_fs.superblock.s_log_block_size;  /* log2(per_block) */
+    u32 mask = per_block - 1;
+    u32 block, level, covered;
+    
+    *span = 1;
+    if (lblock < EXT2_NDIR_BLOCKS) {
+        *pblock = inode->i_block[lblock];
+        return 0;
+    }
+    lblock -= EXT2_NDIR_BLOCKS;
+    
+    /* Niveles de bloques de punteros por debajo de i_block */
+    if (lblock < per_block) {
+        level = 1;
+        block = inode->i_block[EXT2_IND_BLOCK];
+    } else if ((lblock -= per_block) < (per_block << shift)) {
+        level = 2;
+        block = inode->i_block[EXT2_DIND_BLOCK];
+    } else {
+        lblock -= per_block << shift;
+        level = 3;
+        block = inode->i_block[EXT2_TIND_BLOCK];
+    }
+    
+    while (level > 0 && block != 0) {
+        level--;
+        if (ext2_indirect_entry(block, (lblock >> (level * shift)) & mask, &block) != 0) {
+            return -1;
+        }
+    }
+    
+    *pblock = block;
+    if (block == 0) {
+        covered = 1 << (level * shift);
+        *span = covered - (lblock & (covered - 1));
+    }
+    return 0;
+}
+
+int ext2_bmap(struct ext2_inode *inode, u32 lblock, u32 *pblock)
+{
+    u32 span;
+    
+    return ext2_bmap_span(inode, lblock, pblock, &span);
+}
+
+/*
+ * Lee 'bytes' de una racha de bloques contiguos en el disco que empieza
+ * en 'pblock'. Los bloques completos se leen con una sola petición
+ * directamente sobre el destino; solo un bloque final parcial pasa por
+ * la caché.
+ */
+static int ext2_read_run(u32 pblock, char *dest, u32 bytes)
+{
+    u32 sectors_per_block = ext2_fs.block_size / 512;
+    u32 full_blocks = bytes / ext2_fs.block_size;
+    u32 rest = bytes % ext2_fs.block_size;
+    struct buf *bh;
+    char *data;
+    
+    /* Dispositivo en memoria: copia directa de toda la racha */
+    data = (char *)blk_map(ext2_fs.dev, pblock * sectors_per_block,
+                           (full_blocks + (rest != 0)) * sectors_per_block);
+    if (data != NULL) {
+        memcpy(dest, data, bytes);
+        return 0;
+    }
+    
+    /* La lectura directa no ve los bloques modificados en la caché */
+    if (full_blocks > 0 &&
+        bcache_flush_range(ext2_fs.dev, pblock, full_blocks, ext2_fs.block_size) != 0) {
+        return -1;
+    }
+    
+    if (full_blocks > 0 &&
+        blk_read(ext2_fs.dev, pblock * sectors_per_block, full_blocks * sectors_per_block, dest) != 0) {
+        print("ext2   : ERROR - Cannot read file blocks\n");
+        return -1;
+    }
+    
+    if (rest != 0) {
+        data = ext2_get_block(pblock + full_blocks, &bh);
+        if (data == NULL) {
+            return -1;
+        }
+        memcpy(dest + full_blocks * ext2_fs.block_size, data, rest);
+        ext2_put_block(bh);
+    }
+    
+    return 0;
+}
+
+/*
+ * Lee 'size' bytes desde el principio del bloque lógico 'lblock'. Los
+ * bloques se agrupan en rachas físicamente contiguas y cada racha se lee
+ * con una petición multisector directamente sobre el destino. Los
+ * huecos se sirven a ceros sin tocar el disco; si se pasa 'ei', los
+ * bloques diferidos que caen en un hueco se copian de memoria.
+ */
+static int ext2_read_blocks(struct ext2_inode_info *ei, struct ext2_inode *inode,
+                            u32 lblock, char *dest, u32 size)
+{
+    u32 bytes_read = 0;
+    u32 pblock, next, span;
+    u32 run, run_bytes;
+    char *data;
+    
+    while (bytes_read < size) {
+        if (ext2_bmap_span(inode, lblock, &pblock, &span) != 0) {
+            return -1;
+        }
+        
+        if (pblock == 0) {
+            /* Un bloque diferido dentro del hueco lo acorta */
+            data = NULL;
+            if (ei != NULL) {
+                data = ext2_da_lookup(ei, lblock);
+                next = ext2_da_next(ei, lblock);
+                if (next - lblock < span) {
+                    span = next - lblock;
+                }
+            }
+            
+            if (data != NULL) {
+                run_bytes = ext2_fs.block_size;
+            } else if (span > (size - bytes_read) / ext2_fs.block_size) {
+                run_bytes = size - bytes_read;
+            } else {
+                run_bytes = span * ext2_fs.block_size;
+            }
+            if (run_bytes > size - bytes_read) {
+                run_bytes = size - bytes_read;
+            }
+            
+            if (data != NULL) {
+                memcpy(dest + bytes_read, data, run_bytes);
+                lblock++;
+            } else {
+                memset(dest + bytes_read, 0, run_bytes);
+                lblock += span;
+            }
+            bytes_read += run_bytes;
+            continue;
+        }
+        
+        /* Extender la racha mientras los bloques sigan contiguos */
+        run = 1;
+        while (run < EXT2_MAX_RUN_BLOCKS && bytes_read + run * ext2_fs.block_size < size) {
+            if (ext2_bmap(inode, lblock + run, &next) != 0) {
+                return -1;
+            }
+            if (next != pblock + run) {
+                break;
+            }
+            run++;
+        }
+        
+        run_bytes = run * ext2_fs.block_size;
+        if (run_bytes > size - bytes_read) {
+            run_bytes = size - bytes_read;
+        }
+        
+        if (ext2_read_run(pblock, dest + bytes_read, run_bytes) != 0) {
+            return -1;
+        }
+        
+        bytes_read += run_bytes;
+        lblock += run;
+    }
+    
+    return bytes_read;
+}
+
+/*
+ * Lee el contenido de un archivo desde el principio
+ */
+int ext2_read_file(struct ext2_inode *inode, void *buffer, u32 size)
+{
+    /* Verificar que sea un archivo regular */
+    if (!EXT2_S_ISREG(inode->i_mode)) {
+        print("ext2   : ERROR - Not a regular file\n");
+        return -1;
+    }
+    
+    /* Limitar el tamaño a leer */
+    if (size > inode->i_size) {
+        size = inode->i_size;
+    }
+    
+    return ext2_read_blocks(NULL, inode, 0, (char *)buffer, size);
+}
+
+/*
+ * Lee 'len' bytes de un archivo a partir de 'offset', sin usar ni mover
+ * ninguna posición. Solo el bloque inicial parcial pasa por la caché;
+ * desde el primer límite de bloque, los bloques completos se leen
+ * directamente sobre el destino (y el parcial final, otra vez por la
+ * caché). Los huecos se leen a ceros. Devuelve los bytes leídos; menos
+ * de 'len' si se llega al final del archivo.
+ */
+int ext2_pread(struct ext2_inode_info *ei, u32 offset, void *buffer, u32 len)
+{
+    struct ext2_inode *inode = &ei->raw;
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 lblock = offset >> shift;
+    u32 head = offset & (ext2_fs.block_size - 1);
+    u32 chunk, pblock;
+    struct buf *bh;
+    char *data;
+    char *dest = (char *)buffer;
+    int n;
+    
+    if (!EXT2_S_ISREG(inode->i_mode)) {
+        print("ext2   : ERROR - Not a regular file\n");
+        return -1;
+    }
+    
+    if (offset >= inode->i_size) {
+        return 0;
+    }
+    if (len > inode->i_size - offset) {
+        len = inode->i_size - offset;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    
+    /* Bloque inicial parcial */
+    chunk = 0;
+    if (head != 0) {
+        if (ext2_bmap(inode, lblock, &pblock) != 0) {
+            return -1;
+        }
+        
+        bh = NULL;
+        if (pblock != 0) {
+            data = ext2_get_block(pblock, &bh);
+            if (data == NULL) {
+                return -1;
+            }
+        } else {
+            data = ext2_da_lookup(ei, lblock);
+        }
+        
+        chunk = ext2_fs.block_size - head;
+        if (chunk > len) {
+            chunk = len;
+        }
+        if (data != NULL) {
+            memcpy(dest, data + head, chunk);
+        } else {
+            memset(dest, 0, chunk);
+        }
+        ext2_put_block(bh);
+        lblock++;
+    }
+    
+    n = ext2_read_blocks(ei, inode, lblock, dest + chunk, len - chunk);
+    if (n < 0) {
+        return -1;
+    }
+    return chunk + n;
+}
+
+/*
+ * Lectura directa (EXT2_O_DIRECT): 'offset', 'buffer' y 'len' deben ser
+ * múltiplos del sector. Los sectores van del disco al destino en
+ * rachas contiguas, sin copias intermedias y sin dejar nada en la caché
+ * de bloques ni en la de páginas; solo los bloques de punteros pasan
+ * por la caché. El último sector del archivo se lee entero, así que
+ * 'buffer' puede quedar escrito más allá de lo devuelto (hasta 'len').
+ * Los discos escriben por DMA en la dirección física del destino, así
+ * que 'buffer' debe ser memoria del kernel con identity mapping (nunca
+ * de usuario). Devuelve -1 si la petición no está alineada o el destino
+ * no vale; ext2_read() la sirve entonces por la caché.
+ */
+int ext2_read_direct(struct ext2_inode_info *ei, u32 offset, void *buffer, u32 len)
+{
+    struct ext2_inode *inode = &ei->raw;
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 sectors_per_block = ext2_fs.block_size / BLK_SECTOR_SIZE;
+    u32 done = 0;
+    u32 total, pos, lblock, skip;
+    u32 pblock, next, span, run, chunk;
+    char *dest = (char *)buffer;
+    char *data;
+    
+    if (((u32)buffer | offset | len) & (BLK_SECTOR_SIZE - 1)) {
+        return -1;
+    }
+    if ((u32)buffer + len < (u32)buffer || (u32)buffer + len > mm_mapped_end) {
+        return -1;
+    }
+    
+    if (!EXT2_S_ISREG(inode->i_mode)) {
+        print("ext2   : ERROR - Not a regular file\n");
+        return -1;
+    }
+    
+    if (offset >= inode->i_size) {
+        return 0;
+    }
+    total = inode->i_size - offset;
+    if (total > len) {
+        total = len;
+    }
+    
+    /* 'len' es múltiplo del sector: redondear no se sale del destino */
+    len = (total + BLK_SECTOR_SIZE - 1) & ~(BLK_SECTOR_SIZE - 1);
+    
+    while (done < len) {
+        pos = offset + done;
+        lblock = pos >> shift;
+        skip = (pos & (ext2_fs.block_size - 1)) / BLK_SECTOR_SIZE;
+        
+        if (ext2_bmap_span(inode, lblock, &pblock, &span) != 0) {
+            return -1;
+        }
+        
+        if (pblock == 0) {
+            /* Hueco: ceros, salvo los bloques diferidos aún en memoria */
+            data = ext2_da_lookup(ei, lblock);
+            next = ext2_da_next(ei, lblock);
+            if (next - lblock < span) {
+                span = next - lblock;
+            }
+            if (data != NULL) {
+                span = 1;
+            }
+            
+            chunk = len - done;
+            if (span <= chunk / ext2_fs.block_size) {
+                chunk = span * ext2_fs.block_size - skip * BLK_SECTOR_SIZE;
+            }
+            if (chunk > len - done) {
+                chunk = len - done;
+            }
+            
+            if (data != NULL) {
+                memcpy(dest + done, data + skip * BLK_SECTOR_SIZE, chunk);
+            } else {
+                memset(dest + done, 0, chunk);
+            }
+            done += chunk;
+            continue;
+        }
+        
+        /* Extender la racha mientras los bloques sigan contiguos */
+        run = 1;
+        while (run < EXT2_MAX_RUN_BLOCKS &&
+               run * ext2_fs.block_size - skip * BLK_SECTOR_SIZE < len - done) {
+            if (ext2_bmap(inode, lblock + run, &next) != 0) {
+                return -1;
+            }
+            if (next != pblock + run) {
+                break;
+            }
+            run++;
+        }
+        
+        chunk = run * ext2_fs.block_size - skip * BLK_SECTOR_SIZE;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+        
+        /* Los bloques sucios en la caché van antes al disco */
+        if (bcache_flush_range(ext2_fs.dev, pblock, run, ext2_fs.block_size) != 0) {
+            return -1;
+        }
+        
+        data = (char *)blk_map(ext2_fs.dev, pblock * sectors_per_block + skip,
+                               chunk / BLK_SECTOR_SIZE);
+        if (data != NULL) {
+            memcpy(dest + done, data, chunk);
+        } else {
+            if (blk_read(ext2_fs.dev, pblock * sectors_per_block + skip,
+                         chunk / BLK_SECTOR_SIZE, dest + done) != 0) {
+                print("ext2   : ERROR - Cannot read file blocks\n");
+                return -1;
+            }
+        }
+        done += chunk;
+    }
+    
+    return total;
+}
+
+/*
+ * Busca desde 'offset' el siguiente byte con datos (EXT2_SEEK_DATA) o
+ * el siguiente hueco (EXT2_SEEK_HOLE), a la manera de lseek(). Un puntero
+ * a 0 en un bloque de punteros salta todo su subárbol; los bloques
+ * diferidos cuentan como datos. El final del archivo es un hueco
+ * implícito. Devuelve -1 si 'offset' está más allá del final o si no hay
+ * más datos.
+ */
+int ext2_seek_data(struct ext2_inode_info *ei, u32 offset, int whence, u32 *result)
+{
+    struct ext2_inode *inode = &ei->raw;
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 nr_blocks = (inode->i_size + ext2_fs.block_size - 1) >> shift;
+    u32 lblock = offset >> shift;
+    u32 pblock, span, next;
+    int is_data;
+    
+    if (offset >= inode->i_size || (whence != EXT2_SEEK_DATA && whence != EXT2_SEEK_HOLE)) {
+        return -1;
+    }
+    
+    while (lblock < nr_blocks) {
+        if (ext2_bmap_span(inode, lblock, &pblock, &span) != 0) {
+            return -1;
+        }
+        
+        is_data = pblock != 0;
+        if (!is_data && ei->da_count > 0) {
+            next = ext2_da_next(ei, lblock);
+            is_data = next == lblock;
+            if (next - lblock < span) {
+                span = next - lblock;
+            }
+        }
+        
+        if (is_data == (whence == EXT2_SEEK_DATA)) {
+            *result = lblock << shift;
+            if (*result < offset) {
+                *result = offset;
+            }
+            return 0;
+        }
+        lblock += is_data ? 1 : span;
+    }
+    
+    if (whence == EXT2_SEEK_DATA) {
+        return -1;
+    }
+    *result = inode->i_size;
+    return 0;
+}
+
+/*
+ * Recorre las entradas en uso de un bloque lógico de un directorio.
+ * El recorrido se detiene cuando 'actor' devuelve distinto de 0, y ese
+ * valor es el resultado; -1 si hay un error de lectura.
+ */
+int ext2_dir_scan_block(struct ext2_inode *dir_inode, u32 lblock,
+                        int (*actor)(struct ext2_dir_entry *entry, void *arg), void *arg)
+{
+    u32 pblock, offset;
+    struct ext2_dir_entry *entry;
+    struct buf *bh;
+    char *data;
+    int ret = 0;
+    
+    if (ext2_bmap(dir_inode, lblock, &pblock) != 0) {
+        return -1;
+    }
+    if (pblock == 0) {
+        return 0;
+    }
+    
+    data = ext2_get_block(pblock, &bh);
+    if (data == NULL) {
+        print("ext2   : ERROR - Cannot read directory block\n");
+        return -1;
+    }
+    
+    for (offset = 0; offset < ext2_fs.block_size && ret == 0; offset += entry->rec_len) {
+        entry = (struct ext2_dir_entry *)(data + offset);
+        
+        /* Entrada corrupta: saltar el resto del bloque */
+        if (entry->rec_len < 8 || offset + entry->rec_len > ext2_fs.block_size) {
+            break;
+        }
+        
+        if (entry->inode != 0) {
+            ret = actor(entry, arg);
+        }
+    }
+    
+    ext2_put_block(bh);
+    return ret;
+}
+
+/*
+ * Recorre todas las entradas en uso de un directorio, bloque a bloque
+ */
+static int ext2_dir_iterate(struct ext2_inode *dir_inode,
+                            int (*actor)(struct ext2_dir_entry *entry, void *arg), void *arg)
+{
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 nr_blocks = (dir_inode->i_size + ext2_fs.block_size - 1) >> shift;
+    u32 lblock;
+    int ret = 0;
+    
+    for (lblock = 0; lblock < nr_blocks && ret == 0; lblock++) {
+        ret = ext2_dir_scan_block(dir_inode, lblock, actor, arg);
+    }
+    
+    return ret;
+}
+
+int ext2_match_actor(struct ext2_dir_entry *entry, void *arg)
+{
+    struct ext2_match *m = (struct ext2_match *)arg;
+    
+    if (entry->name_len == m->len && memcmp(entry->name, m->name, m->len) == 0) {
+        m->ino = entry->inode;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Busca un nombre en un directorio: por su índice htree si lo tiene y,
+ * si no, recorriendo sus bloques. Deja en *ino el número de inodo o 0
+ * si no existe; devuelve -1 si hay un error.
+ */
+static int ext2_dir_find(struct ext2_inode *dir_inode, const char *name, u32 len, u32 *ino)
+{
+    struct ext2_match m;
+    int ret;
+    
+    if (ext2_fs.use_htree && (dir_inode->i_flags & EXT2_INDEX_FL)) {
+        ret = ext2_htree_find(dir_inode, name, len, ino);
+        if (ret <= 0) {
+            return ret;
+        }
+        /* Índice no soportado: búsqueda lineal */
+    }
+    
+    m.name = name;
+    m.len = len;
+    m.ino = 0;
+    
+    ret = ext2_dir_iterate(dir_inode, ext2_match_actor, &m);
+    if (ret < 0) {
+        return -1;
+    }
+    
+    *ino = m.ino;
+    return 0;
+}
+
+/* Caché de entradas de directorio: (inodo padre, nombre) -> inodo.
+   Un inodo 0 es una entrada negativa (el nombre no existe) */
+static struct ext2_dentry *dcache_hash[EXT2_DCACHE_HASH_SIZE];
+static struct ext2_dentry *dcache_lru_head;    /* Más reciente */
+static struct ext2_dentry *dcache_lru_tail;
+static u32 dcache_count = 0;
+
+static u32 ext2_dcache_hashfn(u32 parent, const char *name, u32 len)
+{
+    u32 h = parent * 31;
+    u32 i;
+    
+    for (i = 0; i < len; i++) {
+        h = (h << 5) + h + (u8)name[i];
+    }
+    return h;
+}
+
+static void dcache_lru_unlink(struct ext2_dentry *de)
+{
+    if (de->lru_prev) {
+        de->lru_prev->lru_next = de->lru_next;
+    } else {
+        dcache_lru_head = de->lru_next;
+    }
+    if (de->lru_next) {
+        de->lru_next->lru_prev = de->lru_prev;
+    } else {
+        dcache_lru_tail = de->lru_prev;
+    }
+}
+
+static void dcache_lru_push_head(struct ext2_dentry *de)
+{
+    de->lru_prev = NULL;
+    de->lru_next = dcache_lru_head;
+    if (dcache_lru_head) {
+        dcache_lru_head->lru_prev = de;
+    } else {
+        dcache_lru_tail = de;
+    }
+    dcache_lru_head = de;
+}
+
+static void dcache_free(struct ext2_dentry *de)
+{
+    struct ext2_dentry **p = &dcache_hash[de->hash % EXT2_DCACHE_HASH_SIZE];
+    
+    while (*p != de) {
+        p = &(*p)->hash_next;
+    }
+    *p = de->hash_next;
+    dcache_lru_unlink(de);
+    dcache_count--;
+    kfree(de);
+}
+
+static struct ext2_dentry *ext2_dcache_find(u32 parent, const char *name, u32 len, u32 hash)
+{
+    struct ext2_dentry *de;
+    
+    for (de = dcache_hash[hash % EXT2_DCACHE_HASH_SIZE]; de != NULL; de = de->hash_next) {
+        if (de->hash == hash && de->parent == parent && de->name_len == len &&
+            memcmp(de->name, name, len) == 0) {
+            return de;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Añade (o actualiza) una entrada de la caché. Los nombres largos no se
+ * guardan.
+ */
+static void ext2_dcache_add(u32 parent, const char *name, u32 len, u32 ino)
+{
+    u32 hash = ext2_dcache_hashfn(parent, name, len);
+    struct ext2_dentry *de;
+    
+    if (len > EXT2_DCACHE_NAME_LEN) {
+        return;
+    }
+    
+    de = ext2_dcache_find(parent, name, len, hash);
+    if (de != NULL) {
+        de->ino = ino;
+        return;
+    }
+    
+    if (dcache_count >= EXT2_DCACHE_MAX) {
+        dcache_free(dcache_lru_tail);
+    }
+    
+    de = (struct ext2_dentry *)kmalloc(sizeof(struct ext2_dentry));
+    if (de == NULL) {
+        return;
+    }
+    
+    de->parent = parent;
+    de->ino = ino;
+    de->hash = hash;
+    de->name_len = len;
+    memcpy(de->name, name, len);
+    de->hash_next = dcache_hash[hash % EXT2_DCACHE_HASH_SIZE];
+    dcache_hash[hash % EXT2_DCACHE_HASH_SIZE] = de;
+    dcache_lru_push_head(de);
+    dcache_count++;
+}
+
+/*
+ * Olvida una entrada (al crear o borrar el nombre en el disco)
+ */
+void ext2_dcache_invalidate(u32 parent, const char *name, u32 len)
+{
+    struct ext2_dentry *de;
+    
+    if (len > EXT2_DCACHE_NAME_LEN) {
+        return;
+    }
+    
+    de = ext2_dcache_find(parent, name, len, ext2_dcache_hashfn(parent, name, len));
+    if (de != NULL) {
+        dcache_free(de);
+    }
+}
+
+static void ext2_dcache_clear(void)
+{
+    while (dcache_lru_head != NULL) {
+        dcache_free(dcache_lru_head);
+    }
+}
+
+/*
+ * Resuelve un nombre dentro de un directorio, primero en la caché de
+ * entradas y si no recorriendo el directorio. Devuelve el inodo, 0 si
+ * no existe o -1 si hay un error.
+ */
+static int ext2_lookup_in(u32 parent, const char *name, u32 len, u32 *ino)
+{
+    struct ext2_inode_info *dir;
+    struct ext2_dentry *de;
+    int ret;
+    
+    if (len <= EXT2_DCACHE_NAME_LEN) {
+        de = ext2_dcache_find(parent, name, len, ext2_dcache_hashfn(parent, name, len));
+        if (de != NULL) {
+            ext2_fs.dcache_hits++;
+            dcache_lru_unlink(de);
+            dcache_lru_push_head(de);
+            *ino = de->ino;
+            return 0;
+        }
+    }
+    ext2_fs.dcache_misses++;
+    
+    dir = ext2_iget(parent);
+    if (dir == NULL) {
+        return -1;
+    }
+    
+    if (!EXT2_S_ISDIR(dir->raw.i_mode)) {
+        ext2_iput(dir);
+        *ino = 0;
+        return 0;
+    }
+    
+    ret = ext2_dir_find(&dir->raw, name, len, ino);
+    ext2_iput(dir);
+    
+    if (ret == 0) {
+        ext2_dcache_add(parent, name, len, *ino);
+    }
+    return ret;
+}
+
+/*
+ * Resuelve una ruta ("/etc/motd", "bin/hello") desde el directorio
+ * raíz. Devuelve su número de inodo o 0 si no existe.
+ */
+u32 ext2_lookup(const char *path)
+{
+    u32 ino = EXT2_ROOT_INODE;
+    u32 len;
+    
+    while (*path != '\0') {
+        /* Saltar separadores repetidos */
+        while (*path == '/') {
+            path++;
+        }
+        if (*path == '\0') {
+            break;
+        }
+        
+        for (len = 0; path[len] != '\0' && path[len] != '/'; len++)
+            ;
+        if (len > EXT2_NAME_LEN) {
+            return 0;
+        }
+        
+        if (ext2_lookup_in(ino, path, len, &ino) != 0 || ino == 0) {
+            return 0;
+        }
+        path += len;
+    }
+    
+    return ino;
+}
+
+/*
+ * Busca un archivo por su ruta desde el directorio raíz
+ */
+int ext2_find_file(const char *name, struct ext2_inode *inode)
+{
+    u32 ino = ext2_lookup(name);
+    
+    if (ino == 0) {
+        return -1;  /* El archivo no se encontró */
+    }
+    
+    if (ext2_read_inode(ino, inode) != 0) {
+        print("ext2   : ERROR - Cannot read file inode\n");
+        return -1;
+    }
+    
+    return 0;
+}
+
+/*
+ * Abre un archivo: toma una referencia a su inodo e inicializa la
+ * posición y el estado de lectura anticipada
+ */
+int ext2_open(const char *name, struct ext2_file *file)
+{
+    u32 ino = ext2_lookup(name);
+    
+    if (ino == 0) {
+        return -1;
+    }
+    
+    file->inode = ext2_iget(ino);
+    if (file->inode == NULL) {
+        return -1;
+    }
+    
+    file->pos = 0;
+    file->ra_pos = 0;
+    file->ra_next = 0;
+    file->ra_window = 0;
+    file->ra_end = 0;
+    file->flags = 0;
+    return 0;
+}
+
+void ext2_close(struct ext2_file *file)
+{
+    ext2_iput(file->inode);
+    file->inode = NULL;
+}
+
+/*
+ * Lectura anticipada antes de servir los bloques [first, last]. Si la
+ * lectura empieza donde acabó la anterior, la ventana se duplica cada
+ * vez que se entra en bloques nuevos (hasta EXT2_RA_MAX_BLOCKS); si
+ * salta, se reduce a la mitad y con menos de EXT2_RA_MIN_BLOCKS se
+ * desactiva. Los bloques de la ventana que aún no se han pedido se
+ * envían como lecturas asíncronas a la caché.
+ */
+static void ext2_readahead(struct ext2_file *file, u32 first, u32 last, u32 end_pos)
+{
+    struct ext2_inode *inode = &file->inode->raw;
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 nr_blocks = (inode->i_size + ext2_fs.block_size - 1) >> shift;
+    u32 start, end, lblock, pblock;
+    
+    if (file->pos == file->ra_pos) {
+        if (file->ra_window == 0) {
+            file->ra_window = EXT2_RA_MIN_BLOCKS;
+        } else if (first >= file->ra_next && file->ra_window < EXT2_RA_MAX_BLOCKS) {
+            file->ra_window <<= 1;
+        }
+    } else {
+        file->ra_window >>= 1;
+        if (file->ra_window < EXT2_RA_MIN_BLOCKS) {
+            file->ra_window = 0;
+        }
+        file->ra_end = first;
+    }
+    file->ra_pos = end_pos;
+    file->ra_next = last + 1;
+    
+    /* En dispositivos en memoria no hay nada que adelantar */
+    if (file->ra_window == 0 || blk_map(ext2_fs.dev, 0, 1) != NULL) {
+        return;
+    }
+    
+    /* Pedir también los bloques que se van a leer ahora, para que vayan
+       en la misma tanda que los anticipados */
+    start = file->ra_end > first ? file->ra_end : first;
+    end = last + 1 + file->ra_window;
+    if (end > nr_blocks) {
+        end = nr_blocks;
+    }
+    
+    for (lblock = start; lblock < end; lblock++) {
+        if (ext2_bmap(inode, lblock, &pblock) != 0) {
+            break;
+        }
+        if (pblock == 0) {
+            continue;       /* Hueco: se leerá a ceros */
+        }
+        if (bcache_prefetch(ext2_fs.dev, pblock, ext2_fs.block_size) != 0) {
+            break;
+        }
+    }
+    file->ra_end = lblock;
+    
+    blk_unplug(ext2_fs.dev);
+}
+
+/*
+ * Lee desde la posición actual de un archivo abierto y la avanza. Los
+ * bloques se sirven desde la caché, que la lectura anticipada mantiene
+ * por delante del consumidor en accesos secuenciales.
+ */
+int ext2_read(struct ext2_file *file, void *buffer, u32 size)
+{
+    struct ext2_inode *inode = &file->inode->raw;
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 bytes_read = 0;
+    u32 lblock, pblock, offset, chunk;
+    struct buf *bh;
+    char *data;
+    char *dest = (char *)buffer;
+    int n;
+    
+    if (!EXT2_S_ISREG(inode->i_mode)) {
+        print("ext2   : ERROR - Not a regular file\n");
+        return -1;
+    }
+    
+    /* Modo directo: nada de lectura anticipada ni de caché si la
+       petición está alineada; si no, se sirve por el camino normal */
+    if ((file->flags & EXT2_O_DIRECT) &&
+        (n = ext2_read_direct(file->inode, file->pos, buffer, size)) >= 0) {
+        file->pos += n;
+        return n;
+    }
+    
+    if (file->pos >= inode->i_size) {
+        return 0;
+    }
+    if (size > inode->i_size - file->pos) {
+        size = inode->i_size - file->pos;
+    }
+    if (size == 0) {
+        return 0;
+    }
+    
+    ext2_readahead(file, file->pos >> shift, (file->pos + size - 1) >> shift, file->pos + size);
+    
+    /* Acceso aleatorio sin lectura anticipada: los bloques completos se
+       leen directamente sobre el destino en lugar de pasar por la caché */
+    if (file->ra_window == 0 && size >= ext2_fs.block_size) {
+        n = ext2_pread(file->inode, file->pos, buffer, size);
+        if (n > 0) {
+            file->pos += n;
+        }
+        return n;
+    }
+    
+    while (bytes_read < size) {
+        lblock = file->pos >> shift;
+        offset = file->pos & (ext2_fs.block_size - 1);
+        
+        if (ext2_bmap(inode, lblock, &pblock) != 0) {
+            return -1;
+        }
+        
+        /* Un hueco puede tener datos escritos aún sin asignar */
+        bh = NULL;
+        if (pblock != 0) {
+            data = ext2_get_block(pblock, &bh);
+            if (data == NULL) {
+                return -1;
+            }
+        } else {
+            data = ext2_da_lookup(file->inode, lblock);
+        }
+        
+        chunk = ext2_fs.block_size - offset;
+        if (chunk > size - bytes_read) {
+            chunk = size - bytes_read;
+        }
+        
+        /* Hueco sin datos diferidos: se lee a ceros */
+        if (data != NULL) {
+            memcpy(dest + bytes_read, data + offset, chunk);
+        } else {
+            memset(dest + bytes_read, 0, chunk);
+        }
+        ext2_put_block(bh);
+        
+        bytes_read += chunk;
+        file->pos += chunk;
+    }
+    
+    return bytes_read;
+}
+
+/* Adaptador para el callback de ext2_list_dir() */
+static int ext2_list_actor(struct ext2_dir_entry *entry, void *arg)
+{
+    void (*callback)(struct ext2_dir_entry *) = (void (*)(struct ext2_dir_entry *))arg;
+    
+    callback(entry);
+    return 0;
+}
+
+/*
+ * Lista el contenido de un directorio
+ */
+int ext2_list_dir(struct ext2_inode *dir_inode, void (*callback)(struct ext2_dir_entry *))
+{
+    /* Verificar que sea un directorio */
+    if (!EXT2_S_ISDIR(dir_inode->i_mode)) {
+        print("ext2   : ERROR - Not a directory\n");
+        return -1;
+    }
+    
+    if (ext2_dir_iterate(dir_inode, ext2_list_actor, (void *)callback) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Estado de un listado con atributos: la tanda de entradas en curso */
+struct ext2_readdirplus_state {
+    struct ext2_dirent_plus *batch;
+    struct ext2_dirent_plus **sorted;
+    u32 count;
+    void (*callback)(struct ext2_dirent_plus *);
+};
+
+/* Ordena por bloque de la tabla de inodos (Shell sort, como la caché) */
+static void ext2_readdirplus_sort(struct ext2_dirent_plus **v, u32 n)
+{
+    u32 gap, i, j;
+    struct ext2_dirent_plus *t;
+    
+    for (gap = n / 2; gap > 0; gap /= 2) {
+        for (i = gap; i < n; i++) {
+            t = v[i];
+            for (j = i; j >= gap && v[j - gap]->block > t->block; j -= gap) {
+                v[j] = v[j - gap];
+            }
+            v[j] = t;
+        }
+    }
+}
+
+/*
+ * Rellena los inodos de la tanda y la entrega en el orden del
+ * directorio. Los inodos en la caché de inodos se copian de allí; el
+ * resto se ordena por bloque de la tabla de inodos, los bloques
+ * distintos se piden todos juntos y cada uno se lee una sola vez.
+ */
+static int ext2_readdirplus_flush(struct ext2_readdirplus_state *st)
+{
+    struct ext2_dirent_plus *p;
+    struct ext2_inode_info *ei;
+    struct buf *bh;
+    char *data;
+    u32 i, block;
+    
+    for (i = 0; i < st->count; i++) {
+        p = &st->batch[i];
+        st->sorted[i] = p;
+        p->block = 0;
+        
+        if (p->ino == 0 || p->ino > ext2_fs.superblock.s_inodes_count) {
+            memset(&p->inode, 0, sizeof(struct ext2_inode));
+            continue;
+        }
+        
+        for (ei = icache_hash[p->ino % EXT2_ICACHE_HASH_SIZE]; ei != NULL; ei = ei->hash_next) {
+            if (ei->ino == p->ino) {
+                break;
+            }
+        }
+        if (ei != NULL) {
+            memcpy(&p->inode, &ei->raw, sizeof(struct ext2_inode));
+        } else {
+            ext2_inode_location(p->ino, &p->block, &p->offset);
+        }
+    }
+    
+    ext2_readdirplus_sort(st->sorted, st->count);
+    
+    /* Pedir los bloques distintos en orden (salvo en memoria) */
+    if (blk_map(ext2_fs.dev, 0, 1) == NULL) {
+        for (i = 0; i < st->count; i++) {
+            block = st->sorted[i]->block;
+            if (block == 0 || (i > 0 && st->sorted[i - 1]->block == block)) {
+                continue;
+            }
+            if (bcache_prefetch(ext2_fs.dev, block, ext2_fs.block_size) != 0) {
+                break;
+            }
+        }
+        blk_unplug(ext2_fs.dev);
+    }
+    
+    /* Un bloque por grupo de entradas consecutivas en el orden */
+    i = 0;
+    while (i < st->count) {
+        block = st->sorted[i]->block;
+        if (block == 0) {
+            i++;
+            continue;
+        }
+        
+        data = ext2_get_block(block, &bh);
+        if (data == NULL) {
+            print("ext2   : ERROR - Cannot read inode block\n");
+            return -1;
+        }
+        for (; i < st->count && st->sorted[i]->block == block; i++) {
+            p = st->sorted[i];
+            memcpy(&p->inode, data + p->offset, sizeof(struct ext2_inode));
+        }
+        ext2_put_block(bh);
+    }
+    
+    for (i = 0; i < st->count; i++) {
+        st->callback(&st->batch[i]);
+    }
+    st->count = 0;
+    return 0;
+}
+
+static int ext2_readdirplus_actor(struct ext2_dir_entry *entry, void *arg)
+{
+    struct ext2_readdirplus_state *st = (struct ext2_readdirplus_state *)arg;
+    struct ext2_dirent_plus *p = &st->batch[st->count++];
+    
+    p->ino = entry->inode;
+    p->file_type = entry->file_type;
+    p->name_len = entry->name_len;
+    memcpy(p->name, entry->name, entry->name_len);
+    p->name[entry->name_len] = '\0';
+    
+    if (st->count == EXT2_READDIRPLUS_BATCH) {
+        return ext2_readdirplus_flush(st);
+    }
+    return 0;
+}
+
+/*
+ * Lista un directorio junto con los atributos de cada inodo. Las
+ * entradas se agrupan en tandas de EXT2_READDIRPLUS_BATCH para que los
+ * inodos que comparten bloque en la tabla cuesten una sola lectura.
+ */
+int ext2_readdirplus(struct ext2_inode *dir_inode, void (*callback)(struct ext2_dirent_plus *))
+{
+    struct ext2_readdirplus_state st;
+    int ret;
+    
+    if (!EXT2_S_ISDIR(dir_inode->i_mode)) {
+        print("ext2   : ERROR - Not a directory\n");
+        return -1;
+    }
+    
+    st.batch = (struct ext2_dirent_plus *)kmalloc(EXT2_READDIRPLUS_BATCH * sizeof(struct ext2_dirent_plus));
+    st.sorted = (struct ext2_dirent_plus **)kmalloc(EXT2_READDIRPLUS_BATCH * sizeof(struct ext2_dirent_plus *));
+    if (st.batch == NULL || st.sorted == NULL) {
+        print("ext2   : ERROR - Cannot allocate directory listing buffer\n");
+        if (st.batch != NULL) {
+            kfree(st.batch);
+        }
+        if (st.sorted != NULL) {
+            kfree(st.sorted);
+        }
+        return -1;
+    }
+    st.count = 0;
+    st.callback = callback;
+    
+    ret = ext2_dir_iterate(dir_inode, ext2_readdirplus_actor, &st);
+    if (ret == 0 && st.count > 0) {
+        ret = ext2_readdirplus_flush(&st);
+    }
+    
+    kfree(st.sorted);
+    kfree(st.batch);
+    return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Operaciones de la tabla de montajes (fs.h). Cada llamada toma y suelta
+ * el inodo de la caché; la posición de lectura y escritura la pone quien
+ * llama, así que no hay lectura adelantada por archivo.
+ */
+static int ext2_fs_read(u32 ino, u32 offset, void *buffer, u32 len)
+{
+    struct ext2_inode_info *ei = ext2_iget(ino);
+    int ret;
+    
+    if (ei == NULL) {
+        return -1;
+    }
+    ret = ext2_pread(ei, offset, buffer, len);
+    ext2_iput(ei);
+    return ret;
+}
+
+static int ext2_fs_write(u32 ino, u32 offset, const void *buffer, u32 len)
+{
+    struct ext2_file file;
+    int ret;
+    
+    memset(&file, 0, sizeof(file));
+    file.inode = ext2_iget(ino);
+    if (file.inode == NULL) {
+        return -1;
+    }
+    file.pos = offset;
+    ret = ext2_write(&file, buffer, len);
+    ext2_iput(file.inode);
+    return ret;
+}
+
+static int ext2_fs_truncate(u32 ino, u32 size)
+{
+    struct ext2_inode_info *ei = ext2_iget(ino);
+    int ret;
+    
+    if (ei == NULL) {
+        return -1;
+    }
+    ret = ext2_truncate(ei, size);
+    ext2_iput(ei);
+    return ret;
+}
+
+static int ext2_fs_stat(u32 ino, struct fs_stat *st)
+{
+    struct ext2_inode_info *ei = ext2_iget(ino);
+    
+    if (ei == NULL) {
+        return -1;
+    }
+    st->ino = ino;
+    st->mode = ei->raw.i_mode;
+    st->nlink = ei->raw.i_links_count;
+    st->size = ei->raw.i_size;
+    ext2_iput(ei);
+    return 0;
+}
+
+/* Estado de un listado a través de la tabla de montajes */
+struct ext2_fs_readdir_state {
+    struct fs_dirent entry;
+    void (*callback)(struct fs_dirent *entry, void *arg);
+    void *arg;
+};
+
+static int ext2_fs_readdir_actor(struct ext2_dir_entry *entry, void *arg)
+{
+    struct ext2_fs_readdir_state *st = (struct ext2_fs_readdir_state *)arg;
+    
+    st->entry.ino = entry->inode;
+    st->entry.type = entry->file_type;
+    st->entry.name_len = entry->name_len;
+    memcpy(st->entry.name, entry->name, entry->name_len);
+    st->entry.name[entry->name_len] = '\0';
+    st->callback(&st->entry, st->arg);
+    return 0;
+}
+
+static int ext2_fs_readdir(u32 ino, void (*callback)(struct fs_dirent *entry, void *arg), void *arg)
+{
+    struct ext2_fs_readdir_state *st;
+    struct ext2_inode_info *ei;
+    int ret = -1;
+    
+    ei = ext2_iget(ino);
+    if (ei == NULL) {
+        return -1;
+    }
+    st = (struct ext2_fs_readdir_state *)kmalloc(sizeof(struct ext2_fs_readdir_state));
+    if (st != NULL) {
+        st->callback = callback;
+        st->arg = arg;
+        if (!EXT2_S_ISDIR(ei->raw.i_mode)) {
+            print("ext2   : ERROR - Not a directory\n");
+        } else {
+            ret = ext2_dir_iterate(&ei->raw, ext2_fs_readdir_actor, st) < 0 ? -1 : 0;
+        }
+        kfree(st);
+    }
+    ext2_iput(ei);
+    return ret;
+}
+
+/*
+ * Un archivo abierto guarda su struct ext2_file: el inodo queda en la
+ * caché mientras esté abierto y las lecturas por el descriptor conservan
+ * el estado de la lectura adelantada
+ */
+static int ext2_fs_open(struct fs_file *file)
+{
+    struct ext2_file *ef = (struct ext2_file *)kmalloc(sizeof(struct ext2_file));
+    
+    if (ef == NULL) {
+        return -1;
+    }
+    memset(ef, 0, sizeof(struct ext2_file));
+    ef->inode = ext2_iget(file->ino);
+    if (ef->inode == NULL) {
+        kfree(ef);
+        return -1;
+    }
+    if (file->flags & FS_O_DIRECT) {
+        ef->flags = EXT2_O_DIRECT;
+    }
+    file->private = ef;
+    return 0;
+}
+
+static void ext2_fs_release(struct fs_file *file)
+{
+    struct ext2_file *ef = (struct ext2_file *)file->private;
+    
+    ext2_close(ef);
+    kfree(ef);
+    file->private = NULL;
+}
+
+static int ext2_fs_read_file(struct fs_file *file, void *buffer, u32 len)
+{
+    struct ext2_file *ef = (struct ext2_file *)file->private;
+    
+    ef->pos = file->pos;
+    return ext2_read(ef, buffer, len);
+}
+
+struct fs_ops ext2_fs_ops = {
+    "ext2",
+    ext2_lookup,
+    ext2_create,
+    NULL,                       /* Sin mkdir todavía */
+    ext2_unlink,
+    ext2_fs_read,
+    ext2_fs_write,
+    ext2_fs_truncate,
+    ext2_fs_stat,
+    ext2_fs_readdir,
+    ext2_fsync,
+    ext2_fs_open,
+    ext2_fs_release,
+    ext2_fs_read_file
+};
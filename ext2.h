@@ -2,15 +2,58 @@
 #define EXT2_H_
 
 #include "types.h"
-#include "ide.h"
+#include "blk.h"
 
 /* Constantes Ext2 */
 #define EXT2_SIGNATURE          0xEF53
 #define EXT2_SUPERBLOCK_OFFSET  1024
 #define EXT2_BLOCK_SIZE         1024
-#define EXT2_INODE_SIZE         128
+#define EXT2_GOOD_OLD_INODE_SIZE 128    /* Inodos de la revisión 0 */
 #define EXT2_ROOT_INODE         2
 
+/* Punteros a bloque en i_block */
+#define EXT2_NDIR_BLOCKS        12      /* Directos */
+#define EXT2_IND_BLOCK          12      /* Indirecto simple */
+#define EXT2_DIND_BLOCK         13      /* Doble indirecto */
+#define EXT2_TIND_BLOCK         14      /* Triple indirecto */
+
+/* Bloques máximos por racha contigua leída con una sola petición */
+#define EXT2_MAX_RUN_BLOCKS     256
+
+/* Revisiones del formato */
+#define EXT2_GOOD_OLD_REV       0
+#define EXT2_DYNAMIC_REV        1
+
+/* Características opcionales (s_feature_compat) */
+#define EXT3_FEATURE_COMPAT_HAS_JOURNAL 0x0004  /* Journal en s_journal_inum */
+#define EXT2_FEATURE_COMPAT_DIR_INDEX   0x0020
+
+/* Características que solo impiden escribir si no se entienden
+   (s_feature_ro_compat) */
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001  /* Copias del superbloque solo en algunos grupos */
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE   0x0002  /* Tamaños de más de 2 GB */
+
+/* Características necesarias para entender el formato (s_feature_incompat) */
+#define EXT2_FEATURE_INCOMPAT_FILETYPE  0x0002  /* Tipo en las entradas de directorio */
+#define EXT3_FEATURE_INCOMPAT_RECOVER   0x0004  /* Journal en uso o por recuperar */
+
+/* Características soportadas: con cualquier otra incompat no se monta
+   y con cualquier otra ro_compat se monta de solo lectura */
+#define EXT2_FEATURE_INCOMPAT_SUPP      (EXT2_FEATURE_INCOMPAT_FILETYPE | \
+                                         EXT3_FEATURE_INCOMPAT_RECOVER)
+#define EXT2_FEATURE_RO_COMPAT_SUPP     (EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | \
+                                         EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
+
+/* Tamaño máximo de bloque soportado: 1024 << EXT2_MAX_LOG_BLOCK_SIZE */
+#define EXT2_MAX_LOG_BLOCK_SIZE         2
+
+/* Primer inodo no reservado en la revisión 0 */
+#define EXT2_GOOD_OLD_FIRST_INO         11
+
+/* s_flags: signo de los caracteres al calcular hashes de directorio */
+#define EXT2_FLAGS_SIGNED_HASH          0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH        0x0002
+
 /* Estados del sistema de archivos */
 #define EXT2_VALID_FS           1
 #define EXT2_ERROR_FS           2
@@ -43,6 +86,9 @@
 #define EXT2_S_IWOTH    0x0002
 #define EXT2_S_IXOTH    0x0001
 
+/* Flags de inodo (i_flags) */
+#define EXT2_INDEX_FL   0x00001000  /* Directorio con índice htree */
+
 /* Macros para verificar tipos de archivo */
 #define EXT2_S_ISDIR(mode)  (((mode) & EXT2_S_IFDIR) == EXT2_S_IFDIR)
 #define EXT2_S_ISREG(mode)  (((mode) & EXT2_S_IFREG) == EXT2_S_IFREG)
@@ -74,7 +120,39 @@ struct ext2_superblock {
     u32 s_rev_level;            /* Nivel de revisión */
     u16 s_def_resuid;           /* UID por defecto para bloques reservados */
     u16 s_def_resgid;           /* GID por defecto para bloques reservados */
-    u8 reserved[940];           /* Relleno hasta 1024 bytes */
+    /* Campos de la revisión 1 (EXT2_DYNAMIC_REV) */
+    u32 s_first_ino;            /* Primer inodo no reservado */
+    u16 s_inode_size;           /* Tamaño de un inodo en disco */
+    u16 s_block_group_nr;       /* Grupo de esta copia del superbloque */
+    u32 s_feature_compat;
+    u32 s_feature_incompat;
+    u32 s_feature_ro_compat;
+    u8 s_uuid[16];
+    char s_volume_name[16];
+    char s_last_mounted[64];
+    u32 s_algorithm_usage_bitmap;
+    u8 s_prealloc_blocks;
+    u8 s_prealloc_dir_blocks;
+    u16 s_padding1;
+    u8 s_journal_uuid[16];
+    u32 s_journal_inum;         /* Inodo del journal (ext3) */
+    u32 s_journal_dev;
+    u32 s_last_orphan;
+    u32 s_hash_seed[4];         /* Semilla de los hash de directorio */
+    u8 s_def_hash_version;
+    u8 s_reserved_char_pad;
+    u16 s_reserved_word_pad;
+    u32 s_default_mount_opts;
+    u32 s_first_meta_bg;
+    u32 s_mkfs_time;
+    u32 s_jnl_blocks[17];
+    u32 s_blocks_count_hi;
+    u32 s_r_blocks_count_hi;
+    u32 s_free_blocks_hi;
+    u16 s_min_extra_isize;
+    u16 s_want_extra_isize;
+    u32 s_flags;                /* EXT2_FLAGS_* */
+    u8 reserved[668];           /* Relleno hasta 1024 bytes */
 } __attribute__ ((packed));
 
 /* Estructura del descriptor de grupo */
@@ -111,6 +189,17 @@ struct ext2_inode {
     u8 i_osd2[12];              /* Específico del OS */
 } __attribute__ ((packed));
 
+/* Tipos en las entradas de directorio (file_type) */
+#define EXT2_FT_UNKNOWN     0
+#define EXT2_FT_REG_FILE    1
+#define EXT2_FT_DIR         2
+
+/* Longitud mínima de una entrada con un nombre de 'len' bytes */
+#define EXT2_DIR_REC_LEN(len)   (((len) + 8 + 3) & ~3)
+
+/* Longitud máxima de una ruta */
+#define EXT2_PATH_MAX       256
+
 /* Estructura de entrada de directorio */
 struct ext2_dir_entry {
     u32 inode;                  /* Número de inodo */
@@ -120,27 +209,193 @@ struct ext2_dir_entry {
     char name[256];             /* Nombre del archivo */
 } __attribute__ ((packed));
 
+/* Caché de inodos en memoria */
+#define EXT2_ICACHE_HASH_SIZE   32
+#define EXT2_ICACHE_MAX         64      /* Inodos en caché (se descartan los libres) */
+
+/* Bloques de cada ventana de reserva: los bloques de un archivo se
+   asignan dentro de su ventana para que sigan contiguos aunque otros
+   archivos crezcan a la vez. La ventana se duplica cada vez que el
+   archivo la agota, hasta EXT2_RSV_MAX_BLOCKS */
+#define EXT2_RSV_BLOCKS         8
+#define EXT2_RSV_MAX_BLOCKS     128
+
+/* Flags de un inodo en memoria */
+#define EXT2_I_DIRTY            0x01    /* Modificado, pendiente de escribir */
+#define EXT2_I_UNLINKED         0x02    /* Sin enlaces: se borra con el último iput */
+#define EXT2_I_NEW              0x04    /* Recién asignado: limpiar el resto del inodo en disco */
+
+/* Bloque escrito que aún no tiene bloque en el disco: se asigna al
+   escribirlo (asignación diferida), junto con los demás del archivo */
+struct ext2_delalloc {
+    u32 lblock;
+    char *data;
+    struct ext2_delalloc *next;
+};
+
+struct pcache_node;
+
+/* Inodo en memoria */
+struct ext2_inode_info {
+    u32 ino;                    /* Número de inodo */
+    u32 refcount;               /* Usuarios activos; 0 = en la LRU */
+    u32 flags;
+    struct ext2_inode raw;      /* Copia del inodo del disco */
+    u32 rsv_start;              /* Ventana de reserva de bloques [start, end) */
+    u32 rsv_end;
+    struct ext2_inode_info *rsv_next;   /* Lista de ventanas activas */
+    struct ext2_delalloc *da_head;      /* Bloques diferidos, por bloque lógico */
+    struct ext2_delalloc *da_tail;
+    u32 da_count;
+    u32 da_since;               /* Tic del primer bloque diferido */
+    struct ext2_inode_info *da_next;    /* Lista de inodos con bloques diferidos */
+    struct pcache_node *pc_root;        /* Árbol radix de la caché de páginas */
+    u32 pc_height;
+    u32 pc_pages;
+    struct ext2_inode_info *hash_next;
+    struct ext2_inode_info *lru_prev;
+    struct ext2_inode_info *lru_next;
+};
+
+/* Nombre buscado por ext2_match_actor() */
+struct ext2_match {
+    const char *name;
+    u32 len;
+    u32 ino;
+};
+
+/* Caché de entradas de directorio (dentries) */
+#define EXT2_NAME_LEN           255
+#define EXT2_DCACHE_HASH_SIZE   64
+#define EXT2_DCACHE_MAX         128
+#define EXT2_DCACHE_NAME_LEN    32      /* Nombres más largos no se guardan */
+
+/* (inodo padre, nombre) -> inodo; ino = 0 es una entrada negativa */
+struct ext2_dentry {
+    u32 parent;
+    u32 ino;
+    u32 hash;
+    u32 name_len;
+    char name[EXT2_DCACHE_NAME_LEN];
+    struct ext2_dentry *hash_next;
+    struct ext2_dentry *lru_prev;
+    struct ext2_dentry *lru_next;
+};
+
+/* Ventana de lectura anticipada, en bloques */
+#define EXT2_RA_MIN_BLOCKS      4
+#define EXT2_RA_MAX_BLOCKS      64
+
+/* Archivo abierto: inodo, posición y estado de lectura anticipada */
+struct ext2_file {
+    struct ext2_inode_info *inode;
+    u32 pos;                    /* Posición en bytes */
+    u32 ra_pos;                 /* Posición donde acabó la última lectura */
+    u32 ra_next;                /* Bloque lógico que seguía a la última lectura */
+    u32 ra_window;              /* Bloques a adelantar (0: acceso aleatorio) */
+    u32 ra_end;                 /* Primer bloque lógico aún no pedido */
+    u32 flags;                  /* EXT2_O_* */
+};
+
+/* Modos de un archivo abierto (ext2_file.flags) */
+#define EXT2_O_DIRECT           0x01    /* Lecturas alineadas sin pasar por las cachés */
+
+/* Búsquedas de ext2_seek_data() (mismos valores que lseek() en Linux) */
+#define EXT2_SEEK_DATA          3       /* Siguiente byte con datos */
+#define EXT2_SEEK_HOLE          4       /* Siguiente hueco (el final cuenta como hueco) */
+
+/* Entradas que ext2_readdirplus() agrupa para leer sus inodos juntos */
+#define EXT2_READDIRPLUS_BATCH  64
+
+/* Entrada de directorio junto con los atributos de su inodo */
+struct ext2_dirent_plus {
+    u32 ino;
+    u8 file_type;
+    u8 name_len;
+    char name[256];             /* Terminado en 0 */
+    struct ext2_inode inode;    /* Copia del inodo */
+    u32 block;                  /* Bloque de la tabla de inodos (0 = ya leído) */
+    u32 offset;
+};
+
 /* Estructura del sistema de archivos */
 struct ext2_fs {
+    struct blk_dev *dev;        /* Dispositivo montado */
+    struct ext2_inode_info *root;   /* Inodo raíz (siempre en caché) */
     struct ext2_superblock superblock;
     struct ext2_group_desc *group_desc;
     u32 groups_count;
     u32 block_size;
     u32 inode_size;
     u32 first_data_block;
+    u32 use_htree;              /* Usar índices de directorio (dir_index) */
+    u32 readonly;               /* Dispositivo de solo lectura */
+    u8 *gd_dirty;               /* Descriptores de grupo pendientes de escribir */
+    u32 sb_dirty;               /* Superbloque pendiente de escribir */
+    u32 da_blocks;              /* Bloques diferidos (reservados) en total */
+    u32 dcache_hits;            /* Búsquedas resueltas por la caché de nombres */
+    u32 dcache_misses;
 } __attribute__ ((packed));
 
 /* Variables globales */
 extern struct ext2_fs ext2_fs;
 
+/* Operaciones montadas en "/" (fs.h) */
+struct fs_ops;
+extern struct fs_ops ext2_fs_ops;
+
 /* Funciones públicas */
 int ext2_init(void);
+int ext2_mount(struct blk_dev *dev);
 int ext2_read_superblock(void);
 int ext2_read_group_desc(void);
 int ext2_read_inode(u32 inode_num, struct ext2_inode *inode);
+struct ext2_inode_info *ext2_iget(u32 inode_num);
+void ext2_iput(struct ext2_inode_info *ei);
+void ext2_mark_inode_dirty(struct ext2_inode_info *ei);
+int ext2_write_inode(struct ext2_inode_info *ei);
 int ext2_read_block(u32 block_num, void *buffer);
+int ext2_bmap(struct ext2_inode *inode, u32 lblock, u32 *pblock);
+struct buf;
+char *ext2_get_block(u32 block_num, struct buf **bh);
+void ext2_put_block(struct buf *bh);
 int ext2_read_file(struct ext2_inode *inode, void *buffer, u32 size);
+int ext2_pread(struct ext2_inode_info *ei, u32 offset, void *buffer, u32 len);
+int ext2_read_direct(struct ext2_inode_info *ei, u32 offset, void *buffer, u32 len);
+int ext2_seek_data(struct ext2_inode_info *ei, u32 offset, int whence, u32 *result);
 int ext2_find_file(const char *name, struct ext2_inode *inode);
+u32 ext2_lookup(const char *path);
+int ext2_dir_scan_block(struct ext2_inode *dir_inode, u32 lblock,
+                        int (*actor)(struct ext2_dir_entry *entry, void *arg), void *arg);
+int ext2_match_actor(struct ext2_dir_entry *entry, void *arg);
+void ext2_dcache_invalidate(u32 parent, const char *name, u32 len);
+int ext2_open(const char *name, struct ext2_file *file);
+int ext2_read(struct ext2_file *file, void *buffer, u32 size);
+void ext2_close(struct ext2_file *file);
 int ext2_list_dir(struct ext2_inode *dir_inode, void (*callback)(struct ext2_dir_entry *));
+int ext2_readdirplus(struct ext2_inode *dir_inode, void (*callback)(struct ext2_dirent_plus *));
+
+/* Asignación de bloques e inodos (ext2_alloc.c) */
+u32 ext2_alloc_block(struct ext2_inode_info *ei, u32 goal);
+void ext2_free_block(u32 block);
+u32 ext2_alloc_inode(u32 parent, int is_dir);
+void ext2_free_inode(u32 ino, int is_dir);
+void ext2_rsv_release(struct ext2_inode_info *ei);
+int ext2_commit_meta(void);
+
+/* Escritura (ext2_write.c) */
+int ext2_bmap_alloc(struct ext2_inode_info *ei, u32 lblock, u32 *pblock, int *created);
+int ext2_write(struct ext2_file *file, const void *buffer, u32 size);
+int ext2_create(const char *path);
+int ext2_truncate(struct ext2_inode_info *ei, u32 size);
+int ext2_unlink(const char *path);
+void ext2_delete_inode(struct ext2_inode_info *ei);
+char *ext2_da_lookup(struct ext2_inode_info *ei, u32 lblock);
+u32 ext2_da_next(struct ext2_inode_info *ei, u32 lblock);
+int ext2_da_flush_inode(struct ext2_inode_info *ei);
+int ext2_writeback(int all);
+void ext2_flush_daemon(void);
+int ext2_sync(void);
+int ext2_fsync(u32 ino);
 
 #endif
\ No newline at end of file
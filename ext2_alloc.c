@@ -0,0 +1,438 @@
+#include "ext2.h"
+#include "screen.h"
+#include "lib.h"
+#include "mm.h"
+#include "bcache.h"
+#include "ext2_journal.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/* Inodos con una ventana de reserva activa */
+static struct ext2_inode_info *rsv_list = NULL;
+
+/*
+ * Operaciones sobre bitmaps de bloques/inodos
+ */
+static int bitmap_test(u8 *map, u32 bit)
+{
+    return (map[bit >> 3] >> (bit & 7)) & 1;
+}
+
+static void bitmap_set(u8 *map, u32 bit)
+{
+    map[bit >> 3] |= 1 << (bit & 7);
+}
+
+static void bitmap_clear(u8 *map, u32 bit)
+{
+    map[bit >> 3] &= ~(1 << (bit & 7));
+}
+
+/* Primer bit a 0 en [start, nbits), o -1 */
+static int bitmap_find_zero(u8 *map, u32 start, u32 nbits)
+{
+    u32 bit = start;
+
+    while (bit < nbits) {
+        /* Saltar bytes completos ocupados */
+        if ((bit & 7) == 0 && map[bit >> 3] == 0xFF) {
+            bit += 8;
+            continue;
+        }
+        if (!bitmap_test(map, bit))
+            return bit;
+        bit++;
+    }
+    return -1;
+}
+
+/* Grupo y bloque inicial (bit 0 del bitmap) de un bloque */
+static u32 ext2_block_group(u32 block)
+{
+    return (block - ext2_fs.first_data_block) / ext2_fs.superblock.s_blocks_per_group;
+}
+
+static u32 ext2_group_first_block(u32 group)
+{
+    return ext2_fs.first_data_block + group * ext2_fs.superblock.s_blocks_per_group;
+}
+
+/* Bloques del grupo (el último puede ser más corto) */
+static u32 ext2_group_blocks(u32 group)
+{
+    u32 first = ext2_group_first_block(group);
+    u32 count = ext2_fs.superblock.s_blocks_count - first;
+
+    if (count > ext2_fs.superblock.s_blocks_per_group)
+        count = ext2_fs.superblock.s_blocks_per_group;
+    return count;
+}
+
+static void ext2_group_dirty(u32 group)
+{
+    ext2_fs.gd_dirty[group] = 1;
+    ext2_fs.sb_dirty = 1;
+}
+
+/*
+ * Pasa a la caché de bloques los descriptores de grupo y el superbloque
+ * modificados por las asignaciones
+ */
+int ext2_commit_meta(void)
+{
+    u32 per_block = ext2_fs.block_size / sizeof(struct ext2_group_desc);
+    u32 first_desc_block = ext2_fs.first_data_block + 1;
+    u32 g, first, count;
+    struct buf *bh;
+    int dirty;
+
+    /* Cada bloque de descriptores se escribe una vez, entero */
+    for (first = 0; first < ext2_fs.groups_count; first += per_block) {
+        count = ext2_fs.groups_count - first;
+        if (count > per_block)
+            count = per_block;
+
+        dirty = 0;
+        for (g = first; g < first + count; g++) {
+            if (ext2_fs.gd_dirty[g]) {
+                dirty = 1;
+                ext2_fs.gd_dirty[g] = 0;
+            }
+        }
+        if (!dirty)
+            continue;
+
+        bh = bread(ext2_fs.dev, first_desc_block + first / per_block, ext2_fs.block_size);
+        if (bh == NULL)
+            return -1;
+        memcpy(bh->data, &ext2_fs.group_desc[first], count * sizeof(struct ext2_group_desc));
+        ext2_journal_dirty(bh);
+        brelse(bh);
+    }
+
+    /* El superbloque está en el byte 1024: bloque 1 con bloques de 1 KB,
+       dentro del bloque 0 con bloques mayores */
+    if (ext2_fs.sb_dirty) {
+        bh = bread(ext2_fs.dev, EXT2_SUPERBLOCK_OFFSET / ext2_fs.block_size, ext2_fs.block_size);
+        if (bh == NULL)
+            return -1;
+        memcpy(bh->data + EXT2_SUPERBLOCK_OFFSET % ext2_fs.block_size, &ext2_fs.superblock,
+               sizeof(struct ext2_superblock));
+        ext2_journal_dirty(bh);
+        brelse(bh);
+        ext2_fs.sb_dirty = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * Comprueba si [start, end) se solapa con la ventana de otro inodo
+ */
+static int ext2_rsv_conflict(struct ext2_inode_info *self, u32 start, u32 end)
+{
+    struct ext2_inode_info *ei;
+
+    for (ei = rsv_list; ei != NULL; ei = ei->rsv_next) {
+        if (ei != self && start < ei->rsv_end && ei->rsv_start < end)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Libera la ventana de reserva de un inodo
+ */
+void ext2_rsv_release(struct ext2_inode_info *ei)
+{
+    struct ext2_inode_info **p;
+
+    if (ei->rsv_end == ei->rsv_start)
+        return;
+
+    for (p = &rsv_list; *p != NULL; p = &(*p)->rsv_next) {
+        if (*p == ei) {
+            *p = ei->rsv_next;
+            break;
+        }
+    }
+    ei->rsv_start = ei->rsv_end = 0;
+    ei->rsv_next = NULL;
+}
+
+/*
+ * Marca un bloque como usado en el bitmap ya leído de su grupo
+ */
+static void ext2_claim_block(struct buf *bh, u32 group, u32 bit)
+{
+    bitmap_set((u8 *)bh->data, bit);
+    bitmap_set(ext2_journal_bitmap(bh), bit);
+    ext2_journal_dirty(bh);
+
+    ext2_fs.group_desc[group].bg_free_blocks_count--;
+    ext2_fs.superblock.s_free_blocks_count--;
+    ext2_group_dirty(group);
+}
+
+/*
+ * Intenta asignar un bloque libre de [start, end) (dentro de un grupo)
+ */
+static u32 ext2_alloc_in_range(u32 start, u32 end)
+{
+    u32 group = ext2_block_group(start);
+    u32 base = ext2_group_first_block(group);
+    struct buf *bh;
+    int bit;
+
+    bh = bread(ext2_fs.dev, ext2_fs.group_desc[group].bg_block_bitmap, ext2_fs.block_size);
+    if (bh == NULL)
+        return 0;
+
+    bit = bitmap_find_zero(ext2_journal_bitmap(bh), start - base, end - base);
+    if (bit < 0) {
+        brelse(bh);
+        return 0;
+    }
+
+    ext2_claim_block(bh, group, bit);
+    brelse(bh);
+    return base + bit;
+}
+
+/*
+ * Asigna un bloque para un inodo lo más cerca posible de 'goal'.
+ *
+ * Primero se usa la ventana de reserva del inodo: bloques libres que
+ * ningún otro inodo toma, de modo que dos archivos que crecen a la vez
+ * no intercalan sus bloques. Si la ventana se agota se abre otra del
+ * doble de tamaño en el primer hueco libre a partir del objetivo (y en
+ * los grupos siguientes si el del objetivo está lleno). Si todo lo libre
+ * está en ventanas de otros inodos, se toma de ellas. Devuelve el bloque
+ * o 0 si no hay espacio.
+ */
+u32 ext2_alloc_block(struct ext2_inode_info *ei, u32 goal)
+{
+    u32 groups = ext2_fs.groups_count;
+    u32 want = EXT2_RSV_BLOCKS;
+    u32 group, base, nbits, start, len, block, i;
+    struct buf *bh;
+    u8 *map;
+    int bit;
+
+    if (goal < ext2_fs.first_data_block || goal >= ext2_fs.superblock.s_blocks_count) {
+        goal = ext2_group_first_block((ei->ino - 1) / ext2_fs.superblock.s_inodes_per_group);
+    }
+
+    /* 1. Dentro de la ventana actual, desde el objetivo */
+    if (ei->rsv_end > ei->rsv_start) {
+        start = (goal >= ei->rsv_start && goal < ei->rsv_end) ? goal : ei->rsv_start;
+        block = ext2_alloc_in_range(start, ei->rsv_end);
+        if (block == 0 && start > ei->rsv_start)
+            block = ext2_alloc_in_range(ei->rsv_start, start);
+        if (block != 0)
+            return block;
+
+        want = (ei->rsv_end - ei->rsv_start) * 2;
+        if (want < EXT2_RSV_BLOCKS)
+            want = EXT2_RSV_BLOCKS;
+        if (want > EXT2_RSV_MAX_BLOCKS)
+            want = EXT2_RSV_MAX_BLOCKS;
+        ext2_rsv_release(ei);
+    }
+
+    /* 2. Abrir una ventana nueva en el primer hueco libre no reservado */
+    group = ext2_block_group(goal);
+    for (i = 0; i < groups; i++, group = (group + 1) % groups) {
+        if (ext2_fs.group_desc[group].bg_free_blocks_count == 0)
+            continue;
+
+        base = ext2_group_first_block(group);
+        nbits = ext2_group_blocks(group);
+        bh = bread(ext2_fs.dev, ext2_fs.group_desc[group].bg_block_bitmap, ext2_fs.block_size);
+        if (bh == NULL)
+            return 0;
+        map = ext2_journal_bitmap(bh);
+
+        bit = bitmap_find_zero(map, i == 0 ? goal - base : 0, nbits);
+        while (bit >= 0 && ext2_rsv_conflict(ei, base + bit, base + bit + 1))
+            bit = bitmap_find_zero(map, bit + 1, nbits);
+        if (bit < 0 && i == 0 && goal > base) {
+            /* Volver al principio del grupo del objetivo */
+            bit = bitmap_find_zero(map, 0, goal - base);
+            while (bit >= 0 && ext2_rsv_conflict(ei, base + bit, base + bit + 1))
+                bit = bitmap_find_zero(map, bit + 1, goal - base);
+        }
+        if (bit < 0) {
+            brelse(bh);
+            continue;
+        }
+
+        /* La ventana abarca los bloques libres consecutivos siguientes */
+        for (len = 1; len < want && bit + len < nbits; len++) {
+            if (bitmap_test(map, bit + len) ||
+                ext2_rsv_conflict(ei, base + bit + len, base + bit + len + 1))
+                break;
+        }
+
+        ext2_claim_block(bh, group, bit);
+        brelse(bh);
+
+        ei->rsv_start = base + bit;
+        ei->rsv_end = base + bit + len;
+        ei->rsv_next = rsv_list;
+        rsv_list = ei;
+        return base + bit;
+    }
+
+    /* 3. Solo queda espacio en ventanas de otros inodos: una reserva no
+       puede dejar sin bloques a nadie, se toma cualquier bloque libre */
+    group = ext2_block_group(goal);
+    for (i = 0; i < groups; i++, group = (group + 1) % groups) {
+        if (ext2_fs.group_desc[group].bg_free_blocks_count == 0)
+            continue;
+        base = ext2_group_first_block(group);
+        block = ext2_alloc_in_range(base, base + ext2_group_blocks(group));
+        if (block != 0)
+            return block;
+    }
+
+    print("ext2   : ERROR - No free blocks\n");
+    return 0;
+}
+
+/*
+ * Devuelve un bloque al bitmap de su grupo
+ */
+void ext2_free_block(u32 block)
+{
+    u32 group, bit;
+    struct buf *bh;
+
+    if (block < ext2_fs.first_data_block || block >= ext2_fs.superblock.s_blocks_count) {
+        print("ext2   : ERROR - Freeing invalid block ");
+        print_dec(block);
+        print("\n");
+        return;
+    }
+
+    group = ext2_block_group(block);
+    bit = block - ext2_group_first_block(group);
+
+    bh = bread(ext2_fs.dev, ext2_fs.group_desc[group].bg_block_bitmap, ext2_fs.block_size);
+    if (bh == NULL)
+        return;
+
+    if (!bitmap_test((u8 *)bh->data, bit)) {
+        print("ext2   : ERROR - Block already free ");
+        print_dec(block);
+        print("\n");
+        brelse(bh);
+        return;
+    }
+
+    /* No se reasigna hasta que la liberación esté confirmada */
+    ext2_journal_freeze(bh);
+    bitmap_clear((u8 *)bh->data, bit);
+    ext2_journal_dirty(bh);
+    brelse(bh);
+
+    ext2_fs.group_desc[group].bg_free_blocks_count++;
+    ext2_fs.superblock.s_free_blocks_count++;
+    ext2_group_dirty(group);
+}
+
+/* Primer inodo que se puede asignar */
+static u32 ext2_first_ino(void)
+{
+    if (ext2_fs.superblock.s_rev_level >= EXT2_DYNAMIC_REV)
+        return ext2_fs.superblock.s_first_ino;
+    return EXT2_GOOD_OLD_FIRST_INO;
+}
+
+/*
+ * Asigna un inodo. Los archivos van al grupo de su directorio; los
+ * directorios se reparten hacia grupos con inodos libres por encima de
+ * la media y con más bloques libres. Devuelve el número de inodo o 0.
+ */
+u32 ext2_alloc_inode(u32 parent, int is_dir)
+{
+    u32 groups = ext2_fs.groups_count;
+    u32 ipg = ext2_fs.superblock.s_inodes_per_group;
+    u32 avg = ext2_fs.superblock.s_free_inodes_count / groups;
+    u32 group = (parent - 1) / ipg;
+    struct ext2_group_desc *gd;
+    struct buf *bh;
+    u32 i, g;
+    int best = -1;
+    int bit;
+
+    if (is_dir) {
+        for (g = 0; g < groups; g++) {
+            gd = &ext2_fs.group_desc[g];
+            if (gd->bg_free_inodes_count == 0 || gd->bg_free_inodes_count < avg)
+                continue;
+            if (best < 0 || gd->bg_free_blocks_count > ext2_fs.group_desc[best].bg_free_blocks_count)
+                best = g;
+        }
+        if (best >= 0)
+            group = best;
+    }
+
+    for (i = 0; i < groups; i++, group = (group + 1) % groups) {
+        gd = &ext2_fs.group_desc[group];
+        if (gd->bg_free_inodes_count == 0)
+            continue;
+
+        bh = bread(ext2_fs.dev, gd->bg_inode_bitmap, ext2_fs.block_size);
+        if (bh == NULL)
+            return 0;
+
+        bit = bitmap_find_zero((u8 *)bh->data, group == 0 ? ext2_first_ino() - 1 : 0, ipg);
+        if (bit < 0) {
+            brelse(bh);
+            continue;
+        }
+
+        bitmap_set((u8 *)bh->data, bit);
+        ext2_journal_dirty(bh);
+        brelse(bh);
+
+        gd->bg_free_inodes_count--;
+        ext2_fs.superblock.s_free_inodes_count--;
+        if (is_dir)
+            gd->bg_used_dirs_count++;
+        ext2_group_dirty(group);
+        return group * ipg + bit + 1;
+    }
+
+    print("ext2   : ERROR - No free inodes\n");
+    return 0;
+}
+
+/*
+ * Devuelve un inodo al bitmap de su grupo
+ */
+void ext2_free_inode(u32 ino, int is_dir)
+{
+    u32 ipg = ext2_fs.superblock.s_inodes_per_group;
+    u32 group = (ino - 1) / ipg;
+    u32 bit = (ino - 1) % ipg;
+    struct ext2_group_desc *gd = &ext2_fs.group_desc[group];
+    struct buf *bh;
+
+    bh = bread(ext2_fs.dev, gd->bg_inode_bitmap, ext2_fs.block_size);
+    if (bh == NULL)
+        return;
+
+    bitmap_clear((u8 *)bh->data, bit);
+    ext2_journal_dirty(bh);
+    brelse(bh);
+
+    gd->bg_free_inodes_count++;
+    ext2_fs.superblock.s_free_inodes_count++;
+    if (is_dir)
+        gd->bg_used_dirs_count--;
+    ext2_group_dirty(group);
+}
@@ -0,0 +1,406 @@
+/*
+ * Native benchmark harness for the ext2 code. The kernel's ext2, block
+ * cache, page cache and block layer sources are compiled for the host
+ * and run against an image file, so filesystem changes can be measured
+ * without booting. The image comes from create_bench_image.sh (no root
+ * needed); this file only supplies the few kernel services they use.
+ *
+ * Each workload reports disk read commands (requests after the merging
+ * the IDE driver does) and kilobytes read per operation, the block
+ * cache hit rate and wall time. "cold" runs drop the block cache first;
+ * the inode and dentry caches stay warm, as they would on a running
+ * system.
+ *
+ * Usage: ./ext2_bench [image]        (make bench)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "types.h"
+#include "mm.h"
+#include "blk.h"
+#include "bcache.h"
+#include "ext2.h"
+
+#define BENCH_LOOKUPS       2000
+#define BENCH_RANDOM_READS  2000
+#define BENCH_CHUNK         (64 * 1024)
+#define BENCH_DEEP_LEVELS   32
+#define BENCH_HUGE_ENTRIES  20000
+
+/* Kernel services used by the ext2 sources. Frames come from malloc, so
+   the shrinker never sees pressure and the page cache just grows. */
+u32 mm_free_frames;
+u32 mm_mapped_end = 0xFFFFFFFF;
+u32 mm_watermark[3];
+
+void print(char *s) { fputs(s, stdout); }
+void print_dec(u32 n) { printf("%u", n); }
+void print_hex(u32 n) { printf("%08X", n); }
+void putcar(uchar c) { putchar(c); }
+void *kmalloc(u32 size) { return malloc(size); }
+void kfree(void *ptr) { free(ptr); }
+
+char *get_page_frame(void)
+{
+    void *frame;
+
+    if (posix_memalign(&frame, PAGE_SIZE, PAGE_SIZE) != 0)
+        return (char *)-1;
+    return frame;
+}
+
+void release_page_frame(u32 p_addr)
+{
+    (void)p_addr;               /* A u32 can't hold a host pointer */
+}
+
+/*
+ * Image-backed disk that behaves like the IDE driver: requests queue up
+ * while a command is in flight, and the next command takes the head of
+ * the queue plus the requests that continue it on disk. A command
+ * completes on the next poll (blk_wait), as if its interrupt arrived.
+ */
+#define BENCH_MAX_CMD_SECTORS   256
+
+static int bench_fd = -1;
+static struct blk_dev bench_dev;
+static struct blk_request *bench_head, *bench_tail;
+static u32 bench_cmd_reqs;      /* Requests covered by the command in flight */
+
+static void bench_start(void)
+{
+    struct blk_request *prev, *next;
+    u32 sectors;
+
+    if (bench_cmd_reqs || bench_head == NULL)
+        return;
+
+    bench_cmd_reqs = 1;
+    sectors = bench_head->count;
+    for (prev = bench_head, next = prev->next; next; prev = next, next = next->next) {
+        if (next->cmd != bench_head->cmd || next->lba != prev->lba + prev->count ||
+            sectors + next->count > BENCH_MAX_CMD_SECTORS)
+            break;
+        bench_cmd_reqs++;
+        sectors += next->count;
+        bench_dev.stats.merges[bench_head->cmd == BLK_WRITE]++;
+    }
+}
+
+static int bench_submit(struct blk_dev *dev, struct blk_request *req)
+{
+    req->next = NULL;
+    if (bench_tail)
+        bench_tail->next = req;
+    else
+        bench_head = req;
+    bench_tail = req;
+    bench_start();
+    return 0;
+}
+
+static void bench_poll(struct blk_dev *dev)
+{
+    struct blk_request *req, *next;
+    off_t pos;
+    size_t len;
+    ssize_t n;
+    u32 i;
+
+    if (!bench_cmd_reqs)
+        return;
+
+    req = bench_head;
+    for (i = 0; i < bench_cmd_reqs; i++) {
+        next = bench_head->next;
+        bench_head = next;
+    }
+    if (bench_head == NULL)
+        bench_tail = NULL;
+    bench_cmd_reqs = 0;
+    bench_start();
+
+    for (; req != bench_head; req = next) {
+        next = req->next;
+        pos = (off_t)req->lba * BLK_SECTOR_SIZE;
+        len = (size_t)req->count * BLK_SECTOR_SIZE;
+        if (req->cmd == BLK_WRITE)
+            n = pwrite(bench_fd, req->buffer, len, pos);
+        else
+            n = pread(bench_fd, req->buffer, len, pos);
+        blk_end_request(req, n == (ssize_t)len ? 0 : -1);
+    }
+}
+
+static struct blk_ops bench_ops = {
+    .submit = bench_submit,
+    .poll = bench_poll,
+};
+
+/* Counters sampled around each workload */
+struct bench_sample {
+    struct blk_stats blk;
+    struct bcache_stats cache;
+    struct timespec time;
+};
+
+static void bench_sample(struct bench_sample *s)
+{
+    blk_get_stats(bench_dev.name, &s->blk);
+    bcache_get_stats(&s->cache);
+    clock_gettime(CLOCK_MONOTONIC, &s->time);
+}
+
+static void bench_report(const char *name, u32 ops, struct bench_sample *before)
+{
+    struct bench_sample after;
+    double usecs, cmds, kbytes;
+    u32 hits, misses;
+
+    bench_sample(&after);
+    usecs = (after.time.tv_sec - before->time.tv_sec) * 1e6 +
+            (after.time.tv_nsec - before->time.tv_nsec) / 1e3;
+    cmds = (after.blk.requests[BLK_READ] - after.blk.merges[BLK_READ]) -
+           (before->blk.requests[BLK_READ] - before->blk.merges[BLK_READ]);
+    kbytes = (after.blk.sectors[BLK_READ] - before->blk.sectors[BLK_READ]) / 2.0;
+    hits = after.cache.hits - before->cache.hits;
+    misses = after.cache.misses - before->cache.misses;
+
+    if (ops == 0)
+        ops = 1;
+    printf("%-28s %7u %10.2f %10.1f ", name, ops, cmds / ops, kbytes / ops);
+    if (hits + misses > 0)
+        printf("%7.1f%%", 100.0 * hits / (hits + misses));
+    else
+        printf("%8s", "-");
+    printf(" %10.1f\n", usecs / ops);
+}
+
+static void bench_drop_caches(void)
+{
+    bcache_invalidate(ext2_fs.dev);
+}
+
+/* Deterministic pseudo-random numbers so runs are comparable */
+static u32 bench_seed = 1;
+
+static u32 bench_rand(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 8;
+}
+
+static void bench_lookup_deep(const char *label)
+{
+    struct bench_sample s;
+    char path[BENCH_DEEP_LEVELS * 4 + 16];
+    int i, len = 0;
+    u32 n;
+
+    len += sprintf(path + len, "/deep");
+    for (i = 0; i < BENCH_DEEP_LEVELS; i++)
+        len += sprintf(path + len, "/l%02d", i);
+    sprintf(path + len, "/leaf");
+
+    bench_sample(&s);
+    for (n = 0; n < BENCH_LOOKUPS; n++) {
+        if (ext2_lookup(path) == 0) {
+            printf("ERROR: %s not found\n", path);
+            return;
+        }
+    }
+    bench_report(label, BENCH_LOOKUPS, &s);
+}
+
+static void bench_lookup_tree(const char *label)
+{
+    struct bench_sample s;
+    char path[64];
+    u32 n;
+
+    bench_seed = 1;
+    bench_sample(&s);
+    for (n = 0; n < BENCH_LOOKUPS; n++) {
+        sprintf(path, "/tree/d%02u/d%02u/f%02u", bench_rand() % 16, bench_rand() % 16, bench_rand() % 16);
+        if (ext2_lookup(path) == 0) {
+            printf("ERROR: %s not found\n", path);
+            return;
+        }
+    }
+    bench_report(label, BENCH_LOOKUPS, &s);
+}
+
+static void bench_lookup_huge(const char *label, int missing)
+{
+    struct bench_sample s;
+    char path[64];
+    u32 n;
+
+    bench_seed = 2;
+    bench_sample(&s);
+    for (n = 0; n < BENCH_LOOKUPS; n++) {
+        if (missing) {
+            sprintf(path, "/huge/g%05u", bench_rand() % BENCH_HUGE_ENTRIES);
+            if (ext2_lookup(path) != 0) {
+                printf("ERROR: %s found\n", path);
+                return;
+            }
+        } else {
+            sprintf(path, "/huge/f%05u", bench_rand() % BENCH_HUGE_ENTRIES);
+            if (ext2_lookup(path) == 0) {
+                printf("ERROR: %s not found\n", path);
+                return;
+            }
+        }
+    }
+    bench_report(label, BENCH_LOOKUPS, &s);
+}
+
+static u32 bench_entries;
+
+static void bench_count_entry(struct ext2_dir_entry *entry)
+{
+    bench_entries++;
+}
+
+static void bench_count_plus(struct ext2_dirent_plus *entry)
+{
+    bench_entries++;
+}
+
+static void bench_list(const char *label, const char *path, int plus)
+{
+    struct bench_sample s;
+    struct ext2_inode inode;
+
+    if (ext2_find_file(path, &inode) != 0) {
+        printf("ERROR: %s not found\n", path);
+        return;
+    }
+
+    bench_entries = 0;
+    bench_sample(&s);
+    if (plus)
+        ext2_readdirplus(&inode, bench_count_plus);
+    else
+        ext2_list_dir(&inode, bench_count_entry);
+    bench_report(label, bench_entries, &s);
+}
+
+/* Sequential read in BENCH_CHUNK pieces; one operation per chunk */
+static void bench_read_seq(const char *label, const char *path, u32 flags)
+{
+    struct bench_sample s;
+    struct ext2_file file;
+    char *buffer;
+    u32 ops = 0;
+    int n;
+
+    if (ext2_open(path, &file) != 0) {
+        printf("ERROR: %s not found\n", path);
+        return;
+    }
+    if (posix_memalign((void **)&buffer, PAGE_SIZE, BENCH_CHUNK) != 0) {
+        ext2_close(&file);
+        return;
+    }
+
+    file.flags = flags;
+    bench_sample(&s);
+    while ((n = ext2_read(&file, buffer, BENCH_CHUNK)) > 0)
+        ops++;
+    bench_report(label, ops, &s);
+
+    free(buffer);
+    ext2_close(&file);
+}
+
+static void bench_read_random(const char *label, const char *path, u32 size)
+{
+    struct bench_sample s;
+    struct ext2_file file;
+    char *buffer;
+    u32 n, blocks;
+
+    if (ext2_open(path, &file) != 0) {
+        printf("ERROR: %s not found\n", path);
+        return;
+    }
+    buffer = malloc(size);
+    blocks = file.inode->raw.i_size / size;
+
+    bench_seed = 3;
+    bench_sample(&s);
+    for (n = 0; n < BENCH_RANDOM_READS; n++)
+        ext2_pread(file.inode, (bench_rand() % blocks) * size, buffer, size);
+    bench_report(label, BENCH_RANDOM_READS, &s);
+
+    free(buffer);
+    ext2_close(&file);
+}
+
+int main(int argc, char **argv)
+{
+    const char *image = argc > 1 ? argv[1] : "bench_disk.img";
+    struct bench_sample s;
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    bench_fd = open(image, O_RDONLY);
+    if (bench_fd < 0) {
+        perror(image);
+        fprintf(stderr, "Create it with ./create_bench_image.sh %s\n", image);
+        return 1;
+    }
+    strcpy(bench_dev.name, "hda");
+    bench_dev.nr_sectors = lseek(bench_fd, 0, SEEK_END) / BLK_SECTOR_SIZE;
+    bench_dev.max_sectors = 256;
+    bench_dev.readonly = 1;
+    bench_dev.ops = &bench_ops;
+    blk_register(&bench_dev);
+
+    bench_sample(&s);
+    if (ext2_init() != 0)
+        return 1;
+    printf("\n%-28s %7s %10s %10s %8s %10s\n", "workload", "ops", "cmds/op", "KB/op", "hit", "usec/op");
+    bench_report("mount", 1, &s);
+
+    bench_drop_caches();
+    bench_lookup_deep("lookup deep (cold)");
+    bench_lookup_deep("lookup deep (warm)");
+
+    bench_drop_caches();
+    bench_lookup_tree("lookup tree (cold)");
+    bench_lookup_tree("lookup tree (warm)");
+
+    bench_drop_caches();
+    bench_lookup_huge("lookup huge (cold)", 0);
+    bench_lookup_huge("lookup huge (warm)", 0);
+    bench_lookup_huge("lookup huge missing", 1);
+
+    bench_drop_caches();
+    bench_list("list huge (cold)", "/huge", 0);
+    bench_list("list huge (warm)", "/huge", 0);
+    bench_drop_caches();
+    bench_list("readdirplus huge (cold)", "/huge", 1);
+
+    bench_drop_caches();
+    bench_read_seq("read large seq 64K", "/large/data", 0);
+    bench_drop_caches();
+    bench_read_seq("read large direct 64K", "/large/data", EXT2_O_DIRECT);
+    bench_drop_caches();
+    bench_read_random("read large random 4K", "/large/data", 4096);
+    bench_drop_caches();
+    bench_read_seq("read sparse seq 64K", "/sparse/data", 0);
+
+    printf("\n");
+    blk_stats_dump(&bench_dev);
+    bcache_stats_dump();
+    return 0;
+}
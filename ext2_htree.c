@@ -0,0 +1,375 @@
+#include "ext2.h"
+#include "ext2_htree.h"
+#include "screen.h"
+#include "lib.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Funciones hash de directorio del formato ext2/ext3 (dir_index). Deben
+ * dar exactamente los mismos valores que las que usaron mke2fs/e2fsck o
+ * Linux al construir el índice.
+ */
+
+/* Hash "legacy": variante con caracteres con o sin signo */
+static u32 dx_hack_hash(const char *name, u32 len, int unsigned_chars)
+{
+    u32 hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    int c;
+
+    while (len--) {
+        c = unsigned_chars ? (int)(u8)*name : (int)(signed char)*name;
+        name++;
+        hash = hash1 + (hash0 ^ (u32)(c * 7152373));
+        if (hash & 0x80000000)
+            hash -= 0x7fffffff;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+
+    return hash0 << 1;
+}
+
+/* Convierte hasta num*4 caracteres del nombre en palabras de 32 bits,
+   rellenando con un patrón que depende de la longitud */
+static void str2hashbuf(const char *msg, u32 len, u32 *buf, int num, int unsigned_chars)
+{
+    u32 pad, val;
+    u32 i;
+    int c;
+
+    pad = len | (len << 8);
+    pad |= pad << 16;
+
+    val = pad;
+    if (len > (u32)num * 4)
+        len = num * 4;
+    for (i = 0; i < len; i++) {
+        c = unsigned_chars ? (int)(u8)msg[i] : (int)(signed char)msg[i];
+        val = (u32)c + (val << 8);
+        if ((i % 4) == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0)
+        *buf++ = val;
+    while (--num >= 0)
+        *buf++ = pad;
+}
+
+#define ROL32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define ROUND(f, a, b, c, d, x, s) \
+        (a += f(b, c, d) + (x), a = ROL32(a, s))
+
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+/* MD4 reducido (3 rondas de 8 pasos) */
+static void half_md4_transform(u32 buf[4], const u32 in[8])
+{
+    u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    /* Ronda 1 */
+    ROUND(F, a, b, c, d, in[0] + K1,  3);
+    ROUND(F, d, a, b, c, in[1] + K1,  7);
+    ROUND(F, c, d, a, b, in[2] + K1, 11);
+    ROUND(F, b, c, d, a, in[3] + K1, 19);
+    ROUND(F, a, b, c, d, in[4] + K1,  3);
+    ROUND(F, d, a, b, c, in[5] + K1,  7);
+    ROUND(F, c, d, a, b, in[6] + K1, 11);
+    ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+    /* Ronda 2 */
+    ROUND(G, a, b, c, d, in[1] + K2,  3);
+    ROUND(G, d, a, b, c, in[3] + K2,  5);
+    ROUND(G, c, d, a, b, in[5] + K2,  9);
+    ROUND(G, b, c, d, a, in[7] + K2, 13);
+    ROUND(G, a, b, c, d, in[0] + K2,  3);
+    ROUND(G, d, a, b, c, in[2] + K2,  5);
+    ROUND(G, c, d, a, b, in[4] + K2,  9);
+    ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+    /* Ronda 3 */
+    ROUND(H, a, b, c, d, in[3] + K3,  3);
+    ROUND(H, d, a, b, c, in[7] + K3,  9);
+    ROUND(H, c, d, a, b, in[2] + K3, 11);
+    ROUND(H, b, c, d, a, in[6] + K3, 15);
+    ROUND(H, a, b, c, d, in[1] + K3,  3);
+    ROUND(H, d, a, b, c, in[5] + K3,  9);
+    ROUND(H, c, d, a, b, in[0] + K3, 11);
+    ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+/* 16 rondas de TEA */
+static void tea_transform(u32 buf[4], const u32 in[4])
+{
+    u32 sum = 0;
+    u32 b0 = buf[0], b1 = buf[1];
+    u32 a = in[0], b = in[1], c = in[2], d = in[3];
+    int n = 16;
+
+    do {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    } while (--n);
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+/*
+ * Hash de un nombre de directorio. 'seed' es s_hash_seed del superbloque
+ * (una semilla toda a cero usa la inicial de MD4). El bit 0 siempre es 0:
+ * en el índice marca las continuaciones por colisión.
+ */
+u32 ext2_dirhash(const char *name, u32 len, int version, u32 *seed)
+{
+    u32 buf[4];
+    u32 in[8];
+    u32 hash = 0;
+    int unsigned_chars = 0;
+    int i;
+
+    buf[0] = 0x67452301;
+    buf[1] = 0xefcdab89;
+    buf[2] = 0x98badcfe;
+    buf[3] = 0x10325476;
+
+    for (i = 0; i < 4; i++) {
+        if (seed[i] != 0) {
+            memcpy(buf, seed, sizeof(buf));
+            break;
+        }
+    }
+
+    switch (version) {
+    case EXT2_HASH_LEGACY_UNSIGNED:
+        unsigned_chars = 1;
+        /* fallthrough */
+    case EXT2_HASH_LEGACY:
+        hash = dx_hack_hash(name, len, unsigned_chars);
+        break;
+    case EXT2_HASH_HALF_MD4_UNSIGNED:
+        unsigned_chars = 1;
+        /* fallthrough */
+    case EXT2_HASH_HALF_MD4:
+        while (1) {
+            str2hashbuf(name, len, in, 8, unsigned_chars);
+            half_md4_transform(buf, in);
+            if (len <= 32)
+                break;
+            len -= 32;
+            name += 32;
+        }
+        hash = buf[1];
+        break;
+    case EXT2_HASH_TEA_UNSIGNED:
+        unsigned_chars = 1;
+        /* fallthrough */
+    case EXT2_HASH_TEA:
+        while (1) {
+            str2hashbuf(name, len, in, 4, unsigned_chars);
+            tea_transform(buf, in);
+            if (len <= 16)
+                break;
+            len -= 16;
+            name += 16;
+        }
+        hash = buf[0];
+        break;
+    }
+
+    hash &= ~1;
+    if (hash == (0x7fffffff << 1))
+        hash = (0x7fffffff - 1) << 1;
+    return hash;
+}
+
+/*
+ * Entrada de un nodo de índice a seguir: la última cuyo hash es <= hash.
+ * 'entries' apunta a countlimit (entrada 0, de hash implícito 0).
+ */
+static struct ext2_dx_entry *dx_search(struct ext2_dx_entry *entries, u32 count, u32 hash)
+{
+    struct ext2_dx_entry *p = entries + 1;
+    struct ext2_dx_entry *q = entries + count - 1;
+    struct ext2_dx_entry *m;
+
+    while (p <= q) {
+        m = p + (q - p) / 2;
+        if (m->hash > hash)
+            q = m - 1;
+        else
+            p = m + 1;
+    }
+
+    return p - 1;
+}
+
+/*
+ * Valida la cabecera de un nodo de índice. Devuelve el número de
+ * entradas o 0 si el nodo no es coherente.
+ */
+static u32 dx_node_count(struct ext2_dx_entry *entries, char *block_end)
+{
+    struct ext2_dx_countlimit *cl = (struct ext2_dx_countlimit *)entries;
+
+    if (cl->count == 0 || cl->count > cl->limit ||
+        (char *)(entries + cl->limit) > block_end)
+        return 0;
+    return cl->count;
+}
+
+/*
+ * Busca un nombre en un directorio indexado: baja por los nodos de
+ * índice según el hash y recorre solo la hoja resultante (y las
+ * siguientes si continúan una colisión de hash).
+ *
+ * Devuelve 0 con *ino = inodo (0 si no existe), -1 si hay un error de
+ * lectura, o 1 si el índice no es utilizable y hay que recorrer el
+ * directorio linealmente.
+ */
+int ext2_htree_find(struct ext2_inode *dir_inode, const char *name, u32 len, u32 *ino)
+{
+    struct ext2_dx_root_info *info;
+    struct ext2_dx_entry *entries, *at;
+    struct ext2_dx_entry *parent = NULL, *parent_end = NULL;
+    struct ext2_match m;
+    struct buf *bh, *next_bh, *parent_bh = NULL;
+    char *data;
+    u32 pblock, hash, count, levels, block;
+    u32 seed[4];
+    int version, ret;
+
+    if (ext2_bmap(dir_inode, 0, &pblock) != 0)
+        return -1;
+    if (pblock == 0)
+        return 1;
+
+    data = ext2_get_block(pblock, &bh);
+    if (data == NULL)
+        return -1;
+
+    /* La información del índice va tras las entradas "." (12 bytes) y
+       ".." (cabecera de 8 bytes + nombre de 4) */
+    info = (struct ext2_dx_root_info *)(data + 24);
+    if (info->reserved_zero != 0 || info->info_length != 8 ||
+        info->indirect_levels >= EXT2_HTREE_MAX_LEVELS ||
+        info->hash_version > EXT2_HASH_TEA) {
+        ext2_put_block(bh);
+        return 1;
+    }
+
+    version = info->hash_version;
+    if (ext2_fs.superblock.s_flags & EXT2_FLAGS_UNSIGNED_HASH)
+        version += EXT2_HASH_LEGACY_UNSIGNED;
+    memcpy(seed, ext2_fs.superblock.s_hash_seed, sizeof(seed));
+    hash = ext2_dirhash(name, len, version, seed);
+
+    levels = info->indirect_levels;
+    entries = (struct ext2_dx_entry *)((char *)info + info->info_length);
+
+    /* Bajar por los nodos intermedios. Se retiene el padre de la hoja
+       para seguir una colisión que pase al nodo siguiente */
+    while (1) {
+        count = dx_node_count(entries, data + ext2_fs.block_size);
+        if (count == 0) {
+            ext2_put_block(bh);
+            ext2_put_block(parent_bh);
+            return 1;
+        }
+
+        at = dx_search(entries, count, hash);
+        if (levels == 0)
+            break;
+
+        if (ext2_bmap(dir_inode, at->block & 0x0FFFFFFF, &pblock) != 0 || pblock == 0) {
+            ext2_put_block(bh);
+            ext2_put_block(parent_bh);
+            return -1;
+        }
+        data = ext2_get_block(pblock, &next_bh);
+        if (data == NULL) {
+            ext2_put_block(bh);
+            ext2_put_block(parent_bh);
+            return -1;
+        }
+        ext2_put_block(parent_bh);
+        parent_bh = bh;
+        parent = at;
+        parent_end = entries + count;
+        bh = next_bh;
+
+        /* Los nodos intermedios empiezan con una entrada vacía de 8 bytes */
+        entries = (struct ext2_dx_entry *)(data + 8);
+        levels--;
+    }
+
+    m.name = name;
+    m.len = len;
+    m.ino = 0;
+
+    /* Recorrer la hoja; si el nombre no está y la entrada siguiente tiene
+       el mismo hash (bit 0 = continuación), seguir en su hoja. Al final
+       del nodo la entrada siguiente es la del padre, y se sigue por el
+       principio del nodo al que apunta */
+    while (1) {
+        block = at->block & 0x0FFFFFFF;
+        ret = ext2_dir_scan_block(dir_inode, block, ext2_match_actor, &m);
+        if (ret != 0)
+            break;
+
+        at++;
+        if (at < entries + count) {
+            if ((at->hash & ~1) != hash)
+                break;
+            continue;
+        }
+
+        if (parent == NULL || ++parent >= parent_end || (parent->hash & ~1) != hash)
+            break;
+        if (ext2_bmap(dir_inode, parent->block & 0x0FFFFFFF, &pblock) != 0 || pblock == 0) {
+            ret = -1;
+            break;
+        }
+        data = ext2_get_block(pblock, &next_bh);
+        if (data == NULL) {
+            ret = -1;
+            break;
+        }
+        ext2_put_block(bh);
+        bh = next_bh;
+        entries = (struct ext2_dx_entry *)(data + 8);
+        count = dx_node_count(entries, data + ext2_fs.block_size);
+        if (count == 0) {
+            ext2_put_block(bh);
+            ext2_put_block(parent_bh);
+            return 1;
+        }
+        at = entries;
+    }
+
+    ext2_put_block(parent_bh);
+    ext2_put_block(bh);
+    if (ret < 0)
+        return -1;
+
+    *ino = m.ino;
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef EXT2_HTREE_H_
+#define EXT2_HTREE_H_
+
+#include "types.h"
+#include "ext2.h"
+
+/* Versiones de la función hash de directorio (dx_root_info.hash_version) */
+#define EXT2_HASH_LEGACY            0
+#define EXT2_HASH_HALF_MD4          1
+#define EXT2_HASH_TEA               2
+#define EXT2_HASH_LEGACY_UNSIGNED   3
+#define EXT2_HASH_HALF_MD4_UNSIGNED 4
+#define EXT2_HASH_TEA_UNSIGNED      5
+
+/* Niveles de índice por debajo de la raíz que se soportan */
+#define EXT2_HTREE_MAX_LEVELS       2
+
+/* Cabecera del bloque 0 de un directorio indexado: tras las entradas
+   "." y ".." (que ocupan el bloque entero para ext2 sin índice) */
+struct ext2_dx_root_info {
+    u32 reserved_zero;
+    u8 hash_version;
+    u8 info_length;             /* 8 */
+    u8 indirect_levels;         /* Niveles de índice por debajo de la raíz */
+    u8 unused_flags;
+} __attribute__ ((packed));
+
+/* Primera entrada de cada nodo: capacidad y entradas usadas */
+struct ext2_dx_countlimit {
+    u16 limit;
+    u16 count;
+} __attribute__ ((packed));
+
+/* Entrada de índice: hash mínimo y bloque lógico del hijo. La primera
+   entrada de un nodo comparte espacio con countlimit y su hash es 0 */
+struct ext2_dx_entry {
+    u32 hash;
+    u32 block;
+} __attribute__ ((packed));
+
+/* Funciones */
+u32 ext2_dirhash(const char *name, u32 len, int version, u32 *seed);
+int ext2_htree_find(struct ext2_inode *dir_inode, const char *name, u32 len, u32 *ino);
+
+#endif
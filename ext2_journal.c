@@ -0,0 +1,774 @@
+#include "ext2.h"
+#include "ext2_journal.h"
+#include "screen.h"
+#include "mm.h"
+#include "lib.h"
+#include "bcache.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Journal compatible con ext3 en modo "ordered". Los metadatos que se
+ * modifican quedan retenidos en la caché de bloques (B_PINNED) hasta el
+ * commit de su transacción. En el commit se escriben primero los datos
+ * en su sitio y después, seguidos en el registro, las copias de los
+ * metadatos y el bloque de commit. Una transacción agrupa todas las
+ * operaciones de un periodo del flusher (group commit); los metadatos
+ * llegan a su sitio después, con el write-back normal. Al montar se
+ * reproducen las transacciones completas que queden en el registro.
+ */
+
+struct ext2_journal ext2_journal;
+
+/* Pasadas por el registro al recuperarlo */
+#define JBD_PASS_SCAN       0   /* Buscar la última transacción completa */
+#define JBD_PASS_REVOKE     1   /* Recoger las revocaciones */
+#define JBD_PASS_REPLAY     2   /* Copiar los bloques a su sitio */
+
+/* Revocación leída del registro: 'block' no se reproduce en las
+   transacciones hasta 'sequence' incluida */
+struct jbd_revoke_record {
+    u32 block;
+    u32 sequence;
+};
+
+static struct jbd_revoke_record *revoke_table = NULL;
+static u32 revoke_count = 0;
+
+static u32 jbd_be32(u32 x)
+{
+    return (x >> 24) | ((x >> 8) & 0xFF00) | ((x << 8) & 0xFF0000) | (x << 24);
+}
+
+/* Siguiente bloque del registro, volviendo al principio tras el último */
+static u32 jbd_next(u32 block)
+{
+    block++;
+    if (block >= ext2_journal.last)
+        block = ext2_journal.first;
+    return block;
+}
+
+static u32 jbd_bmap(u32 lblock)
+{
+    u32 pblock;
+
+    if (ext2_bmap(&ext2_journal.inode->raw, lblock, &pblock) != 0)
+        return 0;
+    return pblock;
+}
+
+/*
+ * Lee o escribe 'count' bloques seguidos del journal, con una petición
+ * por cada racha físicamente contigua (normalmente una)
+ */
+static int jbd_io(int cmd, u32 lblock, u32 count, char *data)
+{
+    u32 sectors = ext2_fs.block_size / BLK_SECTOR_SIZE;
+    u32 start, run, i;
+    char *p;
+    int error;
+
+    for (i = 0; i < count; i += run) {
+        start = jbd_bmap(lblock + i);
+        if (start == 0) {
+            print("ext2   : ERROR - Journal block not mapped\n");
+            return -1;
+        }
+        for (run = 1; i + run < count; run++) {
+            if (jbd_bmap(lblock + i + run) != start + run)
+                break;
+        }
+
+        p = data + i * ext2_fs.block_size;
+        if (cmd == BLK_WRITE)
+            error = blk_write(ext2_fs.dev, start * sectors, run * sectors, p);
+        else
+            error = blk_read(ext2_fs.dev, start * sectors, run * sectors, p);
+        if (error != 0) {
+            print("ext2   : ERROR - Journal I/O failed\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void jbd_header(char *block, u32 type, u32 sequence)
+{
+    struct jbd_header *h = (struct jbd_header *)block;
+
+    memset(block, 0, ext2_fs.block_size);
+    h->h_magic = jbd_be32(JBD_MAGIC_NUMBER);
+    h->h_blocktype = jbd_be32(type);
+    h->h_sequence = jbd_be32(sequence);
+}
+
+/*
+ * Escribe el superbloque del journal: el registro empieza en 'start'
+ * con la transacción 'sequence' (start = 0: no hay nada que reproducir)
+ */
+static int jbd_write_super(u32 start, u32 sequence)
+{
+    struct jbd_superblock *jsb = (struct jbd_superblock *)ext2_journal.sb;
+
+    jsb->s_start = jbd_be32(start);
+    jsb->s_sequence = jbd_be32(sequence);
+    ext2_journal.disk_start = start;
+    return jbd_io(BLK_WRITE, 0, 1, ext2_journal.sb);
+}
+
+/* Bloques de registro de una transacción con 'bufs' metadatos y
+   'revoked' revocaciones: descriptores, copias, revocaciones y commit */
+static u32 jbd_transaction_blocks(u32 bufs, u32 revoked)
+{
+    u32 tags = (ext2_fs.block_size - sizeof(struct jbd_header) - 16) / sizeof(struct jbd_block_tag);
+    u32 records = (ext2_fs.block_size - sizeof(struct jbd_revoke_header)) / 4;
+
+    return bufs + (bufs + tags - 1) / tags + (revoked + records - 1) / records + 1;
+}
+
+/* Bloques libres del registro entre 'head' y el inicio en el disco */
+static u32 jbd_free_blocks(void)
+{
+    struct ext2_journal *j = &ext2_journal;
+
+    if (j->head < j->disk_start)
+        return j->disk_start - j->head;
+    return (j->last - j->first) - (j->head - j->disk_start);
+}
+
+/*
+ * Tanda de escritura del registro: los bloques se copian en 'stage' y
+ * se escriben seguidos al llenarla o al llegar al final del registro
+ */
+static int jbd_stage_flush(void)
+{
+    struct ext2_journal *j = &ext2_journal;
+    int error = 0;
+
+    if (j->stage_count > 0) {
+        error = jbd_io(BLK_WRITE, j->stage_start, j->stage_count, j->stage);
+        j->log_blocks += j->stage_count;
+        j->stage_start += j->stage_count;
+        if (j->stage_start >= j->last)
+            j->stage_start = j->first;
+        j->stage_count = 0;
+    }
+    return error;
+}
+
+static char *jbd_stage_block(void)
+{
+    struct ext2_journal *j = &ext2_journal;
+
+    if (j->stage_count == EXT2_JOURNAL_BATCH || j->stage_start + j->stage_count >= j->last) {
+        if (jbd_stage_flush() != 0)
+            return NULL;
+    }
+    return j->stage + (j->stage_count++) * ext2_fs.block_size;
+}
+
+/*
+ * Suelta los metadatos retenidos: tras un commit pasan a ser bloques
+ * sucios normales; si el journal ha fallado se descartan para no
+ * escribir en su sitio metadatos sin confirmar
+ */
+static void jbd_release(int committed)
+{
+    struct ext2_journal *j = &ext2_journal;
+    struct buf *bh;
+    u32 i;
+
+    for (i = 0; i < j->nr_bufs; i++) {
+        bh = j->bufs[i];
+        bh->flags &= ~B_PINNED;
+        if (committed)
+            bdirty(bh);
+        brelse(bh);
+    }
+    j->nr_bufs = 0;
+    j->nr_revoked = 0;
+
+    for (i = 0; i < j->nr_frozen; i++)
+        kfree(j->frozen[i].data);
+    j->nr_frozen = 0;
+    j->commit_wanted = 0;
+}
+
+/*
+ * Confirma la transacción en curso
+ */
+static int jbd_commit(void)
+{
+    struct ext2_journal *j = &ext2_journal;
+    struct jbd_superblock *jsb = (struct jbd_superblock *)j->sb;
+    u32 bs = ext2_fs.block_size;
+    u32 tags = (bs - sizeof(struct jbd_header) - 16) / sizeof(struct jbd_block_tag);
+    u32 records = (bs - sizeof(struct jbd_revoke_header)) / 4;
+    u32 blocks, start, offset, flags, i, k, n;
+    struct jbd_revoke_header *r;
+    struct jbd_block_tag *tag;
+    struct buf *bh;
+    char *desc, *slot;
+    int error = 0;
+
+    /* Modo ordered: los datos llegan a su sitio antes que los metadatos
+       que los apuntan. Se escribe todo lo no retenido, y con ello los
+       metadatos de las transacciones anteriores */
+    if (bcache_flush(ext2_fs.dev, 0) != 0)
+        error = -1;
+
+    blocks = jbd_transaction_blocks(j->nr_bufs, j->nr_revoked);
+    if (j->disk_start == 0) {
+        j->head = j->first;
+    } else if (blocks > jbd_free_blocks()) {
+        /* Todo lo anterior a la última transacción ya está en su sitio
+           o se vuelve a escribir en esta: el registro puede empezar ahí */
+        if (jbd_write_super(j->last_start, j->last_sequence) != 0 || blocks > jbd_free_blocks())
+            error = -1;
+    }
+
+    start = j->head;
+    j->stage_start = start;
+    j->stage_count = 0;
+
+    /* Descriptores, cada uno seguido de las copias de sus bloques */
+    for (i = 0; i < j->nr_bufs && error == 0; i += n) {
+        n = j->nr_bufs - i;
+        if (n > tags)
+            n = tags;
+
+        desc = jbd_stage_block();
+        if (desc == NULL) {
+            error = -1;
+            break;
+        }
+        jbd_header(desc, JBD_DESCRIPTOR_BLOCK, j->sequence);
+        offset = sizeof(struct jbd_header);
+        for (k = 0; k < n; k++) {
+            bh = j->bufs[i + k];
+            flags = k > 0 ? JBD_FLAG_SAME_UUID : 0;
+            if (k == n - 1)
+                flags |= JBD_FLAG_LAST_TAG;
+            if (*(u32 *)bh->data == jbd_be32(JBD_MAGIC_NUMBER))
+                flags |= JBD_FLAG_ESCAPE;
+
+            tag = (struct jbd_block_tag *)(desc + offset);
+            tag->t_blocknr = jbd_be32(bh->block);
+            tag->t_flags = jbd_be32(flags);
+            offset += sizeof(struct jbd_block_tag);
+            if (k == 0) {
+                memcpy(desc + offset, jsb->s_uuid, 16);
+                offset += 16;
+            }
+        }
+
+        for (k = 0; k < n; k++) {
+            bh = j->bufs[i + k];
+            slot = jbd_stage_block();
+            if (slot == NULL) {
+                error = -1;
+                break;
+            }
+            memcpy(slot, bh->data, bs);
+            /* Un bloque que empieza como una cabecera se guarda sin ella */
+            if (*(u32 *)slot == jbd_be32(JBD_MAGIC_NUMBER))
+                *(u32 *)slot = 0;
+        }
+    }
+
+    /* Bloques liberados: que la recuperación no pise su nuevo contenido */
+    for (i = 0; i < j->nr_revoked && error == 0; i += n) {
+        n = j->nr_revoked - i;
+        if (n > records)
+            n = records;
+
+        slot = jbd_stage_block();
+        if (slot == NULL) {
+            error = -1;
+            break;
+        }
+        jbd_header(slot, JBD_REVOKE_BLOCK, j->sequence);
+        r = (struct jbd_revoke_header *)slot;
+        r->r_count = jbd_be32(sizeof(struct jbd_revoke_header) + n * 4);
+        for (k = 0; k < n; k++)
+            ((u32 *)(r + 1))[k] = jbd_be32(j->revoked[i + k]);
+    }
+
+    if (error == 0 && jbd_stage_flush() != 0)
+        error = -1;
+
+    /* Con el journal vacío, el superbloque debe apuntar a la transacción
+       antes de que el commit la dé por buena */
+    if (error == 0 && j->disk_start == 0 && jbd_write_super(start, j->sequence) != 0)
+        error = -1;
+
+    /* El commit va aparte: solo vale si todo lo anterior está escrito */
+    if (error == 0) {
+        slot = jbd_stage_block();
+        if (slot == NULL) {
+            error = -1;
+        } else {
+            jbd_header(slot, JBD_COMMIT_BLOCK, j->sequence);
+            if (jbd_stage_flush() != 0)
+                error = -1;
+        }
+    }
+
+    if (error != 0) {
+        print("ext2   : ERROR - Journal commit failed, filesystem is now read-only\n");
+        jbd_release(0);
+        j->active = 0;
+        ext2_fs.readonly = 1;
+        return -1;
+    }
+
+    jbd_release(1);
+    j->head = j->stage_start;
+    j->last_start = start;
+    j->last_sequence = j->sequence;
+    j->sequence++;
+    j->commits++;
+    return 0;
+}
+
+/* Una transacción que ya no cabe en el registro, o cuyas revocaciones
+   no caben en su tabla (max_blocks entradas), se confirma aunque haya
+   operaciones a medias */
+static void jbd_check_full(u32 bufs, u32 revoked)
+{
+    if (jbd_transaction_blocks(bufs, revoked) <= ext2_journal.max_blocks &&
+        revoked <= ext2_journal.max_blocks)
+        return;
+
+    if (ext2_journal.handles > 0)
+        print("ext2   : WARNING - Journal transaction too large, committing early\n");
+    jbd_commit();
+}
+
+/*
+ * Añade un metadato modificado a la transacción en curso. Sin journal
+ * se marca sucio sin más.
+ */
+void ext2_journal_dirty(struct buf *bh)
+{
+    struct ext2_journal *j = &ext2_journal;
+
+    if (!j->active) {
+        bdirty(bh);
+        return;
+    }
+    if (bh->flags & B_PINNED)
+        return;
+
+    bh->flags |= B_PINNED;
+    bh->refcount++;
+    j->bufs[j->nr_bufs++] = bh;
+
+    if (jbd_transaction_blocks(j->nr_bufs, j->nr_revoked) > j->soft_blocks)
+        j->commit_wanted = 1;
+    jbd_check_full(j->nr_bufs + 1, j->nr_revoked);
+}
+
+/*
+ * Revoca un bloque de metadatos liberado: sus copias en el registro no
+ * se reproducirán sobre lo que se escriba después en él
+ */
+void ext2_journal_revoke(u32 block)
+{
+    struct ext2_journal *j = &ext2_journal;
+
+    if (!j->active)
+        return;
+
+    j->revoked[j->nr_revoked++] = block;
+    jbd_check_full(j->nr_bufs, j->nr_revoked + 1);
+}
+
+/*
+ * Guarda una copia de un bitmap de bloques antes de liberar bloques en
+ * él. Hasta el commit los bloques liberados no se reasignan: si no, sus
+ * datos nuevos podrían llegar al disco mientras, tras una caída, siguen
+ * perteneciendo a su dueño anterior.
+ */
+void ext2_journal_freeze(struct buf *bh)
+{
+    struct ext2_journal *j = &ext2_journal;
+    u8 *data;
+    u32 i;
+
+    if (!j->active)
+        return;
+
+    for (i = 0; i < j->nr_frozen; i++) {
+        if (j->frozen[i].block == bh->block)
+            return;
+    }
+    if (j->nr_frozen == ext2_fs.groups_count)
+        return;
+
+    data = (u8 *)kmalloc(ext2_fs.block_size);
+    if (data == NULL)
+        return;
+    memcpy(data, bh->data, ext2_fs.block_size);
+    j->frozen[j->nr_frozen].block = bh->block;
+    j->frozen[j->nr_frozen].data = data;
+    j->nr_frozen++;
+}
+
+/*
+ * Bitmap en el que buscar bloques libres: la copia congelada si la hay
+ * (ext2_claim_block marca los bloques en las dos)
+ */
+u8 *ext2_journal_bitmap(struct buf *bh)
+{
+    struct ext2_journal *j = &ext2_journal;
+    u32 i;
+
+    for (i = 0; i < j->nr_frozen; i++) {
+        if (j->frozen[i].block == bh->block)
+            return j->frozen[i].data;
+    }
+    return (u8 *)bh->data;
+}
+
+/*
+ * Una operación empieza/termina de modificar metadatos. Las
+ * transacciones solo se confirman entre operaciones.
+ */
+void ext2_journal_start(void)
+{
+    ext2_journal.handles++;
+}
+
+void ext2_journal_stop(void)
+{
+    if (ext2_journal.handles > 0)
+        ext2_journal.handles--;
+    if (ext2_journal.handles == 0 && ext2_journal.commit_wanted)
+        ext2_journal_commit();
+}
+
+/*
+ * Confirma la transacción en curso, o lo deja pedido si hay una
+ * operación a medias
+ */
+int ext2_journal_commit(void)
+{
+    struct ext2_journal *j = &ext2_journal;
+
+    if (!j->active)
+        return 0;
+    if (j->handles > 0) {
+        j->commit_wanted = 1;
+        return 0;
+    }
+    if (j->nr_bufs == 0 && j->nr_revoked == 0)
+        return 0;
+    return jbd_commit();
+}
+
+/*
+ * Confirma lo pendiente, escribe todos los metadatos en su sitio y deja
+ * el journal vacío: el sistema de archivos queda consistente sin él
+ */
+int ext2_journal_checkpoint(void)
+{
+    struct ext2_journal *j = &ext2_journal;
+
+    if (!j->active)
+        return 0;
+    if (ext2_journal_commit() != 0)
+        return -1;
+    if (j->nr_bufs > 0)
+        return 0;
+
+    if (bcache_flush(ext2_fs.dev, 0) != 0)
+        return -1;
+    if (j->disk_start != 0 && jbd_write_super(0, j->sequence) != 0)
+        return -1;
+    j->head = j->first;
+    return 0;
+}
+
+static int jbd_revoked(u32 block, u32 sequence)
+{
+    u32 i;
+
+    for (i = 0; i < revoke_count; i++) {
+        if (revoke_table[i].block == block && (int)(revoke_table[i].sequence - sequence) >= 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Recorre el registro desde su inicio. SCAN deja en *end la transacción
+ * siguiente a la última completa; las otras pasadas se detienen ahí.
+ */
+static int jbd_pass(int pass, char *buf, char *data, u32 *end)
+{
+    struct ext2_journal *j = &ext2_journal;
+    struct jbd_header *h = (struct jbd_header *)buf;
+    struct jbd_revoke_header *r;
+    struct jbd_block_tag *tag;
+    u32 block = j->disk_start;
+    u32 sequence = j->sequence;
+    u32 offset, flags, target, count;
+    struct buf *bh;
+
+    while (pass == JBD_PASS_SCAN || sequence != *end) {
+        if (jbd_io(BLK_READ, block, 1, buf) != 0)
+            return -1;
+        if (jbd_be32(h->h_magic) != JBD_MAGIC_NUMBER || jbd_be32(h->h_sequence) != sequence)
+            break;
+        block = jbd_next(block);
+
+        switch (jbd_be32(h->h_blocktype)) {
+        case JBD_DESCRIPTOR_BLOCK:
+            offset = sizeof(struct jbd_header);
+            while (offset + sizeof(struct jbd_block_tag) <= ext2_fs.block_size) {
+                tag = (struct jbd_block_tag *)(buf + offset);
+                flags = jbd_be32(tag->t_flags);
+                target = jbd_be32(tag->t_blocknr);
+
+                if (pass == JBD_PASS_REPLAY && !jbd_revoked(target, sequence)) {
+                    if (jbd_io(BLK_READ, block, 1, data) != 0)
+                        return -1;
+                    if (flags & JBD_FLAG_ESCAPE)
+                        *(u32 *)data = jbd_be32(JBD_MAGIC_NUMBER);
+                    bh = bget(ext2_fs.dev, target, ext2_fs.block_size);
+                    if (bh == NULL)
+                        return -1;
+                    memcpy(bh->data, data, ext2_fs.block_size);
+                    bdirty(bh);
+                    brelse(bh);
+                    j->replayed++;
+                }
+                block = jbd_next(block);
+
+                offset += sizeof(struct jbd_block_tag);
+                if (!(flags & JBD_FLAG_SAME_UUID))
+                    offset += 16;
+                if (flags & JBD_FLAG_LAST_TAG)
+                    break;
+            }
+            break;
+
+        case JBD_COMMIT_BLOCK:
+            sequence++;
+            if (pass == JBD_PASS_SCAN)
+                *end = sequence;
+            break;
+
+        case JBD_REVOKE_BLOCK:
+            r = (struct jbd_revoke_header *)buf;
+            count = jbd_be32(r->r_count);
+            if (count > ext2_fs.block_size)
+                count = ext2_fs.block_size;
+            if (pass == JBD_PASS_REPLAY)
+                break;
+            for (offset = sizeof(struct jbd_revoke_header); offset + 4 <= count; offset += 4) {
+                if (pass == JBD_PASS_REVOKE) {
+                    revoke_table[revoke_count].block = jbd_be32(*(u32 *)(buf + offset));
+                    revoke_table[revoke_count].sequence = sequence;
+                }
+                revoke_count++;
+            }
+            break;
+
+        default:
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reproduce las transacciones completas del registro y lo deja vacío
+ */
+static int jbd_recover(void)
+{
+    struct ext2_journal *j = &ext2_journal;
+    u32 end = j->sequence;
+    u32 records;
+    char *buf, *data;
+    int error = -1;
+
+    buf = (char *)kmalloc(ext2_fs.block_size);
+    data = (char *)kmalloc(ext2_fs.block_size);
+    if (buf == NULL || data == NULL)
+        goto out;
+
+    revoke_count = 0;
+    if (jbd_pass(JBD_PASS_SCAN, buf, data, &end) != 0)
+        goto out;
+
+    /* SCAN ha contado las revocaciones (también las de una transacción
+       incompleta): basta para la tabla */
+    records = revoke_count;
+    revoke_count = 0;
+    if (records > 0) {
+        revoke_table = (struct jbd_revoke_record *)kmalloc(records * sizeof(struct jbd_revoke_record));
+        if (revoke_table == NULL)
+            goto out;
+        if (jbd_pass(JBD_PASS_REVOKE, buf, data, &end) != 0)
+            goto out;
+    }
+
+    if (jbd_pass(JBD_PASS_REPLAY, buf, data, &end) != 0 || bcache_flush(ext2_fs.dev, 0) != 0)
+        goto out;
+
+    print("ext2   : journal replayed: ");
+    print_dec(end - j->sequence);
+    print(" transactions, ");
+    print_dec(j->replayed);
+    print(" blocks\n");
+
+    j->sequence = end;
+    error = jbd_write_super(0, end);
+
+out:
+    if (error != 0)
+        print("ext2   : ERROR - Journal recovery failed\n");
+    if (revoke_table != NULL)
+        kfree(revoke_table);
+    revoke_table = NULL;
+    if (buf != NULL)
+        kfree(buf);
+    if (data != NULL)
+        kfree(data);
+    return error;
+}
+
+/* Libera el estado del journal de un montaje anterior */
+static void jbd_reset(void)
+{
+    struct ext2_journal *j = &ext2_journal;
+
+    if (j->sb != NULL)
+        kfree(j->sb);
+    if (j->bufs != NULL)
+        kfree(j->bufs);
+    if (j->revoked != NULL)
+        kfree(j->revoked);
+    if (j->frozen != NULL)
+        kfree(j->frozen);
+    if (j->stage != NULL)
+        kfree(j->stage);
+    memset(j, 0, sizeof(struct ext2_journal));
+}
+
+/*
+ * Carga el journal del sistema de archivos montado (si tiene), lo
+ * recupera si quedó a medias y lo activa si se puede escribir.
+ * Devuelve 1 si se han reproducido transacciones (el superbloque y los
+ * descriptores de grupo se han vuelto a leer), 0 si no y -1 si hay un
+ * error.
+ */
+int ext2_journal_load(void)
+{
+    struct ext2_journal *j = &ext2_journal;
+    struct ext2_superblock *es = &ext2_fs.superblock;
+    struct jbd_superblock *jsb;
+    struct bcache_stats stats;
+    u32 type, blocks;
+    int replayed = 0;
+
+    jbd_reset();
+
+    if (!(es->s_feature_compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL))
+        return 0;
+
+    if (es->s_journal_inum == 0) {
+        print("ext2   : WARNING - External journal not supported, mounting read-only\n");
+        ext2_fs.readonly = 1;
+        return 0;
+    }
+
+    j->inode = ext2_iget(es->s_journal_inum);
+    j->sb = (char *)kmalloc(ext2_fs.block_size);
+    if (j->inode == NULL || j->sb == NULL || jbd_io(BLK_READ, 0, 1, j->sb) != 0) {
+        print("ext2   : ERROR - Cannot read the journal\n");
+        return -1;
+    }
+
+    jsb = (struct jbd_superblock *)j->sb;
+    type = jbd_be32(jsb->s_header.h_blocktype);
+    if (jbd_be32(jsb->s_header.h_magic) != JBD_MAGIC_NUMBER ||
+        (type != JBD_SUPERBLOCK_V1 && type != JBD_SUPERBLOCK_V2) ||
+        jbd_be32(jsb->s_blocksize) != ext2_fs.block_size) {
+        print("ext2   : ERROR - Invalid journal superblock\n");
+        return -1;
+    }
+    if (type == JBD_SUPERBLOCK_V2 &&
+        (jbd_be32(jsb->s_feature_incompat) & ~JBD_FEATURE_INCOMPAT_REVOKE)) {
+        print("ext2   : WARNING - Unsupported journal features, mounting read-only\n");
+        ext2_fs.readonly = 1;
+        return 0;
+    }
+
+    j->first = jbd_be32(jsb->s_first);
+    j->last = jbd_be32(jsb->s_maxlen);
+    j->sequence = jbd_be32(jsb->s_sequence);
+    j->disk_start = jbd_be32(jsb->s_start);
+    j->head = j->first;
+
+    if (j->disk_start != 0) {
+        if (ext2_fs.readonly) {
+            print("ext2   : WARNING - Journal needs recovery on a read-only device\n");
+            return 0;
+        }
+        if (jbd_recover() != 0)
+            return -1;
+        if (ext2_read_superblock() != 0 || ext2_read_group_desc() != 0)
+            return -1;
+        replayed = 1;
+    }
+
+    /* En memoria no hay caídas de las que recuperarse */
+    if (ext2_fs.readonly || blk_map(ext2_fs.dev, 0, 1) != NULL)
+        return replayed;
+
+    /* Una transacción nunca ocupa más de medio registro: así siempre
+       cabe detrás de la anterior (ver jbd_commit) */
+    j->max_blocks = (j->last - j->first - 1) / 2;
+    bcache_get_stats(&stats);
+    blocks = stats.budget / ext2_fs.block_size / 4;
+    j->soft_blocks = j->max_blocks / 2 < blocks ? j->max_blocks / 2 : blocks;
+
+    j->bufs = (struct buf **)kmalloc(j->max_blocks * sizeof(struct buf *));
+    j->revoked = (u32 *)kmalloc(j->max_blocks * sizeof(u32));
+    j->frozen = (struct ext2_journal_frozen *)kmalloc(ext2_fs.groups_count *
+                                                      sizeof(struct ext2_journal_frozen));
+    j->stage = (char *)kmalloc(EXT2_JOURNAL_BATCH * ext2_fs.block_size);
+    if (j->bufs == NULL || j->revoked == NULL || j->frozen == NULL || j->stage == NULL) {
+        print("ext2   : ERROR - Cannot allocate journal state\n");
+        return -1;
+    }
+
+    /* Las revocaciones necesitan la característica en un journal v2 */
+    if (type == JBD_SUPERBLOCK_V2 &&
+        !(jbd_be32(jsb->s_feature_incompat) & JBD_FEATURE_INCOMPAT_REVOKE)) {
+        jsb->s_feature_incompat |= jbd_be32(JBD_FEATURE_INCOMPAT_REVOKE);
+        if (jbd_write_super(0, j->sequence) != 0)
+            return -1;
+    }
+
+    /* Se marca en el disco que el journal está en uso, antes de que
+       pueda contener nada */
+    es->s_feature_incompat |= EXT3_FEATURE_INCOMPAT_RECOVER;
+    ext2_fs.sb_dirty = 1;
+    if (ext2_commit_meta() != 0 || bcache_flush(ext2_fs.dev, 0) != 0)
+        return -1;
+
+    j->active = 1;
+    print("ext2   : journal: ");
+    print_dec(j->last - j->first);
+    print(" blocks, sequence ");
+    print_dec(j->sequence);
+    print("\n");
+    return replayed;
+}
@@ -0,0 +1,114 @@
+#ifndef EXT2_JOURNAL_H_
+#define EXT2_JOURNAL_H_
+
+#include "types.h"
+#include "ext2.h"
+
+/* Journal de ext3 (formato JBD): todos los campos en disco son big-endian */
+#define JBD_MAGIC_NUMBER            0xC03B3998
+
+/* Tipos de bloque del registro (h_blocktype) */
+#define JBD_DESCRIPTOR_BLOCK        1   /* Etiquetas de los bloques que le siguen */
+#define JBD_COMMIT_BLOCK            2   /* Cierra una transacción */
+#define JBD_SUPERBLOCK_V1           3
+#define JBD_SUPERBLOCK_V2           4
+#define JBD_REVOKE_BLOCK            5   /* Bloques que no hay que reproducir */
+
+/* Flags de una etiqueta del descriptor */
+#define JBD_FLAG_ESCAPE             1   /* El bloque empezaba por JBD_MAGIC_NUMBER */
+#define JBD_FLAG_SAME_UUID          2   /* No le sigue el UUID del journal */
+#define JBD_FLAG_DELETED            4
+#define JBD_FLAG_LAST_TAG           8   /* Última etiqueta del descriptor */
+
+/* Características del journal (s_feature_incompat) que se entienden */
+#define JBD_FEATURE_INCOMPAT_REVOKE 0x00000001
+
+/* Bloques del registro que se escriben con una sola petición */
+#define EXT2_JOURNAL_BATCH          32
+
+struct jbd_header {
+    u32 h_magic;
+    u32 h_blocktype;
+    u32 h_sequence;             /* Transacción a la que pertenece */
+} __attribute__ ((packed));
+
+/* Bloque 0 del journal */
+struct jbd_superblock {
+    struct jbd_header s_header;
+    u32 s_blocksize;
+    u32 s_maxlen;               /* Bloques del journal */
+    u32 s_first;                /* Primer bloque del registro */
+    u32 s_sequence;             /* Primera transacción a reproducir */
+    u32 s_start;                /* Bloque donde empieza (0 = journal vacío) */
+    u32 s_errno;
+    /* Versión 2 */
+    u32 s_feature_compat;
+    u32 s_feature_incompat;
+    u32 s_feature_ro_compat;
+    u8 s_uuid[16];
+} __attribute__ ((packed));
+
+/* Etiqueta de un bloque en un descriptor. Si no lleva
+   JBD_FLAG_SAME_UUID le siguen los 16 bytes del UUID */
+struct jbd_block_tag {
+    u32 t_blocknr;              /* Destino del bloque en el sistema de archivos */
+    u32 t_flags;
+} __attribute__ ((packed));
+
+/* Cabecera de un bloque de revocación, seguida de números de bloque */
+struct jbd_revoke_header {
+    struct jbd_header r_header;
+    u32 r_count;                /* Bytes usados, cabecera incluida */
+} __attribute__ ((packed));
+
+/* Copia de un bitmap de bloques anterior a las liberaciones de la
+   transacción en curso: esos bloques no se reasignan hasta el commit */
+struct ext2_journal_frozen {
+    u32 block;
+    u8 *data;
+};
+
+/* Journal en memoria. El registro es circular entre first y last */
+struct ext2_journal {
+    u32 active;                 /* Los metadatos pasan por el journal */
+    struct ext2_inode_info *inode;
+    char *sb;                   /* Bloque 0 (struct jbd_superblock) */
+    u32 first;
+    u32 last;
+    u32 sequence;               /* Transacción en curso */
+    u32 head;                   /* Siguiente bloque libre del registro */
+    u32 disk_start;             /* s_start escrito en el disco (0 = vacío) */
+    u32 last_start;             /* Última transacción confirmada */
+    u32 last_sequence;
+    u32 handles;                /* Operaciones en curso (no se confirma a medias) */
+    u32 commit_wanted;
+    u32 max_blocks;             /* Bloques de registro de una transacción */
+    u32 soft_blocks;            /* A partir de aquí se confirma al acabar la operación */
+    struct buf **bufs;          /* Metadatos de la transacción (retenidos) */
+    u32 nr_bufs;
+    u32 *revoked;
+    u32 nr_revoked;
+    struct ext2_journal_frozen *frozen;
+    u32 nr_frozen;
+    char *stage;                /* EXT2_JOURNAL_BATCH bloques a escribir */
+    u32 stage_start;
+    u32 stage_count;
+    u32 commits;
+    u32 log_blocks;             /* Bloques escritos en el registro */
+    u32 replayed;               /* Bloques reproducidos al montar */
+};
+
+extern struct ext2_journal ext2_journal;
+
+/* Funciones */
+int ext2_journal_load(void);
+void ext2_journal_start(void);
+void ext2_journal_stop(void);
+void ext2_journal_dirty(struct buf *bh);
+void ext2_journal_revoke(u32 block);
+void ext2_journal_freeze(struct buf *bh);
+u8 *ext2_journal_bitmap(struct buf *bh);
+int ext2_journal_commit(void);
+int ext2_journal_checkpoint(void);
+
+#endif
@@ -0,0 +1,255 @@
+#include "ext2.h"
+#include "ext2_prewarm.h"
+#include "screen.h"
+#include "mm.h"
+#include "lib.h"
+#include "bcache.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Precarga de la caché al arrancar. Al montar solo se anota que hay
+ * trabajo; el bucle ocioso del kernel lee después el manifiesto
+ * EXT2_PREWARM_MANIFEST, resuelve las rutas (lo que ya deja en las
+ * cachés de dentries e inodos los directorios del camino y los inodos)
+ * y junta los bloques de datos en una lista ordenada. Los bloques se
+ * piden de forma asíncrona en tandas de EXT2_PREWARM_BATCH, de menor a
+ * mayor, para que la cola del disco los fusione en peticiones grandes.
+ * Nada de esto retrasa la llegada al planificador.
+ */
+
+static struct ext2_prewarm prewarm;
+
+static void ext2_prewarm_free(void)
+{
+    if (prewarm.blocks != NULL)
+        kfree(prewarm.blocks);
+    prewarm.blocks = NULL;
+    prewarm.count = 0;
+    prewarm.next = 0;
+}
+
+/* Ordena los bloques (Shell sort, como la caché) */
+static void ext2_prewarm_sort(u32 *v, u32 n)
+{
+    u32 gap, i, j, t;
+
+    for (gap = n / 2; gap > 0; gap /= 2) {
+        for (i = gap; i < n; i++) {
+            t = v[i];
+            for (j = i; j >= gap && v[j - gap] > t; j -= gap)
+                v[j] = v[j - gap];
+            v[j] = t;
+        }
+    }
+}
+
+/* Añade un bloque a la lista; 0 si ya está llena */
+static int ext2_prewarm_add(u32 block)
+{
+    if (prewarm.count == prewarm.max)
+        return 0;
+    if (block != 0 && block < ext2_fs.superblock.s_blocks_count)
+        prewarm.blocks[prewarm.count++] = block;
+    return 1;
+}
+
+/*
+ * Añade los bloques de un archivo o directorio. Los bloques de punteros
+ * se leen al resolverlos con ext2_bmap() y quedan ya en la caché.
+ */
+static void ext2_prewarm_path(const char *path)
+{
+    struct ext2_inode_info *ei;
+    u32 ino, nr_blocks, lblock, pblock;
+
+    ino = ext2_lookup(path);
+    if (ino == 0) {
+        print("ext2   : prewarm: ");
+        print((char *)path);
+        print(" not found\n");
+        return;
+    }
+
+    ei = ext2_iget(ino);
+    if (ei == NULL)
+        return;
+
+    if (EXT2_S_ISREG(ei->raw.i_mode) || EXT2_S_ISDIR(ei->raw.i_mode)) {
+        nr_blocks = (ei->raw.i_size + ext2_fs.block_size - 1) / ext2_fs.block_size;
+        for (lblock = 0; lblock < nr_blocks; lblock++) {
+            if (ext2_bmap(&ei->raw, lblock, &pblock) != 0)
+                break;
+            if (!ext2_prewarm_add(pblock))
+                break;
+        }
+    }
+    ext2_iput(ei);
+}
+
+/* Lee un número decimal; avanza '*p' */
+static u32 ext2_prewarm_number(char **p)
+{
+    u32 n = 0;
+
+    while (**p >= '0' && **p <= '9') {
+        n = n * 10 + (**p - '0');
+        (*p)++;
+    }
+    return n;
+}
+
+/* Interpreta una línea del manifiesto, ya terminada en '\0' */
+static void ext2_prewarm_line(char *line)
+{
+    u32 start, count, len;
+
+    while (*line == ' ' || *line == '\t')
+        line++;
+    len = strlen(line);
+    while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t' || line[len - 1] == '\r'))
+        line[--len] = '\0';
+
+    if (*line == '/') {
+        ext2_prewarm_path(line);
+    } else if (*line == '@') {
+        line++;
+        start = ext2_prewarm_number(&line);
+        count = 1;
+        if (*line == '+') {
+            line++;
+            count = ext2_prewarm_number(&line);
+        }
+        /* Solo bloques que existen y que caben en la lista */
+        if (start >= ext2_fs.superblock.s_blocks_count)
+            return;
+        if (count > ext2_fs.superblock.s_blocks_count - start)
+            count = ext2_fs.superblock.s_blocks_count - start;
+        if (count > prewarm.max - prewarm.count)
+            count = prewarm.max - prewarm.count;
+        while (count-- > 0 && ext2_prewarm_add(start++))
+            ;
+    }
+}
+
+/*
+ * Lee el manifiesto y prepara la lista ordenada de bloques. Sin
+ * manifiesto no hay nada que hacer.
+ */
+static void ext2_prewarm_load(void)
+{
+    struct bcache_stats stats;
+    struct ext2_file file;
+    char *text, *line, *p;
+    int n;
+    u32 i, j;
+
+    if (ext2_open(EXT2_PREWARM_MANIFEST, &file) != 0)
+        return;
+
+    text = (char *)kmalloc(EXT2_PREWARM_MAX_MANIFEST + 1);
+    if (text == NULL) {
+        ext2_close(&file);
+        return;
+    }
+    n = ext2_read(&file, text, EXT2_PREWARM_MAX_MANIFEST);
+    ext2_close(&file);
+    if (n <= 0) {
+        kfree(text);
+        return;
+    }
+    text[n] = '\0';
+
+    /* No más de lo que cabe en su parte de la caché de bloques */
+    bcache_get_stats(&stats);
+    prewarm.max = stats.budget / 100 * EXT2_PREWARM_BUDGET_RATIO / ext2_fs.block_size;
+    prewarm.blocks = (u32 *)kmalloc(prewarm.max * sizeof(u32));
+    if (prewarm.max == 0 || prewarm.blocks == NULL) {
+        ext2_prewarm_free();
+        kfree(text);
+        return;
+    }
+
+    for (line = p = text; ; p++) {
+        if (*p == '\n' || *p == '\0') {
+            if (*p == '\0') {
+                ext2_prewarm_line(line);
+                break;
+            }
+            *p = '\0';
+            ext2_prewarm_line(line);
+            line = p + 1;
+        }
+    }
+    kfree(text);
+
+    ext2_prewarm_sort(prewarm.blocks, prewarm.count);
+    for (i = j = 0; i < prewarm.count; i++) {
+        if (j == 0 || prewarm.blocks[j - 1] != prewarm.blocks[i])
+            prewarm.blocks[j++] = prewarm.blocks[i];
+    }
+    prewarm.count = j;
+    prewarm.state = EXT2_PREWARM_ISSUING;
+}
+
+/*
+ * Pide la siguiente tanda de bloques. Las lecturas terminan solas
+ * (B_BUSY); quien llegue antes espera a su bloque en bread().
+ */
+static void ext2_prewarm_issue(void)
+{
+    u32 end = prewarm.next + EXT2_PREWARM_BATCH;
+
+    if (end > prewarm.count)
+        end = prewarm.count;
+
+    for (; prewarm.next < end; prewarm.next++) {
+        if (bcache_prefetch(ext2_fs.dev, prewarm.blocks[prewarm.next], ext2_fs.block_size) != 0) {
+            prewarm.next = prewarm.count;
+            break;
+        }
+        prewarm.issued++;
+    }
+    blk_unplug(ext2_fs.dev);
+}
+
+/*
+ * Se llama al montar: deja la precarga para el bucle ocioso
+ */
+void ext2_prewarm_schedule(void)
+{
+    ext2_prewarm_free();
+    prewarm.issued = 0;
+    prewarm.state = EXT2_PREWARM_PENDING;
+
+    /* Un dispositivo en memoria no necesita precarga */
+    if (blk_map(ext2_fs.dev, 0, 1) != NULL)
+        prewarm.state = EXT2_PREWARM_OFF;
+}
+
+/*
+ * Una pasada de la precarga desde el bucle ocioso del kernel
+ */
+void ext2_prewarm_daemon(void)
+{
+    if (prewarm.state == EXT2_PREWARM_OFF || ext2_fs.dev == NULL)
+        return;
+
+    if (prewarm.state == EXT2_PREWARM_PENDING) {
+        prewarm.state = EXT2_PREWARM_OFF;
+        ext2_prewarm_load();
+        return;
+    }
+
+    ext2_prewarm_issue();
+    if (prewarm.next < prewarm.count)
+        return;
+
+    print("ext2   : prewarmed ");
+    print_dec(prewarm.issued);
+    print(" blocks from " EXT2_PREWARM_MANIFEST "\n");
+    ext2_prewarm_free();
+    prewarm.state = EXT2_PREWARM_OFF;
+}
@@ -0,0 +1,32 @@
+#ifndef EXT2_PREWARM_H_
+#define EXT2_PREWARM_H_
+
+#include "types.h"
+
+/* Manifiesto de precarga: una entrada por línea, '#' para comentarios.
+     /ruta          el inodo y los bloques del archivo o directorio
+     @bloque+n      n bloques del sistema de archivos desde 'bloque' */
+#define EXT2_PREWARM_MANIFEST       "/etc/prewarm"
+#define EXT2_PREWARM_MAX_MANIFEST   4096    /* Bytes del manifiesto que se leen */
+#define EXT2_PREWARM_BATCH          64      /* Bloques pedidos en cada pasada ociosa */
+#define EXT2_PREWARM_BUDGET_RATIO   50      /* % de la caché de bloques que puede ocupar */
+
+/* Estados de la precarga */
+#define EXT2_PREWARM_OFF        0       /* Nada pendiente */
+#define EXT2_PREWARM_PENDING    1       /* Montado: falta leer el manifiesto */
+#define EXT2_PREWARM_ISSUING    2       /* Pidiendo bloques por tandas */
+
+struct ext2_prewarm {
+    u32 state;
+    u32 *blocks;                /* Bloques a leer, ordenados y sin repetir */
+    u32 count;
+    u32 max;
+    u32 next;                   /* Primer bloque aún no pedido */
+    u32 issued;                 /* Bloques pedidos al disco */
+};
+
+/* Funciones */
+void ext2_prewarm_schedule(void);
+void ext2_prewarm_daemon(void);
+
+#endif
@@ -7,6 +7,16 @@
 #include "ext2_test.h"
 #include "screen.h"
 #include "mm.h"
+#include "bcache.h"
+#include "ext2_journal.h"
+#include "pagecache.h"
+#include "ext2_prewarm.h"
+#include "fs.h"
+#include "tmpfs.h"
+#include "vfs.h"
+#include "shrink.h"
+#include "io.h"
+#include "lib.h"
 
 #ifndef NULL
 #define NULL ((void*)0)
@@ -35,6 +45,18 @@ void ext2_test_list_callback(struct ext2_dir_entry *entry)
     print(")\n");
 }
 
+/*
+ * Test callback for listings with inode attributes
+ */
+void ext2_test_plus_callback(struct ext2_dirent_plus *entry)
+{
+    print("  ");
+    print(entry->name);
+    print(EXT2_S_ISDIR(entry->inode.i_mode) ? " (dir, " : " (file, ");
+    print_dec(entry->inode.i_size);
+    print(" bytes)\n");
+}
+
 /*
  * Test Ext2 filesystem functionality
  */
@@ -119,5 +141,774 @@ void ext2_test(void)
         print("Correctly reported file not found\n");
     }
     
+    /* Test 5: A repeated lookup must be served from the buffer cache */
+    print("\nTest 5: Repeated lookup through the buffer cache\n");
+    {
+        struct bcache_stats before, after;
+        
+        ext2_find_file("hello.txt", &test_inode);
+        bcache_get_stats(&before);
+        ext2_find_file("hello.txt", &test_inode);
+        bcache_get_stats(&after);
+        
+        if (after.misses == before.misses && after.hits > before.hits) {
+            print("Lookup served from cache\n");
+        } else {
+            print("ERROR: Lookup went to disk\n");
+        }
+        bcache_stats_dump();
+    }
+    
+    /* Test 6: The root inode stays pinned in the inode cache */
+    print("\nTest 6: Root inode pinned in the inode cache\n");
+    {
+        struct ext2_inode_info *root = ext2_iget(EXT2_ROOT_INODE);
+        
+        if (root != NULL && root == ext2_fs.root && root->refcount > 1) {
+            print("Root inode served from memory\n");
+        } else {
+            print("ERROR: Root inode not cached\n");
+        }
+        ext2_iput(root);
+    }
+    
+    /* Test 7: Read hello.txt through an open file in small chunks */
+    print("\nTest 7: Chunked reads through ext2_open/ext2_read\n");
+    {
+        struct ext2_file file;
+        char chunk[4];
+        int n, total = 0;
+        
+        if (ext2_open("hello.txt", &file) == 0) {
+            while ((n = ext2_read(&file, chunk, sizeof(chunk))) > 0) {
+                total += n;
+            }
+            print("Read ");
+            print_dec(total);
+            print(" bytes, readahead window ");
+            print_dec(file.ra_window);
+            print(" blocks\n");
+            
+            /* A positional read must return the same bytes as the
+               sequential ones, without moving the file position */
+            if (total > 2) {
+                char whole[64], part[64];
+                u32 len = total < (int)sizeof(whole) ? total : sizeof(whole);
+                
+                file.pos = 0;
+                ext2_read(&file, whole, len);
+                if (ext2_pread(file.inode, 2, part, len - 2) == (int)len - 2 &&
+                    memcmp(whole + 2, part, len - 2) == 0 && file.pos == len) {
+                    print("Positional read matches\n");
+                } else {
+                    print("ERROR: Positional read mismatch\n");
+                }
+            }
+            ext2_close(&file);
+        } else {
+            print("File hello.txt not found\n");
+        }
+    }
+    
+    /* Test 8: Multi-component paths and the dentry cache */
+    print("\nTest 8: Resolving /etc/motd and /bin/hello\n");
+    if (ext2_find_file("/etc/motd", &test_inode) == 0 &&
+        ext2_find_file("/bin/hello", &test_inode) == 0) {
+        print("Paths resolved\n");
+    } else {
+        print("ERROR: Path lookup failed\n");
+    }
+    if (ext2_find_file("/etc/nonexistent", &test_inode) != 0 &&
+        ext2_find_file("/etc/nonexistent", &test_inode) != 0) {
+        print("Missing name reported twice (negative entry)\n");
+    }
+    print("Dentry cache: ");
+    print_dec(ext2_fs.dcache_hits);
+    print(" hits, ");
+    print_dec(ext2_fs.dcache_misses);
+    print(" misses\n");
+
+    /* Test 9: Create, write, read back, truncate and unlink a file */
+    print("\nTest 9: Create/write/truncate/unlink /tmp_test.txt\n");
+    if (ext2_fs.readonly) {
+        print("Skipped: read-only device\n");
+    } else if (ext2_create("/tmp_test.txt") != 0) {
+        print("ERROR: Cannot create file\n");
+    } else {
+        static const char msg[] = "written by the kernel";
+        struct ext2_file file;
+        u32 free_blocks = ext2_fs.superblock.s_free_blocks_count;
+        char data[32];
+        int n;
+
+        if (ext2_open("/tmp_test.txt", &file) == 0) {
+            n = ext2_write(&file, msg, sizeof(msg) - 1);
+            file.pos = 0;
+            memset(data, 0, sizeof(data));
+            if (n == sizeof(msg) - 1 && ext2_read(&file, data, sizeof(data)) == n) {
+                print("Read back: ");
+                print(data);
+                print("\n");
+            } else {
+                print("ERROR: Write/read mismatch\n");
+            }
+
+            if (ext2_truncate(file.inode, 0) == 0 && file.inode->raw.i_blocks == 0) {
+                print("Truncated to 0 bytes\n");
+            }
+            ext2_close(&file);
+        }
+
+        if (ext2_unlink("/tmp_test.txt") == 0 && ext2_lookup("/tmp_test.txt") == 0 &&
+            ext2_fs.superblock.s_free_blocks_count >= free_blocks) {
+            print("Unlinked, blocks returned\n");
+        } else {
+            print("ERROR: Unlink failed\n");
+        }
+
+        /* Nothing may stay dirty in the cache after a sync */
+        {
+            struct bcache_stats stats;
+
+            if (ext2_sync() == 0) {
+                bcache_get_stats(&stats);
+                print(stats.dirty == 0 ? "Synced to disk\n" : "ERROR: Dirty buffers after sync\n");
+                /* A sync checkpoints the journal: nothing is left to replay */
+                if (ext2_journal.active) {
+                    print(ext2_journal.disk_start == 0 ? "Journal checkpointed\n" :
+                          "ERROR: Journal not empty after sync\n");
+                }
+            } else {
+                print("ERROR: Sync failed\n");
+            }
+        }
+    }
+
+    /* Test 10: Directory listing with inode attributes */
+    print("\nTest 10: Listing root directory with sizes (readdirplus)\n");
+    {
+        struct ext2_inode root_inode;
+        
+        if (ext2_read_inode(EXT2_ROOT_INODE, &root_inode) != 0 ||
+            ext2_readdirplus(&root_inode, ext2_test_plus_callback) != 0) {
+            print("ERROR: readdirplus failed\n");
+        }
+    }
+
+    /* Test 11: A write past the end leaves a hole that reads as zeros */
+    print("\nTest 11: Sparse file holes and SEEK_DATA/SEEK_HOLE\n");
+    if (ext2_fs.readonly) {
+        print("Skipped: read-only device\n");
+    } else if (ext2_create("/sparse_test") != 0) {
+        print("ERROR: Cannot create file\n");
+    } else {
+        struct ext2_file file;
+        u32 hole = 3 * ext2_fs.block_size;
+        u32 data_pos = 0, hole_pos = 0;
+        char data[16];
+        
+        if (ext2_open("/sparse_test", &file) == 0) {
+            file.pos = hole;
+            ext2_write(&file, "x", 1);
+            
+            memset(data, 0x55, sizeof(data));
+            if (ext2_pread(file.inode, hole - 8, data, sizeof(data)) == 9 &&
+                data[0] == 0 && data[7] == 0 && data[8] == 'x') {
+                print("Hole reads as zeros\n");
+            } else {
+                print("ERROR: Hole read mismatch\n");
+            }
+            
+            if (ext2_seek_data(file.inode, 0, EXT2_SEEK_DATA, &data_pos) == 0 && data_pos == hole &&
+                ext2_seek_data(file.inode, 0, EXT2_SEEK_HOLE, &hole_pos) == 0 && hole_pos == 0) {
+                print("Data found after the hole\n");
+            } else {
+                print("ERROR: SEEK_DATA/SEEK_HOLE mismatch\n");
+            }
+            ext2_close(&file);
+        }
+        ext2_unlink("/sparse_test");
+    }
+
+    /* Test 12: Page cache pages follow writes and truncation */
+    print("\nTest 12: Page cache\n");
+    if (ext2_fs.readonly) {
+        print("Skipped: read-only device\n");
+    } else if (ext2_create("/pcache_test") != 0) {
+        print("ERROR: Cannot create file\n");
+    } else {
+        struct ext2_file file;
+        struct pcache_page *page;
+        struct pcache_stats before, after;
+        
+        if (ext2_open("/pcache_test", &file) == 0) {
+            ext2_write(&file, "page cache", 10);
+            
+            pcache_get_stats(&before);
+            page = pcache_get(file.inode, 0);
+            if (page != NULL && pcache_get(file.inode, 0) == page &&
+                memcmp(page->data, "page cache", 10) == 0 && page->data[10] == 0) {
+                print("Page cached once and matches the file\n");
+            } else {
+                print("ERROR: Cached page mismatch\n");
+            }
+            pcache_get_stats(&after);
+            if (after.misses == before.misses + 1 && after.hits == before.hits + 1) {
+                print("Second lookup was a hit\n");
+            } else {
+                print("ERROR: Unexpected page cache hits/misses\n");
+            }
+            
+            file.pos = 0;
+            ext2_write(&file, "PAGE", 4);
+            if (page != NULL && memcmp(page->data, "PAGE cache", 10) == 0) {
+                print("Write updated the cached page\n");
+            } else {
+                print("ERROR: Cached page is stale after write\n");
+            }
+            
+            ext2_truncate(file.inode, 0);
+            if (pcache_lookup(file.inode, 0) == NULL && file.inode->pc_pages == 0) {
+                print("Truncate dropped the cached page\n");
+            } else {
+                print("ERROR: Page survived truncate\n");
+            }
+            ext2_close(&file);
+        }
+        ext2_unlink("/pcache_test");
+    }
+
+    /* Test 13: Direct reads bypass the caches */
+    print("\nTest 13: Direct I/O read\n");
+    if (ext2_fs.readonly) {
+        print("Skipped: read-only device\n");
+    } else if (ext2_create("/direct_test") != 0) {
+        print("ERROR: Cannot create file\n");
+    } else {
+        struct ext2_file file;
+        struct bcache_stats before, after;
+        char *direct = get_page_frame();
+        char cached[1024];
+        int i, n;
+        
+        if (direct != (char *)-1 && ext2_open("/direct_test", &file) == 0) {
+            for (i = 0; i < PAGE_SIZE; i++) {
+                direct[i] = 'a' + i % 26;
+            }
+            ext2_write(&file, direct, 2000);
+            ext2_sync();
+            
+            bcache_get_stats(&before);
+            memset(direct, 0, PAGE_SIZE);
+            file.pos = 1024;
+            file.flags = EXT2_O_DIRECT;
+            n = ext2_read(&file, direct, PAGE_SIZE);
+            bcache_get_stats(&after);
+            
+            file.flags = 0;
+            if (ext2_pread(file.inode, 1024, cached, 976) == 976 &&
+                n == 976 && memcmp(direct, cached, 976) == 0) {
+                print("Direct read matches the cached read\n");
+            } else {
+                print("ERROR: Direct read mismatch\n");
+            }
+            if (after.misses == before.misses && after.nr_buffers == before.nr_buffers) {
+                print("Block cache untouched\n");
+            } else {
+                print("ERROR: Direct read went through the block cache\n");
+            }
+            if (ext2_read_direct(file.inode, 1, direct, 512) == -1) {
+                print("Unaligned direct read refused\n");
+            } else {
+                print("ERROR: Unaligned direct read accepted\n");
+            }
+            ext2_close(&file);
+        }
+        if (direct != (char *)-1) {
+            release_page_frame((u32)direct);
+        }
+        ext2_unlink("/direct_test");
+    }
+
+    /* Test 14: The idle-loop prewarm reads the manifest's files ahead */
+    print("\nTest 14: Cache prewarm from " EXT2_PREWARM_MANIFEST "\n");
+    if (ext2_fs.readonly || blk_map(ext2_fs.dev, 0, 1) != NULL) {
+        print("Skipped: read-only or memory device\n");
+    } else if (ext2_lookup(EXT2_PREWARM_MANIFEST) != 0) {
+        print("Skipped: manifest already present\n");
+    } else if (ext2_create(EXT2_PREWARM_MANIFEST) != 0 || ext2_create("/prewarm_test") != 0) {
+        print("ERROR: Cannot create files\n");
+    } else {
+        struct ext2_file file;
+        struct bcache_stats before, after;
+        char block[64];
+        int i;
+        
+        if (ext2_open("/prewarm_test", &file) == 0) {
+            memset(block, 'w', sizeof(block));
+            for (i = 0; i < 64; i++) {
+                ext2_write(&file, block, sizeof(block));
+            }
+            ext2_close(&file);
+        }
+        if (ext2_open(EXT2_PREWARM_MANIFEST, &file) == 0) {
+            ext2_write(&file, "# test\n/prewarm_test\n", 22);
+            ext2_close(&file);
+        }
+        ext2_sync();
+        bcache_invalidate(ext2_fs.dev);
+        
+        ext2_prewarm_schedule();
+        ext2_prewarm_daemon();      /* Lee el manifiesto */
+        bcache_get_stats(&before);
+        for (i = 0; i < 8; i++) {
+            ext2_prewarm_daemon();
+        }
+        bcache_get_stats(&after);
+        
+        if (after.prefetches - before.prefetches == (4096 + ext2_fs.block_size - 1) / ext2_fs.block_size) {
+            print("File blocks prefetched\n");
+        } else {
+            print("ERROR: Unexpected number of prefetched blocks\n");
+        }
+        
+        if (ext2_open("/prewarm_test", &file) == 0) {
+            bcache_get_stats(&before);
+            ext2_read(&file, block, sizeof(block));
+            bcache_get_stats(&after);
+            if (after.misses == before.misses) {
+                print("First read hit the warm cache\n");
+            } else {
+                print("ERROR: First read missed the cache\n");
+            }
+            ext2_close(&file);
+        }
+        ext2_unlink("/prewarm_test");
+        ext2_unlink(EXT2_PREWARM_MANIFEST);
+    }
+
+    /* Test 15: tmpfs and ext2 behind the same mount table */
+    print("\nTest 15: tmpfs through the mount table\n");
+    if (fs_resolve(TMPFS_MOUNT_POINT, NULL) == NULL ||
+        fs_resolve(TMPFS_MOUNT_POINT, NULL) == fs_resolve("/", NULL)) {
+        print("Skipped: tmpfs not mounted\n");
+    } else {
+        struct fs_mount *mnt = NULL;
+        struct tmpfs_stats ts_before, ts_after;
+        struct fs_stat st;
+        char data[64], back[64];
+        u32 ino;
+        int i, ok;
+        
+        tmpfs_get_stats(&ts_before);
+        if (fs_lookup("/hello.txt", &mnt) != ext2_lookup("/hello.txt") || mnt == fs_resolve(TMPFS_MOUNT_POINT, NULL)) {
+            print("ERROR: Root path not served by ext2\n");
+        }
+        
+        if (fs_mkdir(TMPFS_MOUNT_POINT "/scratch") != 0 ||
+            fs_create(TMPFS_MOUNT_POINT "/scratch/data") != 0) {
+            print("ERROR: Cannot create tmpfs files\n");
+        } else {
+            ino = fs_lookup(TMPFS_MOUNT_POINT "/scratch/data", &mnt);
+            for (i = 0; i < 64; i++) {
+                data[i] = 'a' + i % 26;
+            }
+            
+            /* One write straddling a page boundary, one far away */
+            fs_write(mnt, ino, PAGE_SIZE - 32, data, 64);
+            fs_write(mnt, ino, 10 * PAGE_SIZE, data, 64);
+            fs_stat(mnt, ino, &st);
+            if (st.size == 10 * PAGE_SIZE + 64 && FS_S_ISREG(st.mode)) {
+                print("Size after sparse writes OK\n");
+            } else {
+                print("ERROR: Wrong size after writes\n");
+            }
+            
+            ok = fs_read(mnt, ino, PAGE_SIZE - 32, back, 64) == 64 && memcmp(back, data, 64) == 0;
+            fs_read(mnt, ino, 5 * PAGE_SIZE, back, 64);
+            for (i = 0; i < 64; i++) {
+                ok = ok && back[i] == 0;
+            }
+            print(ok ? "Data and holes read back\n" : "ERROR: Data mismatch\n");
+            
+            /* Shrink into the first page, then grow: the tail reads as zeros */
+            fs_truncate(mnt, ino, PAGE_SIZE - 16);
+            fs_truncate(mnt, ino, 2 * PAGE_SIZE);
+            fs_read(mnt, ino, PAGE_SIZE - 32, back, 64);
+            ok = memcmp(back, data, 16) == 0;
+            for (i = 16; i < 64; i++) {
+                ok = ok && back[i] == 0;
+            }
+            print(ok ? "Truncate zeroed the tail\n" : "ERROR: Stale data after truncate\n");
+            
+            if (fs_unlink(TMPFS_MOUNT_POINT "/scratch") == 0) {
+                print("ERROR: Removed a non-empty directory\n");
+            }
+        }
+        fs_unlink(TMPFS_MOUNT_POINT "/scratch/data");
+        fs_unlink(TMPFS_MOUNT_POINT "/scratch");
+        
+        /* An unlinked file stays readable through an open descriptor,
+           and its inode is not reused until the descriptor is closed */
+        {
+            int fd = vfs_open(TMPFS_MOUNT_POINT "/open", FS_O_RDWR | FS_O_CREAT);
+            
+            if (fd < 0 || vfs_write(fd, "kept", 4) != 4 ||
+                fs_unlink(TMPFS_MOUNT_POINT "/open") != 0 ||
+                fs_create(TMPFS_MOUNT_POINT "/other") != 0) {
+                print("ERROR: Cannot unlink an open tmpfs file\n");
+            } else {
+                fs_write(fs_resolve(TMPFS_MOUNT_POINT, NULL),
+                         fs_lookup(TMPFS_MOUNT_POINT "/other", NULL), 0, "new!", 4);
+                memset(back, 0, sizeof(back));
+                vfs_lseek(fd, 0, VFS_SEEK_SET);
+                if (vfs_read(fd, back, sizeof(back)) == 4 && memcmp(back, "kept", 4) == 0) {
+                    print("Unlinked file kept while open\n");
+                } else {
+                    print("ERROR: Open file lost after unlink\n");
+                }
+            }
+            vfs_close(fd);
+            fs_unlink(TMPFS_MOUNT_POINT "/other");
+        }
+        
+        tmpfs_get_stats(&ts_after);
+        if (ts_after.pages == ts_before.pages && ts_after.inodes == ts_before.inodes &&
+            fs_lookup(TMPFS_MOUNT_POINT "/scratch", NULL) == 0) {
+            print("All tmpfs memory released\n");
+        } else {
+            print("ERROR: tmpfs leaked pages or inodes\n");
+        }
+    }
+
+    /* Test 16: File descriptors keep the position across calls */
+    print("\nTest 16: File descriptors\n");
+    if (ext2_fs.readonly) {
+        print("Skipped: read-only filesystem\n");
+    } else {
+        char line[32], back[32];
+        int fd, fd2, i, n, ok;
+        
+        fd = vfs_open("/vfs_test", FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC);
+        if (fd < 0) {
+            print("ERROR: Cannot open with FS_O_CREAT\n");
+        } else {
+            /* Sequential writes land one after another */
+            ok = 1;
+            for (i = 0; i < 100; i++) {
+                memset(line, 'a' + i % 26, sizeof(line));
+                ok = ok && vfs_write(fd, line, sizeof(line)) == sizeof(line);
+            }
+            ok = ok && vfs_lseek(fd, 0, VFS_SEEK_CUR) == 100 * sizeof(line);
+            print(ok ? "Sequential writes advanced the position\n" : "ERROR: Write position wrong\n");
+            
+            /* Rewind and read it back in small steps */
+            ok = vfs_lseek(fd, 0, VFS_SEEK_SET) == 0;
+            for (i = 0; i < 100 && ok; i++) {
+                n = vfs_read(fd, back, sizeof(back));
+                ok = n == sizeof(back) && back[0] == 'a' + i % 26 && back[sizeof(back) - 1] == back[0];
+            }
+            ok = ok && vfs_read(fd, back, sizeof(back)) == 0;
+            print(ok ? "Sequential reads returned the data, then EOF\n" : "ERROR: Read back mismatch\n");
+            
+            /* A second descriptor has its own position; append goes to the end */
+            fd2 = vfs_open("/vfs_test", FS_O_WRONLY | FS_O_APPEND);
+            if (fd2 != fd + 1 || vfs_write(fd2, "END", 3) != 3 ||
+                vfs_lseek(fd, -3, VFS_SEEK_END) != 100 * sizeof(line) ||
+                vfs_read(fd, back, sizeof(back)) != 3 || memcmp(back, "END", 3) != 0) {
+                print("ERROR: Append through second descriptor\n");
+            } else {
+                print("Append through second descriptor OK\n");
+            }
+            
+            if (vfs_read(fd2, back, 1) != -1 || vfs_lseek(fd, -1, VFS_SEEK_SET) != -1) {
+                print("ERROR: Invalid access allowed\n");
+            }
+            /* The position must stay a valid int */
+            if (vfs_lseek(fd, VFS_MAX_POS, VFS_SEEK_SET) != VFS_MAX_POS ||
+                vfs_write(fd, line, 1) != -1 ||
+                vfs_lseek(fd, 1, VFS_SEEK_CUR) != -1 ||
+                vfs_lseek(fd, VFS_MAX_POS, VFS_SEEK_END) != -1) {
+                print("ERROR: Seek past VFS_MAX_POS allowed\n");
+            }
+            vfs_close(fd2);
+            vfs_close(fd);
+            if (vfs_close(fd) != -1 || vfs_open("/vfs_test", FS_O_RDONLY) != fd) {
+                print("ERROR: Descriptor not released\n");
+            }
+            vfs_close(fd);
+            ext2_unlink("/vfs_test");
+        }
+    }
+
+    /* Test 17: The shrinker frees the oldest unmapped page cache pages */
+    print("\nTest 17: Cache shrinker\n");
+    if (ext2_fs.readonly) {
+        print("Skipped: read-only filesystem\n");
+    } else {
+        struct pcache_stats before, after;
+        struct ext2_inode_info *ei;
+        char fill[PAGE_SIZE / 4];
+        u32 ino, freed, i;
+        int fd;
+        
+        fd = vfs_open("/shrink_test", FS_O_WRONLY | FS_O_CREAT | FS_O_TRUNC);
+        memset(fill, 's', sizeof(fill));
+        for (i = 0; fd >= 0 && i < 16 * 4; i++) {
+            vfs_write(fd, fill, sizeof(fill));
+        }
+        vfs_close(fd);
+        
+        ino = ext2_lookup("/shrink_test");
+        ei = ino != 0 ? ext2_iget(ino) : NULL;
+        if (ei == NULL) {
+            print("ERROR: Cannot create test file\n");
+        } else {
+            for (i = 0; i < 16; i++) {
+                pcache_get(ei, i);
+            }
+            pcache_get_stats(&before);
+            
+            /* Ask for 8 more free frames than there are now */
+            freed = shrink_caches(mm_free_frames + 8, 1);
+            pcache_get_stats(&after);
+            
+            if (freed == 8 && before.pages - after.pages == 8) {
+                print("Reclaimed exactly the frames asked for\n");
+            } else {
+                print("ERROR: Unexpected number of frames reclaimed\n");
+            }
+            if (pcache_lookup(ei, 15) != NULL) {
+                print("Most recent page kept\n");
+            } else {
+                print("ERROR: Shrinker dropped the most recent page\n");
+            }
+            ext2_iput(ei);
+        }
+        ext2_unlink("/shrink_test");
+    }
+
+    /* Test 18: The frame allocator never hands out kernel or unmapped RAM */
+    print("\nTest 18: Frame allocator\n");
+    if (mm_watermark[MM_WMARK_MIN] == 0) {
+        print("Skipped: memory manager not initialized\n");
+    } else {
+        u32 *frame, *chain = NULL;
+        u32 n, bad = 0, high = 0;
+        
+        /* Take frames until one lies past the kernel image and past 4MB */
+        for (n = 0; n < 1024 && high == 0; n++) {
+            frame = (u32 *)get_page_frame();
+            if (frame == (u32 *)-1) {
+                break;
+            }
+            if ((u32)frame < 0x20000 ||
+                ((u32)frame >= 0xA0000 && (u32)frame < KERNEL_END) ||
+                (u32)frame >= mm_mapped_end) {
+                bad++;
+            }
+            if ((u32)frame >= 0x400000) {
+                high = (u32)frame;
+            }
+            /* The frame must be usable through its identity mapping */
+            frame[0] = (u32)chain;
+            frame[PAGE_SIZE / 4 - 1] = 0x5A5A5A5A;
+            chain = frame;
+        }
+        
+        if (bad == 0) {
+            print("No reserved frame handed out\n");
+        } else {
+            print("ERROR: Allocator handed out reserved frames\n");
+        }
+        if (high != 0) {
+            print("Allocated past 4MB at 0x");
+            print_hex(high);
+            print("\n");
+        } else if (mm_mapped_end <= 0x400000) {
+            print("Skipped: no RAM past 4MB\n");
+        } else {
+            print("ERROR: Could not allocate past 4MB\n");
+        }
+        
+        while (chain != NULL) {
+            frame = chain;
+            chain = (u32 *)frame[0];
+            release_page_frame((u32)frame);
+        }
+    }
+
+    /* Test 19: fsync only commits to the journal; a crash before the
+       checkpoint is recovered by replaying it on the next mount */
+    print("\nTest 19: Journal replay after fsync\n");
+    if (!ext2_journal.active) {
+        print("Skipped: no journal\n");
+    } else if (blk_map(ext2_fs.dev, 0, 1) != NULL) {
+        print("Skipped: memory device writes through\n");
+    } else {
+        static const char msg[] = "survives the crash";
+        struct blk_dev *dev = ext2_fs.dev;
+        struct bcache_stats stats;
+        struct ext2_file file;
+        char data[32];
+        u32 ino = 0;
+        int fd, n = -1;
+        
+        /* Start from an empty journal */
+        ext2_sync();
+        fd = vfs_open("/fsync_test", FS_O_WRONLY | FS_O_CREAT | FS_O_TRUNC);
+        if (fd >= 0) {
+            n = vfs_write(fd, msg, sizeof(msg) - 1);
+            vfs_close(fd);
+            ino = ext2_lookup("/fsync_test");
+        }
+        
+        if (n != sizeof(msg) - 1 || ino == 0 || ext2_fsync(ino) != 0) {
+            print("ERROR: Cannot write and fsync the test file\n");
+        } else {
+            bcache_get_stats(&stats);
+            if (stats.dirty > 0 && ext2_journal.disk_start != 0) {
+                print("Metadata committed, not checkpointed\n");
+            } else {
+                print("ERROR: fsync checkpointed the journal\n");
+            }
+            
+            /* Crash: what is only in the cache is lost, and the old
+               mount is forgotten instead of synced */
+            bcache_discard(dev);
+            ext2_fs.dev = NULL;
+            if (ext2_mount(dev) != 0) {
+                print("ERROR: Remount failed\n");
+            } else {
+                if (ext2_journal.replayed > 0) {
+                    print("Journal replayed on remount\n");
+                } else {
+                    print("ERROR: Nothing replayed on remount\n");
+                }
+                memset(data, 0, sizeof(data));
+                n = -1;
+                if (ext2_open("/fsync_test", &file) == 0) {
+                    n = ext2_read(&file, data, sizeof(data));
+                    ext2_close(&file);
+                }
+                if (n == sizeof(msg) - 1 && memcmp(data, msg, n) == 0) {
+                    print("File restored: ");
+                    print(data);
+                    print("\n");
+                } else {
+                    print("ERROR: File lost in the crash\n");
+                }
+            }
+        }
+        ext2_unlink("/fsync_test");
+        ext2_sync();
+    }
+
+    /* Test 20: A remount cannot free inodes that are still in use */
+    print("\nTest 20: Remount with an open file\n");
+    {
+        struct ext2_inode_info *ei = ext2_iget(EXT2_ROOT_INODE);
+        
+        if (ei == NULL) {
+            print("ERROR: Cannot get the root inode\n");
+        } else {
+            if (ext2_mount(ext2_fs.dev) != 0 && ext2_fs.root == ei && ei->refcount == 2) {
+                print("Remount refused, inodes kept\n");
+            } else {
+                print("ERROR: Remounted over a busy inode\n");
+            }
+            ext2_iput(ei);
+        }
+    }
+
+    /* Test 21: More revocations than the revoke table holds commit early */
+    print("\nTest 21: Journal revoke table limit\n");
+    if (!ext2_journal.active) {
+        print("Skipped: no journal\n");
+    } else {
+        u32 commits = ext2_journal.commits;
+        u32 i;
+        
+        /* Block numbers past the end: revoking them never hides a replay */
+        ext2_journal_start();
+        for (i = 0; i < 2 * ext2_journal.max_blocks + 1; i++) {
+            ext2_journal_revoke(ext2_fs.superblock.s_blocks_count + i);
+        }
+        ext2_journal_stop();
+        
+        if (ext2_journal.commits - commits >= 2 && ext2_journal.nr_revoked <= ext2_journal.max_blocks) {
+            print("Revocations committed in batches\n");
+        } else {
+            print("ERROR: Revoke table not bounded\n");
+        }
+        ext2_sync();
+    }
+
     print("\n=== Ext2 Tests Complete ===\n");
-}
\ No newline at end of file
+}
+
+/*
+ * Builds "/spool/fNNNNN" (the names created by create_htree_image.sh)
+ */
+static void ext2_bench_name(char *path, u32 n)
+{
+    const char *prefix = "/spool/f";
+    int i, d;
+    
+    for (i = 0; prefix[i] != '\0'; i++) {
+        path[i] = prefix[i];
+    }
+    path[i + 5] = '\0';
+    for (d = 4; d >= 0; d--) {
+        path[i + d] = '0' + n % 10;
+        n /= 10;
+    }
+}
+
+/*
+ * Lookup benchmark over the /spool directory of create_htree_image.sh:
+ * the same names are resolved through the htree index and by linear
+ * scan, reporting device requests and cycles for each method.
+ */
+void ext2_htree_bench(u32 entries, u32 lookups)
+{
+    struct blk_stats before, after;
+    char path[16];
+    u32 i, found;
+    u64 start, cycles;
+    int mode;
+    
+    print("\n=== Ext2 htree lookup benchmark ===\n");
+    
+    for (mode = 1; mode >= 0; mode--) {
+        ext2_fs.use_htree = mode;
+        found = 0;
+        
+        blk_get_stats(ext2_fs.dev->name, &before);
+        start = rdtsc();
+        
+        /* Stride through the directory so the dentry cache never hits */
+        for (i = 0; i < lookups; i++) {
+            ext2_bench_name(path, (i * 7919) % entries);
+            if (ext2_lookup(path) != 0) {
+                found++;
+            }
+        }
+        
+        cycles = rdtsc() - start;
+        blk_get_stats(ext2_fs.dev->name, &after);
+        
+        print(mode ? "htree : " : "linear: ");
+        print_dec(found);
+        print("/");
+        print_dec(lookups);
+        print(" found, ");
+        print_dec(after.requests[BLK_READ] - before.requests[BLK_READ]);
+        print(" reads, ");
+        print_dec((u32)(cycles >> 20));
+        print(" Mcyc\n");
+    }
+    
+    ext2_fs.use_htree = 1;
+    bcache_stats_dump();
+}
@@ -6,5 +6,6 @@
 /* Test functions */
 void ext2_test(void);
 void ext2_test_list_callback(struct ext2_dir_entry *entry);
+void ext2_htree_bench(u32 entries, u32 lookups);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,989 @@
+#include "ext2.h"
+#include "screen.h"
+#include "mm.h"
+#include "lib.h"
+#include "bcache.h"
+#include "ext2_journal.h"
+#include "pagecache.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Escritura en ext2: asignación de bloques a archivos, creación y
+ * borrado de nombres y truncado. Las modificaciones quedan sucias en la
+ * caché de bloques y el flusher las escribe más tarde; los datos que
+ * llenan huecos ni siquiera tienen bloque hasta entonces. Con journal
+ * (ext3) cada operación va entre ext2_journal_start()/stop() y sus
+ * metadatos pasan por ext2_journal_dirty().
+ */
+
+static int ext2_check_writable(void)
+{
+    if (ext2_fs.readonly) {
+        print("ext2   : ERROR - Filesystem is read-only\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Sectores de 512 bytes que ocupa un bloque (unidad de i_blocks) */
+static u32 ext2_block_sectors(void)
+{
+    return ext2_fs.block_size / 512;
+}
+
+/*
+ * Rellena con ceros un bloque recién asignado
+ */
+static int ext2_zero_block(u32 block)
+{
+    struct buf *bh;
+
+    bh = bget(ext2_fs.dev, block, ext2_fs.block_size);
+    if (bh == NULL)
+        return -1;
+    memset(bh->data, 0, ext2_fs.block_size);
+    ext2_journal_dirty(bh);
+    brelse(bh);
+    return 0;
+}
+
+/*
+ * Ruta de índices desde i_block hasta un bloque lógico. Devuelve la
+ * profundidad (1 = directo ... 4 = triple indirecto).
+ */
+static int ext2_block_path(u32 lblock, u32 offsets[4])
+{
+    u32 per_block = ext2_fs.block_size / 4;
+    u32 shift = 8 + ext2_fs.superblock.s_log_block_size;
+    u32 mask = per_block - 1;
+
+    if (lblock < EXT2_NDIR_BLOCKS) {
+        offsets[0] = lblock;
+        return 1;
+    }
+    lblock -= EXT2_NDIR_BLOCKS;
+
+    if (lblock < per_block) {
+        offsets[0] = EXT2_IND_BLOCK;
+        offsets[1] = lblock;
+        return 2;
+    }
+    lblock -= per_block;
+
+    if (lblock < (per_block << shift)) {
+        offsets[0] = EXT2_DIND_BLOCK;
+        offsets[1] = lblock >> shift;
+        offsets[2] = lblock & mask;
+        return 3;
+    }
+    lblock -= per_block << shift;
+
+    offsets[0] = EXT2_TIND_BLOCK;
+    offsets[1] = lblock >> (2 * shift);
+    offsets[2] = (lblock >> shift) & mask;
+    offsets[3] = lblock & mask;
+    return 4;
+}
+
+/*
+ * Bloque físico preferido para un bloque lógico: el siguiente al
+ * anterior del archivo, o el principio del grupo del inodo
+ */
+static u32 ext2_find_goal(struct ext2_inode_info *ei, u32 lblock)
+{
+    u32 prev;
+
+    if (lblock > 0 && ext2_bmap(&ei->raw, lblock - 1, &prev) == 0 && prev != 0)
+        return prev + 1;
+
+    return ext2_fs.first_data_block +
+           ((ei->ino - 1) / ext2_fs.superblock.s_inodes_per_group) *
+           ext2_fs.superblock.s_blocks_per_group;
+}
+
+/* Asigna un bloque para el inodo; los bloques de punteros se ponen a 0 */
+static u32 ext2_new_block(struct ext2_inode_info *ei, u32 goal, int zero)
+{
+    u32 block = ext2_alloc_block(ei, goal);
+
+    if (block == 0)
+        return 0;
+    if (zero && ext2_zero_block(block) != 0) {
+        ext2_free_block(block);
+        return 0;
+    }
+    ei->raw.i_blocks += ext2_block_sectors();
+    ext2_mark_inode_dirty(ei);
+    return block;
+}
+
+/*
+ * Como ext2_bmap(), pero asigna el bloque (y los bloques indirectos que
+ * falten) si el bloque lógico es un hueco. *created indica si el bloque
+ * de datos es nuevo: su contenido anterior no es del archivo. El inodo
+ * queda marcado como modificado; lo escribe el llamador.
+ */
+int ext2_bmap_alloc(struct ext2_inode_info *ei, u32 lblock, u32 *pblock, int *created)
+{
+    u32 offsets[4];
+    u32 goal, block;
+    u32 *entry;
+    struct buf *bh;
+    int depth, i;
+
+    *created = 0;
+    depth = ext2_block_path(lblock, offsets);
+    goal = ext2_find_goal(ei, lblock);
+
+    /* Puntero en el propio inodo */
+    block = ei->raw.i_block[offsets[0]];
+    if (block == 0) {
+        block = ext2_new_block(ei, goal, depth > 1);
+        if (block == 0)
+            return -1;
+        ei->raw.i_block[offsets[0]] = block;
+        *created = (depth == 1);
+    }
+
+    /* Bajar por los bloques de punteros */
+    for (i = 1; i < depth; i++) {
+        bh = bread(ext2_fs.dev, block, ext2_fs.block_size);
+        if (bh == NULL)
+            return -1;
+
+        entry = (u32 *)bh->data + offsets[i];
+        if (*entry == 0) {
+            *entry = ext2_new_block(ei, goal, i < depth - 1);
+            if (*entry == 0) {
+                brelse(bh);
+                return -1;
+            }
+            ext2_journal_dirty(bh);
+            *created = (i == depth - 1);
+        }
+        block = *entry;
+        brelse(bh);
+    }
+
+    *pblock = block;
+    return 0;
+}
+
+/* Inodos con bloques diferidos */
+static struct ext2_inode_info *da_inodes = NULL;
+
+static struct ext2_delalloc *ext2_da_find(struct ext2_inode_info *ei, u32 lblock)
+{
+    struct ext2_delalloc *da;
+
+    /* Caso habitual: se sigue escribiendo el último bloque */
+    if (ei->da_tail != NULL && ei->da_tail->lblock == lblock)
+        return ei->da_tail;
+
+    for (da = ei->da_head; da != NULL && da->lblock <= lblock; da = da->next) {
+        if (da->lblock == lblock)
+            return da;
+    }
+    return NULL;
+}
+
+/*
+ * Datos de un bloque diferido del archivo, o NULL si no lo hay
+ */
+char *ext2_da_lookup(struct ext2_inode_info *ei, u32 lblock)
+{
+    struct ext2_delalloc *da;
+
+    if (ei->da_count == 0)
+        return NULL;
+    da = ext2_da_find(ei, lblock);
+    return da ? da->data : NULL;
+}
+
+/*
+ * Primer bloque lógico diferido a partir de 'lblock', o 0xFFFFFFFF si
+ * no hay ninguno
+ */
+u32 ext2_da_next(struct ext2_inode_info *ei, u32 lblock)
+{
+    struct ext2_delalloc *da;
+
+    for (da = ei->da_head; da != NULL; da = da->next) {
+        if (da->lblock >= lblock)
+            return da->lblock;
+    }
+    return 0xFFFFFFFF;
+}
+
+/*
+ * Devuelve el bloque diferido de 'lblock', creándolo (a ceros) si no
+ * existe. El espacio queda reservado: se comprueba que los bloques
+ * libres cubren todos los diferidos más sus bloques de punteros.
+ */
+static char *ext2_da_get(struct ext2_inode_info *ei, u32 lblock)
+{
+    u32 per_block = ext2_fs.block_size / 4;
+    struct ext2_delalloc *da, **p;
+    u32 needed;
+
+    da = ext2_da_find(ei, lblock);
+    if (da != NULL)
+        return da->data;
+
+    needed = ext2_fs.da_blocks + 1;
+    needed += needed / per_block + 3;
+    if (ext2_fs.superblock.s_free_blocks_count < needed) {
+        print("ext2   : ERROR - No free blocks\n");
+        return NULL;
+    }
+
+    da = (struct ext2_delalloc *)kmalloc(sizeof(struct ext2_delalloc));
+    if (da == NULL)
+        return NULL;
+    da->data = (char *)kmalloc(ext2_fs.block_size);
+    if (da->data == NULL) {
+        kfree(da);
+        return NULL;
+    }
+    memset(da->data, 0, ext2_fs.block_size);
+    da->lblock = lblock;
+
+    /* Mantener la lista ordenada; lo normal es añadir al final */
+    if (ei->da_tail == NULL || ei->da_tail->lblock < lblock) {
+        da->next = NULL;
+        if (ei->da_tail)
+            ei->da_tail->next = da;
+        else
+            ei->da_head = da;
+        ei->da_tail = da;
+    } else {
+        for (p = &ei->da_head; (*p)->lblock < lblock; p = &(*p)->next)
+            ;
+        da->next = *p;
+        *p = da;
+    }
+
+    /* Un inodo con datos pendientes no puede salir de la caché: la lista
+       de diferidos tiene su propia referencia */
+    if (ei->da_count++ == 0) {
+        ext2_iget(ei->ino);
+        ei->da_since = bcache_now();
+        ei->da_next = da_inodes;
+        da_inodes = ei;
+    }
+    ext2_fs.da_blocks++;
+    return da->data;
+}
+
+static void ext2_da_unlist(struct ext2_inode_info *ei)
+{
+    struct ext2_inode_info **p;
+
+    for (p = &da_inodes; *p != NULL; p = &(*p)->da_next) {
+        if (*p == ei) {
+            *p = ei->da_next;
+            break;
+        }
+    }
+    ei->da_next = NULL;
+    ext2_iput(ei);
+}
+
+/*
+ * Descarta los bloques diferidos a partir de 'first' (truncado)
+ */
+static void ext2_da_truncate(struct ext2_inode_info *ei, u32 first)
+{
+    struct ext2_delalloc **p = &ei->da_head;
+    struct ext2_delalloc *da;
+
+    if (ei->da_count == 0)
+        return;
+
+    ei->da_tail = NULL;
+    while ((da = *p) != NULL) {
+        if (da->lblock < first) {
+            ei->da_tail = da;
+            p = &da->next;
+            continue;
+        }
+        *p = da->next;
+        kfree(da->data);
+        kfree(da);
+        ei->da_count--;
+        ext2_fs.da_blocks--;
+    }
+
+    if (ei->da_count == 0)
+        ext2_da_unlist(ei);
+}
+
+/*
+ * Asigna en el disco los bloques diferidos de un inodo y pasa sus datos
+ * a la caché de bloques. Al asignarlos todos seguidos y en orden, los
+ * bloques de un archivo escrito poco a poco quedan contiguos.
+ */
+int ext2_da_flush_inode(struct ext2_inode_info *ei)
+{
+    struct ext2_delalloc *da;
+    struct buf *bh;
+    u32 pblock;
+    int created;
+    int error = 0;
+
+    if (ei->da_count == 0)
+        return 0;
+
+    ext2_journal_start();
+    while ((da = ei->da_head) != NULL) {
+        if (ext2_bmap_alloc(ei, da->lblock, &pblock, &created) != 0) {
+            error = -1;
+            break;
+        }
+        bh = bget(ext2_fs.dev, pblock, ext2_fs.block_size);
+        if (bh == NULL) {
+            error = -1;
+            break;
+        }
+        memcpy(bh->data, da->data, ext2_fs.block_size);
+        bdirty(bh);
+        brelse(bh);
+
+        ei->da_head = da->next;
+        kfree(da->data);
+        kfree(da);
+        ei->da_count--;
+        ext2_fs.da_blocks--;
+    }
+    if (ei->da_head == NULL)
+        ei->da_tail = NULL;
+
+    if (ext2_write_inode(ei) != 0 || ext2_commit_meta() != 0)
+        error = -1;
+    ext2_journal_stop();
+
+    /* Un archivo sin usuarios ya no necesita su ventana de reserva */
+    if (ei->da_count == 0 && ei->refcount == 0)
+        ext2_rsv_release(ei);
+
+    /* Puede liberar el inodo si ya no tiene nombre */
+    if (ei->da_count == 0)
+        ext2_da_unlist(ei);
+    return error;
+}
+
+/*
+ * Escribe lo pendiente. Con 'all' todo; si no, asigna los bloques
+ * diferidos de los inodos cuyos datos superan BCACHE_DIRTY_EXPIRE y
+ * escribe los buffers sucios de esa edad (todos si se ha asignado algo,
+ * para que esos datos no esperen otro periodo). Con journal, además, se
+ * confirma la transacción en curso.
+ */
+int ext2_writeback(int all)
+{
+    struct ext2_inode_info *ei, *next;
+    u32 now = bcache_now();
+    int flushed = 0;
+    int error = 0;
+
+    for (ei = da_inodes; ei != NULL; ei = next) {
+        next = ei->da_next;
+        if (all || now - ei->da_since >= BCACHE_DIRTY_EXPIRE) {
+            if (ext2_da_flush_inode(ei) != 0)
+                error = -1;
+            flushed = 1;
+        }
+    }
+
+    if (ext2_commit_meta() != 0 || ext2_journal_commit() != 0)
+        error = -1;
+    if (bcache_flush(ext2_fs.dev, (all || flushed) ? 0 : BCACHE_DIRTY_EXPIRE) != 0)
+        error = -1;
+    return error;
+}
+
+/*
+ * Flusher: se llama desde el bucle ocioso del kernel. El tic del reloj
+ * lo despierta cada BCACHE_WRITEBACK_INTERVAL; si los datos pendientes
+ * superan BCACHE_DIRTY_BACKGROUND_RATIO lo escribe todo.
+ */
+void ext2_flush_daemon(void)
+{
+    u32 pending;
+
+    if (ext2_fs.dev == NULL || ext2_fs.readonly)
+        return;
+
+    pending = ext2_fs.da_blocks * ext2_fs.block_size;
+    if (bcache_writeback_due(pending))
+        ext2_writeback(bcache_over_background(pending));
+}
+
+/*
+ * Escribe en el disco todo lo pendiente (SYS_SYNC). El journal queda
+ * vacío: todos los metadatos están en su sitio.
+ */
+int ext2_sync(void)
+{
+    if (ext2_fs.readonly)
+        return 0;
+    if (ext2_writeback(1) != 0)
+        return -1;
+    return ext2_journal_checkpoint();
+}
+
+/*
+ * Escribe los datos y el inodo de un archivo (SYS_FSYNC). La caché no
+ * sabe a qué archivo pertenece cada buffer, así que se escriben todos
+ * los sucios del dispositivo, en una sola tanda ordenada. Con journal
+ * basta el commit: escribe antes los datos (modo ordered) y los
+ * metadatos solo en el registro, seguidos; llevarlos a su sitio queda
+ * para el flusher.
+ */
+int ext2_fsync(u32 ino)
+{
+    struct ext2_inode_info *ei;
+    int error = 0;
+
+    if (ext2_fs.readonly)
+        return 0;
+
+    ei = ext2_iget(ino);
+    if (ei == NULL)
+        return -1;
+
+    if (ext2_da_flush_inode(ei) != 0 || ext2_write_inode(ei) != 0 ||
+        ext2_commit_meta() != 0)
+        error = -1;
+    ext2_iput(ei);
+
+    if (ext2_journal.active) {
+        if (ext2_journal_commit() != 0)
+            error = -1;
+    } else if (bcache_flush(ext2_fs.dev, 0) != 0) {
+        error = -1;
+    }
+    return error;
+}
+
+/*
+ * Escribe 'size' bytes en la posición actual del archivo. Los bloques
+ * que ya existen se modifican en la caché; los huecos se llenan con
+ * bloques diferidos que se asignan al escribirlos al disco. Si hay
+ * demasiados datos pendientes se escriben antes de volver. Devuelve los
+ * bytes escritos o -1 si hay un error.
+ */
+int ext2_write(struct ext2_file *file, const void *buffer, u32 size)
+{
+    struct ext2_inode_info *ei = file->inode;
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 written = 0;
+    u32 lblock, offset, chunk, pblock;
+    struct buf *bh;
+    char *data;
+    int error;
+
+    if (ext2_check_writable() != 0)
+        return -1;
+
+    ext2_journal_start();
+    while (written < size) {
+        lblock = file->pos >> shift;
+        offset = file->pos & (ext2_fs.block_size - 1);
+        chunk = ext2_fs.block_size - offset;
+        if (chunk > size - written)
+            chunk = size - written;
+
+        if (ext2_bmap(&ei->raw, lblock, &pblock) != 0)
+            break;
+
+        if (pblock == 0) {
+            data = ext2_da_get(ei, lblock);
+            if (data == NULL)
+                break;
+            memcpy(data + offset, (const char *)buffer + written, chunk);
+        } else {
+            /* Un bloque sobrescrito entero no se lee del disco */
+            if (chunk == ext2_fs.block_size)
+                bh = bget(ext2_fs.dev, pblock, ext2_fs.block_size);
+            else
+                bh = bread(ext2_fs.dev, pblock, ext2_fs.block_size);
+            if (bh == NULL)
+                break;
+
+            memcpy(bh->data + offset, (const char *)buffer + written, chunk);
+            bdirty(bh);
+            brelse(bh);
+        }
+
+        file->pos += chunk;
+        written += chunk;
+    }
+
+    /* Las páginas en caché (y sus mapeos) ven lo escrito */
+    pcache_update(ei, file->pos - written, buffer, written);
+
+    if (file->pos > ei->raw.i_size)
+        ei->raw.i_size = file->pos;
+    ext2_mark_inode_dirty(ei);
+
+    error = ext2_write_inode(ei);
+    ext2_journal_stop();
+    if (error != 0)
+        return -1;
+
+    if (bcache_over_dirty_limit(ext2_fs.da_blocks * ext2_fs.block_size))
+        ext2_writeback(1);
+
+    if (written == 0 && size > 0)
+        return -1;
+    return written;
+}
+
+/*
+ * Separa una ruta en el directorio padre y el último nombre. Devuelve el
+ * inodo del padre o 0 si no existe.
+ */
+static u32 ext2_split_path(const char *path, const char **name, u32 *len)
+{
+    char dir_path[EXT2_PATH_MAX];
+    const char *slash = NULL;
+    const char *p;
+    u32 dir_len;
+
+    for (p = path; *p != '\0'; p++) {
+        if (*p == '/')
+            slash = p;
+    }
+
+    *name = slash ? slash + 1 : path;
+    *len = p - *name;
+    if (*len == 0 || *len > EXT2_NAME_LEN)
+        return 0;
+
+    if (slash == NULL)
+        return EXT2_ROOT_INODE;
+
+    dir_len = slash - path;
+    if (dir_len >= EXT2_PATH_MAX)
+        return 0;
+    memcpy(dir_path, path, dir_len);
+    dir_path[dir_len] = '\0';
+
+    return ext2_lookup(dir_path);
+}
+
+/*
+ * Las modificaciones de un directorio invalidan su índice htree, que no
+ * se mantiene: sin EXT2_INDEX_FL se recorre linealmente
+ */
+static void ext2_dir_modified(struct ext2_inode_info *dir)
+{
+    dir->raw.i_flags &= ~EXT2_INDEX_FL;
+    ext2_mark_inode_dirty(dir);
+}
+
+static void ext2_fill_entry(struct ext2_dir_entry *de, const char *name, u32 len,
+                            u32 ino, u8 file_type)
+{
+    de->inode = ino;
+    de->name_len = len;
+    de->file_type = 0;
+    if (ext2_fs.superblock.s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE)
+        de->file_type = file_type;
+    memcpy(de->name, name, len);
+}
+
+/*
+ * Añade la entrada 'name' -> 'ino' a un directorio: en el hueco libre de
+ * una entrada existente o en un bloque nuevo al final
+ */
+static int ext2_add_link(struct ext2_inode_info *dir, const char *name, u32 len,
+                         u32 ino, u8 file_type)
+{
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 nr_blocks = (dir->raw.i_size + ext2_fs.block_size - 1) >> shift;
+    u32 need = EXT2_DIR_REC_LEN(len);
+    u32 lblock, pblock, offset, used;
+    struct ext2_dir_entry *de, *new_de;
+    struct buf *bh;
+    int created;
+
+    for (lblock = 0; lblock < nr_blocks; lblock++) {
+        if (ext2_bmap(&dir->raw, lblock, &pblock) != 0)
+            return -1;
+        if (pblock == 0)
+            continue;
+
+        bh = bread(ext2_fs.dev, pblock, ext2_fs.block_size);
+        if (bh == NULL)
+            return -1;
+
+        for (offset = 0; offset < ext2_fs.block_size; offset += de->rec_len) {
+            de = (struct ext2_dir_entry *)(bh->data + offset);
+            if (de->rec_len < 8 || offset + de->rec_len > ext2_fs.block_size)
+                break;
+
+            used = de->inode ? EXT2_DIR_REC_LEN(de->name_len) : 0;
+            if (de->rec_len - used < need)
+                continue;
+
+            /* Partir la entrada: la nueva ocupa su espacio sobrante */
+            if (used != 0) {
+                new_de = (struct ext2_dir_entry *)((char *)de + used);
+                new_de->rec_len = de->rec_len - used;
+                de->rec_len = used;
+                de = new_de;
+            }
+            ext2_fill_entry(de, name, len, ino, file_type);
+
+            ext2_journal_dirty(bh);
+            brelse(bh);
+            ext2_dir_modified(dir);
+            return ext2_write_inode(dir);
+        }
+        brelse(bh);
+    }
+
+    /* Directorio lleno: añadir un bloque */
+    if (ext2_bmap_alloc(dir, nr_blocks, &pblock, &created) != 0)
+        return -1;
+
+    bh = bget(ext2_fs.dev, pblock, ext2_fs.block_size);
+    if (bh == NULL)
+        return -1;
+    memset(bh->data, 0, ext2_fs.block_size);
+    de = (struct ext2_dir_entry *)bh->data;
+    de->rec_len = ext2_fs.block_size;
+    ext2_fill_entry(de, name, len, ino, file_type);
+    ext2_journal_dirty(bh);
+    brelse(bh);
+
+    dir->raw.i_size = (nr_blocks + 1) << shift;
+    ext2_dir_modified(dir);
+    return ext2_write_inode(dir);
+}
+
+/*
+ * Quita la entrada 'name' de un directorio: se une a la anterior del
+ * bloque, o se marca libre (inodo 0) si es la primera
+ */
+static int ext2_remove_link(struct ext2_inode_info *dir, const char *name, u32 len)
+{
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 nr_blocks = (dir->raw.i_size + ext2_fs.block_size - 1) >> shift;
+    u32 lblock, pblock, offset;
+    struct ext2_dir_entry *de, *prev;
+    struct buf *bh;
+
+    for (lblock = 0; lblock < nr_blocks; lblock++) {
+        if (ext2_bmap(&dir->raw, lblock, &pblock) != 0)
+            return -1;
+        if (pblock == 0)
+            continue;
+
+        bh = bread(ext2_fs.dev, pblock, ext2_fs.block_size);
+        if (bh == NULL)
+            return -1;
+
+        prev = NULL;
+        for (offset = 0; offset < ext2_fs.block_size; offset += de->rec_len) {
+            de = (struct ext2_dir_entry *)(bh->data + offset);
+            if (de->rec_len < 8 || offset + de->rec_len > ext2_fs.block_size)
+                break;
+
+            if (de->inode != 0 && de->name_len == len && memcmp(de->name, name, len) == 0) {
+                if (prev != NULL)
+                    prev->rec_len += de->rec_len;
+                else
+                    de->inode = 0;
+
+                ext2_journal_dirty(bh);
+                brelse(bh);
+                ext2_dir_modified(dir);
+                return ext2_write_inode(dir);
+            }
+            prev = de;
+        }
+        brelse(bh);
+    }
+
+    return -1;
+}
+
+/*
+ * Crea un archivo regular vacío. Devuelve 0, o -1 si el directorio no
+ * existe, el nombre ya existe o no hay espacio.
+ */
+int ext2_create(const char *path)
+{
+    struct ext2_inode_info *dir, *ei;
+    const char *name;
+    u32 parent, ino, len;
+    int ret;
+
+    if (ext2_check_writable() != 0)
+        return -1;
+
+    parent = ext2_split_path(path, &name, &len);
+    if (parent == 0)
+        return -1;
+    if (ext2_lookup(path) != 0) {
+        print("ext2   : ERROR - File already exists\n");
+        return -1;
+    }
+
+    dir = ext2_iget(parent);
+    if (dir == NULL)
+        return -1;
+    if (!EXT2_S_ISDIR(dir->raw.i_mode)) {
+        ext2_iput(dir);
+        return -1;
+    }
+
+    ext2_journal_start();
+    ino = ext2_alloc_inode(parent, 0);
+    if (ino == 0) {
+        ext2_journal_stop();
+        ext2_iput(dir);
+        return -1;
+    }
+
+    ei = ext2_iget(ino);
+    if (ei == NULL) {
+        ext2_free_inode(ino, 0);
+        ext2_iput(dir);
+        ext2_commit_meta();
+        ext2_journal_stop();
+        return -1;
+    }
+
+    /* La tabla de inodos conserva lo que dejó el anterior dueño */
+    memset(&ei->raw, 0, sizeof(struct ext2_inode));
+    ei->raw.i_mode = EXT2_S_IFREG | EXT2_S_IRUSR | EXT2_S_IWUSR | EXT2_S_IRGRP | EXT2_S_IROTH;
+    ei->raw.i_links_count = 1;
+    ei->flags |= EXT2_I_NEW;
+    ext2_mark_inode_dirty(ei);
+
+    ret = ext2_write_inode(ei);
+    if (ret == 0)
+        ret = ext2_add_link(dir, name, len, ino, EXT2_FT_REG_FILE);
+    if (ret != 0) {
+        /* Sin nombre: se libera con el último iput */
+        ei->raw.i_links_count = 0;
+        ei->flags |= EXT2_I_UNLINKED;
+    }
+
+    ext2_dcache_invalidate(parent, name, len);
+    ext2_iput(ei);
+    ext2_iput(dir);
+
+    if (ext2_commit_meta() != 0)
+        ret = -1;
+    ext2_journal_stop();
+    return ret;
+}
+
+/*
+ * Libera los bloques lógicos >= 'first' del subárbol que cuelga de
+ * 'block'. 'depth' es el nivel (0 = bloque de datos) y 'base' el primer
+ * bloque lógico que cubre. Un bloque de punteros se libera entero si
+ * todo su rango cae en el truncado. Devuelve el nuevo valor del puntero
+ * (0 si el bloque se ha liberado).
+ */
+static u32 ext2_free_branch(struct ext2_inode_info *ei, u32 block, u32 depth,
+                            u32 base, u32 first)
+{
+    u32 shift = 8 + ext2_fs.superblock.s_log_block_size;
+    u32 per_block = ext2_fs.block_size / 4;
+    u32 child_span, child_base, i;
+    u32 *entries;
+    struct buf *bh;
+    int changed = 0;
+
+    if (block == 0)
+        return 0;
+
+    if (depth > 0) {
+        child_span = 1 << (shift * (depth - 1));
+        if (first >= base + child_span * per_block)
+            return block;
+
+        bh = bread(ext2_fs.dev, block, ext2_fs.block_size);
+        if (bh == NULL)
+            return block;
+        entries = (u32 *)bh->data;
+
+        for (i = 0; i < per_block; i++) {
+            child_base = base + i * child_span;
+            if (child_base + child_span <= first || entries[i] == 0)
+                continue;
+            entries[i] = ext2_free_branch(ei, entries[i], depth - 1, child_base, first);
+            changed = 1;
+        }
+
+        /* Parte del rango sigue en uso: el bloque de punteros se queda */
+        if (first > base) {
+            if (changed)
+                ext2_journal_dirty(bh);
+            brelse(bh);
+            return block;
+        }
+        brelse(bh);
+
+        /* Bloque de punteros: sus copias en el journal no deben
+           reproducirse sobre lo que se escriba después en él */
+        ext2_journal_revoke(block);
+    }
+
+    ext2_free_block(block);
+    ei->raw.i_blocks -= ext2_block_sectors();
+    return 0;
+}
+
+/*
+ * Cambia el tamaño de un archivo. Al reducirlo se liberan los bloques
+ * que quedan fuera y se pone a cero el final del último bloque, para
+ * que una extensión posterior lea ceros.
+ */
+int ext2_truncate(struct ext2_inode_info *ei, u32 size)
+{
+    u32 shift = 10 + ext2_fs.superblock.s_log_block_size;
+    u32 per_block = ext2_fs.block_size / 4;
+    u32 ptr_shift = 8 + ext2_fs.superblock.s_log_block_size;
+    u32 first, offset, pblock, i;
+    struct buf *bh;
+    char *data;
+    int ret = 0;
+
+    if (ext2_check_writable() != 0)
+        return -1;
+
+    ext2_journal_start();
+    if (size < ei->raw.i_size) {
+        first = (size + ext2_fs.block_size - 1) >> shift;
+
+        for (i = first; i < EXT2_NDIR_BLOCKS; i++)
+            ei->raw.i_block[i] = ext2_free_branch(ei, ei->raw.i_block[i], 0, i, first);
+        ei->raw.i_block[EXT2_IND_BLOCK] =
+            ext2_free_branch(ei, ei->raw.i_block[EXT2_IND_BLOCK], 1,
+                             EXT2_NDIR_BLOCKS, first);
+        ei->raw.i_block[EXT2_DIND_BLOCK] =
+            ext2_free_branch(ei, ei->raw.i_block[EXT2_DIND_BLOCK], 2,
+                             EXT2_NDIR_BLOCKS + per_block, first);
+        ei->raw.i_block[EXT2_TIND_BLOCK] =
+            ext2_free_branch(ei, ei->raw.i_block[EXT2_TIND_BLOCK], 3,
+                             EXT2_NDIR_BLOCKS + per_block + (per_block << ptr_shift), first);
+
+        ext2_da_truncate(ei, first);
+
+        offset = size & (ext2_fs.block_size - 1);
+        if (offset != 0 && ext2_bmap(&ei->raw, size >> shift, &pblock) == 0) {
+            if (pblock != 0) {
+                bh = bread(ext2_fs.dev, pblock, ext2_fs.block_size);
+                if (bh != NULL) {
+                    memset(bh->data + offset, 0, ext2_fs.block_size - offset);
+                    bdirty(bh);
+                    brelse(bh);
+                }
+            } else if ((data = ext2_da_lookup(ei, size >> shift)) != NULL) {
+                memset(data + offset, 0, ext2_fs.block_size - offset);
+            }
+        }
+
+        ext2_rsv_release(ei);
+        pcache_truncate(ei, size);
+    }
+
+    ei->raw.i_size = size;
+    ext2_mark_inode_dirty(ei);
+
+    if (ext2_write_inode(ei) != 0 || ext2_commit_meta() != 0)
+        ret = -1;
+    ext2_journal_stop();
+    return ret;
+}
+
+/*
+ * Borra un nombre. El inodo se libera cuando se queda sin enlaces y sin
+ * usuarios (un archivo abierto sigue legible hasta cerrarlo).
+ */
+int ext2_unlink(const char *path)
+{
+    struct ext2_inode_info *dir, *ei;
+    const char *name;
+    u32 parent, ino, len;
+    int ret;
+
+    if (ext2_check_writable() != 0)
+        return -1;
+
+    parent = ext2_split_path(path, &name, &len);
+    ino = ext2_lookup(path);
+    if (parent == 0 || ino == 0)
+        return -1;
+
+    ei = ext2_iget(ino);
+    if (ei == NULL)
+        return -1;
+    if (EXT2_S_ISDIR(ei->raw.i_mode)) {
+        print("ext2   : ERROR - Cannot unlink a directory\n");
+        ext2_iput(ei);
+        return -1;
+    }
+
+    dir = ext2_iget(parent);
+    if (dir == NULL) {
+        ext2_iput(ei);
+        return -1;
+    }
+
+    ext2_journal_start();
+    ret = ext2_remove_link(dir, name, len);
+    ext2_dcache_invalidate(parent, name, len);
+    ext2_iput(dir);
+
+    if (ret == 0) {
+        if (ei->raw.i_links_count > 0)
+            ei->raw.i_links_count--;
+        if (ei->raw.i_links_count == 0) {
+            /* Sus datos pendientes ya no hay que escribirlos */
+            ext2_da_truncate(ei, 0);
+            ei->flags |= EXT2_I_UNLINKED;
+        }
+        ext2_mark_inode_dirty(ei);
+        ret = ext2_write_inode(ei);
+    }
+
+    ext2_iput(ei);
+    ext2_journal_stop();
+    return ret;
+}
+
+/*
+ * Libera los bloques y el propio inodo de un archivo sin enlaces
+ * (llamada desde el último ext2_iput)
+ */
+void ext2_delete_inode(struct ext2_inode_info *ei)
+{
+    if (ext2_fs.readonly)
+        return;
+
+    ext2_journal_start();
+    ext2_truncate(ei, 0);
+
+    /* Sin reloj se usa la última escritura del superbloque. Un i_dtime
+       menor que s_inodes_count se leería como enlace de la lista de
+       huérfanos */
+    ei->raw.i_dtime = ext2_fs.superblock.s_wtime;
+    if (ei->raw.i_dtime < ext2_fs.superblock.s_inodes_count)
+        ei->raw.i_dtime = ext2_fs.superblock.s_inodes_count;
+    ext2_write_inode(ei);
+
+    ext2_free_inode(ei->ino, EXT2_S_ISDIR(ei->raw.i_mode));
+    ext2_commit_meta();
+    ext2_journal_stop();
+}
@@ -0,0 +1,204 @@
+#include "types.h"
+#include "lib.h"
+#include "screen.h"
+#include "fs.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Tabla de montajes. Una ruta se atiende en el montaje cuyo punto de
+ * montaje es el prefijo más largo de la ruta (por componentes enteros);
+ * el sistema de archivos recibe el resto de la ruta desde su raíz.
+ */
+
+static struct fs_mount fs_mounts[FS_MAX_MOUNTS];
+
+/* Longitud del punto de montaje sin '/' final ("/" se queda en 1) */
+static u32 fs_path_len(const char *path)
+{
+    u32 len = strlen(path);
+
+    while (len > 1 && path[len - 1] == '/')
+        len--;
+    return len;
+}
+
+int fs_mount(const char *path, struct fs_ops *ops)
+{
+    struct fs_mount *free = NULL;
+    u32 len, i;
+
+    if (path[0] != '/') {
+        print("fs     : ERROR - Mount point must be absolute\n");
+        return -1;
+    }
+    len = fs_path_len(path);
+    if (len >= FS_MOUNT_PATH_LEN) {
+        print("fs     : ERROR - Mount point too long\n");
+        return -1;
+    }
+
+    for (i = 0; i < FS_MAX_MOUNTS; i++) {
+        if (fs_mounts[i].ops == NULL) {
+            if (free == NULL)
+                free = &fs_mounts[i];
+        } else if (fs_mounts[i].len == len && memcmp(fs_mounts[i].path, path, len) == 0) {
+            /* Volver a montar el mismo punto lo sustituye */
+            free = &fs_mounts[i];
+            break;
+        }
+    }
+    if (free == NULL) {
+        print("fs     : ERROR - Mount table full\n");
+        return -1;
+    }
+
+    memcpy(free->path, path, len);
+    free->path[len] = '\0';
+    free->len = len;
+    free->ops = ops;
+
+    print("fs     : ");
+    print((char *)ops->name);
+    print(" mounted on ");
+    print(free->path);
+    print("\n");
+    return 0;
+}
+
+int fs_umount(const char *path)
+{
+    u32 len = fs_path_len(path);
+    u32 i;
+
+    for (i = 0; i < FS_MAX_MOUNTS; i++) {
+        if (fs_mounts[i].ops != NULL && fs_mounts[i].len == len &&
+            memcmp(fs_mounts[i].path, path, len) == 0) {
+            fs_mounts[i].ops = NULL;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Busca el montaje que atiende 'path' y deja en *rest la ruta dentro de
+ * él (siempre empieza por '/'). NULL si no hay ninguno.
+ */
+struct fs_mount *fs_resolve(const char *path, const char **rest)
+{
+    struct fs_mount *best = NULL;
+    struct fs_mount *m;
+    u32 i;
+
+    if (path[0] != '/')
+        return NULL;
+
+    for (i = 0; i < FS_MAX_MOUNTS; i++) {
+        m = &fs_mounts[i];
+        if (m->ops == NULL || (best != NULL && m->len <= best->len))
+            continue;
+        if (m->len == 1 ||
+            (memcmp(path, m->path, m->len) == 0 &&
+             (path[m->len] == '/' || path[m->len] == '\0')))
+            best = m;
+    }
+
+    if (best != NULL && rest != NULL) {
+        if (best->len == 1)
+            *rest = path;
+        else if (path[best->len] == '\0')
+            *rest = "/";
+        else
+            *rest = path + best->len;
+    }
+    return best;
+}
+
+/*
+ * Resuelve una ruta a (montaje, inodo). Devuelve 0 si no existe.
+ */
+u32 fs_lookup(const char *path, struct fs_mount **mnt)
+{
+    const char *rest;
+    struct fs_mount *m = fs_resolve(path, &rest);
+
+    if (m == NULL)
+        return 0;
+    if (mnt != NULL)
+        *mnt = m;
+    return m->ops->lookup(rest);
+}
+
+int fs_create(const char *path)
+{
+    const char *rest;
+    struct fs_mount *m = fs_resolve(path, &rest);
+
+    if (m == NULL)
+        return -1;
+    return m->ops->create(rest);
+}
+
+int fs_mkdir(const char *path)
+{
+    const char *rest;
+    struct fs_mount *m = fs_resolve(path, &rest);
+
+    if (m == NULL)
+        return -1;
+    if (m->ops->mkdir == NULL) {
+        print("fs     : ERROR - mkdir not supported by ");
+        print((char *)m->ops->name);
+        print("\n");
+        return -1;
+    }
+    return m->ops->mkdir(rest);
+}
+
+int fs_unlink(const char *path)
+{
+    const char *rest;
+    struct fs_mount *m = fs_resolve(path, &rest);
+
+    /* Un punto de montaje no se borra */
+    if (m == NULL || (rest[0] == '/' && rest[1] == '\0'))
+        return -1;
+    return m->ops->unlink(rest);
+}
+
+int fs_read(struct fs_mount *mnt, u32 ino, u32 offset, void *buffer, u32 len)
+{
+    return mnt->ops->read(ino, offset, buffer, len);
+}
+
+int fs_write(struct fs_mount *mnt, u32 ino, u32 offset, const void *buffer, u32 len)
+{
+    return mnt->ops->write(ino, offset, buffer, len);
+}
+
+int fs_truncate(struct fs_mount *mnt, u32 ino, u32 size)
+{
+    return mnt->ops->truncate(ino, size);
+}
+
+int fs_stat(struct fs_mount *mnt, u32 ino, struct fs_stat *st)
+{
+    return mnt->ops->stat(ino, st);
+}
+
+int fs_readdir(struct fs_mount *mnt, u32 ino,
+               void (*callback)(struct fs_dirent *entry, void *arg), void *arg)
+{
+    return mnt->ops->readdir(ino, callback, arg);
+}
+
+/* Sin fsync el sistema de archivos no tiene nada que escribir */
+int fs_fsync(struct fs_mount *mnt, u32 ino)
+{
+    if (mnt->ops->fsync == NULL)
+        return 0;
+    return mnt->ops->fsync(ino);
+}
@@ -0,0 +1,103 @@
+#ifndef FS_H_
+#define FS_H_
+
+#include "types.h"
+
+/* Tabla de montajes: cada sistema de archivos atiende las rutas que
+   empiezan por su punto de montaje (gana el más largo) */
+#define FS_MAX_MOUNTS       8
+#define FS_MOUNT_PATH_LEN   64
+#define FS_PATH_MAX         256     /* Ruta completa, con el '\0' */
+
+/* Tipo de archivo en st_mode (mismos bits que ext2) */
+#define FS_S_IFMT           0xF000
+#define FS_S_IFREG          0x8000
+#define FS_S_IFDIR          0x4000
+#define FS_S_ISREG(mode)    (((mode) & FS_S_IFMT) == FS_S_IFREG)
+#define FS_S_ISDIR(mode)    (((mode) & FS_S_IFMT) == FS_S_IFDIR)
+
+/* Tipo de una entrada de directorio (mismos valores que ext2) */
+#define FS_FT_UNKNOWN       0
+#define FS_FT_REG_FILE      1
+#define FS_FT_DIR           2
+
+struct fs_stat {
+    u32 ino;
+    u16 mode;
+    u16 nlink;
+    u32 size;
+};
+
+struct fs_dirent {
+    u32 ino;
+    u8 type;                    /* FS_FT_* */
+    u8 name_len;
+    char name[256];             /* Terminado en '\0' */
+};
+
+/* Modos de apertura (mismos valores que open() en Linux) */
+#define FS_O_ACCMODE        0x0003
+#define FS_O_RDONLY         0x0000
+#define FS_O_WRONLY         0x0001
+#define FS_O_RDWR           0x0002
+#define FS_O_CREAT          0x0040
+#define FS_O_TRUNC          0x0200
+#define FS_O_APPEND         0x0400
+#define FS_O_DIRECT         0x4000  /* Lecturas alineadas sin pasar por las cachés */
+
+/* Archivo abierto: lo comparten los descriptores que apuntan a él */
+struct fs_file {
+    struct fs_mount *mnt;       /* NULL: libre */
+    u32 ino;
+    u32 pos;                    /* Posición en bytes */
+    u32 flags;                  /* FS_O_* */
+    void *private;              /* Estado del sistema de archivos (lectura adelantada) */
+};
+
+/*
+ * Operaciones de un sistema de archivos. Las rutas son relativas a la
+ * raíz del montaje y empiezan por '/'; los archivos se identifican por
+ * su número de inodo. read/write devuelven los bytes transferidos o -1.
+ * mkdir, fsync y las operaciones de archivo abierto son opcionales
+ * (NULL): sin read_file las lecturas usan read() en file->pos.
+ */
+struct fs_ops {
+    const char *name;
+    u32 (*lookup)(const char *path);                /* 0 si no existe */
+    int (*create)(const char *path);
+    int (*mkdir)(const char *path);
+    int (*unlink)(const char *path);
+    int (*read)(u32 ino, u32 offset, void *buffer, u32 len);
+    int (*write)(u32 ino, u32 offset, const void *buffer, u32 len);
+    int (*truncate)(u32 ino, u32 size);
+    int (*stat)(u32 ino, struct fs_stat *st);
+    int (*readdir)(u32 ino, void (*callback)(struct fs_dirent *entry, void *arg), void *arg);
+    int (*fsync)(u32 ino);
+    int (*open)(struct fs_file *file);                              /* Prepara file->private */
+    void (*release)(struct fs_file *file);
+    int (*read_file)(struct fs_file *file, void *buffer, u32 len);  /* Desde file->pos, sin moverla */
+};
+
+struct fs_mount {
+    char path[FS_MOUNT_PATH_LEN];   /* Sin '/' final, salvo la raíz */
+    u32 len;
+    struct fs_ops *ops;
+};
+
+/* Funciones */
+int fs_mount(const char *path, struct fs_ops *ops);
+int fs_umount(const char *path);
+struct fs_mount *fs_resolve(const char *path, const char **rest);
+u32 fs_lookup(const char *path, struct fs_mount **mnt);
+int fs_create(const char *path);
+int fs_mkdir(const char *path);
+int fs_unlink(const char *path);
+int fs_read(struct fs_mount *mnt, u32 ino, u32 offset, void *buffer, u32 len);
+int fs_write(struct fs_mount *mnt, u32 ino, u32 offset, const void *buffer, u32 len);
+int fs_truncate(struct fs_mount *mnt, u32 ino, u32 size);
+int fs_stat(struct fs_mount *mnt, u32 ino, struct fs_stat *st);
+int fs_readdir(struct fs_mount *mnt, u32 ino,
+               void (*callback)(struct fs_dirent *entry, void *arg), void *arg);
+int fs_fsync(struct fs_mount *mnt, u32 ino);
+
+#endif
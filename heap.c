@@ -1,4 +1,5 @@
 #include "mm.h"
+#include "io.h"
 #include "screen.h"
 #include "lib.h"
 
@@ -18,6 +19,7 @@ void init_heap(void) {
 void *kmalloc(u32 size) {
     struct heap_block *curr, *prev = 0;
     u32 total_size;
+    u32 flags;
     
     // Align size to 4 bytes
     size = (size + 3) & ~3;
@@ -25,6 +27,9 @@ void *kmalloc(u32 size) {
     
     total_size = size + sizeof(struct heap_block);
     
+    // Block drivers may allocate/free from interrupt context
+    irq_save(flags);
+    
     curr = heap_start;
     while (curr) {
         if (!curr->used && curr->size >= size) {
@@ -41,12 +46,15 @@ void *kmalloc(u32 size) {
             }
             
             curr->used = 1;
+            irq_restore(flags);
             return (void *)((u32)curr + sizeof(struct heap_block));
         }
         prev = curr;
         curr = curr->next;
     }
     
+    irq_restore(flags);
+    
     // No suitable block found
     print("heap   : ERROR - Out of memory!\n");
     return 0;
@@ -54,12 +62,14 @@ void *kmalloc(u32 size) {
 
 void kfree(void *ptr) {
     struct heap_block *block = (struct heap_block *)((u32)ptr - sizeof(struct heap_block));
+    u32 flags;
     
     if (block->magic != HEAP_MAGIC) {
         print("heap   : ERROR - Invalid free!\n");
         return;
     }
     
+    irq_save(flags);
     block->used = 0;
     
     // Merge with next block if free
@@ -67,6 +77,7 @@ void kfree(void *ptr) {
         block->size += block->next->size + sizeof(struct heap_block);
         block->next = block->next->next;
     }
+    irq_restore(flags);
 }
 
 void init_page_heap(void) {
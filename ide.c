@@ -3,120 +3,352 @@
 #include "screen.h"
 #include "lib.h"
 #include "mm.h"
+#include "irq.h"
+#include "blk.h"
 
-// Función para esperar a que el disco esté listo
-static int ide_wait(int check_error) {
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+// Iteraciones máximas esperando al disco durante la detección
+#define IDE_PROBE_TIMEOUT 100000
+
+// Estado de un canal: cada uno tiene su cola y su IRQ, de modo que
+// los comandos de canales distintos avanzan en paralelo. Un comando puede
+// cubrir varias peticiones contiguas de la cola (fusión)
+struct ide_channel {
+    u16 base;
+    u16 ctrl;
+    int irq;
+    struct blk_request *head;       // Cabeza de la cola; las 'cmd_reqs' primeras están en curso
+    struct blk_request *tail;
+    u32 cmd_reqs;                   // Peticiones del comando en curso (0: canal inactivo)
+    u32 cmd_sectors;                // Sectores del comando en curso
+    u32 done_sectors;               // Sectores ya transferidos del comando
+    struct blk_request *xfer;       // Petición cuyo buffer recibe el siguiente sector
+    u32 xfer_done;                  // Sectores ya transferidos de 'xfer'
+};
+
+// Unidad física expuesta a la capa de bloques ("hda".."hdd")
+struct ide_drive {
+    struct blk_dev blk;
+    struct ide_channel *chan;
+    int slave;
+    int present;
+};
+
+static struct ide_channel ide_channels[IDE_CHANNELS] = {
+    { IDE_PRIMARY_BASE, IDE_PRIMARY_CTRL, IDE_PRIMARY_IRQ },
+    { IDE_SECONDARY_BASE, IDE_SECONDARY_CTRL, IDE_SECONDARY_IRQ },
+};
+
+static struct ide_drive ide_drives[IDE_DRIVES];
+
+// Retardo de 400ns: cuatro lecturas del registro de estado alternativo
+static void ide_delay(struct ide_channel *chan) {
+    inb(chan->ctrl);
+    inb(chan->ctrl);
+    inb(chan->ctrl);
+    inb(chan->ctrl);
+}
+
+// Espera con límite a que BSY baje. Devuelve el estado o -1 si expira
+static int ide_wait_timeout(struct ide_channel *chan) {
+    u8 status;
+    int i;
+
+    for (i = 0; i < IDE_PROBE_TIMEOUT; i++) {
+        status = inb(chan->base + IDE_STATUS);
+        if (!(status & IDE_STATUS_BSY))
+            return status;
+    }
+
+    return -1;
+}
+
+// Transfiere un sector entre el disco y el buffer de la petición actual
+// del comando, pasando a la siguiente petición cuando se completa
+static void ide_xfer_sector(struct ide_channel *chan, int write) {
+    char *buffer = (char *)chan->xfer->buffer + chan->xfer_done * 512;
+
+    if (write)
+        outsl(chan->base + IDE_DATA, buffer, 128);
+    else
+        insl(chan->base + IDE_DATA, buffer, 128);   // 256 palabras (512 bytes)
+
+    chan->done_sectors++;
+    if (++chan->xfer_done == chan->xfer->count && chan->done_sectors < chan->cmd_sectors) {
+        chan->xfer = chan->xfer->next;
+        chan->xfer_done = 0;
+    }
+}
+
+// Envía al disco un comando para la cabeza de la cola, fusionando las
+// peticiones siguientes que continúan en el disco a la misma unidad
+static void ide_start(struct ide_channel *chan) {
+    struct blk_request *req = chan->head;
+    struct blk_request *prev, *next;
+    struct ide_drive *drive;
+    u32 lba;
     u8 status;
-    
-    do {
-        status = inb(IDE_STATUS);
-    } while (status & IDE_STATUS_BSY);
-    
-    if (check_error && (status & IDE_STATUS_ERR)) {
+
+    if (chan->cmd_reqs || req == NULL)
+        return;
+
+    drive = (struct ide_drive *)req->dev->private;
+    lba = req->lba;
+
+    chan->cmd_reqs = 1;
+    chan->cmd_sectors = req->count;
+    for (prev = req, next = req->next; next; prev = next, next = next->next) {
+        if (next->dev != req->dev || next->cmd != req->cmd ||
+            next->lba != prev->lba + prev->count ||
+            chan->cmd_sectors + next->count > IDE_MAX_CMD_SECTORS)
+            break;
+        chan->cmd_reqs++;
+        chan->cmd_sectors += next->count;
+        req->dev->stats.merges[req->cmd == BLK_WRITE]++;
+    }
+
+    chan->done_sectors = 0;
+    chan->xfer = req;
+    chan->xfer_done = 0;
+
+    // Configurar parámetros (LBA28). 0 sectores equivale a 256
+    outb(chan->base + IDE_DRIVE_HEAD, 0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+    ide_delay(chan);
+    outb(chan->base + IDE_SECT_COUNT, chan->cmd_sectors & 0xFF);
+    outb(chan->base + IDE_SECT_NUM, lba & 0xFF);
+    outb(chan->base + IDE_CYL_LOW, (lba >> 8) & 0xFF);
+    outb(chan->base + IDE_CYL_HIGH, (lba >> 16) & 0xFF);
+
+    if (req->cmd == BLK_WRITE) {
+        outb(chan->base + IDE_CMD, IDE_CMD_WRITE);
+
+        // El primer sector se entrega en cuanto el disco pide datos;
+        // los siguientes, en cada interrupción
+        ide_delay(chan);
+        do {
+            status = inb(chan->base + IDE_STATUS);
+        } while (status & IDE_STATUS_BSY);
+        if (status & IDE_STATUS_DRQ)
+            ide_xfer_sector(chan, 1);
+    } else {
+        outb(chan->base + IDE_CMD, IDE_CMD_READ);
+    }
+
+    ide_delay(chan);
+}
+
+// Termina las peticiones del comando en curso y arranca el siguiente
+static void ide_finish(struct ide_channel *chan, int error) {
+    struct blk_request *req = chan->head;
+    struct blk_request *last = req;
+    struct blk_request *next;
+    u32 i;
+
+    // Separar de la cola las peticiones que cubría el comando
+    for (i = 1; i < chan->cmd_reqs; i++)
+        last = last->next;
+    chan->head = last->next;
+    if (chan->head == NULL)
+        chan->tail = NULL;
+    last->next = NULL;
+    chan->cmd_reqs = 0;
+
+    if (error)
         print("IDE    : Error during operation\n");
-        return -1;
+
+    ide_start(chan);
+
+    while (req) {
+        next = req->next;
+        blk_end_request(req, error);
+        req = next;
     }
-    
-    return 0;
 }
 
-// Inicialización del controlador IDE
-void ide_init(void) {
-    outb(IDE_DRIVE_HEAD, 0xE0 | (IDE_MASTER << 4)); // Seleccionar master
-    outb(IDE_SECT_COUNT, 0);
-    outb(IDE_SECT_NUM, 0);
-    
-    // Esperar a que el disco esté listo
-    ide_wait(0);
-    
-    print("IDE    : Controller initialized\n");
+// Avanza el comando en curso de un canal. Se llama desde la IRQ del
+// canal y también por sondeo (blk_wait) cuando no hay interrupciones
+static void ide_service(struct ide_channel *chan) {
+    u8 status;
+    u32 flags;
+
+    irq_save(flags);
+
+    if (!chan->cmd_reqs) {
+        irq_restore(flags);
+        return;
+    }
+
+    // Leer el estado también confirma la interrupción del disco
+    status = inb(chan->base + IDE_STATUS);
+    if (status & IDE_STATUS_BSY) {
+        irq_restore(flags);
+        return;
+    }
+
+    if (status & (IDE_STATUS_ERR | IDE_STATUS_DF)) {
+        ide_finish(chan, -1);
+    } else if (chan->head->cmd == BLK_READ) {
+        if (status & IDE_STATUS_DRQ) {
+            ide_xfer_sector(chan, 0);
+            if (chan->done_sectors == chan->cmd_sectors)
+                ide_finish(chan, 0);
+        }
+    } else {
+        if (chan->done_sectors == chan->cmd_sectors) {
+            // Último sector escrito y el disco ya no está ocupado
+            ide_finish(chan, 0);
+        } else if (status & IDE_STATUS_DRQ) {
+            ide_xfer_sector(chan, 1);
+            ide_delay(chan);
+        }
+    }
+
+    irq_restore(flags);
 }
 
-// Leer sectores del disco
-int ide_read_sectors(int drive, u32 lba, u8 num_sectors, void *buffer) {
-    u16 *buf = (u16 *)buffer;
+// Manejador de IRQ 14/15
+static void ide_irq(int irq) {
     int i;
-    
-    // Esperar a que el disco esté listo
-    if (ide_wait(1)) return -1;
-    
-    // Configurar parámetros de lectura
-    outb(IDE_DRIVE_HEAD, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
-    outb(IDE_SECT_COUNT, num_sectors);
-    outb(IDE_SECT_NUM, lba & 0xFF);
-    outb(IDE_CYL_LOW, (lba >> 8) & 0xFF);
-    outb(IDE_CYL_HIGH, (lba >> 16) & 0xFF);
-    
-    // Enviar comando de lectura
-    outb(IDE_CMD, IDE_CMD_READ);
-    
-    // Leer datos sector por sector
-    for (i = 0; i < num_sectors; i++) {
-        // Esperar hasta que los datos estén listos
-        if (ide_wait(1)) return -1;
-        
-        // Leer 256 palabras (512 bytes)
-        insl(IDE_DATA, buf, 128);
-        buf += 256;
+
+    for (i = 0; i < IDE_CHANNELS; i++) {
+        if (ide_channels[i].irq == irq)
+            ide_service(&ide_channels[i]);
     }
-    
+}
+
+// Encola una petición de la capa de bloques en el canal de la unidad
+static int ide_blk_submit(struct blk_dev *dev, struct blk_request *req) {
+    struct ide_drive *drive = (struct ide_drive *)dev->private;
+    struct ide_channel *chan = drive->chan;
+    u32 flags;
+
+    irq_save(flags);
+    if (chan->tail)
+        chan->tail->next = req;
+    else
+        chan->head = req;
+    chan->tail = req;
+    ide_start(chan);
+    irq_restore(flags);
+
     return 0;
 }
 
-// Escribir sectores en el disco
-int ide_write_sectors(int drive, u32 lba, u8 num_sectors, void *buffer) {
-    u16 *buf = (u16 *)buffer;
+static void ide_blk_poll(struct blk_dev *dev) {
+    struct ide_drive *drive = (struct ide_drive *)dev->private;
+
+    ide_service(drive->chan);
+}
+
+static struct blk_ops ide_blk_ops = {
+    .submit = ide_blk_submit,
+    .poll = ide_blk_poll,
+};
+
+// Inicialización del controlador IDE: detecta las cuatro unidades
+void ide_init(void) {
+    u16 id[256];
+    struct ide_drive *drive;
     int i;
-    
-    // Esperar a que el disco esté listo
-    if (ide_wait(1)) return -1;
-    
-    // Configurar parámetros de escritura
-    outb(IDE_DRIVE_HEAD, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
-    outb(IDE_SECT_COUNT, num_sectors);
-    outb(IDE_SECT_NUM, lba & 0xFF);
-    outb(IDE_CYL_LOW, (lba >> 8) & 0xFF);
-    outb(IDE_CYL_HIGH, (lba >> 16) & 0xFF);
-    
-    // Enviar comando de escritura
-    outb(IDE_CMD, IDE_CMD_WRITE);
-    
-    // Escribir datos sector por sector
-    for (i = 0; i < num_sectors; i++) {
-        // Esperar hasta que el disco esté listo para recibir datos
-        if (ide_wait(1)) return -1;
-        
-        // Escribir 256 palabras (512 bytes)
-        outsl(IDE_DATA, buf, 128);
-        buf += 256;
+
+    for (i = 0; i < IDE_DRIVES; i++) {
+        drive = &ide_drives[i];
+        drive->chan = &ide_channels[i / 2];
+        drive->slave = i % 2;
+
+        if (ide_identify(i, id) != 0)
+            continue;
+
+        // Palabras 60-61: número de sectores direccionables en LBA28
+        drive->present = 1;
+        drive->blk.name[0] = 'h';
+        drive->blk.name[1] = 'd';
+        drive->blk.name[2] = 'a' + i;
+        drive->blk.name[3] = '\0';
+        drive->blk.nr_sectors = id[60] | ((u32)id[61] << 16);
+        drive->blk.max_sectors = IDE_MAX_SECTORS;
+        drive->blk.ops = &ide_blk_ops;
+        drive->blk.private = drive;
+        blk_register(&drive->blk);
     }
-    
-    // Esperar a que la escritura se complete
-    if (ide_wait(1)) return -1;
-    
-    return 0;
+
+    // Cada canal con unidades tiene su propia IRQ
+    for (i = 0; i < IDE_CHANNELS; i++) {
+        if (!ide_drives[i * 2].present && !ide_drives[i * 2 + 1].present)
+            continue;
+        irq_register(ide_channels[i].irq, ide_irq);
+        outb(ide_channels[i].ctrl, 0);      // nIEN = 0: interrupciones activas
+    }
+
+    print("IDE    : Controller initialized\n");
 }
 
-// Identificar dispositivo IDE
+// Leer sectores del disco (síncrono, a través de la cola del canal)
+int ide_read_sectors(int drive, u32 lba, u8 num_sectors, void *buffer) {
+    if (drive < 0 || drive >= IDE_DRIVES || !ide_drives[drive].present)
+        return -1;
+
+    return blk_read(&ide_drives[drive].blk, lba, num_sectors, buffer);
+}
+
+// Escribir sectores en el disco (síncrono, a través de la cola del canal)
+int ide_write_sectors(int drive, u32 lba, u8 num_sectors, void *buffer) {
+    if (drive < 0 || drive >= IDE_DRIVES || !ide_drives[drive].present)
+        return -1;
+
+    return blk_write(&ide_drives[drive].blk, lba, num_sectors, buffer);
+}
+
+// Identificar dispositivo IDE. Devuelve -1 si no hay disco ATA
 int ide_identify(int drive, u16 *buffer) {
-    // Esperar a que el disco esté listo
-    if (ide_wait(1)) return -1;
-    
+    struct ide_channel *chan = &ide_channels[drive / 2];
+    int status, i;
+
+    // Bus flotante: no hay controlador en este canal
+    if (inb(chan->base + IDE_STATUS) == 0xFF)
+        return -1;
+
+    // Seleccionar la unidad con interrupciones deshabilitadas
+    outb(chan->ctrl, IDE_CTRL_NIEN);
+    outb(chan->base + IDE_DRIVE_HEAD, 0xA0 | ((drive % 2) << 4));
+    ide_delay(chan);
+
     // Configurar parámetros de identificación
-    outb(IDE_DRIVE_HEAD, 0xE0 | (drive << 4));
-    outb(IDE_SECT_COUNT, 0);
-    outb(IDE_SECT_NUM, 0);
-    outb(IDE_CYL_LOW, 0);
-    outb(IDE_CYL_HIGH, 0);
-    
+    outb(chan->base + IDE_SECT_COUNT, 0);
+    outb(chan->base + IDE_SECT_NUM, 0);
+    outb(chan->base + IDE_CYL_LOW, 0);
+    outb(chan->base + IDE_CYL_HIGH, 0);
+
     // Enviar comando IDENTIFY
-    outb(IDE_CMD, IDE_CMD_IDENTIFY);
-    
+    outb(chan->base + IDE_CMD, IDE_CMD_IDENTIFY);
+    ide_delay(chan);
+
+    // Estado 0: la unidad no existe
+    if (inb(chan->base + IDE_STATUS) == 0)
+        return -1;
+
+    status = ide_wait_timeout(chan);
+    if (status < 0)
+        return -1;
+
+    // Firma ATAPI/SATA en los registros de cilindro: no es un disco ATA
+    if (inb(chan->base + IDE_CYL_LOW) != 0 || inb(chan->base + IDE_CYL_HIGH) != 0)
+        return -1;
+
     // Esperar respuesta
-    if (ide_wait(1)) return -1;
-    
+    for (i = 0; i < IDE_PROBE_TIMEOUT; i++) {
+        if (status & (IDE_STATUS_DRQ | IDE_STATUS_ERR))
+            break;
+        status = inb(chan->base + IDE_STATUS);
+    }
+    if (!(status & IDE_STATUS_DRQ) || (status & IDE_STATUS_ERR))
+        return -1;
+
     // Leer datos de identificación (256 palabras = 512 bytes)
-    insl(IDE_DATA, buffer, 128);
-    
+    insl(chan->base + IDE_DATA, buffer, 128);
+
     return 0;
 }
@@ -3,30 +3,56 @@
 
 #include "types.h"
 
-// Puertos del controlador IDE primario
-#define IDE_DATA        0x1F0
-#define IDE_ERROR       0x1F1
-#define IDE_SECT_COUNT  0x1F2
-#define IDE_SECT_NUM    0x1F3
-#define IDE_CYL_LOW     0x1F4
-#define IDE_CYL_HIGH    0x1F5
-#define IDE_DRIVE_HEAD  0x1F6
-#define IDE_STATUS      0x1F7
-#define IDE_CMD         0x1F7
+// Puertos base de los dos canales IDE
+#define IDE_PRIMARY_BASE    0x1F0
+#define IDE_PRIMARY_CTRL    0x3F6
+#define IDE_SECONDARY_BASE  0x170
+#define IDE_SECONDARY_CTRL  0x376
+
+// Línea IRQ de cada canal
+#define IDE_PRIMARY_IRQ     14
+#define IDE_SECONDARY_IRQ   15
+
+// Registros (desplazamiento desde la base del canal)
+#define IDE_DATA        0
+#define IDE_ERROR       1
+#define IDE_SECT_COUNT  2
+#define IDE_SECT_NUM    3
+#define IDE_CYL_LOW     4
+#define IDE_CYL_HIGH    5
+#define IDE_DRIVE_HEAD  6
+#define IDE_STATUS      7
+#define IDE_CMD         7
 
 // Bits del registro de estado
 #define IDE_STATUS_ERR  0x01
 #define IDE_STATUS_DRQ  0x08
+#define IDE_STATUS_DF   0x20
 #define IDE_STATUS_BSY  0x80
 
+// Registro de control: bit nIEN deshabilita las interrupciones
+#define IDE_CTRL_NIEN   0x02
+
 // Comandos
 #define IDE_CMD_READ    0x20
 #define IDE_CMD_WRITE   0x30
 #define IDE_CMD_IDENTIFY 0xEC
 
-// Tipos de unidad
+// Máximo de sectores por petición de la capa de bloques
+#define IDE_MAX_SECTORS 128
+
+// Máximo de sectores por comando tras fusionar peticiones (el contador
+// es de 8 bits; 0 equivale a 256)
+#define IDE_MAX_CMD_SECTORS 256
+
+// Unidades: canal * 2 + maestro/esclavo
 #define IDE_MASTER      0
 #define IDE_SLAVE       1
+#define IDE_SEC_MASTER  2
+#define IDE_SEC_SLAVE   3
+
+#define IDE_CHANNELS    2
+#define IDE_DRIVES      4
 
 // Prototipos de funciones
 void ide_init(void);
@@ -36,6 +36,22 @@ void init_idt(void)
     init_idt_desc(0x08, (u32)_asm_irq_0, 0x8E00, &kidt[32]);     /* IRQ0 - reloj */
     init_idt_desc(0x08, (u32)_asm_irq_1, 0x8E00, &kidt[33]);     /* IRQ1 - teclado */
     
+    /* IRQ 2..7 (PIC maestro) e IRQ 8..15 (PIC esclavo, ver pic.c) */
+    init_idt_desc(0x08, (u32)_asm_irq_2, 0x8E00, &kidt[0x22]);
+    init_idt_desc(0x08, (u32)_asm_irq_3, 0x8E00, &kidt[0x23]);
+    init_idt_desc(0x08, (u32)_asm_irq_4, 0x8E00, &kidt[0x24]);
+    init_idt_desc(0x08, (u32)_asm_irq_5, 0x8E00, &kidt[0x25]);
+    init_idt_desc(0x08, (u32)_asm_irq_6, 0x8E00, &kidt[0x26]);
+    init_idt_desc(0x08, (u32)_asm_irq_7, 0x8E00, &kidt[0x27]);
+    init_idt_desc(0x08, (u32)_asm_irq_8, 0x8E00, &kidt[0x70]);
+    init_idt_desc(0x08, (u32)_asm_irq_9, 0x8E00, &kidt[0x71]);
+    init_idt_desc(0x08, (u32)_asm_irq_10, 0x8E00, &kidt[0x72]);
+    init_idt_desc(0x08, (u32)_asm_irq_11, 0x8E00, &kidt[0x73]);
+    init_idt_desc(0x08, (u32)_asm_irq_12, 0x8E00, &kidt[0x74]);
+    init_idt_desc(0x08, (u32)_asm_irq_13, 0x8E00, &kidt[0x75]);
+    init_idt_desc(0x08, (u32)_asm_irq_14, 0x8E00, &kidt[0x76]);  /* IDE primario */
+    init_idt_desc(0x08, (u32)_asm_irq_15, 0x8E00, &kidt[0x77]);  /* IDE secundario */
+    
     /* Excepciones del procesador */
     init_idt_desc(0x08, (u32)_asm_exc_GP, 0x8E00, &kidt[13]);    /* General Protection Fault */
     init_idt_desc(0x08, (u32)_asm_exc_PF, 0x8E00, &kidt[14]);    /* Page Fault */
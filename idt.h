@@ -37,6 +37,20 @@ void init_idt(void);
 extern void _asm_default_int(void);
 extern void _asm_irq_0(void);
 extern void _asm_irq_1(void);
+extern void _asm_irq_2(void);
+extern void _asm_irq_3(void);
+extern void _asm_irq_4(void);
+extern void _asm_irq_5(void);
+extern void _asm_irq_6(void);
+extern void _asm_irq_7(void);
+extern void _asm_irq_8(void);
+extern void _asm_irq_9(void);
+extern void _asm_irq_10(void);
+extern void _asm_irq_11(void);
+extern void _asm_irq_12(void);
+extern void _asm_irq_13(void);
+extern void _asm_irq_14(void);
+extern void _asm_irq_15(void);
 extern void _asm_exc_GP(void);
 extern void _asm_exc_PF(void);
 
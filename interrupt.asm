@@ -7,6 +7,7 @@ extern isr_clock_int
 extern isr_kbd_int
 extern do_syscalls
 extern page_fault_handler
+extern isr_irq_dispatch
 
 ; Macros para guardar y restaurar registros
 %macro  SAVE_REGS 0
@@ -29,6 +30,24 @@ extern page_fault_handler
     popad           ; Restaurar todos los registros generales
 %endmacro
 
+; Rutina genérica para las IRQ 2..15: llama a isr_irq_dispatch(irq)
+; y envía el EOI al PIC esclavo (IRQ >= 8) y al maestro
+%macro  IRQ_STUB 1
+global _asm_irq_%1
+_asm_irq_%1:
+    SAVE_REGS
+    push dword %1
+    call isr_irq_dispatch
+    add esp, 4
+    mov al, 0x20    ; EOI (End Of Interrupt)
+%if %1 >= 8
+    out 0xA0, al
+%endif
+    out 0x20, al
+    RESTORE_REGS
+    iret
+%endmacro
+
 ; Rutina de interrupción por defecto
 global _asm_default_int
 _asm_default_int:
@@ -57,6 +76,22 @@ _asm_irq_1:
     RESTORE_REGS
     iret
 
+; Rutinas de interrupción para IRQ 2..15 (drivers de disco, PCI...)
+IRQ_STUB 2
+IRQ_STUB 3
+IRQ_STUB 4
+IRQ_STUB 5
+IRQ_STUB 6
+IRQ_STUB 7
+IRQ_STUB 8
+IRQ_STUB 9
+IRQ_STUB 10
+IRQ_STUB 11
+IRQ_STUB 12
+IRQ_STUB 13
+IRQ_STUB 14
+IRQ_STUB 15
+
 ; Rutina de interrupción para General Protection Fault
 global _asm_exc_GP
 _asm_exc_GP:
@@ -70,7 +105,9 @@ _asm_exc_GP:
 global _asm_exc_PF
 _asm_exc_PF:
     SAVE_REGS
+    push dword [esp+48]     ; código de error, encima de los registros guardados
     call page_fault_handler
+    add esp, 4
     RESTORE_REGS
     add esp, 4      ; Limpiar código de error de la pila
     iret
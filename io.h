@@ -22,4 +22,47 @@
         _v;     \
 })
 
+/* escribe una palabra de 16 bits en un puerto */
+#define outw(port,value) \
+        asm volatile ("outw %%ax, %%dx" :: "d" (port), "a" (value));
+
+/* lee una palabra de 16 bits de un puerto */
+#define inw(port) ({    \
+        unsigned short _v;      \
+        asm volatile ("inw %%dx, %%ax" : "=a" (_v) : "d" (port)); \
+        _v;     \
+})
+
+/* escribe una palabra de 32 bits en un puerto */
+#define outl(port,value) \
+        asm volatile ("outl %%eax, %%dx" :: "d" (port), "a" (value));
+
+/* lee una palabra de 32 bits de un puerto */
+#define inl(port) ({    \
+        unsigned int _v;        \
+        asm volatile ("inl %%dx, %%eax" : "=a" (_v) : "d" (port)); \
+        _v;     \
+})
+
+#ifdef __i386__
+/* guarda EFLAGS y desactiva las interrupciones */
+#define irq_save(flags) \
+        asm volatile ("pushfl; popl %0; cli" : "=g" (flags) :: "memory");
+
+/* restaura EFLAGS (y con ello el estado previo de IF) */
+#define irq_restore(flags) \
+        asm volatile ("pushl %0; popfl" :: "g" (flags) : "memory", "cc");
+#else
+/* compilación nativa de las pruebas (test_ext2.c): no hay interrupciones */
+#define irq_save(flags)         ((flags) = 0)
+#define irq_restore(flags)      ((void)(flags))
+#endif
+
+/* lee el contador de ciclos del procesador (TSC) */
+#define rdtsc() ({      \
+        unsigned int _lo, _hi;  \
+        asm volatile ("rdtsc" : "=a" (_lo), "=d" (_hi)); \
+        ((unsigned long long)_hi << 32) | _lo;  \
+})
+
 #endif
@@ -0,0 +1,39 @@
+#include "types.h"
+#include "io.h"
+#include "screen.h"
+#include "irq.h"
+
+/* Manejadores registrados por los drivers para las IRQ 2..15 */
+static irq_handler_t irq_handlers[IRQ_LINES];
+
+/*
+ * Registra el manejador de una línea IRQ. Las líneas 0 (reloj) y
+ * 1 (teclado) tienen rutinas propias en interrupt.asm.
+ */
+int irq_register(int irq, irq_handler_t handler)
+{
+    u32 flags;
+
+    if (irq < 2 || irq >= IRQ_LINES) {
+        print("irq    : ERROR - Invalid IRQ line ");
+        print_dec(irq);
+        print("\n");
+        return -1;
+    }
+
+    irq_save(flags);
+    irq_handlers[irq] = handler;
+    irq_restore(flags);
+
+    return 0;
+}
+
+/*
+ * Llamada desde las rutinas _asm_irq_N. El EOI lo envía la rutina
+ * en ensamblador al volver de aquí.
+ */
+void isr_irq_dispatch(int irq)
+{
+    if (irq >= 0 && irq < IRQ_LINES && irq_handlers[irq])
+        irq_handlers[irq](irq);
+}
@@ -0,0 +1,20 @@
+#ifndef IRQ_H_
+#define IRQ_H_
+
+#include "types.h"
+
+/* Líneas de interrupción de los dos PIC 8259A */
+#define IRQ_LINES       16
+
+/* Vectores donde pic.c reprograma cada PIC */
+#define IRQ_MASTER_BASE 0x20
+#define IRQ_SLAVE_BASE  0x70
+
+/* Manejador de una línea IRQ (recibe el número de línea) */
+typedef void (*irq_handler_t)(int irq);
+
+/* Funciones */
+int irq_register(int irq, irq_handler_t handler);
+void isr_irq_dispatch(int irq);
+
+#endif
@@ -3,6 +3,7 @@
 #include "io.h"
 #include "kbd.h"
 #include "process.h"
+#include "bcache.h"
 
 void isr_default_int(void)
 {
@@ -29,6 +30,9 @@ void isr_clock_int(void)
         }
     }
     
+    /* Reloj del write-back de la caché de bloques */
+    bcache_tick();
+    
     /* Llamar al scheduler */
     schedule();
 }
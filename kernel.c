@@ -10,6 +10,14 @@
 #include "ide.h"  // Agregado para soporte IDE
 #include "ext2.h" // Agregado para soporte Ext2
 #include "ext2_test.h" // Test para Ext2
+#include "ext2_prewarm.h"
+#include "tmpfs.h"
+#include "shrink.h"
+#include "blk.h"
+#include "virtio.h"
+#include "multiboot.h"
+#include "ramdisk.h"
+#include "raid0.h"
 
 void init_pic(void);
 int main(void);  // Declaración de la función main
@@ -19,14 +27,8 @@ int main(void);  // Declaración de la función main
 #define NULL ((void*)0)
 #endif
 
-// Estructura para información del multiboot
-struct mb_partial_info {
-    unsigned long flags;
-    unsigned long low_mem;
-    unsigned long high_mem;
-    unsigned long boot_device;
-    unsigned long cmdline;
-};
+// Información del multiboot recibida del cargador
+struct mb_partial_info *mb_info;
 
 // Función llamada por boot.asm
 void kmain(struct mb_partial_info *mbi)
@@ -41,6 +43,12 @@ void kmain(struct mb_partial_info *mbi)
     print("Pepin OS - Kernel loaded successfully!\n");
     print("This is a test message from the kernel.\n");
     print("Phase 1: Ext2 Filesystem Infrastructure\n");
+    
+    /* Imagen Ext2 pasada como módulo: se registra como "rd0" antes de
+       que nada use la memoria donde la dejó el cargador */
+    mb_info = mbi;
+    ramdisk_init(mbi);
+    
     print("Kernel is working - halting here for testing.\n");
     
     /* Detener el sistema aquí para pruebas */
@@ -70,14 +78,37 @@ int main(void)
     
     print("kernel : memory management disabled for testing\n");
     
-    /* Inicializar controlador IDE */
+    /* Inicializar controlador IDE y discos virtio-blk */
     /*
     ide_init();
     print("kernel : IDE controller initialized\n");
+    
+    virtio_blk_init();
+    
+    // RAID-0 con chunks de 64 KB sobre un disco de cada canal IDE
+    // (create_raid0_images.sh + make run-raid0)
+    struct blk_dev *members[2] = { blk_get("hda"), blk_get("hdc") };
+    if (members[0] != NULL && members[1] != NULL) {
+        raid0_create(members, 2, 128);
+    }
+    
+    // Comparar IDE y virtio-blk leyendo 8 MB de la misma imagen (make run-virtio)
+    // y, con make run-raid0, un miembro frente al RAID-0 completo
+    blk_bench(blk_get("hda"), 16384);
+    blk_bench(blk_get("vda"), 16384);
+    blk_bench(blk_get("md0"), 16384);
+    
+    // Peticiones, fusiones, profundidad de cola e histograma de latencias
+    blk_stats_dump_all();
     */
     
     print("kernel : IDE disabled for testing\n");
     
+    /* Archivos temporales en memoria, montados en /tmp (necesita init_mm) */
+    /*
+    tmpfs_init();
+    */
+    
     /* Inicializar sistema de archivos Ext2 */
     /*
     if (ext2_init() == 0) {
@@ -85,6 +116,9 @@ int main(void)
         
         // Probar funcionalidad Ext2
         ext2_test();
+        
+        // Búsquedas en /spool con y sin htree (make run-htree)
+        ext2_htree_bench(50000, 200);
     } else {
         print("kernel : WARNING - Ext2 filesystem not available\n");
     }
@@ -188,8 +222,14 @@ int main(void)
     
     print("Done.\n");
     
-    /* El sistema ahora funciona con multitarea */
+    /* El sistema ahora funciona con multitarea. No hay hilos de kernel:
+       el bucle ocioso hace de flusher, de precarga de la caché y de
+       recuperación de marcos, y la interrupción del reloj lo despierta
+       de cada hlt */
     while (1) {
+        ext2_flush_daemon();
+        ext2_prewarm_daemon();
+        shrink_daemon();
         asm("hlt");
     }
 }
@@ -14,6 +14,25 @@ void *memcpy(void *dest, const void *src, u32 count)
     return dest;
 }
 
+/*
+ * memmove: como memcpy, pero admite que las zonas se solapen
+ */
+void *memmove(void *dest, const void *src, u32 count)
+{
+    char *d = (char*)dest;
+    const char *s = (const char*)src;
+    
+    if (d <= s || d >= s + count)
+        return memcpy(dest, src, count);
+    
+    d += count;
+    s += count;
+    while (count--)
+        *--d = *--s;
+    
+    return dest;
+}
+
 /*
  * memset: llena 'count' bytes de 'dest' con 'val'
  */
@@ -78,3 +97,15 @@ int memcmp(const void *s1, const void *s2, u32 n)
     }
     return 0;
 }
+
+/*
+ * strcmp: compara dos cadenas terminadas en cero
+ */
+int strcmp(const char *s1, const char *s2)
+{
+    while (*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+    return *(const unsigned char *)s1 - *(const unsigned char *)s2;
+}
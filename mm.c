@@ -1,16 +1,66 @@
 #include "mm.h"
 #include "screen.h"
 #include "lib.h"
+#include "mmap.h"
+#include "multiboot.h"
+#include "shrink.h"
 
 /* Variables globales */
 u8 mem_bitmap[RAM_MAXPAGE / 8];  /* Bitmap de páginas físicas */
+u32 mm_free_frames = 0;          /* Marcos libres en el bitmap */
+u32 mm_mapped_end = 0;           /* Fin de la RAM con identity mapping */
+u32 mm_watermark[3];             /* Umbrales MM_WMARK_* */
 u32 *pd0;                        /* kernel page directory */
 u32 *pt0;                        /* kernel page table */
 
+/* Zonas reservadas antes de init_mm() */
+static struct {
+    u32 start;
+    u32 end;
+} mm_regions[MM_MAX_REGIONS];
+static int mm_nr_regions = 0;
+
 /*
- * Obtiene una página física libre y la marca como usada
+ * Reserva una zona física para que init_mm() no la entregue como
+ * página libre y la mapee 1:1 aunque esté por encima de los 4 MB
  */
-char *get_page_frame(void)
+void mm_reserve_region(u32 start, u32 end)
+{
+    if (mm_nr_regions >= MM_MAX_REGIONS) {
+        print("mm     : ERROR: Too many reserved regions\n");
+        return;
+    }
+    mm_regions[mm_nr_regions].start = start & PAGE_MASK;
+    mm_regions[mm_nr_regions].end = end;
+    mm_nr_regions++;
+}
+
+/*
+ * Marca una página física como usada
+ */
+void set_page_frame_used(u32 page)
+{
+    if (page >= RAM_MAXPAGE || (mem_bitmap[page / 8] & (1 << (page % 8))))
+        return;
+    mem_bitmap[page / 8] |= 1 << (page % 8);
+    mm_free_frames--;
+}
+
+/*
+ * Devuelve una página física al bitmap
+ */
+void release_page_frame(u32 p_addr)
+{
+    u32 page = p_addr / PAGE_SIZE;
+
+    if (page >= RAM_MAXPAGE || !(mem_bitmap[page / 8] & (1 << (page % 8))))
+        return;
+    mem_bitmap[page / 8] &= ~(1 << (page % 8));
+    mm_free_frames++;
+}
+
+/* Primera página física libre del bitmap */
+static char *mm_alloc_frame(void)
 {
     int byte, bit;
     int page = -1;
@@ -29,12 +79,58 @@ char *get_page_frame(void)
     return (char *)-1;  /* No hay páginas libres */
 }
 
+/*
+ * Obtiene una página física libre y la marca como usada. Con pocos
+ * marcos libres se encogen antes las cachés, y si no queda ninguno se
+ * recupera lo que se pueda y se reintenta antes de fallar. El marco
+ * siempre tiene identity mapping (init_mm() no entrega los demás), así
+ * que el kernel lo puede usar como puntero.
+ */
+char *get_page_frame(void)
+{
+    char *frame;
+
+    if (mm_free_frames <= mm_watermark[MM_WMARK_MIN])
+        shrink_caches(mm_watermark[MM_WMARK_LOW], 1);
+
+    frame = mm_alloc_frame();
+    if (frame == (char *)-1 && shrink_caches(mm_watermark[MM_WMARK_LOW], 1) > 0)
+        frame = mm_alloc_frame();
+    return frame;
+}
+
+/*
+ * Identity mapping de [start, end) en el directorio del kernel. Las
+ * tablas que faltan se piden al bitmap; se llama antes de activar la
+ * paginación, así que se escriben por su dirección física.
+ */
+static int mm_identity_map(u32 start, u32 end)
+{
+    u32 page_addr;
+    u32 *pt;
+
+    for (page_addr = start & PAGE_MASK; page_addr < end; page_addr += PAGE_SIZE) {
+        if (!(pd0[VADDR_PD_OFFSET(page_addr)] & PAGE_PRESENT)) {
+            pt = (u32 *)mm_alloc_frame();
+            if (pt == (u32 *)-1) {
+                print("mm     : ERROR: Cannot allocate page table\n");
+                return -1;
+            }
+            memset(pt, 0, PAGE_SIZE);
+            pd0[VADDR_PD_OFFSET(page_addr)] = (u32)pt | PAGE_PRESENT | PAGE_RW;
+        }
+        pt = (u32 *)(pd0[VADDR_PD_OFFSET(page_addr)] & PAGE_MASK);
+        pt[VADDR_PT_OFFSET(page_addr)] = page_addr | PAGE_PRESENT | PAGE_RW;
+    }
+    return 0;
+}
+
 /*
  * Inicializa la gestión de memoria con paginación
  */
 void init_mm(void)
 {
-    u32 page_addr;
+    u32 page_addr, high_kb;
     int i, pg;
 
     print("mm     : initializing memory management...\n");
@@ -42,6 +138,21 @@ void init_mm(void)
     /* Inicializar el bitmap de páginas físicas */
     for (pg = 0; pg < RAM_MAXPAGE / 8; pg++)
         mem_bitmap[pg] = 0;
+    mm_free_frames = RAM_MAXPAGE;
+
+    /* RAM que se va a mapear (high_mem: KB desde 1 MB). Sin información
+       del cargador solo se cuenta con los primeros 4MB */
+    mm_mapped_end = 0x400000;
+    if (mb_info != 0 && (mb_info->flags & MB_INFO_MEMORY)) {
+        high_kb = mb_info->high_mem;
+        if (high_kb > (RAM_MAXPAGE / 1024) * 4096 - 1024)
+            high_kb = (RAM_MAXPAGE / 1024) * 4096 - 1024;
+        mm_mapped_end = 0x100000 + high_kb * 1024;
+    }
+
+    /* Las páginas que no existen o no se mapean no se entregan */
+    for (pg = PAGE(mm_mapped_end); pg < RAM_MAXPAGE; pg++)
+        set_page_frame_used(pg);
 
     /* Marcar páginas reservadas para el kernel (0x0 - 0x20000) */
     for (pg = PAGE(0x0); pg < PAGE(0x20000); pg++)
@@ -51,6 +162,17 @@ void init_mm(void)
     for (pg = PAGE(0xA0000); pg < PAGE(0x100000); pg++)
         set_page_frame_used(pg);
 
+    /* Imagen del kernel, heap y page heap: el page heap remapea sus
+       direcciones virtuales, así que sus marcos físicos tampoco valen */
+    for (pg = PAGE(KERNEL_START); pg < PAGE(KERNEL_END); pg++)
+        set_page_frame_used(pg);
+
+    /* Marcar las zonas reservadas (módulos multiboot...) */
+    for (i = 0; i < mm_nr_regions; i++) {
+        for (pg = PAGE(mm_regions[i].start); pg < PAGE(mm_regions[i].end + PAGE_SIZE - 1); pg++)
+            set_page_frame_used(pg);
+    }
+
     /* Obtener páginas dinámicamente para el directorio y tabla de páginas del kernel */
     pd0 = (u32 *)get_page_frame();
     if (pd0 == (u32 *)-1) {
@@ -84,6 +206,31 @@ void init_mm(void)
     print("\n");
     print("mm     : identity mapping for first 4MB established\n");
 
+    /* Identity mapping del resto de la RAM: todo marco que entrega
+       get_page_frame() se puede usar como puntero del kernel. Si falta
+       una tabla, la RAM desde ahí no se entrega */
+    if (mm_mapped_end > 0x400000) {
+        for (page_addr = 0x400000; page_addr < mm_mapped_end; page_addr += 0x400000) {
+            if (mm_identity_map(page_addr, page_addr + 0x400000 < mm_mapped_end ?
+                                page_addr + 0x400000 : mm_mapped_end) != 0) {
+                for (pg = PAGE(page_addr); pg < PAGE(mm_mapped_end); pg++)
+                    set_page_frame_used(pg);
+                mm_mapped_end = page_addr;
+                break;
+            }
+        }
+        print("mm     : identity mapping up to 0x");
+        print_hex(mm_mapped_end);
+        print("\n");
+    }
+
+    /* Identity mapping de las zonas reservadas que pasan de los 4MB */
+    for (i = 0; i < mm_nr_regions; i++) {
+        if (mm_regions[i].end > 0x400000)
+            mm_identity_map(mm_regions[i].start < 0x400000 ? 0x400000 : mm_regions[i].start,
+                            mm_regions[i].end);
+    }
+
     /* Cargar el Page Directory en CR3 y activar la paginación */
     asm("   mov %0, %%eax    \n"
         "   mov %%eax, %%cr3 \n"
@@ -93,6 +240,30 @@ void init_mm(void)
         :: "r"(pd0), "i"(PAGING_FLAG) : "eax");
 
     print("mm     : paging enabled successfully\n");
+
+    /* Umbrales para encoger las cachés, según la memoria que queda: se
+       cuenta en el bitmap, sin el kernel, los heaps, las tablas ni la
+       RAM sin mapear */
+    mm_free_frames = 0;
+    for (pg = 0; pg < RAM_MAXPAGE; pg++) {
+        if (!(mem_bitmap[pg / 8] & (1 << (pg % 8))))
+            mm_free_frames++;
+    }
+    mm_watermark[MM_WMARK_MIN] = mm_free_frames / MM_WMARK_MIN_RATIO;
+    if (mm_watermark[MM_WMARK_MIN] < MM_WMARK_MIN_FRAMES)
+        mm_watermark[MM_WMARK_MIN] = MM_WMARK_MIN_FRAMES;
+    mm_watermark[MM_WMARK_LOW] = 2 * mm_watermark[MM_WMARK_MIN];
+    mm_watermark[MM_WMARK_HIGH] = 3 * mm_watermark[MM_WMARK_MIN];
+
+    print("mm     : ");
+    print_dec(mm_free_frames);
+    print(" free frames, watermarks ");
+    print_dec(mm_watermark[MM_WMARK_MIN]);
+    print("/");
+    print_dec(mm_watermark[MM_WMARK_LOW]);
+    print("/");
+    print_dec(mm_watermark[MM_WMARK_HIGH]);
+    print("\n");
 }
 
 /*
@@ -125,8 +296,10 @@ u32 *pd_create_task1(void)
     for (i = 0; i < 1024; i++)
         pt[i] = 0;
 
-    /* Espacio kernel - compartido con todas las tareas (identity mapping) */
-    pd[0] = (u32)pt0 | PAGE_PRESENT | PAGE_RW;  /* Sin PAGE_USER para protección */
+    /* Espacio kernel - compartido con todas las tareas (identity mapping
+       de toda la RAM, sin PAGE_USER para protección) */
+    for (i = 0; i < (USER_OFFSET >> 22); i++)
+        pd[i] = pd0[i];
 
     /* Espacio usuario - mapear 0x40000000 a 0x100000 */
     pd[USER_OFFSET >> 22] = (u32)pt | PAGE_PRESENT | PAGE_RW | PAGE_USER;
@@ -145,16 +318,16 @@ u32 *pd_create_task1(void)
 /*
  * Manejador de Page Fault
  */
-void page_fault_handler(void)
+void page_fault_handler(u32 error_code)
 {
     u32 fault_addr;
-    u32 error_code;
     
     /* Obtener la dirección que causó el page fault desde CR2 */
     asm("mov %%cr2, %0" : "=r" (fault_addr));
     
-    /* El código de error está en la pila, necesitamos accederlo correctamente */
-    asm("mov 40(%%esp), %0" : "=r" (error_code));  /* Ajuste para el stack frame */
+    /* Fallo dentro de un archivo mapeado: se resuelve y se reintenta */
+    if (mmap_fault(fault_addr, error_code) == 0)
+        return;
     
     print("mm     : PAGE FAULT EXCEPTION!\n");
     print("mm     : fault address: 0x");
@@ -165,19 +338,19 @@ void page_fault_handler(void)
     print("\n");
     
     /* Analizar el código de error */
-    if (error_code & 0x01) {
+    if (error_code & PF_PRESENT) {
         print("mm     : page protection violation\n");
     } else {
         print("mm     : page not present\n");
     }
     
-    if (error_code & 0x02) {
+    if (error_code & PF_WRITE) {
         print("mm     : write operation\n");
     } else {
         print("mm     : read operation\n");
     }
     
-    if (error_code & 0x04) {
+    if (error_code & PF_USER) {
         print("mm     : user mode access\n");
     } else {
         print("mm     : supervisor mode access\n");
@@ -17,6 +17,11 @@
 #define PAGE_ACCESSED   0x20            /* Página accedida */
 #define PAGE_DIRTY      0x40            /* Página modificada */
 
+/* Bits del código de error de un fallo de página */
+#define PF_PRESENT      0x01            /* Violación de protección (página presente) */
+#define PF_WRITE        0x02            /* Acceso de escritura */
+#define PF_USER         0x04            /* Acceso desde modo usuario */
+
 /* Gestión de memoria física */
 #define RAM_MAXPAGE     0x10000         /* Número máximo de páginas físicas (1GB / 4KB) */
 #define USER_OFFSET     0x40000000      /* Offset base para espacio de usuario */
@@ -44,13 +49,29 @@ struct heap_block {
 #define PAGE_HEAP_MAX    256           // 256 pages (1MB)
 #define PAGE_HEAP_ENTRIES 64           // 64 zones (each can manage multiple pages)
 
+/* Marcos que init_mm() nunca entrega: imagen del kernel, heap y page heap */
+#define KERNEL_START     0x100000
+#define KERNEL_END       (PAGE_HEAP_START + PAGE_HEAP_MAX * PAGE_SIZE)
+
 struct page_zone {
     u32 start;
     u32 size;
     u8 used;
 } __attribute__((packed));
+/* Umbrales de marcos libres para encoger las cachés (shrink.c): por
+   debajo de LOW el bucle ocioso recupera hasta HIGH; por debajo de MIN
+   lo hace get_page_frame() antes de asignar */
+#define MM_WMARK_MIN        0
+#define MM_WMARK_LOW        1
+#define MM_WMARK_HIGH       2
+#define MM_WMARK_MIN_RATIO  128     /* MIN = marcos libres al arrancar / 128 */
+#define MM_WMARK_MIN_FRAMES 16
+
 /* Variables globales */
 extern u8 mem_bitmap[RAM_MAXPAGE / 8];  /* Bitmap de páginas físicas */
+extern u32 mm_free_frames;              /* Marcos libres en mem_bitmap */
+extern u32 mm_mapped_end;               /* Fin de la RAM con identity mapping */
+extern u32 mm_watermark[3];             /* MM_WMARK_* */
 extern u32 *pd0;                        /* kernel page directory */
 extern u32 *pt0;                        /* kernel page table */
 
@@ -83,11 +104,16 @@ struct pt_entry {
     u32 page_base:20;
 } __attribute__ ((packed));
 
+/* Zonas físicas que init_mm() reserva y mapea (p.ej. módulos multiboot) */
+#define MM_MAX_REGIONS  4
+
 /* Funciones para gestión de memoria */
 void init_mm(void);
-void page_fault_handler(void);
+void mm_reserve_region(u32 start, u32 end);
+void page_fault_handler(u32 error_code);
 char *get_page_frame(void);
 void release_page_frame(u32 p_addr);
+void set_page_frame_used(u32 page);
 u32 *pd_create_task1(void);
 void *kmalloc(u32 size);
 void kfree(void *ptr);
@@ -96,9 +122,4 @@ void release_page_from_heap(void *ptr);
 void init_heap(void);
 void init_page_heap(void);
 
-/* Macros para manipular el bitmap */
-#define set_page_frame_used(page)       mem_bitmap[((u32)page)/8] |= (1 << (((u32)page)%8))
-#define release_page_frame(p_addr)      mem_bitmap[((u32)p_addr/PAGE_SIZE)/8] &= ~(1 << (((u32)p_addr/PAGE_SIZE)%8))
-
-
 #endif
@@ -0,0 +1,127 @@
+#include "types.h"
+#include "lib.h"
+#include "mm.h"
+#include "screen.h"
+#include "process.h"
+#include "ext2.h"
+#include "pagecache.h"
+#include "vfs.h"
+#include "mmap.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Mapeo de archivos en el espacio de usuario. mmap() solo reserva
+ * direcciones; cada página se mapea en el primer fallo de página con el
+ * marco de la caché de páginas, así que todos los procesos que mapean un
+ * archivo comparten la misma copia y leen sin llamadas ni copias.
+ */
+
+/*
+ * Crea un mapeo de solo lectura de 'length' bytes del archivo abierto en
+ * 'fd' desde 'offset' (múltiplo de PAGE_SIZE) en el proceso actual. Solo
+ * los archivos de ext2 tienen caché de páginas. Devuelve la dirección de
+ * usuario o MMAP_FAILED.
+ */
+u32 do_mmap(int fd, u32 length, u32 offset)
+{
+    struct ext2_inode_info *ei;
+    struct fs_file *file;
+    u32 size, start;
+    int i;
+
+    if (current == 0) {
+        print("mmap   : ERROR - No current process\n");
+        return MMAP_FAILED;
+    }
+
+    size = (length + PAGE_SIZE - 1) & PAGE_MASK;
+    if (size == 0 || (offset & (PAGE_SIZE - 1)) != 0)
+        return MMAP_FAILED;
+
+    if (size > MMAP_END - current->mmap_next) {
+        print("mmap   : ERROR - Address space exhausted\n");
+        return MMAP_FAILED;
+    }
+
+    /* process es packed: se indexa mmaps[] en vez de tomar punteros */
+    for (i = 0; i < MMAP_MAX_AREAS; i++) {
+        if (current->mmaps[i].inode == NULL)
+            break;
+    }
+    if (i == MMAP_MAX_AREAS) {
+        print("mmap   : ERROR - Too many mappings\n");
+        return MMAP_FAILED;
+    }
+
+    file = vfs_fget(fd);
+    if (file == NULL || file->mnt->ops != &ext2_fs_ops ||
+        (file->flags & FS_O_ACCMODE) == FS_O_WRONLY)
+        return MMAP_FAILED;
+
+    ei = ext2_iget(file->ino);
+    if (ei == NULL)
+        return MMAP_FAILED;
+    if (!EXT2_S_ISREG(ei->raw.i_mode)) {
+        ext2_iput(ei);
+        return MMAP_FAILED;
+    }
+
+    start = current->mmap_next;
+    current->mmaps[i].start = start;
+    current->mmaps[i].end = start + size;
+    current->mmaps[i].pgoff = offset / PAGE_SIZE;
+    current->mmaps[i].inode = ei;
+    current->mmap_next += size;
+    return start;
+}
+
+/*
+ * Resuelve un fallo de página dentro de un mapeo del proceso actual:
+ * trae la página a la caché si no está y la mapea de solo lectura.
+ * Devuelve -1 si el fallo no corresponde a un mapeo (o es una escritura).
+ */
+int mmap_fault(u32 addr, u32 error_code)
+{
+    struct pcache_page *page;
+    u32 *pd, *pt;
+    int i;
+
+    if (current == 0 || (error_code & (PF_PRESENT | PF_WRITE)))
+        return -1;
+
+    for (i = 0; i < MMAP_MAX_AREAS; i++) {
+        if (current->mmaps[i].inode != NULL &&
+            addr >= current->mmaps[i].start && addr < current->mmaps[i].end)
+            break;
+    }
+    if (i == MMAP_MAX_AREAS)
+        return -1;
+
+    /* La tabla se pide antes que la página: pedir un marco puede
+       encoger la caché, y la página aún sin mapear se podría liberar */
+    pd = current->page_dir;
+    if (!(pd[VADDR_PD_OFFSET(addr)] & PAGE_PRESENT)) {
+        pt = (u32 *)get_page_frame();
+        if (pt == (u32 *)-1) {
+            print("mmap   : ERROR - Cannot allocate page table\n");
+            return -1;
+        }
+        memset(pt, 0, PAGE_SIZE);
+        pd[VADDR_PD_OFFSET(addr)] = (u32)pt | PAGE_PRESENT | PAGE_RW | PAGE_USER;
+    }
+    pt = (u32 *)(pd[VADDR_PD_OFFSET(addr)] & PAGE_MASK);
+
+    /* Más allá del final del archivo no hay página */
+    page = pcache_get(current->mmaps[i].inode,
+                      current->mmaps[i].pgoff + (addr - current->mmaps[i].start) / PAGE_SIZE);
+    if (page == NULL)
+        return -1;
+
+    pcache_map(page);
+    pt[VADDR_PT_OFFSET(addr)] = (u32)page->data | PAGE_PRESENT | PAGE_USER;
+    asm volatile("invlpg (%0)" :: "r"(addr & PAGE_MASK) : "memory");
+    return 0;
+}
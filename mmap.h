@@ -0,0 +1,27 @@
+#ifndef MMAP_H_
+#define MMAP_H_
+
+#include "types.h"
+
+/* Zonas de archivos mapeadas en el espacio de usuario con mmap() */
+#define MMAP_MAX_AREAS  8               /* Mapeos por proceso */
+#define MMAP_BASE       0x80000000      /* Primera dirección de los mapeos */
+#define MMAP_END        0xE0000000      /* Hasta la pila de usuario (USER_STACK) */
+#define MMAP_FAILED     0xFFFFFFFF
+
+struct ext2_inode_info;
+
+/* Zona [start, end) que muestra el archivo desde la página 'pgoff'.
+   Las páginas se mapean de solo lectura al primer acceso */
+struct mmap_area {
+    u32 start;
+    u32 end;
+    u32 pgoff;
+    struct ext2_inode_info *inode;  /* Referencia tomada; NULL = libre */
+};
+
+/* Funciones */
+u32 do_mmap(int fd, u32 length, u32 offset);
+int mmap_fault(u32 addr, u32 error_code);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef MULTIBOOT_H_
+#define MULTIBOOT_H_
+
+#include "types.h"
+
+/* Bits de 'flags' en la información que pasa el cargador */
+#define MB_INFO_MEMORY      0x00000001
+#define MB_INFO_CMDLINE     0x00000004
+#define MB_INFO_MODS        0x00000008
+
+/* Estructura para información del multiboot (hasta la lista de módulos) */
+struct mb_partial_info {
+    u32 flags;
+    u32 low_mem;
+    u32 high_mem;
+    u32 boot_device;
+    u32 cmdline;
+    u32 mods_count;
+    u32 mods_addr;              /* Dirección de la tabla de struct mb_module */
+};
+
+/* Módulo cargado junto al kernel (-initrd en QEMU, "module" en GRUB) */
+struct mb_module {
+    u32 mod_start;
+    u32 mod_end;
+    u32 string;
+    u32 reserved;
+};
+
+/* Información recibida en kmain() */
+extern struct mb_partial_info *mb_info;
+
+#endif
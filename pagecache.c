@@ -0,0 +1,357 @@
+#include "types.h"
+#include "lib.h"
+#include "mm.h"
+#include "screen.h"
+#include "pagecache.h"
+#include "shrink.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Caché de páginas de archivos. Cada página es un marco físico con 4 KB
+ * del archivo a partir de index * PAGE_SIZE; el inodo las indexa con un
+ * árbol radix de PCACHE_RADIX_SLOTS hijos por nivel. Una página está en
+ * la caché una sola vez, la mapeen cuantos procesos la mapeen. La caché
+ * no tiene límite: cuando faltan marcos, el shrinker libera las páginas
+ * menos recientes que nadie tiene mapeadas.
+ */
+
+static struct pcache_page *pcache_lru_head;    /* Más reciente */
+static struct pcache_page *pcache_lru_tail;
+static struct pcache_stats pcache_stats;
+
+static void pcache_lru_unlink(struct pcache_page *page)
+{
+    if (page->lru_prev)
+        page->lru_prev->lru_next = page->lru_next;
+    else
+        pcache_lru_head = page->lru_next;
+    if (page->lru_next)
+        page->lru_next->lru_prev = page->lru_prev;
+    else
+        pcache_lru_tail = page->lru_prev;
+    page->lru_prev = page->lru_next = NULL;
+}
+
+static void pcache_lru_push_head(struct pcache_page *page)
+{
+    page->lru_prev = NULL;
+    page->lru_next = pcache_lru_head;
+    if (pcache_lru_head)
+        pcache_lru_head->lru_prev = page;
+    else
+        pcache_lru_tail = page;
+    pcache_lru_head = page;
+}
+
+/* Índices que cubre un árbol de 'height' niveles: 2^(6 * height) */
+static int pcache_fits(struct ext2_inode_info *ei, u32 index)
+{
+    return ei->pc_root != NULL && (index >> (ei->pc_height * PCACHE_RADIX_SHIFT)) == 0;
+}
+
+static struct pcache_node *pcache_node_alloc(void)
+{
+    struct pcache_node *node;
+
+    node = (struct pcache_node *)kmalloc(sizeof(struct pcache_node));
+    if (node != NULL)
+        memset(node, 0, sizeof(struct pcache_node));
+    return node;
+}
+
+/*
+ * Busca una página en el árbol del inodo, sin leer nada
+ */
+struct pcache_page *pcache_lookup(struct ext2_inode_info *ei, u32 index)
+{
+    struct pcache_node *node = ei->pc_root;
+    u32 level;
+
+    if (!pcache_fits(ei, index))
+        return NULL;
+
+    for (level = ei->pc_height - 1; level > 0; level--) {
+        node = (struct pcache_node *)node->slots[(index >> (level * PCACHE_RADIX_SHIFT)) & PCACHE_RADIX_MASK];
+        if (node == NULL)
+            return NULL;
+    }
+    return (struct pcache_page *)node->slots[index & PCACHE_RADIX_MASK];
+}
+
+/*
+ * Inserta una página. El árbol crece por arriba (la raíz pasa a ser el
+ * primer hijo de una nueva) hasta cubrir el índice.
+ */
+static int pcache_insert(struct ext2_inode_info *ei, struct pcache_page *page)
+{
+    struct pcache_node *node, *child;
+    u32 level, slot;
+
+    while (!pcache_fits(ei, page->index)) {
+        if (ei->pc_height == PCACHE_MAX_HEIGHT)
+            return -1;
+        node = pcache_node_alloc();
+        if (node == NULL)
+            return -1;
+        if (ei->pc_root != NULL) {
+            node->slots[0] = ei->pc_root;
+            node->count = 1;
+        }
+        ei->pc_root = node;
+        ei->pc_height++;
+    }
+
+    node = ei->pc_root;
+    for (level = ei->pc_height - 1; level > 0; level--) {
+        slot = (page->index >> (level * PCACHE_RADIX_SHIFT)) & PCACHE_RADIX_MASK;
+        child = (struct pcache_node *)node->slots[slot];
+        if (child == NULL) {
+            child = pcache_node_alloc();
+            if (child == NULL)
+                return -1;
+            node->slots[slot] = child;
+            node->count++;
+        }
+        node = child;
+    }
+
+    node->slots[page->index & PCACHE_RADIX_MASK] = page;
+    node->count++;
+    return 0;
+}
+
+/*
+ * Quita una página del árbol y libera los nodos que quedan vacíos
+ */
+static void pcache_delete(struct ext2_inode_info *ei, u32 index)
+{
+    struct pcache_node *path[PCACHE_MAX_HEIGHT];
+    u32 slots[PCACHE_MAX_HEIGHT];
+    struct pcache_node *node = ei->pc_root;
+    u32 i, height = ei->pc_height;
+
+    if (!pcache_fits(ei, index))
+        return;
+
+    for (i = 0; i < height; i++) {
+        path[i] = node;
+        slots[i] = (index >> ((height - 1 - i) * PCACHE_RADIX_SHIFT)) & PCACHE_RADIX_MASK;
+        if (i < height - 1) {
+            node = (struct pcache_node *)node->slots[slots[i]];
+            if (node == NULL)
+                return;
+        }
+    }
+
+    for (i = height; i-- > 0; ) {
+        path[i]->slots[slots[i]] = NULL;
+        if (--path[i]->count > 0)
+            break;
+        kfree(path[i]);
+        if (i == 0) {
+            ei->pc_root = NULL;
+            ei->pc_height = 0;
+        }
+    }
+}
+
+/*
+ * Saca una página de la caché y libera su marco
+ */
+static void pcache_remove(struct pcache_page *page)
+{
+    struct ext2_inode_info *ei = page->inode;
+
+    pcache_delete(ei, page->index);
+    pcache_lru_unlink(page);
+    release_page_frame((u32)page->data);
+    if (page->mapcount > 0)
+        pcache_stats.mapped--;
+    kfree(page);
+    ei->pc_pages--;
+    pcache_stats.pages--;
+}
+
+/*
+ * Devuelve la página 'index' del archivo, leyéndola si no está en la
+ * caché. Lo que queda más allá del final del archivo se rellena a ceros.
+ * NULL si la página empieza después del final o no hay memoria.
+ */
+struct pcache_page *pcache_get(struct ext2_inode_info *ei, u32 index)
+{
+    struct pcache_page *page;
+    char *frame;
+    int n;
+
+    page = pcache_lookup(ei, index);
+    if (page != NULL) {
+        pcache_stats.hits++;
+        pcache_lru_unlink(page);
+        pcache_lru_push_head(page);
+        return page;
+    }
+
+    if (index >= (ei->raw.i_size + PAGE_SIZE - 1) / PAGE_SIZE)
+        return NULL;
+
+    frame = get_page_frame();
+    if (frame == (char *)-1) {
+        print("pcache : ERROR - Out of page frames\n");
+        return NULL;
+    }
+
+    n = ext2_pread(ei, index * PAGE_SIZE, frame, PAGE_SIZE);
+    if (n < 0) {
+        release_page_frame((u32)frame);
+        return NULL;
+    }
+    if (n < PAGE_SIZE)
+        memset(frame + n, 0, PAGE_SIZE - n);
+
+    page = (struct pcache_page *)kmalloc(sizeof(struct pcache_page));
+    if (page == NULL) {
+        release_page_frame((u32)frame);
+        return NULL;
+    }
+    page->inode = ei;
+    page->index = index;
+    page->data = frame;
+    page->mapcount = 0;
+
+    if (pcache_insert(ei, page) != 0) {
+        print("pcache : ERROR - Cannot index page\n");
+        release_page_frame((u32)frame);
+        kfree(page);
+        return NULL;
+    }
+    pcache_lru_push_head(page);
+
+    ei->pc_pages++;
+    pcache_stats.pages++;
+    pcache_stats.misses++;
+    return page;
+}
+
+/*
+ * Anota una entrada de tabla de páginas más que apunta a la página
+ */
+void pcache_map(struct pcache_page *page)
+{
+    if (page->mapcount++ == 0)
+        pcache_stats.mapped++;
+}
+
+/*
+ * Copia en las páginas en caché lo que ext2_write() acaba de escribir,
+ * para que los mapeos vean el contenido nuevo
+ */
+void pcache_update(struct ext2_inode_info *ei, u32 pos, const void *buffer, u32 len)
+{
+    struct pcache_page *page;
+    u32 done = 0;
+    u32 offset, chunk;
+
+    if (ei->pc_pages == 0)
+        return;
+
+    while (done < len) {
+        offset = (pos + done) & (PAGE_SIZE - 1);
+        chunk = PAGE_SIZE - offset;
+        if (chunk > len - done)
+            chunk = len - done;
+
+        page = pcache_lookup(ei, (pos + done) / PAGE_SIZE);
+        if (page != NULL)
+            memcpy(page->data + offset, (const char *)buffer + done, chunk);
+        done += chunk;
+    }
+}
+
+/*
+ * Ajusta la caché a un nuevo tamaño del archivo: las páginas enteras
+ * más allá del final se liberan y el resto de la última se pone a
+ * ceros. Las páginas aún mapeadas no se liberan; quedan a ceros.
+ */
+void pcache_truncate(struct ext2_inode_info *ei, u32 size)
+{
+    struct pcache_page *page, *next;
+    u32 start;
+
+    if (ei->pc_pages == 0)
+        return;
+
+    for (page = pcache_lru_head; page != NULL; page = next) {
+        next = page->lru_next;
+        if (page->inode != ei)
+            continue;
+
+        start = page->index * PAGE_SIZE;
+        if (start >= size && page->mapcount == 0)
+            pcache_remove(page);
+        else if (start >= size)
+            memset(page->data, 0, PAGE_SIZE);
+        else if (size - start < PAGE_SIZE)
+            memset(page->data + (size - start), 0, PAGE_SIZE - (size - start));
+    }
+}
+
+/*
+ * Libera todas las páginas de un inodo que sale de la caché de inodos
+ */
+void pcache_release_inode(struct ext2_inode_info *ei)
+{
+    struct pcache_page *page, *next;
+
+    for (page = pcache_lru_head; page != NULL && ei->pc_pages > 0; page = next) {
+        next = page->lru_next;
+        if (page->inode == ei)
+            pcache_remove(page);
+    }
+}
+
+/* Páginas que el shrinker puede liberar: las no mapeadas */
+static u32 pcache_shrink_count(void)
+{
+    return pcache_stats.pages - pcache_stats.mapped;
+}
+
+/*
+ * Libera hasta 'nr' páginas no mapeadas, empezando por la menos reciente
+ */
+static u32 pcache_shrink_scan(u32 nr)
+{
+    struct pcache_page *page, *prev;
+    u32 freed = 0;
+
+    for (page = pcache_lru_tail; page != NULL && freed < nr; page = prev) {
+        prev = page->lru_prev;
+        if (page->mapcount == 0) {
+            pcache_remove(page);
+            freed++;
+        }
+    }
+    return freed;
+}
+
+static struct shrinker pcache_shrinker = {
+    "pcache",
+    pcache_shrink_count,
+    pcache_shrink_scan,
+    NULL
+};
+
+/*
+ * Registra la caché para que se encoja cuando falten marcos
+ */
+void pcache_init(void)
+{
+    register_shrinker(&pcache_shrinker);
+}
+
+void pcache_get_stats(struct pcache_stats *stats)
+{
+    *stats = pcache_stats;
+}
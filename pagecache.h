@@ -0,0 +1,47 @@
+#ifndef PAGECACHE_H_
+#define PAGECACHE_H_
+
+#include "types.h"
+#include "ext2.h"
+
+/* Caché de páginas: páginas de 4 KB del contenido de los archivos,
+   indexadas en cada inodo por un árbol radix de índices de página */
+#define PCACHE_RADIX_SHIFT      6
+#define PCACHE_RADIX_SLOTS      (1 << PCACHE_RADIX_SHIFT)
+#define PCACHE_RADIX_MASK       (PCACHE_RADIX_SLOTS - 1)
+#define PCACHE_MAX_HEIGHT       4       /* 6 * 4 bits: 2^24 páginas, más de 4 GB */
+
+/* Nodo interior u hoja del árbol: las hojas apuntan a páginas */
+struct pcache_node {
+    void *slots[PCACHE_RADIX_SLOTS];
+    u32 count;                  /* Slots ocupados */
+};
+
+/* Página de un archivo en la caché */
+struct pcache_page {
+    struct ext2_inode_info *inode;
+    u32 index;                  /* Índice de página en el archivo */
+    char *data;                 /* Marco físico (identity mapping) */
+    u32 mapcount;               /* Entradas de tablas de páginas que la mapean */
+    struct pcache_page *lru_prev;   /* Lista LRU global: cabeza = más reciente */
+    struct pcache_page *lru_next;
+};
+
+struct pcache_stats {
+    u32 pages;                  /* Páginas en la caché */
+    u32 mapped;                 /* Páginas mapeadas en algún proceso */
+    u32 hits;
+    u32 misses;
+};
+
+/* Funciones */
+void pcache_init(void);
+struct pcache_page *pcache_lookup(struct ext2_inode_info *ei, u32 index);
+struct pcache_page *pcache_get(struct ext2_inode_info *ei, u32 index);
+void pcache_map(struct pcache_page *page);
+void pcache_update(struct ext2_inode_info *ei, u32 pos, const void *buffer, u32 len);
+void pcache_truncate(struct ext2_inode_info *ei, u32 size);
+void pcache_release_inode(struct ext2_inode_info *ei);
+void pcache_get_stats(struct pcache_stats *stats);
+
+#endif
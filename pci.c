@@ -0,0 +1,84 @@
+#include "types.h"
+#include "io.h"
+#include "pci.h"
+
+/*
+ * Construye la dirección de configuración (mecanismo #1)
+ */
+static u32 pci_config_address(u8 bus, u8 slot, u8 func, u8 offset)
+{
+    return 0x80000000 | ((u32)bus << 16) | ((u32)(slot & 0x1F) << 11) |
+           ((u32)(func & 0x07) << 8) | (offset & 0xFC);
+}
+
+/*
+ * Lee un registro de 32 bits del espacio de configuración
+ */
+u32 pci_read_config(u8 bus, u8 slot, u8 func, u8 offset)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(bus, slot, func, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+/*
+ * Escribe un registro de 32 bits del espacio de configuración
+ */
+void pci_write_config(u8 bus, u8 slot, u8 func, u8 offset, u32 value)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(bus, slot, func, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+/*
+ * Busca la aparición número 'index' del dispositivo vendor:device
+ * recorriendo todos los buses. Devuelve 0 y rellena 'dev' si existe.
+ */
+int pci_find_device(u16 vendor, u16 device, int index, struct pci_device *dev)
+{
+    u32 id, header;
+    int bus, slot, func, funcs, i;
+
+    for (bus = 0; bus < 256; bus++) {
+        for (slot = 0; slot < 32; slot++) {
+            id = pci_read_config(bus, slot, 0, PCI_VENDOR_ID);
+            if ((id & 0xFFFF) == 0xFFFF)
+                continue;
+
+            /* Dispositivo multifunción: bit 7 del tipo de cabecera */
+            header = pci_read_config(bus, slot, 0, PCI_HEADER_TYPE);
+            funcs = (header & 0x00800000) ? 8 : 1;
+
+            for (func = 0; func < funcs; func++) {
+                id = pci_read_config(bus, slot, func, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) != vendor || (id >> 16) != device)
+                    continue;
+                if (index-- > 0)
+                    continue;
+
+                dev->bus = bus;
+                dev->slot = slot;
+                dev->func = func;
+                dev->vendor = vendor;
+                dev->device = device;
+                dev->irq = pci_read_config(bus, slot, func, PCI_INTERRUPT_LINE) & 0xFF;
+                for (i = 0; i < 6; i++)
+                    dev->bar[i] = pci_read_config(bus, slot, func, PCI_BAR0 + i * 4);
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Habilita el acceso a E/S, memoria y DMA (bus master) del dispositivo
+ */
+void pci_enable_device(struct pci_device *dev)
+{
+    u32 cmd;
+
+    cmd = pci_read_config(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+    cmd |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+    pci_write_config(dev->bus, dev->slot, dev->func, PCI_COMMAND, cmd & 0xFFFF);
+}
@@ -0,0 +1,42 @@
+#ifndef PCI_H_
+#define PCI_H_
+
+#include "types.h"
+
+/* Puertos del mecanismo de configuración #1 */
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+/* Registros del espacio de configuración */
+#define PCI_VENDOR_ID       0x00
+#define PCI_COMMAND         0x04
+#define PCI_HEADER_TYPE     0x0C
+#define PCI_BAR0            0x10
+#define PCI_INTERRUPT_LINE  0x3C
+
+/* Bits del registro de comando */
+#define PCI_COMMAND_IO      0x0001
+#define PCI_COMMAND_MEMORY  0x0002
+#define PCI_COMMAND_MASTER  0x0004
+
+/* Bit 0 de un BAR: espacio de E/S en lugar de memoria */
+#define PCI_BAR_IO          0x01
+
+/* Dispositivo PCI localizado */
+struct pci_device {
+    u8 bus;
+    u8 slot;
+    u8 func;
+    u8 irq;
+    u16 vendor;
+    u16 device;
+    u32 bar[6];
+};
+
+/* Funciones */
+u32 pci_read_config(u8 bus, u8 slot, u8 func, u8 offset);
+void pci_write_config(u8 bus, u8 slot, u8 func, u8 offset, u32 value);
+int pci_find_device(u16 vendor, u16 device, int index, struct pci_device *dev);
+void pci_enable_device(struct pci_device *dev);
+
+#endif
@@ -52,6 +52,9 @@ void load_task(u32 *code_phys_addr, u32 *fn, unsigned int code_size)
     p_list[n_proc].mem_info.stack_start = 0x40001000;
     p_list[n_proc].mem_info.stack_end = 0x40002000;
     p_list[n_proc].page_dir = pd;
+    memset(p_list[n_proc].mmaps, 0, sizeof(p_list[n_proc].mmaps));
+    p_list[n_proc].mmap_next = MMAP_BASE;
+    memset(p_list[n_proc].files, 0, sizeof(p_list[n_proc].files));
     
     /* Inicializar los registros del proceso */
     p_list[n_proc].pid = n_proc;
@@ -113,8 +116,10 @@ u32 *pd_create(u32 *code_phys_addr, unsigned int code_size)
     for (i = 0; i < 1024; i++)
         pt[i] = 0;
 
-    /* Espacio kernel - compartido con todas las tareas */
-    pd[0] = (u32)pt0 | PAGE_PRESENT | PAGE_RW;
+    /* Espacio kernel - compartido con todas las tareas (incluye las
+       zonas reservadas por encima de 4MB, como el ramdisk) */
+    for (i = 0; i < (USER_OFFSET >> 22); i++)
+        pd[i] = pd0[i];
 
     /* Espacio usuario - mapear 0x40000000 a la dirección física del código */
     pd[USER_OFFSET >> 22] = (u32)pt | PAGE_PRESENT | PAGE_RW | PAGE_USER;
@@ -2,6 +2,8 @@
 #define PROCESS_H_
 
 #include "types.h"
+#include "mmap.h"
+#include "vfs.h"
 
 /* Estructura para almacenar el contexto de un proceso */
 struct process {
@@ -31,6 +33,12 @@ struct process {
     
     u32 *page_dir;
     u32 *page_tables[1024];
+
+    /* Archivos mapeados con mmap(); siempre al final, sched.asm usa
+       desplazamientos fijos de los campos anteriores */
+    struct mmap_area mmaps[MMAP_MAX_AREAS];
+    u32 mmap_next;          /* Siguiente dirección libre para mmap() */
+    struct fs_file *files[VFS_MAX_FDS];     /* Descriptores de archivo */
     
 } __attribute__ ((packed));
 
@@ -0,0 +1,221 @@
+#include "types.h"
+#include "io.h"
+#include "lib.h"
+#include "mm.h"
+#include "screen.h"
+#include "blk.h"
+#include "raid0.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Dispositivo de bloques apilado sobre otros: el sector lógico L cae en
+ * el chunk c = L / chunk, que vive en el miembro c % N a partir del
+ * sector (c / N) * chunk. Cada petición se trocea por chunks y los
+ * trozos se envían a todos los miembros antes de esperar a ninguno.
+ */
+
+struct raid0 {
+    struct blk_dev blk;
+    struct blk_dev *members[RAID0_MAX_MEMBERS];
+    int nr_members;
+    u32 chunk_sectors;
+};
+
+/* Estado de una petición lógica repartida en 'nr_children' trozos */
+struct raid0_io {
+    struct blk_request *parent;
+    int pending;
+    int error;
+    int nr_children;
+    struct blk_request children[];
+};
+
+static struct raid0 raid0_devs[RAID0_MAX_DEVICES];
+static int raid0_count = 0;
+
+/*
+ * Suelta una referencia; la petición lógica termina con la última.
+ * Los trozos pueden completarse desde la IRQ de cualquier miembro.
+ */
+static void raid0_put(struct raid0_io *io)
+{
+    struct blk_request *parent;
+    int error;
+    u32 flags;
+
+    irq_save(flags);
+    if (--io->pending == 0) {
+        parent = io->parent;
+        error = io->error;
+        kfree(io);
+        blk_end_request(parent, error);
+    }
+    irq_restore(flags);
+}
+
+/*
+ * Fin de un trozo
+ */
+static void raid0_end_io(struct blk_request *child)
+{
+    struct raid0_io *io = (struct raid0_io *)child->private;
+
+    if (child->error)
+        io->error = -1;
+    raid0_put(io);
+}
+
+static int raid0_submit(struct blk_dev *dev, struct blk_request *req)
+{
+    struct raid0 *r = (struct raid0 *)dev->private;
+    struct raid0_io *io;
+    struct blk_request *child;
+    struct blk_dev *member;
+    char *buf = (char *)req->buffer;
+    u32 lba = req->lba, count = req->count;
+    u32 chunk, offset, len, n;
+    int i;
+
+    /* Número máximo de trozos: uno por chunk tocado */
+    n = (lba % r->chunk_sectors + count + r->chunk_sectors - 1) / r->chunk_sectors;
+    io = (struct raid0_io *)kmalloc(sizeof(struct raid0_io) + n * sizeof(struct blk_request));
+    if (io == NULL)
+        return -1;
+
+    io->parent = req;
+    io->error = 0;
+    io->nr_children = 0;
+
+    while (count > 0) {
+        chunk = lba / r->chunk_sectors;
+        offset = lba % r->chunk_sectors;
+        member = r->members[chunk % r->nr_members];
+
+        len = r->chunk_sectors - offset;
+        if (len > count)
+            len = count;
+
+        child = &io->children[io->nr_children++];
+        child->dev = member;
+        child->cmd = req->cmd;
+        child->lba = (chunk / r->nr_members) * r->chunk_sectors + offset;
+        child->count = len;
+        child->buffer = buf;
+        child->end_io = raid0_end_io;
+        child->private = io;
+
+        lba += len;
+        count -= len;
+        buf += len * BLK_SECTOR_SIZE;
+    }
+
+    /* Referencia extra para que ningún trozo síncrono libere 'io' antes
+       de haber enviado todos */
+    io->pending = io->nr_children + 1;
+    n = io->nr_children;
+    for (i = 0; i < (int)n; i++)
+        blk_submit(&io->children[i]);
+
+    for (i = 0; i < r->nr_members; i++)
+        blk_unplug(r->members[i]);
+
+    raid0_put(io);
+    return 0;
+}
+
+static void raid0_unplug(struct blk_dev *dev)
+{
+    struct raid0 *r = (struct raid0 *)dev->private;
+    int i;
+
+    for (i = 0; i < r->nr_members; i++)
+        blk_unplug(r->members[i]);
+}
+
+static void raid0_poll(struct blk_dev *dev)
+{
+    struct raid0 *r = (struct raid0 *)dev->private;
+    int i;
+
+    for (i = 0; i < r->nr_members; i++) {
+        if (r->members[i]->ops->poll)
+            r->members[i]->ops->poll(r->members[i]);
+    }
+}
+
+static struct blk_ops raid0_ops = {
+    .submit = raid0_submit,
+    .unplug = raid0_unplug,
+    .poll = raid0_poll,
+};
+
+/*
+ * Crea "md0", "md1"... sobre 'nr_members' discos con chunks de
+ * 'chunk_sectors' sectores. La capacidad es la del miembro más pequeño
+ * (redondeada a chunks) por el número de miembros.
+ */
+struct blk_dev *raid0_create(struct blk_dev **members, int nr_members, u32 chunk_sectors)
+{
+    struct raid0 *r;
+    u32 min_sectors = 0xFFFFFFFF;
+    int i;
+
+    if (raid0_count >= RAID0_MAX_DEVICES || nr_members < 1 ||
+        nr_members > RAID0_MAX_MEMBERS || chunk_sectors == 0) {
+        print("raid0  : ERROR - Invalid configuration\n");
+        return NULL;
+    }
+
+    r = &raid0_devs[raid0_count];
+    for (i = 0; i < nr_members; i++) {
+        if (members[i] == NULL) {
+            print("raid0  : ERROR - Missing member disk\n");
+            return NULL;
+        }
+        /* Cada trozo debe caber en una sola petición del miembro */
+        if (chunk_sectors > members[i]->max_sectors) {
+            print("raid0  : ERROR - Chunk larger than ");
+            print(members[i]->name);
+            print(" requests\n");
+            return NULL;
+        }
+        if (members[i]->nr_sectors < min_sectors)
+            min_sectors = members[i]->nr_sectors;
+        r->members[i] = members[i];
+    }
+
+    r->nr_members = nr_members;
+    r->chunk_sectors = chunk_sectors;
+
+    r->blk.name[0] = 'm';
+    r->blk.name[1] = 'd';
+    r->blk.name[2] = '0' + raid0_count;
+    r->blk.name[3] = '\0';
+    r->blk.nr_sectors = (min_sectors / chunk_sectors) * chunk_sectors * nr_members;
+    r->blk.max_sectors = chunk_sectors * nr_members * RAID0_STRIPES_PER_REQUEST;
+    r->blk.readonly = 0;
+    r->blk.ops = &raid0_ops;
+    r->blk.private = r;
+
+    for (i = 0; i < nr_members; i++) {
+        if (members[i]->readonly)
+            r->blk.readonly = 1;
+    }
+
+    print("raid0  : ");
+    print(r->blk.name);
+    print(": ");
+    print_dec(nr_members);
+    print(" members, chunk ");
+    print_dec(chunk_sectors / 2);
+    print(" KB\n");
+
+    if (blk_register(&r->blk) != 0)
+        return NULL;
+
+    raid0_count++;
+    return &r->blk;
+}
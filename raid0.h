@@ -0,0 +1,17 @@
+#ifndef RAID0_H_
+#define RAID0_H_
+
+#include "types.h"
+#include "blk.h"
+
+/* Dispositivo RAID-0: reparte chunks consecutivos entre N discos */
+#define RAID0_MAX_DEVICES   2
+#define RAID0_MAX_MEMBERS   4
+
+/* Chunks por petición lógica (cada uno acaba en un disco miembro) */
+#define RAID0_STRIPES_PER_REQUEST 4
+
+/* Funciones */
+struct blk_dev *raid0_create(struct blk_dev **members, int nr_members, u32 chunk_sectors);
+
+#endif
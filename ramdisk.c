@@ -0,0 +1,109 @@
+#include "types.h"
+#include "lib.h"
+#include "mm.h"
+#include "screen.h"
+#include "blk.h"
+#include "multiboot.h"
+#include "ramdisk.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Dispositivo de bloques sobre un módulo multiboot (p.ej. una imagen
+ * Ext2 pasada con -initrd). Los datos ya están en memoria, así que las
+ * lecturas a través de blk_map() no copian nada.
+ */
+
+struct ramdisk {
+    struct blk_dev blk;
+    char *data;
+    u32 size;
+};
+
+static struct ramdisk ramdisks[RAMDISK_MAX_DEVICES];
+static int ramdisk_count = 0;
+
+static int ramdisk_submit(struct blk_dev *dev, struct blk_request *req)
+{
+    struct ramdisk *rd = (struct ramdisk *)dev->private;
+    char *p = rd->data + req->lba * BLK_SECTOR_SIZE;
+
+    if (req->cmd == BLK_WRITE)
+        memcpy(p, req->buffer, req->count * BLK_SECTOR_SIZE);
+    else
+        memcpy(req->buffer, p, req->count * BLK_SECTOR_SIZE);
+
+    blk_end_request(req, 0);
+    return 0;
+}
+
+static void *ramdisk_map(struct blk_dev *dev, u32 lba, u32 count)
+{
+    struct ramdisk *rd = (struct ramdisk *)dev->private;
+
+    return rd->data + lba * BLK_SECTOR_SIZE;
+}
+
+static struct blk_ops ramdisk_ops = {
+    .submit = ramdisk_submit,
+    .map = ramdisk_map,
+};
+
+/*
+ * Registra cada módulo multiboot como "rd0", "rd1"... Debe llamarse
+ * antes de init_heap(): si el cargador dejó el módulo sobre el heap
+ * fijo del kernel se mueve a RAMDISK_RELOC_BASE.
+ */
+int ramdisk_init(struct mb_partial_info *mbi)
+{
+    struct mb_module *mod;
+    struct ramdisk *rd;
+    u32 start, size, reloc = RAMDISK_RELOC_BASE;
+    u32 i;
+
+    if (mbi == NULL || !(mbi->flags & MB_INFO_MODS) || mbi->mods_count == 0)
+        return 0;
+
+    /* Los módulos se mueven por encima de todos ellos para no pisarse */
+    mod = (struct mb_module *)mbi->mods_addr;
+    for (i = 0; i < mbi->mods_count; i++) {
+        if (reloc < mod[i].mod_end)
+            reloc = (mod[i].mod_end + PAGE_SIZE - 1) & PAGE_MASK;
+    }
+
+    for (i = 0; i < mbi->mods_count && ramdisk_count < RAMDISK_MAX_DEVICES; i++) {
+        start = mod[i].mod_start;
+        size = mod[i].mod_end - mod[i].mod_start;
+
+        /* Zona del heap y del page heap: [HEAP_START, PAGE_HEAP_START + 1MB) */
+        if (start < PAGE_HEAP_START + PAGE_HEAP_MAX * PAGE_SIZE && start + size > HEAP_START) {
+            memmove((void *)reloc, (void *)start, size);
+            print("ramdisk: module moved to 0x");
+            print_hex(reloc);
+            print("\n");
+            start = reloc;
+            reloc = (reloc + size + PAGE_SIZE - 1) & PAGE_MASK;
+        }
+
+        mm_reserve_region(start, start + size);
+
+        rd = &ramdisks[ramdisk_count];
+        rd->data = (char *)start;
+        rd->size = size;
+        rd->blk.name[0] = 'r';
+        rd->blk.name[1] = 'd';
+        rd->blk.name[2] = '0' + ramdisk_count;
+        rd->blk.name[3] = '\0';
+        rd->blk.nr_sectors = size / BLK_SECTOR_SIZE;
+        rd->blk.max_sectors = 0xFFFFFFFF;
+        rd->blk.ops = &ramdisk_ops;
+        rd->blk.private = rd;
+
+        if (blk_register(&rd->blk) == 0)
+            ramdisk_count++;
+    }
+
+    return ramdisk_count;
+}
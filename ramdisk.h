@@ -0,0 +1,15 @@
+#ifndef RAMDISK_H_
+#define RAMDISK_H_
+
+#include "types.h"
+#include "multiboot.h"
+
+#define RAMDISK_MAX_DEVICES 2
+
+/* Dirección donde se mueve un módulo que pisa el heap del kernel */
+#define RAMDISK_RELOC_BASE  0x400000
+
+/* Funciones */
+int ramdisk_init(struct mb_partial_info *mbi);
+
+#endif
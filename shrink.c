@@ -0,0 +1,90 @@
+#include "shrink.h"
+#include "mm.h"
+#include "screen.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Registro de cachés que se pueden encoger. Mientras sobra memoria las
+ * cachés crecen sin límite; cuando los marcos libres bajan de
+ * mm_watermark[MM_WMARK_LOW], el bucle ocioso las encoge hasta
+ * mm_watermark[MM_WMARK_HIGH], y si llegan al mínimo lo hace el propio
+ * get_page_frame() antes de asignar (o de fallar). Cada pasada pide a
+ * cada caché una parte de lo que puede liberar, empezando por
+ * 1/2^SHRINK_PRIORITY y doblando en cada pasada, hasta alcanzar el
+ * objetivo; en la última se le pide todo.
+ */
+
+static struct shrinker *shrinkers;
+static struct shrink_stats shrink_stats;
+static int shrink_active;
+
+/* Registrar dos veces la misma caché no tiene efecto */
+void register_shrinker(struct shrinker *s)
+{
+    struct shrinker *p;
+
+    for (p = shrinkers; p != NULL; p = p->next) {
+        if (p == s)
+            return;
+    }
+    s->next = shrinkers;
+    shrinkers = s;
+}
+
+/*
+ * Encoge las cachés hasta que haya 'target' marcos libres o no quede
+ * nada que liberar. Devuelve los marcos recuperados.
+ */
+u32 shrink_caches(u32 target, int direct)
+{
+    struct shrinker *s;
+    u32 start = mm_free_frames;
+    u32 priority, count, nr;
+
+    /* Las cachés liberan sin pedir marcos, pero por si acaso */
+    if (shrink_active)
+        return 0;
+    shrink_active = 1;
+
+    if (direct)
+        shrink_stats.direct++;
+    else
+        shrink_stats.background++;
+
+    for (priority = SHRINK_PRIORITY + 1; priority-- > 0 && mm_free_frames < target; ) {
+        for (s = shrinkers; s != NULL && mm_free_frames < target; s = s->next) {
+            count = s->count();
+            if (count == 0)
+                continue;
+            nr = count >> priority;
+            if (nr == 0)
+                nr = 1;
+            if (nr > target - mm_free_frames && priority > 0)
+                nr = target - mm_free_frames;
+            shrink_stats.objects += s->scan(nr);
+        }
+    }
+
+    shrink_active = 0;
+    if (mm_free_frames <= start)
+        return 0;
+    shrink_stats.frames += mm_free_frames - start;
+    return mm_free_frames - start;
+}
+
+/*
+ * Una pasada desde el bucle ocioso del kernel
+ */
+void shrink_daemon(void)
+{
+    if (mm_free_frames < mm_watermark[MM_WMARK_LOW])
+        shrink_caches(mm_watermark[MM_WMARK_HIGH], 0);
+}
+
+void shrink_get_stats(struct shrink_stats *stats)
+{
+    *stats = shrink_stats;
+}
@@ -0,0 +1,35 @@
+#ifndef SHRINK_H_
+#define SHRINK_H_
+
+#include "types.h"
+
+/* Recuperación de memoria de las cachés cuando quedan pocos marcos
+   libres (umbrales mm_watermark[] de mm.h) */
+#define SHRINK_PRIORITY     4       /* Primera pasada: 1/16 de cada caché */
+
+/*
+ * Caché que se puede encoger. count() dice cuántos objetos podría
+ * liberar ahora mismo y scan(nr) libera hasta 'nr' de ellos, de los
+ * menos usados a los más, y devuelve cuántos liberó.
+ */
+struct shrinker {
+    const char *name;
+    u32 (*count)(void);
+    u32 (*scan)(u32 nr);
+    struct shrinker *next;
+};
+
+struct shrink_stats {
+    u32 background;             /* Pasadas desde el bucle ocioso */
+    u32 direct;                 /* Pasadas desde get_page_frame() */
+    u32 objects;                /* Objetos liberados */
+    u32 frames;                 /* Marcos recuperados */
+};
+
+/* Funciones */
+void register_shrinker(struct shrinker *s);
+u32 shrink_caches(u32 target, int direct);
+void shrink_daemon(void);
+void shrink_get_stats(struct shrink_stats *stats);
+
+#endif
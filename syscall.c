@@ -2,13 +2,126 @@
 #include "lib.h"
 #include "screen.h"
 #include "io.h"
+#include "syscall.h"
+#include "ext2.h"
+#include "mmap.h"
+#include "mm.h"
+#include "vfs.h"
+#include "process.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/* Valor de retorno en el EAX que restaura _asm_syscalls. Encima del
+   número de llamada están gs, fs, es, ds y los registros de pushad */
+#define SYSCALL_EAX_SLOT    12
+#define SYSCALL_EBX_SLOT    9
+#define SYSCALL_EDX_SLOT    10
+#define SYSCALL_ECX_SLOT    11
+
+/*
+ * Comprueba que [addr, addr + len) está en el espacio de usuario y que
+ * sus páginas están mapeadas para el usuario (y se pueden escribir si
+ * 'write'), porque el kernel las copia sin más: un fallo de página en
+ * modo supervisor detiene el sistema. Las páginas de un mmap() que aún
+ * no se han tocado se traen antes.
+ */
+static int syscall_user_range(u32 addr, u32 len, int write)
+{
+    u32 *pd, *pt;
+    u32 page, pte;
+
+    if (addr < USER_OFFSET || addr + len < addr || addr + len > USER_STACK)
+        return 0;
+    if (len == 0)
+        return 1;
+    if (current == 0)
+        return 0;
+
+    pd = current->page_dir;
+    for (page = addr & PAGE_MASK; page < addr + len; page += PAGE_SIZE) {
+        pte = 0;
+        if ((pd[VADDR_PD_OFFSET(page)] & (PAGE_PRESENT | PAGE_USER)) == (PAGE_PRESENT | PAGE_USER)) {
+            pt = (u32 *)(pd[VADDR_PD_OFFSET(page)] & PAGE_MASK);
+            pte = pt[VADDR_PT_OFFSET(page)];
+        }
+        if (!(pte & PAGE_PRESENT) && !write && mmap_fault(page, 0) == 0) {
+            pt = (u32 *)(pd[VADDR_PD_OFFSET(page)] & PAGE_MASK);
+            pte = pt[VADDR_PT_OFFSET(page)];
+        }
+        if ((pte & (PAGE_PRESENT | PAGE_USER)) != (PAGE_PRESENT | PAGE_USER))
+            return 0;
+        if (write && !(pte & pd[VADDR_PD_OFFSET(page)] & PAGE_RW))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Copia una ruta de usuario en 'path' (FS_PATH_MAX bytes) comprobando
+ * cada byte. Devuelve -1 si sale del espacio de usuario o no termina
+ * dentro del buffer.
+ */
+static int syscall_copy_path(u32 addr, char *path)
+{
+    u32 i;
+
+    for (i = 0; i < FS_PATH_MAX; i++) {
+        if (!syscall_user_range(addr + i, 1, 0))
+            return -1;
+        path[i] = *(const char *)(addr + i);
+        if (path[i] == '\0')
+            return 0;
+    }
+    return -1;
+}
+
+/*
+ * read() sobre memoria de usuario. Los discos escriben por DMA en
+ * direcciones físicas y las páginas de usuario no tienen identity
+ * mapping ni son contiguas: se lee en un marco del kernel y se copia
+ * al usuario, de página en página. Devuelve los bytes leídos o -1.
+ */
+static int syscall_read(int fd, char *buffer, u32 len)
+{
+    char *bounce;
+    u32 done = 0, chunk;
+    int n = 0;
+
+    bounce = get_page_frame();
+    if (bounce == (char *)-1)
+        return -1;
+
+    while (done < len) {
+        chunk = len - done;
+        if (chunk > PAGE_SIZE)
+            chunk = PAGE_SIZE;
+        n = vfs_read(fd, bounce, chunk);
+        if (n <= 0)
+            break;
+        memcpy(buffer + done, bounce, n);
+        done += n;
+        if ((u32)n < chunk)
+            break;
+    }
+
+    release_page_frame((u32)bounce);
+    if (done == 0 && n < 0)
+        return -1;
+    return done;
+}
 
 void do_syscalls(int sys_num)
 {
+    u32 *regs = (u32 *)&sys_num;
+    u32 ebx = regs[SYSCALL_EBX_SLOT];
+    u32 ecx = regs[SYSCALL_ECX_SLOT];
+    u32 edx = regs[SYSCALL_EDX_SLOT];
     char *u_str;
     int i;
 
-    if (sys_num == 1) {
+    if (sys_num == SYS_PRINT) {
         /* Obtener el puntero a la cadena desde el registro EBX */
         asm("mov %%ebx, %0": "=m"(u_str) :);
         
@@ -30,6 +143,27 @@ void do_syscalls(int sys_num)
         
         /* Rehabilitar interrupciones */
         sti;
+    } else if (sys_num == SYS_SYNC) {
+        regs[SYSCALL_EAX_SLOT] = ext2_sync();
+    } else if (sys_num == SYS_FSYNC) {
+        struct fs_file *file = vfs_fget(ebx);
+        
+        regs[SYSCALL_EAX_SLOT] = file != NULL ? fs_fsync(file->mnt, file->ino) : -1;
+    } else if (sys_num == SYS_MMAP) {
+        /* Los argumentos se leen de los registros guardados por pushad */
+        regs[SYSCALL_EAX_SLOT] = do_mmap(ebx, ecx, edx);
+    } else if (sys_num == SYS_OPEN) {
+        char path[FS_PATH_MAX];
+        
+        regs[SYSCALL_EAX_SLOT] = syscall_copy_path(ebx, path) == 0 ? vfs_open(path, ecx) : -1;
+    } else if (sys_num == SYS_READ) {
+        regs[SYSCALL_EAX_SLOT] = syscall_user_range(ecx, edx, 1) ? syscall_read(ebx, (char *)ecx, edx) : -1;
+    } else if (sys_num == SYS_WRITE) {
+        regs[SYSCALL_EAX_SLOT] = syscall_user_range(ecx, edx, 0) ? vfs_write(ebx, (const void *)ecx, edx) : -1;
+    } else if (sys_num == SYS_LSEEK) {
+        regs[SYSCALL_EAX_SLOT] = vfs_lseek(ebx, ecx, edx);
+    } else if (sys_num == SYS_CLOSE) {
+        regs[SYSCALL_EAX_SLOT] = vfs_close(ebx);
     } else {
         print("syscall: unknown system call ");
         print_dec(sys_num);
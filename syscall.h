@@ -5,6 +5,14 @@
 
 /* Números de llamadas al sistema */
 #define SYS_PRINT 1
+#define SYS_SYNC  2     /* Escribe en el disco todo lo pendiente */
+#define SYS_FSYNC 3     /* EBX = descriptor */
+#define SYS_MMAP  4     /* EBX = descriptor, ECX = longitud, EDX = offset */
+#define SYS_OPEN  5     /* EBX = ruta, ECX = FS_O_* */
+#define SYS_READ  6     /* EBX = descriptor, ECX = buffer, EDX = bytes */
+#define SYS_WRITE 7     /* EBX = descriptor, ECX = buffer, EDX = bytes */
+#define SYS_LSEEK 8     /* EBX = descriptor, ECX = desplazamiento, EDX = VFS_SEEK_* */
+#define SYS_CLOSE 9     /* EBX = descriptor */
 
 /* Funciones */
 void init_syscalls(void);
@@ -29,22 +29,27 @@ void* memset(void* dest, u8 val, u32 count) { return memset(dest, val, count); }
 u32 strlen(const char* s) { return strlen(s); }
 int memcmp(const void* s1, const void* s2, u32 n) { return memcmp(s1, s2, n); }
 
-// Simulate disk I/O
+// Simulate the block layer with a file-backed disk
+#include "blk.h"
+
 int disk_fd = -1;
-int ide_read_sectors(int drive, u32 lba, u8 num_sectors, void *buffer) {
+struct blk_dev disk_dev = { "hda" };
+
+struct blk_dev *blk_get(const char *name) {
     if (disk_fd == -1) {
         disk_fd = open("ext2_disk.img", O_RDONLY);
         if (disk_fd == -1) {
             printf("ERROR: Cannot open disk image\n");
-            return -1;
+            return NULL;
         }
     }
-    
-    lseek(disk_fd, lba * 512, SEEK_SET);
-    return read(disk_fd, buffer, num_sectors * 512) == (num_sectors * 512) ? 0 : -1;
+    return strcmp(name, disk_dev.name) == 0 ? &disk_dev : NULL;
 }
 
-#define IDE_MASTER 0
+int blk_read(struct blk_dev *dev, u32 lba, u32 count, void *buffer) {
+    lseek(disk_fd, (off_t)lba * 512, SEEK_SET);
+    return read(disk_fd, buffer, count * 512) == (count * 512) ? 0 : -1;
+}
 
 // Include our Ext2 implementation
 #include "ext2.c"
@@ -0,0 +1,519 @@
+#include "tmpfs.h"
+#include "fs.h"
+#include "screen.h"
+#include "mm.h"
+#include "lib.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * tmpfs: archivos que solo viven en memoria. El contenido de cada
+ * archivo se guarda en marcos de 4 KB pedidos al asignador de páginas
+ * cuando se escriben, indexados en dos niveles (un marco de punteros a
+ * marcos de punteros a páginas); lo que nunca se escribió es un hueco y
+ * se lee a ceros. Las entradas de directorio están en una tabla hash por
+ * (directorio, nombre), así que buscar un nombre no recorre el
+ * directorio. Se monta en TMPFS_MOUNT_POINT y se usa con las mismas
+ * operaciones de fs.h que ext2. Nada llega nunca a disco.
+ */
+
+/* Punteros por marco de índice: dos niveles direccionan todo u32 */
+#define TMPFS_PTRS_PER_PAGE     (PAGE_SIZE / sizeof(char *))
+
+static struct tmpfs_inode tmpfs_inodes[TMPFS_MAX_INODES];
+static struct tmpfs_dirent *tmpfs_hash[TMPFS_HASH_SIZE];
+static struct tmpfs_stats tmpfs_stats;
+static struct fs_ops tmpfs_ops;
+
+/* Misma función hash que la caché de dentries de ext2 */
+static u32 tmpfs_hashfn(u32 parent, const char *name, u32 len)
+{
+    u32 h = parent * 31;
+    u32 i;
+
+    for (i = 0; i < len; i++)
+        h = (h << 5) + h + (u8)name[i];
+    return h % TMPFS_HASH_SIZE;
+}
+
+static struct tmpfs_inode *tmpfs_iget(u32 ino)
+{
+    if (ino == 0 || ino > TMPFS_MAX_INODES || tmpfs_inodes[ino - 1].ino == 0)
+        return NULL;
+    return &tmpfs_inodes[ino - 1];
+}
+
+static struct tmpfs_dirent *tmpfs_find(u32 parent, const char *name, u32 len)
+{
+    struct tmpfs_dirent *d;
+
+    for (d = tmpfs_hash[tmpfs_hashfn(parent, name, len)]; d != NULL; d = d->hash_next) {
+        if (d->parent == parent && d->name_len == len && memcmp(d->name, name, len) == 0)
+            return d;
+    }
+    return NULL;
+}
+
+/*
+ * Marco nuevo a ceros, dentro del límite del sistema de archivos. Se usa
+ * por su dirección física: get_page_frame() solo entrega marcos con
+ * identity mapping y fuera del kernel y los heaps.
+ */
+static char *tmpfs_alloc_frame(void)
+{
+    char *frame;
+
+    if (tmpfs_stats.pages >= TMPFS_MAX_PAGES)
+        return NULL;
+    frame = get_page_frame();
+    if (frame == (char *)-1)
+        return NULL;
+    memset(frame, 0, PAGE_SIZE);
+    tmpfs_stats.pages++;
+    return frame;
+}
+
+static void tmpfs_free_frame(void *frame)
+{
+    release_page_frame((u32)frame);
+    tmpfs_stats.pages--;
+}
+
+/*
+ * Devuelve la página 'index' de un archivo; con 'alloc', la crea (y los
+ * marcos de índice que falten). NULL si es un hueco o no hay memoria.
+ */
+static char *tmpfs_page(struct tmpfs_inode *inode, u32 index, int alloc)
+{
+    u32 top = index / TMPFS_PTRS_PER_PAGE;
+    u32 slot = index % TMPFS_PTRS_PER_PAGE;
+
+    if (top >= TMPFS_PTRS_PER_PAGE)
+        return NULL;
+
+    if (inode->index == NULL) {
+        if (!alloc)
+            return NULL;
+        inode->index = (char ***)tmpfs_alloc_frame();
+        if (inode->index == NULL)
+            return NULL;
+    }
+    if (inode->index[top] == NULL) {
+        if (!alloc)
+            return NULL;
+        inode->index[top] = (char **)tmpfs_alloc_frame();
+        if (inode->index[top] == NULL)
+            return NULL;
+    }
+    if (inode->index[top][slot] == NULL && alloc)
+        inode->index[top][slot] = tmpfs_alloc_frame();
+    return inode->index[top][slot];
+}
+
+/*
+ * Libera las páginas desde 'first' hasta el final, y los marcos de
+ * índice que se quedan vacíos
+ */
+static void tmpfs_free_pages(struct tmpfs_inode *inode, u32 first)
+{
+    u32 top, slot, used;
+    char **leaf;
+
+    if (inode->index == NULL)
+        return;
+
+    for (top = 0; top < TMPFS_PTRS_PER_PAGE; top++) {
+        leaf = inode->index[top];
+        if (leaf == NULL)
+            continue;
+        used = 0;
+        for (slot = 0; slot < TMPFS_PTRS_PER_PAGE; slot++) {
+            if (leaf[slot] == NULL)
+                continue;
+            if (top * TMPFS_PTRS_PER_PAGE + slot >= first) {
+                tmpfs_free_frame(leaf[slot]);
+                leaf[slot] = NULL;
+            } else {
+                used++;
+            }
+        }
+        if (used == 0) {
+            tmpfs_free_frame(leaf);
+            inode->index[top] = NULL;
+        }
+    }
+
+    if (first == 0) {
+        tmpfs_free_frame(inode->index);
+        inode->index = NULL;
+    }
+}
+
+/*
+ * Separa una ruta en el directorio que la contiene (que debe existir) y
+ * el último componente. Devuelve -1 si no se puede.
+ */
+static int tmpfs_split(const char *path, u32 *parent, const char **name, u32 *len)
+{
+    struct tmpfs_inode *dir;
+    struct tmpfs_dirent *d;
+    const char *p = path;
+    u32 n;
+
+    *parent = TMPFS_ROOT_INO;
+    for (;;) {
+        while (*p == '/')
+            p++;
+        for (n = 0; p[n] != '\0' && p[n] != '/'; n++)
+            ;
+        if (n == 0 || n > TMPFS_NAME_LEN)
+            return -1;
+
+        /* ¿Último componente? (admite una '/' final) */
+        if (p[n] == '\0' || (p[n] == '/' && p[n + 1] == '\0')) {
+            *name = p;
+            *len = n;
+            return 0;
+        }
+
+        d = tmpfs_find(*parent, p, n);
+        if (d == NULL)
+            return -1;
+        dir = tmpfs_iget(d->ino);
+        if (dir == NULL || !FS_S_ISDIR(dir->mode))
+            return -1;
+        *parent = d->ino;
+        p += n;
+    }
+}
+
+static u32 tmpfs_lookup(const char *path)
+{
+    struct tmpfs_dirent *d;
+    const char *name;
+    u32 parent, len;
+
+    while (*path == '/')
+        path++;
+    if (*path == '\0')
+        return TMPFS_ROOT_INO;
+
+    if (tmpfs_split(path, &parent, &name, &len) != 0)
+        return 0;
+    d = tmpfs_find(parent, name, len);
+    return d != NULL ? d->ino : 0;
+}
+
+/* Crea un archivo o directorio vacío en su directorio */
+static int tmpfs_new(const char *path, u16 mode)
+{
+    struct tmpfs_inode *dir, *inode = NULL;
+    struct tmpfs_dirent *d;
+    const char *name;
+    u32 parent, len, i, h;
+
+    if (tmpfs_split(path, &parent, &name, &len) != 0 || tmpfs_find(parent, name, len) != NULL)
+        return -1;
+
+    for (i = 0; i < TMPFS_MAX_INODES; i++) {
+        if (tmpfs_inodes[i].ino == 0) {
+            inode = &tmpfs_inodes[i];
+            break;
+        }
+    }
+    if (inode == NULL) {
+        print("tmpfs  : ERROR - No free inodes\n");
+        return -1;
+    }
+
+    d = (struct tmpfs_dirent *)kmalloc(sizeof(struct tmpfs_dirent));
+    if (d == NULL)
+        return -1;
+
+    memset(inode, 0, sizeof(struct tmpfs_inode));
+    inode->ino = i + 1;
+    inode->mode = mode;
+    inode->nlink = FS_S_ISDIR(mode) ? 2 : 1;
+    inode->parent = parent;
+
+    d->parent = parent;
+    d->ino = inode->ino;
+    d->name_len = len;
+    memcpy(d->name, name, len);
+
+    h = tmpfs_hashfn(parent, name, len);
+    d->hash_next = tmpfs_hash[h];
+    tmpfs_hash[h] = d;
+
+    dir = tmpfs_iget(parent);
+    d->sibling = dir->children;
+    dir->children = d;
+    if (FS_S_ISDIR(mode))
+        dir->nlink++;
+
+    tmpfs_stats.inodes++;
+    return 0;
+}
+
+static int tmpfs_create(const char *path)
+{
+    return tmpfs_new(path, FS_S_IFREG | 0644);
+}
+
+static int tmpfs_mkdir(const char *path)
+{
+    return tmpfs_new(path, FS_S_IFDIR | 0755);
+}
+
+/* Libera la memoria de un inodo sin nombre ni archivos abiertos */
+static void tmpfs_destroy(struct tmpfs_inode *inode)
+{
+    tmpfs_free_pages(inode, 0);
+    inode->ino = 0;
+    tmpfs_stats.inodes--;
+}
+
+/*
+ * Borra un archivo o un directorio vacío. Su memoria se libera ya, o al
+ * cerrarse el último archivo abierto que lo usa (que lo sigue viendo).
+ */
+static int tmpfs_unlink(const char *path)
+{
+    struct tmpfs_dirent *d, **pp;
+    struct tmpfs_inode *inode, *dir;
+    const char *name;
+    u32 parent, len;
+
+    if (tmpfs_split(path, &parent, &name, &len) != 0)
+        return -1;
+    d = tmpfs_find(parent, name, len);
+    if (d == NULL)
+        return -1;
+    inode = tmpfs_iget(d->ino);
+    if (FS_S_ISDIR(inode->mode) && inode->children != NULL)
+        return -1;
+
+    for (pp = &tmpfs_hash[tmpfs_hashfn(parent, name, len)]; *pp != d; pp = &(*pp)->hash_next)
+        ;
+    *pp = d->hash_next;
+
+    dir = tmpfs_iget(parent);
+    for (pp = &dir->children; *pp != d; pp = &(*pp)->sibling)
+        ;
+    *pp = d->sibling;
+    if (FS_S_ISDIR(inode->mode))
+        dir->nlink--;
+    kfree(d);
+
+    inode->nlink = 0;
+    if (inode->opens == 0)
+        tmpfs_destroy(inode);
+    return 0;
+}
+
+static int tmpfs_read(u32 ino, u32 offset, void *buffer, u32 len)
+{
+    struct tmpfs_inode *inode = tmpfs_iget(ino);
+    u32 done = 0, chunk, in_page;
+    char *page;
+
+    if (inode == NULL || FS_S_ISDIR(inode->mode))
+        return -1;
+    if (offset >= inode->size)
+        return 0;
+    if (len > inode->size - offset)
+        len = inode->size - offset;
+
+    while (done < len) {
+        in_page = (offset + done) % PAGE_SIZE;
+        chunk = PAGE_SIZE - in_page;
+        if (chunk > len - done)
+            chunk = len - done;
+
+        page = tmpfs_page(inode, (offset + done) / PAGE_SIZE, 0);
+        if (page != NULL)
+            memcpy((char *)buffer + done, page + in_page, chunk);
+        else
+            memset((char *)buffer + done, 0, chunk);
+        done += chunk;
+    }
+    return done;
+}
+
+/*
+ * Escribe en el archivo pidiendo las páginas que falten. Si se acaba la
+ * memoria devuelve lo escrito hasta entonces (-1 si nada).
+ */
+static int tmpfs_write(u32 ino, u32 offset, const void *buffer, u32 len)
+{
+    struct tmpfs_inode *inode = tmpfs_iget(ino);
+    u32 done = 0, chunk, in_page;
+    char *page;
+
+    if (inode == NULL || FS_S_ISDIR(inode->mode))
+        return -1;
+    if (offset + len < offset)
+        len = 0xFFFFFFFF - offset;
+
+    while (done < len) {
+        in_page = (offset + done) % PAGE_SIZE;
+        chunk = PAGE_SIZE - in_page;
+        if (chunk > len - done)
+            chunk = len - done;
+
+        page = tmpfs_page(inode, (offset + done) / PAGE_SIZE, 1);
+        if (page == NULL) {
+            print("tmpfs  : ERROR - Out of space\n");
+            break;
+        }
+        memcpy(page + in_page, (const char *)buffer + done, chunk);
+        done += chunk;
+    }
+
+    if (done > 0 && offset + done > inode->size)
+        inode->size = offset + done;
+    return (done == 0 && len > 0) ? -1 : (int)done;
+}
+
+/*
+ * Cambia el tamaño. Al encoger se liberan las páginas sobrantes y se
+ * borra la cola de la última, para que al crecer otra vez se lea a
+ * ceros; al crecer solo se deja un hueco.
+ */
+static int tmpfs_truncate(u32 ino, u32 size)
+{
+    struct tmpfs_inode *inode = tmpfs_iget(ino);
+    char *page;
+
+    if (inode == NULL || FS_S_ISDIR(inode->mode))
+        return -1;
+
+    if (size < inode->size) {
+        tmpfs_free_pages(inode, (size + PAGE_SIZE - 1) / PAGE_SIZE);
+        if (size % PAGE_SIZE != 0) {
+            page = tmpfs_page(inode, size / PAGE_SIZE, 0);
+            if (page != NULL)
+                memset(page + size % PAGE_SIZE, 0, PAGE_SIZE - size % PAGE_SIZE);
+        }
+    }
+    inode->size = size;
+    return 0;
+}
+
+static int tmpfs_stat(u32 ino, struct fs_stat *st)
+{
+    struct tmpfs_inode *inode = tmpfs_iget(ino);
+
+    if (inode == NULL)
+        return -1;
+    st->ino = ino;
+    st->mode = inode->mode;
+    st->nlink = inode->nlink;
+    st->size = inode->size;
+    return 0;
+}
+
+static void tmpfs_emit(struct fs_dirent *entry, u32 ino, u8 type, const char *name, u32 len,
+                       void (*callback)(struct fs_dirent *entry, void *arg), void *arg)
+{
+    entry->ino = ino;
+    entry->type = type;
+    entry->name_len = len;
+    memcpy(entry->name, name, len);
+    entry->name[len] = '\0';
+    callback(entry, arg);
+}
+
+/* Lista un directorio, con "." y ".." como en ext2 */
+static int tmpfs_readdir(u32 ino, void (*callback)(struct fs_dirent *entry, void *arg), void *arg)
+{
+    struct tmpfs_inode *dir = tmpfs_iget(ino);
+    struct tmpfs_inode *inode;
+    struct tmpfs_dirent *d;
+    struct fs_dirent *entry;
+
+    if (dir == NULL || !FS_S_ISDIR(dir->mode))
+        return -1;
+    entry = (struct fs_dirent *)kmalloc(sizeof(struct fs_dirent));
+    if (entry == NULL)
+        return -1;
+
+    tmpfs_emit(entry, ino, FS_FT_DIR, ".", 1, callback, arg);
+    tmpfs_emit(entry, dir->parent, FS_FT_DIR, "..", 2, callback, arg);
+    for (d = dir->children; d != NULL; d = d->sibling) {
+        inode = tmpfs_iget(d->ino);
+        tmpfs_emit(entry, d->ino, FS_S_ISDIR(inode->mode) ? FS_FT_DIR : FS_FT_REG_FILE,
+                   d->name, d->name_len, callback, arg);
+    }
+
+    kfree(entry);
+    return 0;
+}
+
+/* Un inodo abierto no se reutiliza aunque se borre su nombre */
+static int tmpfs_open(struct fs_file *file)
+{
+    struct tmpfs_inode *inode = tmpfs_iget(file->ino);
+
+    if (inode == NULL)
+        return -1;
+    inode->opens++;
+    return 0;
+}
+
+static void tmpfs_release(struct fs_file *file)
+{
+    struct tmpfs_inode *inode = tmpfs_iget(file->ino);
+
+    if (inode == NULL || inode->opens == 0)
+        return;
+    if (--inode->opens == 0 && inode->nlink == 0)
+        tmpfs_destroy(inode);
+}
+
+void tmpfs_get_stats(struct tmpfs_stats *stats)
+{
+    *stats = tmpfs_stats;
+}
+
+/*
+ * Crea el directorio raíz y monta el sistema de archivos
+ */
+int tmpfs_init(void)
+{
+    struct tmpfs_inode *root = &tmpfs_inodes[TMPFS_ROOT_INO - 1];
+
+    /* Sin init_mm() no se sabe qué marcos se pueden usar */
+    if (mm_mapped_end == 0) {
+        print("tmpfs  : ERROR - Memory manager not initialized\n");
+        return -1;
+    }
+
+    memset(root, 0, sizeof(struct tmpfs_inode));
+    root->ino = TMPFS_ROOT_INO;
+    root->mode = FS_S_IFDIR | 0777;
+    root->nlink = 2;
+    root->parent = TMPFS_ROOT_INO;
+    tmpfs_stats.inodes = 1;
+
+    return fs_mount(TMPFS_MOUNT_POINT, &tmpfs_ops);
+}
+
+static struct fs_ops tmpfs_ops = {
+    "tmpfs",
+    tmpfs_lookup,
+    tmpfs_create,
+    tmpfs_mkdir,
+    tmpfs_unlink,
+    tmpfs_read,
+    tmpfs_write,
+    tmpfs_truncate,
+    tmpfs_stat,
+    tmpfs_readdir,
+    NULL,                       /* Nada que escribir a disco */
+    tmpfs_open,
+    tmpfs_release,
+    NULL
+};
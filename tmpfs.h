@@ -0,0 +1,46 @@
+#ifndef TMPFS_H_
+#define TMPFS_H_
+
+#include "types.h"
+#include "fs.h"
+
+/* Sistema de archivos en memoria para archivos temporales: los datos
+   viven en marcos de 4 KB y las entradas de directorio en una tabla hash */
+#define TMPFS_MOUNT_POINT       "/tmp"
+#define TMPFS_MAX_INODES        256
+#define TMPFS_ROOT_INO          1
+#define TMPFS_HASH_SIZE         64      /* Cubetas de la tabla de entradas */
+#define TMPFS_NAME_LEN          60
+#define TMPFS_MAX_PAGES         1024    /* Límite de marcos (datos e índices): 4 MB */
+
+/* Entrada de directorio */
+struct tmpfs_dirent {
+    u32 parent;                 /* Inodo del directorio */
+    u32 ino;
+    u8 name_len;
+    char name[TMPFS_NAME_LEN];
+    struct tmpfs_dirent *hash_next;     /* Cadena de la cubeta */
+    struct tmpfs_dirent *sibling;       /* Siguiente entrada del mismo directorio */
+};
+
+struct tmpfs_inode {
+    u32 ino;                    /* 0: libre */
+    u16 mode;                   /* FS_S_IF* */
+    u16 nlink;                  /* 0: borrado, vive mientras esté abierto */
+    u32 size;
+    u32 opens;                  /* Archivos abiertos que lo usan */
+    u32 parent;                 /* Directorio que lo contiene */
+    char ***index;              /* Marco de índices de marcos de páginas */
+    struct tmpfs_dirent *children;      /* Solo directorios */
+};
+
+struct tmpfs_stats {
+    u32 inodes;
+    u32 pages;                  /* Marcos de datos e índices en uso */
+};
+
+/* Funciones */
+int tmpfs_init(void);
+void tmpfs_get_stats(struct tmpfs_stats *stats);
+
+#endif
@@ -0,0 +1,208 @@
+#include "vfs.h"
+#include "fs.h"
+#include "screen.h"
+#include "lib.h"
+#include "process.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Descriptores de archivo. open() resuelve la ruta en la tabla de
+ * montajes y ocupa una entrada de la tabla global de archivos abiertos,
+ * que guarda el montaje, el inodo, la posición y el estado propio del
+ * sistema de archivos (la lectura adelantada de ext2). El descriptor es
+ * el índice en la tabla del proceso actual; el kernel, sin proceso
+ * actual, usa la suya. read() y write() copian directamente entre la
+ * caché y el buffer de quien llama.
+ */
+
+static struct fs_file vfs_files[VFS_MAX_FILES];
+static struct fs_file *vfs_kernel_fds[VFS_MAX_FDS];
+
+/* process es packed: se indexa files[] en vez de tomar punteros */
+static struct fs_file *vfs_fd_get(int fd)
+{
+    if (current != 0)
+        return current->files[fd];
+    return vfs_kernel_fds[fd];
+}
+
+static void vfs_fd_set(int fd, struct fs_file *file)
+{
+    if (current != 0)
+        current->files[fd] = file;
+    else
+        vfs_kernel_fds[fd] = file;
+}
+
+struct fs_file *vfs_fget(int fd)
+{
+    if (fd < 0 || fd >= VFS_MAX_FDS)
+        return NULL;
+    return vfs_fd_get(fd);
+}
+
+/*
+ * Abre un archivo y devuelve el descriptor libre más bajo, o -1. Con
+ * FS_O_CREAT se crea si no existe; con FS_O_TRUNC se vacía si se abre
+ * para escribir. Los directorios solo se abren para leer.
+ */
+int vfs_open(const char *path, u32 flags)
+{
+    struct fs_file *file = NULL;
+    struct fs_mount *mnt;
+    struct fs_stat st;
+    u32 ino;
+    int fd, i;
+
+    ino = fs_lookup(path, &mnt);
+    if (ino == 0 && (flags & FS_O_CREAT)) {
+        if (fs_create(path) == 0)
+            ino = fs_lookup(path, &mnt);
+    }
+    if (ino == 0 || fs_stat(mnt, ino, &st) != 0)
+        return -1;
+    if (FS_S_ISDIR(st.mode) && (flags & FS_O_ACCMODE) != FS_O_RDONLY)
+        return -1;
+
+    for (fd = 0; fd < VFS_MAX_FDS; fd++) {
+        if (vfs_fd_get(fd) == NULL)
+            break;
+    }
+    if (fd == VFS_MAX_FDS) {
+        print("vfs    : ERROR - Too many open files in process\n");
+        return -1;
+    }
+
+    for (i = 0; i < VFS_MAX_FILES; i++) {
+        if (vfs_files[i].mnt == NULL) {
+            file = &vfs_files[i];
+            break;
+        }
+    }
+    if (file == NULL) {
+        print("vfs    : ERROR - File table full\n");
+        return -1;
+    }
+
+    file->mnt = mnt;
+    file->ino = ino;
+    file->pos = 0;
+    file->flags = flags;
+    file->private = NULL;
+    if (mnt->ops->open != NULL && mnt->ops->open(file) != 0) {
+        file->mnt = NULL;
+        return -1;
+    }
+
+    if ((flags & FS_O_TRUNC) && (flags & FS_O_ACCMODE) != FS_O_RDONLY)
+        fs_truncate(mnt, ino, 0);
+
+    vfs_fd_set(fd, file);
+    return fd;
+}
+
+/*
+ * Lee desde la posición del archivo y la avanza. Devuelve los bytes
+ * leídos (0 al final del archivo) o -1. El buffer debe ser memoria del
+ * kernel con identity mapping: los bloques completos se leen por DMA
+ * directamente sobre él (las llamadas al sistema pasan por un marco).
+ */
+int vfs_read(int fd, void *buffer, u32 len)
+{
+    struct fs_file *file = vfs_fget(fd);
+    int n;
+
+    if (file == NULL || (file->flags & FS_O_ACCMODE) == FS_O_WRONLY)
+        return -1;
+
+    if (file->mnt->ops->read_file != NULL)
+        n = file->mnt->ops->read_file(file, buffer, len);
+    else
+        n = fs_read(file->mnt, file->ino, file->pos, buffer, len);
+    if (n > 0)
+        file->pos += n;
+    return n;
+}
+
+/*
+ * Escribe en la posición del archivo (al final con FS_O_APPEND) y la
+ * avanza. No se escribe más allá de VFS_MAX_POS. Devuelve los bytes
+ * escritos o -1.
+ */
+int vfs_write(int fd, const void *buffer, u32 len)
+{
+    struct fs_file *file = vfs_fget(fd);
+    struct fs_stat st;
+    int n;
+
+    if (file == NULL || (file->flags & FS_O_ACCMODE) == FS_O_RDONLY)
+        return -1;
+
+    if (file->flags & FS_O_APPEND) {
+        if (fs_stat(file->mnt, file->ino, &st) != 0)
+            return -1;
+        file->pos = st.size;
+    }
+    if (file->pos > VFS_MAX_POS || len > VFS_MAX_POS - file->pos)
+        return -1;
+
+    n = fs_write(file->mnt, file->ino, file->pos, buffer, len);
+    if (n > 0)
+        file->pos += n;
+    return n;
+}
+
+/*
+ * Mueve la posición del archivo. Se puede pasar del final (la siguiente
+ * escritura deja un hueco), pero no de VFS_MAX_POS. Devuelve la nueva
+ * posición o -1.
+ */
+int vfs_lseek(int fd, int offset, int whence)
+{
+    struct fs_file *file = vfs_fget(fd);
+    struct fs_stat st;
+    u32 base;
+
+    if (file == NULL)
+        return -1;
+
+    if (whence == VFS_SEEK_SET) {
+        base = 0;
+    } else if (whence == VFS_SEEK_CUR) {
+        base = file->pos;
+    } else if (whence == VFS_SEEK_END) {
+        if (fs_stat(file->mnt, file->ino, &st) != 0)
+            return -1;
+        base = st.size;
+    } else {
+        return -1;
+    }
+
+    /* Ni antes del principio ni más allá de VFS_MAX_POS (sin dar la
+       vuelta al sumar) */
+    if (offset < 0) {
+        if (0 - (u32)offset > base || base + offset > VFS_MAX_POS)
+            return -1;
+    } else if (base > VFS_MAX_POS || (u32)offset > VFS_MAX_POS - base) {
+        return -1;
+    }
+    file->pos = base + offset;
+    return file->pos;
+}
+
+int vfs_close(int fd)
+{
+    struct fs_file *file = vfs_fget(fd);
+
+    if (file == NULL)
+        return -1;
+
+    if (file->mnt->ops->release != NULL)
+        file->mnt->ops->release(file);
+    file->mnt = NULL;
+    vfs_fd_set(fd, NULL);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef VFS_H_
+#define VFS_H_
+
+#include "types.h"
+#include "fs.h"
+
+/* Descriptores de archivo: cada proceso tiene su tabla y todos apuntan
+   a la tabla global de archivos abiertos */
+#define VFS_MAX_FDS         16      /* Descriptores por proceso */
+#define VFS_MAX_FILES       64      /* Archivos abiertos en todo el sistema */
+
+/* Origen de vfs_lseek() (mismos valores que lseek() en Linux) */
+#define VFS_SEEK_SET        0
+#define VFS_SEEK_CUR        1
+#define VFS_SEEK_END        2
+
+/* vfs_lseek() devuelve la posición en un int */
+#define VFS_MAX_POS         0x7FFFFFFF
+
+/* Funciones */
+int vfs_open(const char *path, u32 flags);
+int vfs_read(int fd, void *buffer, u32 len);
+int vfs_write(int fd, const void *buffer, u32 len);
+int vfs_lseek(int fd, int offset, int whence);
+int vfs_close(int fd);
+struct fs_file *vfs_fget(int fd);
+
+#endif
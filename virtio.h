@@ -0,0 +1,97 @@
+#ifndef VIRTIO_H_
+#define VIRTIO_H_
+
+#include "types.h"
+
+/* Identificadores PCI de virtio-blk (interfaz legacy/transicional) */
+#define VIRTIO_PCI_VENDOR           0x1AF4
+#define VIRTIO_PCI_DEVICE_BLK       0x1001
+
+/* Registros legacy en el BAR0 de E/S */
+#define VIRTIO_PCI_HOST_FEATURES    0x00
+#define VIRTIO_PCI_GUEST_FEATURES   0x04
+#define VIRTIO_PCI_QUEUE_PFN        0x08
+#define VIRTIO_PCI_QUEUE_SIZE       0x0C
+#define VIRTIO_PCI_QUEUE_SEL        0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY     0x10
+#define VIRTIO_PCI_STATUS           0x12
+#define VIRTIO_PCI_ISR              0x13
+#define VIRTIO_PCI_CONFIG           0x14    /* Sin MSI-X */
+
+/* Bits del registro de estado */
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FAILED        0x80
+
+/* Características */
+#define VIRTIO_BLK_F_RO             (1 << 5)
+#define VIRTIO_RING_F_EVENT_IDX     (1 << 29)
+
+/* Virtqueue partida (split) */
+#define VIRTQ_ALIGN                 4096
+#define VIRTQ_MAX_SIZE              256
+
+#define VRING_DESC_F_NEXT           1
+#define VRING_DESC_F_WRITE          2
+
+#define VRING_AVAIL_F_NO_INTERRUPT  1
+#define VRING_USED_F_NO_NOTIFY      1
+
+struct vring_desc {
+    u64 addr;                   /* Dirección física */
+    u32 len;
+    u16 flags;
+    u16 next;
+} __attribute__ ((packed));
+
+struct vring_avail {
+    u16 flags;
+    u16 idx;
+    u16 ring[];                 /* Seguido de used_event */
+} __attribute__ ((packed));
+
+struct vring_used_elem {
+    u32 id;                     /* Cabeza de la cadena de descriptores */
+    u32 len;
+} __attribute__ ((packed));
+
+struct vring_used {
+    u16 flags;
+    u16 idx;
+    struct vring_used_elem ring[];  /* Seguido de avail_event */
+} __attribute__ ((packed));
+
+/* Tamaño de la memoria de una virtqueue legacy de 'num' entradas */
+#define VIRTQ_AVAIL_SIZE(num)   (6 + 2 * (num))
+#define VIRTQ_USED_OFFSET(num)  \
+        ((16 * (num) + VIRTQ_AVAIL_SIZE(num) + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1))
+#define VIRTQ_MEM_SIZE(num)     \
+        ((VIRTQ_USED_OFFSET(num) + 6 + 8 * (num) + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1))
+
+/*
+ * ¿Hay que avisar al otro lado? Con EVENT_IDX solo si 'event' está
+ * entre el índice anterior y el nuevo.
+ */
+#define vring_need_event(event, new_idx, old_idx) \
+        ((u16)((new_idx) - (event) - 1) < (u16)((new_idx) - (old_idx)))
+
+/* Barrera completa: las escrituras al anillo deben verse antes de leer eventos */
+#define virtio_mb() asm volatile ("lock; addl $0, 0(%%esp)" ::: "memory")
+
+/* Peticiones virtio-blk */
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+
+#define VIRTIO_BLK_S_OK             0
+
+struct virtio_blk_req_hdr {
+    u32 type;
+    u32 ioprio;
+    u64 sector;
+} __attribute__ ((packed));
+
+/* Funciones */
+int virtio_blk_init(void);
+
+#endif
@@ -0,0 +1,362 @@
+#include "types.h"
+#include "io.h"
+#include "lib.h"
+#include "screen.h"
+#include "pci.h"
+#include "irq.h"
+#include "blk.h"
+#include "virtio.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/*
+ * Driver virtio-blk sobre la interfaz PCI legacy (BAR0 de E/S), que
+ * QEMU ofrece por defecto en los dispositivos transicionales. Las
+ * direcciones que se pasan al dispositivo son físicas: el kernel usa
+ * identity mapping, así que buffers de kmalloc y datos estáticos sirven
+ * tal cual.
+ */
+
+#define VIRTIO_BLK_MAX_DEVICES  4
+#define VIRTIO_BLK_SLOTS        32      /* Peticiones en vuelo (3 descriptores c/u) */
+#define VIRTIO_BLK_MAX_SECTORS  128     /* 64 KB por petición */
+
+/* Cabecera y byte de estado de una petición en vuelo */
+struct virtio_blk_slot {
+    struct virtio_blk_req_hdr hdr;
+    volatile u8 status;
+    struct blk_request *req;
+};
+
+struct virtio_blk {
+    struct blk_dev blk;
+    struct pci_device pci;
+    u16 iobase;
+    u16 num;                        /* Entradas de la virtqueue */
+    int event_idx;                  /* VIRTIO_RING_F_EVENT_IDX negociado */
+    int use_irq;
+    struct vring_desc *desc;
+    struct vring_avail *avail;
+    volatile struct vring_used *used;
+    volatile u16 *used_event;       /* Tras el anillo avail */
+    volatile u16 *avail_event;      /* Tras el anillo used */
+    u16 last_used;                  /* Siguiente entrada de used por procesar */
+    u16 kicked_idx;                 /* avail->idx en la última notificación */
+    u32 nr_slots;
+    u32 inflight;
+    struct virtio_blk_slot slots[VIRTIO_BLK_SLOTS];
+    struct blk_request *queue_head; /* Esperando un slot libre */
+    struct blk_request *queue_tail;
+};
+
+static struct virtio_blk virtio_blks[VIRTIO_BLK_MAX_DEVICES];
+static int virtio_blk_count = 0;
+
+/* Memoria de las virtqueues: contigua y alineada a página */
+static u8 virtq_mem[VIRTIO_BLK_MAX_DEVICES][VIRTQ_MEM_SIZE(VIRTQ_MAX_SIZE)]
+        __attribute__ ((aligned(VIRTQ_ALIGN)));
+
+/*
+ * Publica una petición en el anillo avail usando el slot 'slot'
+ */
+static void virtio_blk_start(struct virtio_blk *vb, u32 slot, struct blk_request *req)
+{
+    struct virtio_blk_slot *s = &vb->slots[slot];
+    struct vring_desc *d = &vb->desc[slot * 3];
+
+    s->req = req;
+    s->status = 0xFF;
+    s->hdr.type = (req->cmd == BLK_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    s->hdr.ioprio = 0;
+    s->hdr.sector = req->lba;
+
+    d[0].addr = (u32)&s->hdr;
+    d[0].len = sizeof(struct virtio_blk_req_hdr);
+    d[0].flags = VRING_DESC_F_NEXT;
+
+    d[1].addr = (u32)req->buffer;
+    d[1].len = req->count * BLK_SECTOR_SIZE;
+    d[1].flags = VRING_DESC_F_NEXT;
+    if (req->cmd == BLK_READ)
+        d[1].flags |= VRING_DESC_F_WRITE;
+
+    d[2].addr = (u32)&s->status;
+    d[2].len = 1;
+    d[2].flags = VRING_DESC_F_WRITE;
+
+    vb->avail->ring[vb->avail->idx % vb->num] = slot * 3;
+    asm volatile ("" ::: "memory");
+    vb->avail->idx++;
+    vb->inflight++;
+}
+
+/*
+ * Busca un slot libre (-1 si todos están en vuelo)
+ */
+static int virtio_blk_free_slot(struct virtio_blk *vb)
+{
+    u32 i;
+
+    for (i = 0; i < vb->nr_slots; i++) {
+        if (vb->slots[i].req == NULL)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Notifica al dispositivo las peticiones nuevas. Con EVENT_IDX solo se
+ * escribe el puerto (una salida al hipervisor) si el dispositivo lo ha
+ * pedido mediante avail_event.
+ */
+static void virtio_blk_kick(struct virtio_blk *vb)
+{
+    u16 new_idx = vb->avail->idx;
+    int need;
+
+    if (new_idx == vb->kicked_idx)
+        return;
+
+    virtio_mb();
+    if (vb->event_idx)
+        need = vring_need_event(*vb->avail_event, new_idx, vb->kicked_idx);
+    else
+        need = !(vb->used->flags & VRING_USED_F_NO_NOTIFY);
+    vb->kicked_idx = new_idx;
+
+    if (need) {
+        outw(vb->iobase + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+    }
+}
+
+/*
+ * Ajusta cuándo queremos interrupción. Con EVENT_IDX se pide una sola
+ * cuando termine la última petición en vuelo; sin IRQ se suprimen.
+ */
+static void virtio_blk_set_event(struct virtio_blk *vb)
+{
+    if (!vb->use_irq) {
+        vb->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+        if (vb->event_idx)
+            *vb->used_event = vb->last_used - 1;
+    } else if (vb->event_idx) {
+        *vb->used_event = vb->last_used + (vb->inflight ? vb->inflight - 1 : 0);
+    }
+}
+
+/*
+ * Recoge las peticiones completadas y arranca las que esperaban slot
+ */
+static void virtio_blk_complete(struct virtio_blk *vb)
+{
+    volatile struct vring_used_elem *elem;
+    struct virtio_blk_slot *s;
+    struct blk_request *req;
+    int slot, started = 0;
+    u32 flags;
+
+    irq_save(flags);
+
+    while (vb->last_used != vb->used->idx) {
+        asm volatile ("" ::: "memory");
+        elem = &vb->used->ring[vb->last_used % vb->num];
+        s = &vb->slots[elem->id / 3];
+        req = s->req;
+        s->req = NULL;
+        vb->inflight--;
+        vb->last_used++;
+        if (req)
+            blk_end_request(req, s->status == VIRTIO_BLK_S_OK ? 0 : -1);
+    }
+
+    while (vb->queue_head && (slot = virtio_blk_free_slot(vb)) >= 0) {
+        req = vb->queue_head;
+        vb->queue_head = req->next;
+        if (vb->queue_head == NULL)
+            vb->queue_tail = NULL;
+        virtio_blk_start(vb, slot, req);
+        started = 1;
+    }
+
+    virtio_blk_set_event(vb);
+    if (started)
+        virtio_blk_kick(vb);
+
+    irq_restore(flags);
+}
+
+static int virtio_blk_submit(struct blk_dev *dev, struct blk_request *req)
+{
+    struct virtio_blk *vb = (struct virtio_blk *)dev->private;
+    int slot;
+    u32 flags;
+
+    irq_save(flags);
+    slot = virtio_blk_free_slot(vb);
+    if (slot >= 0 && vb->queue_head == NULL) {
+        virtio_blk_start(vb, slot, req);
+    } else if (vb->queue_tail) {
+        vb->queue_tail->next = req;
+        vb->queue_tail = req;
+    } else {
+        vb->queue_head = vb->queue_tail = req;
+    }
+    virtio_blk_set_event(vb);
+    irq_restore(flags);
+
+    return 0;
+}
+
+static void virtio_blk_unplug(struct blk_dev *dev)
+{
+    struct virtio_blk *vb = (struct virtio_blk *)dev->private;
+    u32 flags;
+
+    irq_save(flags);
+    virtio_blk_kick(vb);
+    irq_restore(flags);
+}
+
+static void virtio_blk_poll(struct blk_dev *dev)
+{
+    virtio_blk_complete((struct virtio_blk *)dev->private);
+}
+
+static struct blk_ops virtio_blk_ops = {
+    .submit = virtio_blk_submit,
+    .unplug = virtio_blk_unplug,
+    .poll = virtio_blk_poll,
+};
+
+/*
+ * Manejador de IRQ: leer el registro ISR baja la línea (INTx)
+ */
+static void virtio_blk_irq(int irq)
+{
+    int i;
+
+    for (i = 0; i < virtio_blk_count; i++) {
+        if (virtio_blks[i].use_irq && virtio_blks[i].pci.irq == irq) {
+            if (inb(virtio_blks[i].iobase + VIRTIO_PCI_ISR) & 0x01)
+                virtio_blk_complete(&virtio_blks[i]);
+        }
+    }
+}
+
+/*
+ * Inicializa un dispositivo: negociación, virtqueue 0 y registro
+ */
+static int virtio_blk_probe(struct virtio_blk *vb, struct pci_device *pci, int n)
+{
+    u32 host_features, guest_features, cap_high;
+    u8 *mem = virtq_mem[n];
+    u16 io;
+    u32 i;
+
+    if (!(pci->bar[0] & PCI_BAR_IO)) {
+        print("virtio : ERROR - Device has no legacy I/O BAR\n");
+        return -1;
+    }
+
+    memset(vb, 0, sizeof(struct virtio_blk));
+    vb->pci = *pci;
+    vb->iobase = io = pci->bar[0] & ~0x3;
+    pci_enable_device(pci);
+
+    /* Reset y reconocimiento del dispositivo */
+    outb(io + VIRTIO_PCI_STATUS, 0);
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    /* Solo nos interesa EVENT_IDX; RO se respeta sin negociarlo */
+    host_features = inl(io + VIRTIO_PCI_HOST_FEATURES);
+    guest_features = host_features & VIRTIO_RING_F_EVENT_IDX;
+    outl(io + VIRTIO_PCI_GUEST_FEATURES, guest_features);
+    vb->event_idx = (guest_features & VIRTIO_RING_F_EVENT_IDX) != 0;
+
+    /* Virtqueue 0: en legacy el tamaño lo impone el dispositivo */
+    outw(io + VIRTIO_PCI_QUEUE_SEL, 0);
+    vb->num = inw(io + VIRTIO_PCI_QUEUE_SIZE);
+    if (vb->num == 0 || vb->num > VIRTQ_MAX_SIZE) {
+        print("virtio : ERROR - Unsupported queue size ");
+        print_dec(vb->num);
+        print("\n");
+        outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+
+    memset(mem, 0, VIRTQ_MEM_SIZE(vb->num));
+    vb->desc = (struct vring_desc *)mem;
+    vb->avail = (struct vring_avail *)(mem + 16 * vb->num);
+    vb->used = (struct vring_used *)(mem + VIRTQ_USED_OFFSET(vb->num));
+    vb->used_event = (volatile u16 *)((u8 *)vb->avail + VIRTQ_AVAIL_SIZE(vb->num) - 2);
+    vb->avail_event = (volatile u16 *)(mem + VIRTQ_USED_OFFSET(vb->num) + 4 + 8 * vb->num);
+
+    /* Cada slot usa una cadena fija de 3 descriptores */
+    vb->nr_slots = vb->num / 3;
+    if (vb->nr_slots > VIRTIO_BLK_SLOTS)
+        vb->nr_slots = VIRTIO_BLK_SLOTS;
+    for (i = 0; i < vb->nr_slots; i++) {
+        vb->desc[i * 3].next = i * 3 + 1;
+        vb->desc[i * 3 + 1].next = i * 3 + 2;
+    }
+
+    outl(io + VIRTIO_PCI_QUEUE_PFN, (u32)mem >> 12);
+
+    /* Interrupciones: si no hay línea válida se trabaja por sondeo */
+    if (pci->irq > 0 && pci->irq < 16 && irq_register(pci->irq, virtio_blk_irq) == 0)
+        vb->use_irq = 1;
+    virtio_blk_set_event(vb);
+
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER |
+                                 VIRTIO_STATUS_DRIVER_OK);
+
+    /* Capacidad en sectores de 512 bytes (config del dispositivo) */
+    vb->blk.nr_sectors = inl(io + VIRTIO_PCI_CONFIG);
+    cap_high = inl(io + VIRTIO_PCI_CONFIG + 4);
+    if (cap_high)
+        vb->blk.nr_sectors = 0xFFFFFFFF;
+
+    vb->blk.name[0] = 'v';
+    vb->blk.name[1] = 'd';
+    vb->blk.name[2] = 'a' + n;
+    vb->blk.name[3] = '\0';
+    vb->blk.max_sectors = VIRTIO_BLK_MAX_SECTORS;
+    vb->blk.readonly = (host_features & VIRTIO_BLK_F_RO) != 0;
+    vb->blk.ops = &virtio_blk_ops;
+    vb->blk.private = vb;
+
+    print("virtio : ");
+    print(vb->blk.name);
+    print(" at io 0x");
+    print_hex(io);
+    print(", irq ");
+    print_dec(pci->irq);
+    print(", queue ");
+    print_dec(vb->num);
+    if (vb->event_idx)
+        print(", event-idx");
+    print("\n");
+
+    return blk_register(&vb->blk);
+}
+
+/*
+ * Busca y registra todos los discos virtio-blk
+ */
+int virtio_blk_init(void)
+{
+    struct pci_device pci;
+    int i;
+
+    for (i = 0; i < VIRTIO_BLK_MAX_DEVICES; i++) {
+        if (pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK, i, &pci) != 0)
+            break;
+        if (virtio_blk_probe(&virtio_blks[virtio_blk_count], &pci, virtio_blk_count) == 0)
+            virtio_blk_count++;
+    }
+
+    return virtio_blk_count;
+}